@@ -0,0 +1,583 @@
+/**
+ * @file capture_bench.c
+ * @brief Host benchmark of the capture-to-storage path
+ *
+ * Runs the capture pipeline in continuous mode with the mock camera as
+ * source and the configured storage format (segments, JPEG files or the
+ * sector log, as in main.c) under MOUNT_POINT or in the card image, then
+ * reports frames/s, bytes/s and the percentiles of the time from frame
+ * acquisition to the end of the write.
+ * With -B the pipeline runs triggered instead, one burst into a burst
+ * buffer after the other, and the burst frame rate and flush times are
+ * reported as well. With -T the time-lapse scheduler requests one frame
+ * per slot, held in a batch buffer of -K frames, and the slot timing is
+ * reported. With -t every stored frame also gets a thumbnail, and the
+ * per-frame thumbnail cost is reported. With -e JPEG files get EXIF
+ * metadata with the given device id, written as a gather write. With -D
+ * near-duplicate frames are skipped and the bytes saved are reported;
+ * skipped frames count towards the frames to store. With -S the scrub reads
+ * the captures back while frames are stored (JPEG files get a CRC trailer)
+ * and once more after the run, and its read rate and errors are reported.
+ *
+ * Usage: capture_bench [-n frames] [-r fps] [-s frame_kb] [-W width] [-H height]
+ *                      [-d fixture_dir] [-q queue_len] [-b fb_count] [-B burst_frames]
+ *                      [-A burst_kb] [-T interval_ms] [-K batch_frames] [-e device_id] [-D max_distance]
+ *                      [-t] [-S] [-f] [-v]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "app_config.h"
+#include "sd_card_driver.h"
+#include "file_operations.h"
+#include "capture_pipeline.h"
+#include "frame_ring.h"
+#include "frame_pool.h"
+#include "segment_store.h"
+#include "sector_log.h"
+#include "capture_index.h"
+#include "latency_stats.h"
+#include "timelapse.h"
+#include "thumbnail.h"
+#include "frame_dedup.h"
+#include "exif.h"
+#include "scrub.h"
+#include "mock_camera.h"
+
+static const char *TAG = "capture_bench";
+
+/* Give up when no frame has been stored for this long */
+#define BENCH_STALL_TIMEOUT_MS  10000
+
+/* Longest wait for the scrub to finish its passes after the run */
+#define BENCH_SCRUB_TIMEOUT_MS  60000
+
+static portMUX_TYPE s_bench_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t *s_latency_us = NULL;
+static uint32_t s_target_frames = 0;
+static uint32_t s_stored = 0;
+static uint32_t s_errors = 0;
+static uint32_t s_skipped = 0;
+static uint64_t s_stored_bytes = 0;
+static int64_t s_first_stored_us = 0;
+static int64_t s_last_stored_us = 0;
+
+/* EXIF device id of JPEG files, NULL to store frames as they are */
+static const char *s_device_id = NULL;
+
+/* Scrub running: writes are announced to it, JPEG files get a CRC trailer */
+static bool s_scrub = false;
+
+#if CONFIG_APP_STORAGE_JPEG_FILES
+static uint32_t s_photo_index = 0;
+static exif_frame_t s_exif_frame;
+#endif
+
+/**
+ * @brief Pipeline sink: store the frame as main.c does and record its latency
+ */
+static esp_err_t bench_store(void *ctx, const capture_frame_t *frame)
+{
+    /* The frame as stored; EXIF metadata and the CRC trailer make a JPEG file longer */
+    capture_frame_t stored = *frame;
+    if (s_scrub) {
+        scrub_write_begin();
+    }
+#if CONFIG_APP_STORAGE_SEGMENTS
+    segment_location_t location = { 0 };
+    esp_err_t ret = segment_store_append(frame, &location);
+    uint32_t file_id = location.segment_id;
+    uint32_t offset = location.offset;
+#elif CONFIG_APP_STORAGE_SECTOR_LOG
+    sector_log_location_t location = { 0 };
+    esp_err_t ret = sector_log_append(frame, &location);
+    uint32_t file_id = (uint32_t)location.lsn;
+    uint32_t offset = location.sector;
+#else
+    char photo_path[EXAMPLE_MAX_CHAR_SIZE];
+    uint32_t file_id = s_photo_index++;
+    uint32_t offset = 0;
+    snprintf(photo_path, sizeof(photo_path), PHOTO_NAME_FORMAT, MOUNT_POINT, (unsigned long)file_id);
+    file_write_part_t parts[3] = { { .data = frame->buf, .size = frame->len } };
+    size_t part_count = 1;
+    if (s_device_id != NULL && exif_frame_build(frame, s_device_id, &s_exif_frame) == ESP_OK) {
+        memcpy(parts, s_exif_frame.parts, s_exif_frame.part_count * sizeof(parts[0]));
+        part_count = s_exif_frame.part_count;
+    }
+    scrub_trailer_t trailer;
+    if (s_scrub) {
+        scrub_trailer_init(&trailer, parts, part_count);
+        parts[part_count].data = (const uint8_t *)&trailer;
+        parts[part_count].size = sizeof(trailer);
+        part_count++;
+    }
+    esp_err_t ret = file_write_binary_fast_v(photo_path, parts, part_count, NULL, NULL);
+    stored.len = 0;
+    for (size_t i = 0; i < part_count; i++) {
+        stored.len += parts[i].size;
+    }
+#endif
+    if (ret == ESP_OK && capture_index_is_open()) {
+        capture_index_append(&stored, file_id, offset, frame->motion_score);
+    }
+    if (ret == ESP_OK) {
+        timelapse_note_frame(frame);
+        thumbnail_submit(frame, file_id, offset);
+    }
+    if (s_scrub) {
+        scrub_write_end();
+    }
+    int64_t done = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_bench_lock);
+    if (ret != ESP_OK) {
+        s_errors++;
+    } else if (s_stored < s_target_frames) {
+        s_latency_us[s_stored++] = (uint32_t)(done - frame->timestamp_us);
+        s_stored_bytes += stored.len;
+        if (s_first_stored_us == 0) {
+            s_first_stored_us = done;
+        }
+        s_last_stored_us = done;
+    }
+    portEXIT_CRITICAL(&s_bench_lock);
+    return ret;
+}
+
+/**
+ * @brief Pipeline filter: drop near-duplicates, counting them as handled frames
+ */
+static bool bench_filter(void *ctx, capture_frame_t *frame)
+{
+    bool keep = frame_dedup_filter(ctx, frame);
+    if (!keep) {
+        portENTER_CRITICAL(&s_bench_lock);
+        s_skipped++;
+        portEXIT_CRITICAL(&s_bench_lock);
+    }
+    return keep;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Nearest-rank percentile of sorted samples
+ */
+static uint32_t percentile(const uint32_t *sorted, uint32_t count, uint32_t pct)
+{
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t rank = (uint32_t)(((uint64_t)pct * count + 99) / 100);
+    return sorted[rank ? rank - 1 : 0];
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n frames     frames to store (default 300)\n"
+            "  -r fps        mock camera frame rate, 0 = unthrottled (default 15)\n"
+            "  -s kb         synthetic frame size in KB (default 200)\n"
+            "  -W width      synthetic frame width (default 1600)\n"
+            "  -H height     synthetic frame height (default 1200)\n"
+            "  -d dir        serve the .jpg files of dir instead of synthetic frames\n"
+            "  -q length     pipeline queue length (default %d)\n"
+            "  -b count      camera frame buffers (default %d)\n"
+            "  -B frames     capture in bursts of this many frames instead of continuously\n"
+            "  -A kb         burst buffer size in KB (default %d)\n"
+            "  -T ms         capture on a time-lapse schedule with this interval instead\n"
+            "  -K frames     time-lapse frames per batch write, 1 = no batching (default %d)\n"
+            "  -P kb         hold burst, batch and thumbnail frames in a frame pool of this size\n"
+            "  -e id         add EXIF metadata with this device id (JPEG files build)\n"
+            "  -D bits       skip frames within this hash distance of a stored one\n"
+            "  -t            store a thumbnail of every frame\n"
+            "  -S            scrub the captures during and after the run, without a rate cap\n"
+            "  -f            clear the card directory before starting\n"
+            "  -v            log at info level (default: errors only)\n",
+            prog, CONFIG_APP_PIPELINE_QUEUE_LEN, CONFIG_APP_CAMERA_FB_COUNT, CONFIG_APP_BURST_ARENA_KB,
+            CONFIG_APP_TIMELAPSE_BATCH_FRAMES);
+}
+
+int main(int argc, char **argv)
+{
+    mock_camera_config_t camera_config = MOCK_CAMERA_DEFAULT_CONFIG();
+    capture_pipeline_config_t pipeline_config = CAPTURE_PIPELINE_DEFAULT_CONFIG();
+    uint32_t frames = 300;
+    uint32_t burst_frames = 0;
+    size_t burst_arena_kb = CONFIG_APP_BURST_ARENA_KB;
+    size_t pool_kb = 0;
+    uint32_t timelapse_ms = 0;
+    uint32_t batch_frames = CONFIG_APP_TIMELAPSE_BATCH_FRAMES;
+    int dedup_distance = -1;
+    bool thumbnails = false;
+    bool format = false;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:s:W:H:d:q:b:B:A:T:K:P:e:D:tSfvh")) != -1) {
+        switch (opt) {
+        case 'n': frames = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': camera_config.fps = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 's': camera_config.frame_len = strtoul(optarg, NULL, 0) * 1024; break;
+        case 'W': camera_config.width = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'H': camera_config.height = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'd': camera_config.fixture_dir = optarg; break;
+        case 'q': pipeline_config.queue_length = strtoul(optarg, NULL, 0); break;
+        case 'b': camera_config.fb_count = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 'B': burst_frames = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'A': burst_arena_kb = strtoul(optarg, NULL, 0); break;
+        case 'T': timelapse_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'K': batch_frames = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'P': pool_kb = strtoul(optarg, NULL, 0); break;
+        case 'e': s_device_id = optarg; break;
+        case 'D': dedup_distance = atoi(optarg); break;
+        case 't': thumbnails = true; break;
+        case 'S': s_scrub = true; break;
+        case 'f': format = true; break;
+        case 'v': verbose = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (frames == 0 || pipeline_config.queue_length == 0 || camera_config.fb_count == 0 ||
+        burst_arena_kb == 0 || batch_frames == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    /* Dropped frames are counted in the report; only errors are logged by default */
+    esp_log_level_set("*", verbose ? ESP_LOG_INFO : ESP_LOG_ERROR);
+
+    if (sd_card_init() != ESP_OK || (format && sd_card_format() != ESP_OK)) {
+        ESP_LOGE(TAG, "Failed to prepare %s", MOUNT_POINT);
+        return 1;
+    }
+#if CONFIG_APP_STORAGE_SEGMENTS
+    segment_store_config_t segment_config = SEGMENT_STORE_DEFAULT_CONFIG(MOUNT_POINT);
+    if (segment_store_open(&segment_config) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open segment store");
+        return 1;
+    }
+#elif CONFIG_APP_STORAGE_SECTOR_LOG
+    /* -f starts an empty log, as formatting clears the card directory */
+    sector_log_config_t log_config = SECTOR_LOG_DEFAULT_CONFIG(sd_card_get_handle());
+    if ((format ? sector_log_format(&log_config) : sector_log_open(&log_config)) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open sector log");
+        return 1;
+    }
+#else
+    s_photo_index = file_next_index(MOUNT_POINT, PHOTO_NAME_PREFIX, PHOTO_NAME_EXT);
+#endif
+    if (mock_camera_init(&camera_config) != ESP_OK) {
+        return 1;
+    }
+
+    s_target_frames = frames;
+    s_latency_us = calloc(frames, sizeof(*s_latency_us));
+    if (s_latency_us == NULL) {
+        return 1;
+    }
+
+    pipeline_config.source = mock_camera_get_frame_source();
+    pipeline_config.sink = bench_store;
+    pipeline_config.continuous = (burst_frames == 0 && timelapse_ms == 0);
+
+    /* As on the device: classes around the frame size, up to a fifth of the pixel count */
+    frame_pool_handle_t pool = NULL;
+    if (pool_kb != 0) {
+        size_t max_len = (size_t)camera_config.width * camera_config.height / 5;
+        size_t typical_len = camera_config.fixture_dir ? 0 : camera_config.frame_len;
+        if (typical_len > max_len) {
+            max_len = typical_len;
+        }
+        frame_pool_config_t pool_config = FRAME_POOL_DEFAULT_CONFIG(typical_len, max_len);
+        pool_config.arena_size = pool_kb * 1024;
+        if (frame_pool_create(&pool_config, &pool) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create frame pool");
+            return 1;
+        }
+    }
+
+    frame_ring_handle_t burst_buffer = NULL;
+    if (burst_frames != 0) {
+        frame_ring_config_t burst_config = {
+            .arena_size = burst_arena_kb * 1024,
+            .max_frames = CONFIG_APP_BURST_MAX_FRAMES,
+            .caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+            .pool = pool,
+        };
+        if (frame_ring_create(&burst_config, &burst_buffer) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to allocate burst buffer");
+            return 1;
+        }
+        pipeline_config.burst = burst_buffer;
+    }
+
+    frame_ring_handle_t batch_buffer = NULL;
+    if (timelapse_ms != 0 && batch_frames > 1) {
+        frame_ring_config_t batch_config = {
+            .arena_size = CONFIG_APP_TIMELAPSE_BATCH_ARENA_KB * 1024,
+            .max_frames = batch_frames,
+            .caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+            .pool = pool,
+        };
+        if (frame_ring_create(&batch_config, &batch_buffer) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to allocate batch buffer");
+            return 1;
+        }
+        pipeline_config.batch = batch_buffer;
+        pipeline_config.batch_frames = batch_frames;
+    }
+
+    if (thumbnails) {
+        thumbnail_config_t thumbnail_config = THUMBNAIL_DEFAULT_CONFIG(MOUNT_POINT);
+        thumbnail_config.pool = pool;
+        if (thumbnail_start(&thumbnail_config) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to start thumbnails");
+            return 1;
+        }
+    }
+
+    frame_dedup_handle_t dedup = NULL;
+    if (dedup_distance >= 0) {
+        frame_dedup_config_t dedup_config = FRAME_DEDUP_DEFAULT_CONFIG();
+        dedup_config.max_distance = (uint8_t)dedup_distance;
+        if (frame_dedup_create(&dedup_config, &dedup) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create duplicate suppression");
+            return 1;
+        }
+        pipeline_config.filter = bench_filter;
+        pipeline_config.filter_ctx = dedup;
+    }
+
+    /* Passes back to back, each read waits for the writes as on the device */
+    if (s_scrub) {
+        scrub_config_t scrub_config = SCRUB_DEFAULT_CONFIG(MOUNT_POINT);
+        scrub_config.card = sd_card_get_handle();
+        scrub_config.rate_kbps = 0;
+        scrub_config.interval_s = 0;
+        if (scrub_start(&scrub_config) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to start scrub");
+            return 1;
+        }
+    }
+
+    int64_t start = esp_timer_get_time();
+    if (capture_pipeline_start(&pipeline_config) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start capture pipeline");
+        return 1;
+    }
+    if (timelapse_ms != 0) {
+        timelapse_config_t timelapse_config = TIMELAPSE_DEFAULT_CONFIG();
+        timelapse_config.interval_ms = timelapse_ms;
+        if (timelapse_start(&timelapse_config) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to start time-lapse");
+            return 1;
+        }
+    }
+
+    /* Stop once enough frames are stored, or when storage stalls */
+    uint32_t stored = 0;
+    uint32_t last_progress = 0;
+    uint32_t bursts_requested = 0;
+    int64_t progress_us = start;
+    while (stored < frames) {
+        if (burst_frames != 0) {
+            /* Next burst once the previous one has been written */
+            capture_pipeline_stats_t burst_stats;
+            capture_pipeline_get_stats(&burst_stats);
+            if (burst_stats.bursts_written + burst_stats.bursts_refused == bursts_requested &&
+                capture_pipeline_burst(burst_frames) == ESP_OK) {
+                bursts_requested++;
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+        portENTER_CRITICAL(&s_bench_lock);
+        stored = s_stored + s_skipped;
+        portEXIT_CRITICAL(&s_bench_lock);
+        int64_t now = esp_timer_get_time();
+        if (stored != last_progress) {
+            last_progress = stored;
+            progress_us = now;
+        } else if (now - progress_us > BENCH_STALL_TIMEOUT_MS * 1000LL) {
+            ESP_LOGE(TAG, "No frame stored for %d ms, stopping", BENCH_STALL_TIMEOUT_MS);
+            break;
+        }
+    }
+
+    timelapse_stop();
+    capture_pipeline_stop();
+    capture_pipeline_stats_t stats;
+    capture_pipeline_get_stats(&stats);
+
+    /* Thumbnails still pending when storage ends are finished before reporting */
+    thumbnail_stats_t thumbnail;
+    thumbnail_get_stats(&thumbnail);
+    int64_t drain_us = esp_timer_get_time();
+    while (thumbnail.pending > 0 && esp_timer_get_time() - drain_us < BENCH_STALL_TIMEOUT_MS * 1000LL) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        thumbnail_get_stats(&thumbnail);
+    }
+    thumbnail_stop();
+
+    /* The pass after the one in progress starts after the last write and covers every capture */
+    scrub_stats_t scrub;
+    scrub_get_stats(&scrub);
+    if (s_scrub) {
+        uint32_t passes = scrub.passes + 2;
+        drain_us = esp_timer_get_time();
+        while (scrub.passes < passes && esp_timer_get_time() - drain_us < BENCH_SCRUB_TIMEOUT_MS * 1000LL) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+            scrub_get_stats(&scrub);
+        }
+        scrub_stop();
+    }
+
+    portENTER_CRITICAL(&s_bench_lock);
+    stored = s_stored;
+    uint64_t bytes = s_stored_bytes;
+    uint32_t errors = s_errors;
+    double elapsed_s = (double)(s_last_stored_us - start) / 1e6;
+    double steady_s = (double)(s_last_stored_us - s_first_stored_us) / 1e6;
+    portEXIT_CRITICAL(&s_bench_lock);
+
+    qsort(s_latency_us, stored, sizeof(*s_latency_us), compare_u32);
+
+#if CONFIG_APP_STORAGE_SEGMENTS
+    const char *storage = "segments";
+#elif CONFIG_APP_STORAGE_SECTOR_LOG
+    const char *storage = "sector log";
+#else
+    const char *storage = "JPEG files";
+#endif
+    printf("Capture-to-storage benchmark (%s, %s)\n",
+           camera_config.fixture_dir ? camera_config.fixture_dir : "synthetic frames", storage);
+    printf("  frames stored     %lu (%lu write errors, %lu dropped at the queue)\n",
+           (unsigned long)stored, (unsigned long)errors, (unsigned long)stats.frames_dropped);
+    printf("  elapsed           %.3f s\n", elapsed_s);
+    printf("  throughput        %.2f frames/s, %.2f MB/s\n",
+           elapsed_s > 0 ? stored / elapsed_s : 0.0, elapsed_s > 0 ? bytes / elapsed_s / 1e6 : 0.0);
+    printf("  steady state      %.2f frames/s (first to last stored frame)\n",
+           steady_s > 0 && stored > 1 ? (stored - 1) / steady_s : 0.0);
+    printf("  latency (us)      p50 %lu  p90 %lu  p99 %lu  max %lu\n",
+           (unsigned long)percentile(s_latency_us, stored, 50),
+           (unsigned long)percentile(s_latency_us, stored, 90),
+           (unsigned long)percentile(s_latency_us, stored, 99),
+           (unsigned long)(stored ? s_latency_us[stored - 1] : 0));
+    printf("  capture / write   avg %lu us / %lu us, queue high water %lu\n",
+           (unsigned long)stats.avg_capture_us, (unsigned long)stats.avg_write_us,
+           (unsigned long)stats.queue_high_water);
+    if (burst_frames != 0) {
+        printf("  bursts            %lu (%lu refused, %lu shrunk), last %lu frames at %.1f fps, "
+               "flush last %lu ms max %lu ms\n",
+               (unsigned long)stats.bursts, (unsigned long)stats.bursts_refused,
+               (unsigned long)stats.bursts_shrunk, (unsigned long)stats.last_burst_frames,
+               stats.last_burst_fps, (unsigned long)stats.last_burst_flush_ms,
+               (unsigned long)stats.max_burst_flush_ms);
+    }
+    if (timelapse_ms != 0) {
+        timelapse_stats_t timelapse;
+        timelapse_get_stats(&timelapse);
+        printf("  time-lapse        %lu slots (%lu missed, request late max %lu us), "
+               "jitter avg %lu us max %lu us, %lu batch writes\n",
+               (unsigned long)timelapse.slots, (unsigned long)timelapse.missed,
+               (unsigned long)timelapse.max_late_us, (unsigned long)timelapse.avg_jitter_us,
+               (unsigned long)timelapse.max_jitter_us, (unsigned long)stats.batches_written);
+    }
+    if (thumbnails) {
+        printf("  thumbnails        %lu (%lu skipped, %lu failed), avg %llu bytes\n",
+               (unsigned long)thumbnail.written, (unsigned long)thumbnail.skipped,
+               (unsigned long)thumbnail.failed,
+               (unsigned long long)(thumbnail.written ? thumbnail.bytes / thumbnail.written : 0));
+        printf("  thumbnail (us)    copy %lu  decode %lu  encode %lu  write %lu  total %lu (avg), "
+               "max total %lu\n",
+               (unsigned long)thumbnail.avg_copy_us, (unsigned long)thumbnail.avg_decode_us,
+               (unsigned long)thumbnail.avg_encode_us, (unsigned long)thumbnail.avg_write_us,
+               (unsigned long)thumbnail.avg_total_us, (unsigned long)thumbnail.max_total_us);
+    }
+    if (s_scrub) {
+        printf("  scrub             %lu passes, %lu captures (%lu without CRC), %llu KB at %.2f MB/s, "
+               "%lu reads deferred\n",
+               (unsigned long)scrub.passes, (unsigned long)scrub.captures, (unsigned long)scrub.unverified,
+               (unsigned long long)(scrub.bytes / 1024), scrub.read_kbps / 1024.0,
+               (unsigned long)scrub.deferrals);
+        printf("  scrub errors      crc %lu  jpeg %lu  header %lu  read %lu, %lu bad in " SCRUB_LOG_FILE "\n",
+               (unsigned long)scrub.crc_errors, (unsigned long)scrub.jpeg_errors,
+               (unsigned long)scrub.header_errors, (unsigned long)scrub.read_errors, (unsigned long)scrub.bad);
+    }
+    if (dedup != NULL) {
+        frame_dedup_stats_t dedup_stats;
+        frame_dedup_get_stats(dedup, &dedup_stats);
+        printf("  duplicates        %lu skipped of %lu (%lu kept by the interval), %llu KB saved, "
+               "hash %lu us\n",
+               (unsigned long)dedup_stats.skipped, (unsigned long)dedup_stats.frames,
+               (unsigned long)dedup_stats.thinned, (unsigned long long)(dedup_stats.bytes_saved / 1024),
+               (unsigned long)dedup_stats.avg_hash_us);
+    }
+    if (pool != NULL) {
+        frame_pool_stats_t pool_stats;
+        frame_pool_get_stats(pool, &pool_stats);
+        printf("  frame pool        %lu allocs (%lu failed, %lu oversize), high water %u KB of %u KB, "
+               "waste high water %u KB\n",
+               (unsigned long)pool_stats.allocs, (unsigned long)pool_stats.failed,
+               (unsigned long)pool_stats.oversize, (unsigned)(pool_stats.bytes_high_water / 1024),
+               (unsigned)(pool_stats.arena_size / 1024), (unsigned)(pool_stats.waste_high_water / 1024));
+        for (size_t i = 0; i < pool_stats.classes; i++) {
+            const frame_pool_class_stats_t *cls = &pool_stats.class_stats[i];
+            printf("    %7u bytes   %lu blocks, high water %lu, fallbacks %lu\n",
+                   (unsigned)cls->block_size, (unsigned long)cls->blocks,
+                   (unsigned long)cls->high_water, (unsigned long)cls->fallbacks);
+        }
+    }
+    for (int stage = 0; stage < LATENCY_STAGE_MAX; stage++) {
+        latency_histogram_t hist;
+        latency_stats_get((latency_stage_t)stage, &hist);
+        if (hist.count == 0) {
+            continue;
+        }
+        printf("  %-7s (us)      n %lu  avg %lu  p50 %lu  p99 %lu  max %lu\n",
+               latency_stage_name((latency_stage_t)stage), (unsigned long)hist.count,
+               (unsigned long)(hist.total_us / hist.count),
+               (unsigned long)latency_histogram_percentile(&hist, 50),
+               (unsigned long)latency_histogram_percentile(&hist, 99),
+               (unsigned long)hist.max_us);
+    }
+    latency_stats_dump(MOUNT_POINT "/" LATENCY_STATS_FILE);
+
+#if CONFIG_APP_STORAGE_SEGMENTS
+    segment_store_close();
+#elif CONFIG_APP_STORAGE_SECTOR_LOG
+    sector_log_stats_t log_stats;
+    sector_log_get_stats(&log_stats);
+    printf("  sector log        %lu records at sector %lu, next record %llu at %lu, %lu wraps, "
+           "%lu checkpoints, %lu bounced\n",
+           (unsigned long)log_stats.records, (unsigned long)log_stats.start_sector,
+           (unsigned long long)log_stats.next_lsn, (unsigned long)log_stats.head,
+           (unsigned long)log_stats.wraps, (unsigned long)log_stats.checkpoints,
+           (unsigned long)log_stats.bounced);
+    sector_log_close();
+#endif
+    frame_ring_delete(burst_buffer);
+    frame_ring_delete(batch_buffer);
+    frame_pool_delete(pool);
+    mock_camera_deinit();
+    sd_card_cleanup();
+    free(s_latency_us);
+    return stored == frames && errors == 0 ? 0 : 1;
+}
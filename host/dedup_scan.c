@@ -0,0 +1,170 @@
+/**
+ * @file dedup_scan.c
+ * @brief Run JPEG files through the near-duplicate suppression
+ *
+ * The files are taken as consecutive frames at a frame rate, in the order
+ * given, and hashed from their DC luminance maps as on the device. Prints
+ * one line per file (hash, distance to the nearest earlier file, decision)
+ * and a summary with the bytes a card would have been spared. With -p the
+ * pairwise hash distances of all files are printed instead.
+ *
+ * Usage: dedup_scan [-m max_distance] [-k history] [-i keep_interval_ms] [-r fps] [-p] [-q]
+ *                   file.jpg...
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+
+#include "frame_dedup.h"
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] file.jpg...\n"
+            "  -m bits       duplicate distance (default %d)\n"
+            "  -k frames     stored frames compared against, up to %d (default %d)\n"
+            "  -i ms         store a duplicate at least this often, 0 = never (default %d)\n"
+            "  -r fps        frame rate the files are taken at (default 15)\n"
+            "  -p            print the pairwise hash distances only\n"
+            "  -q            print the summary only\n",
+            prog, CONFIG_APP_DEDUP_MAX_DISTANCE, FRAME_DEDUP_MAX_HISTORY, CONFIG_APP_DEDUP_HISTORY,
+            CONFIG_APP_DEDUP_KEEP_INTERVAL_MS);
+}
+
+/**
+ * @brief Read a whole file
+ * @return Buffer to free, NULL on error
+ */
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = size > 0 ? malloc((size_t)size) : NULL;
+    if (buf == NULL || fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = (size_t)size;
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    frame_dedup_config_t config = FRAME_DEDUP_DEFAULT_CONFIG();
+    uint32_t fps = 15;
+    bool pairwise = false;
+    bool quiet = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:k:i:r:pqh")) != -1) {
+        switch (opt) {
+        case 'm': config.max_distance = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 'k': config.history = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 'i': config.keep_interval_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': fps = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'p': pairwise = true; break;
+        case 'q': quiet = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind == argc || fps == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    esp_log_level_set("*", ESP_LOG_ERROR);
+
+    frame_dedup_handle_t dedup = NULL;
+    if (frame_dedup_create(&config, &dedup) != ESP_OK) {
+        fprintf(stderr, "Invalid configuration\n");
+        return 2;
+    }
+
+    int files = argc - optind;
+    uint64_t *hashes = calloc((size_t)files, sizeof(uint64_t));
+    bool *hashed = calloc((size_t)files, sizeof(bool));
+    if (hashes == NULL || hashed == NULL) {
+        return 1;
+    }
+
+    uint64_t total_bytes = 0;
+    for (int i = 0; i < files; i++) {
+        const char *path = argv[optind + i];
+        capture_frame_t frame = { 0 };
+        size_t len;
+        uint8_t *data = read_file(path, &len);
+        if (data == NULL) {
+            continue;
+        }
+        frame.buf = data;
+        frame.len = len;
+        frame.seq = (uint32_t)i;
+        frame.timestamp_us = (int64_t)i * 1000000 / fps;
+        total_bytes += len;
+
+        esp_err_t ret = frame_dedup_hash_jpeg(dedup, &frame, &hashes[i]);
+        if (ret != ESP_OK) {
+            fprintf(stderr, "%s: no hash: %s\n", path, esp_err_to_name(ret));
+        }
+        hashed[i] = ret == ESP_OK;
+
+        /* The pipeline filter, so skipped bytes and timing are counted as on the device */
+        bool keep = pairwise || frame_dedup_filter(dedup, &frame);
+        if (!pairwise && !quiet && hashed[i]) {
+            uint8_t nearest = 64;
+            for (int j = 0; j < i; j++) {
+                if (hashed[j]) {
+                    uint8_t d = frame_dedup_distance(hashes[i], hashes[j]);
+                    nearest = d < nearest ? d : nearest;
+                }
+            }
+            printf("%s,%016llx,%u,%s\n", path, (unsigned long long)hashes[i], nearest,
+                   keep ? "kept" : "skipped");
+        }
+        free(data);
+    }
+
+    if (pairwise) {
+        for (int i = 0; i < files; i++) {
+            printf("%s", argv[optind + i]);
+            for (int j = 0; j < files; j++) {
+                if (hashed[i] && hashed[j]) {
+                    printf(",%u", frame_dedup_distance(hashes[i], hashes[j]));
+                } else {
+                    printf(",");
+                }
+            }
+            printf("\n");
+        }
+    } else {
+        frame_dedup_stats_t stats;
+        frame_dedup_get_stats(dedup, &stats);
+        printf("Duplicate scan of %d files, %llu KB\n", files, (unsigned long long)(total_bytes / 1024));
+        printf("  kept              %lu (%lu duplicates kept by the interval)\n",
+               (unsigned long)stats.kept, (unsigned long)stats.thinned);
+        printf("  skipped           %lu, %llu KB (%.1f%% of the bytes)\n", (unsigned long)stats.skipped,
+               (unsigned long long)(stats.bytes_saved / 1024),
+               total_bytes ? 100.0 * stats.bytes_saved / total_bytes : 0.0);
+        printf("  not hashed        %lu\n", (unsigned long)stats.errors);
+        printf("  hash              %lu us per frame\n", (unsigned long)stats.avg_hash_us);
+    }
+
+    free(hashes);
+    free(hashed);
+    frame_dedup_delete(dedup);
+    return 0;
+}
@@ -0,0 +1,312 @@
+/**
+ * @file mock_camera.c
+ * @brief Host stand-in for camera_driver: a frame source serving JPEG fixtures or synthetic frames
+ */
+
+#include "mock_camera.h"
+#include "jpeg_dc.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char *TAG = "mock_camera";
+
+/* esp_camera_fb_get() gives up after this long without a free buffer */
+#define MOCK_CAMERA_FB_TIMEOUT_MS   4000
+
+/* Largest marker segment payload (the length field counts itself) */
+#define JPEG_SEGMENT_MAX_PAYLOAD    65533
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    uint16_t width;
+    uint16_t height;
+} mock_frame_t;
+
+static mock_camera_config_t s_config;
+static mock_frame_t *s_frames = NULL;
+static size_t s_frame_count = 0;
+static size_t s_next_frame = 0;
+static SemaphoreHandle_t s_free_buffers = NULL;
+static int64_t s_next_frame_us = 0;
+
+/**
+ * @brief Append a marker segment with a length field
+ */
+static uint8_t *jpeg_put_segment(uint8_t *p, uint8_t marker, const uint8_t *payload, size_t len)
+{
+    *p++ = 0xFF;
+    *p++ = marker;
+    *p++ = (uint8_t)((len + 2) >> 8);
+    *p++ = (uint8_t)(len + 2);
+    if (payload != NULL) {
+        memcpy(p, payload, len);
+    } else {
+        memset(p, 0, len);
+    }
+    return p + len;
+}
+
+/**
+ * @brief Build a baseline grayscale JPEG of a uniform mid-gray image
+ *
+ * Both Huffman tables hold a single one-bit code (DC difference 0, AC
+ * end-of-block), so every 8x8 block takes two bits of entropy-coded data.
+ * The frame is padded to @p target_len with comment segments.
+ */
+static esp_err_t mock_build_synthetic(uint16_t width, uint16_t height, size_t target_len, mock_frame_t *frame)
+{
+    static const uint8_t huffman_dc[] = { 0x00, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x00 };
+    static const uint8_t huffman_ac[] = { 0x10, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x00 };
+    uint8_t quant[65];
+    memset(quant, 1, sizeof(quant));
+    quant[0] = 0x00;
+    const uint8_t sof[] = { 8, (uint8_t)(height >> 8), (uint8_t)height, (uint8_t)(width >> 8), (uint8_t)width,
+                            1, 1, 0x11, 0 };
+    const uint8_t sos[] = { 1, 1, 0x00, 0, 63, 0 };
+
+    size_t blocks = (size_t)((width + 7) / 8) * ((height + 7) / 8);
+    size_t scan_len = (blocks * 2 + 7) / 8;
+    size_t header_len = 2 + (4 + sizeof(quant)) + (4 + sizeof(sof)) + (4 + sizeof(huffman_dc)) +
+                        (4 + sizeof(huffman_ac)) + (4 + sizeof(sos));
+    size_t min_len = header_len + scan_len + 2;
+    size_t padding = target_len > min_len ? target_len - min_len : 0;
+
+    frame->data = malloc(min_len + padding + 4);
+    if (frame->data == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t *p = frame->data;
+    *p++ = 0xFF;
+    *p++ = 0xD8;
+    p = jpeg_put_segment(p, 0xDB, quant, sizeof(quant));
+    p = jpeg_put_segment(p, 0xC0, sof, sizeof(sof));
+    p = jpeg_put_segment(p, 0xC4, huffman_dc, sizeof(huffman_dc));
+    p = jpeg_put_segment(p, 0xC4, huffman_ac, sizeof(huffman_ac));
+    /* Comment segments carry the padding; each has a 4-byte header */
+    while (padding >= 4) {
+        size_t len = padding - 4 > JPEG_SEGMENT_MAX_PAYLOAD ? JPEG_SEGMENT_MAX_PAYLOAD : padding - 4;
+        p = jpeg_put_segment(p, 0xFE, NULL, len);
+        padding -= len + 4;
+    }
+    p = jpeg_put_segment(p, 0xDA, sos, sizeof(sos));
+    memset(p, 0x00, scan_len);
+    /* Pad the last byte with one bits */
+    size_t bits = blocks * 2;
+    if (bits % 8) {
+        p[scan_len - 1] = (uint8_t)(0xFF >> (bits % 8));
+    }
+    p += scan_len;
+    *p++ = 0xFF;
+    *p++ = 0xD9;
+
+    frame->len = (size_t)(p - frame->data);
+    frame->width = width;
+    frame->height = height;
+    return ESP_OK;
+}
+
+static int mock_compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Read a whole file into memory
+ */
+static esp_err_t mock_read_file(const char *path, mock_frame_t *frame)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    frame->data = len > 0 ? malloc((size_t)len) : NULL;
+    esp_err_t ret = ESP_FAIL;
+    if (frame->data != NULL && fread(frame->data, 1, (size_t)len, f) == (size_t)len) {
+        frame->len = (size_t)len;
+        ret = jpeg_dc_get_size(frame->data, frame->len, &frame->width, &frame->height);
+    }
+    fclose(f);
+    if (ret != ESP_OK) {
+        free(frame->data);
+        frame->data = NULL;
+    }
+    return ret;
+}
+
+/**
+ * @brief Load every .jpg/.jpeg file of a directory, in name order
+ */
+static esp_err_t mock_load_fixtures(const char *dir_path)
+{
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        ESP_LOGE(TAG, "Cannot open fixture directory %s", dir_path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char **names = NULL;
+    size_t count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *ext = strrchr(entry->d_name, '.');
+        if (ext == NULL || (strcasecmp(ext, ".jpg") != 0 && strcasecmp(ext, ".jpeg") != 0)) {
+            continue;
+        }
+        char **grown = realloc(names, (count + 1) * sizeof(*names));
+        if (grown == NULL) {
+            break;
+        }
+        names = grown;
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(*names), mock_compare_names);
+
+    s_frames = calloc(count ? count : 1, sizeof(*s_frames));
+    for (size_t i = 0; i < count && s_frames != NULL; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, names[i]);
+        if (mock_read_file(path, &s_frames[s_frame_count]) == ESP_OK) {
+            s_frame_count++;
+        } else {
+            ESP_LOGW(TAG, "Skipping %s: not a readable JPEG", path);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+
+    if (s_frame_count == 0) {
+        ESP_LOGE(TAG, "No JPEG fixtures in %s", dir_path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGI(TAG, "Loaded %zu fixtures from %s", s_frame_count, dir_path);
+    return ESP_OK;
+}
+
+esp_err_t mock_camera_init(const mock_camera_config_t *config)
+{
+    if (config == NULL || config->fb_count == 0 || s_frames != NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_config = *config;
+    s_frame_count = 0;
+    s_next_frame = 0;
+
+    esp_err_t ret;
+    if (config->fixture_dir != NULL) {
+        ret = mock_load_fixtures(config->fixture_dir);
+    } else {
+        s_frames = calloc(1, sizeof(*s_frames));
+        ret = s_frames ? mock_build_synthetic(config->width, config->height, config->frame_len, &s_frames[0])
+                       : ESP_ERR_NO_MEM;
+        if (ret == ESP_OK) {
+            s_frame_count = 1;
+            ESP_LOGI(TAG, "Synthetic %ux%u frames of %zu bytes at %lu fps", config->width, config->height,
+                     s_frames[0].len, (unsigned long)config->fps);
+        }
+    }
+
+    if (ret == ESP_OK) {
+        s_free_buffers = xSemaphoreCreateCounting(config->fb_count, config->fb_count);
+        if (s_free_buffers == NULL) {
+            ret = ESP_ERR_NO_MEM;
+        }
+    }
+    if (ret != ESP_OK) {
+        mock_camera_deinit();
+        return ret;
+    }
+    s_next_frame_us = esp_timer_get_time();
+    return ESP_OK;
+}
+
+void mock_camera_deinit(void)
+{
+    for (size_t i = 0; i < s_frame_count; i++) {
+        free(s_frames[i].data);
+    }
+    free(s_frames);
+    s_frames = NULL;
+    s_frame_count = 0;
+    if (s_free_buffers != NULL) {
+        vSemaphoreDelete(s_free_buffers);
+        s_free_buffers = NULL;
+    }
+}
+
+/**
+ * @brief Wait for the next frame period, skipping periods that already passed
+ *
+ * Like CAMERA_GRAB_LATEST, a late caller gets the newest frame instead of
+ * catching up on the ones it missed.
+ */
+static void mock_wait_frame_period(void)
+{
+    if (s_config.fps == 0) {
+        return;
+    }
+    int64_t period_us = 1000000 / s_config.fps;
+    int64_t now = esp_timer_get_time();
+    if (now > s_next_frame_us + period_us) {
+        s_next_frame_us = now - (now - s_next_frame_us) % period_us;
+    }
+    if (s_next_frame_us > now) {
+        vTaskDelay(pdMS_TO_TICKS((s_next_frame_us - now + 999) / 1000));
+    }
+    s_next_frame_us += period_us;
+}
+
+static esp_err_t mock_source_acquire(void *ctx, capture_frame_t *frame)
+{
+    if (xSemaphoreTake(s_free_buffers, pdMS_TO_TICKS(MOCK_CAMERA_FB_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "No free frame buffer");
+        return ESP_ERR_TIMEOUT;
+    }
+    mock_wait_frame_period();
+
+    const mock_frame_t *src = &s_frames[s_next_frame];
+    s_next_frame = (s_next_frame + 1) % s_frame_count;
+
+    frame->buf = src->data;
+    frame->len = src->len;
+    frame->width = src->width;
+    frame->height = src->height;
+    frame->timestamp_us = esp_timer_get_time();
+    frame->priv = (void *)src;
+    return ESP_OK;
+}
+
+static void mock_source_release(void *ctx, capture_frame_t *frame)
+{
+    if (frame->priv != NULL) {
+        frame->priv = NULL;
+        xSemaphoreGive(s_free_buffers);
+    }
+}
+
+static const capture_source_t mock_source = {
+    .acquire = mock_source_acquire,
+    .release = mock_source_release,
+    .set_mode = NULL,
+    .ctx = NULL,
+};
+
+const capture_source_t *mock_camera_get_frame_source(void)
+{
+    return &mock_source;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file mock_camera.h
+ * @brief Host stand-in for camera_driver: a frame source serving JPEG fixtures or synthetic frames
+ *
+ * Frames are paced at the configured rate and at most fb_count of them can
+ * be held at once, so the pipeline sees the same back-pressure as with the
+ * camera driver's frame buffers.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "capture_frame.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Mock camera configuration
+ */
+typedef struct {
+    const char *fixture_dir;    /**< Directory of .jpg files served in name order, NULL for synthetic frames */
+    uint16_t width;             /**< Synthetic frame width */
+    uint16_t height;            /**< Synthetic frame height */
+    size_t frame_len;           /**< Synthetic frame size in bytes */
+    uint32_t fps;               /**< Frame rate, 0 to deliver frames as fast as they are requested */
+    uint8_t fb_count;           /**< Frames that can be held at once */
+} mock_camera_config_t;
+
+/**
+ * @brief Default mock camera configuration: UXGA frames of 200 KB at 15 fps
+ */
+#define MOCK_CAMERA_DEFAULT_CONFIG() {          \
+    .fixture_dir = NULL,                        \
+    .width       = 1600,                        \
+    .height      = 1200,                        \
+    .frame_len   = 200 * 1024,                  \
+    .fps         = 15,                          \
+    .fb_count    = CONFIG_APP_CAMERA_FB_COUNT,  \
+}
+
+/**
+ * @brief Load the fixtures or build the synthetic frame
+ *
+ * Synthetic frames are valid baseline JPEGs of a uniform gray image, padded
+ * to frame_len with a comment segment.
+ *
+ * @param config Mock camera configuration
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the fixture directory has no
+ *         JPEG files, error code otherwise
+ */
+esp_err_t mock_camera_init(const mock_camera_config_t *config);
+
+/**
+ * @brief Free the frames; no frame may still be held
+ */
+void mock_camera_deinit(void);
+
+/**
+ * @brief Get the mock frame source for the capture pipeline
+ */
+const capture_source_t *mock_camera_get_frame_source(void);
+
+#ifdef __cplusplus
+}
+#endif
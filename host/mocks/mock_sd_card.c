@@ -0,0 +1,175 @@
+/**
+ * @file mock_sd_card.c
+ * @brief Host stand-in for sd_card_driver: a local directory serves as the card
+ *
+ * The directory is MOUNT_POINT, set by the host build. Mounting runs the
+ * same recovery pass as on the card; formatting deletes the directory's files
+ * and subdirectories. Raw sector access goes to HOST_CARD_IMAGE, a sparse
+ * image file of HOST_CARD_IMAGE_MB created on first use, which has no
+ * partition table. There is no bus to calibrate, so the Kconfig write chunk
+ * size is used.
+ */
+
+#include "sd_card_driver.h"
+#include "app_config.h"
+#include "file_operations.h"
+#include "capture_index.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef HOST_CARD_IMAGE
+#define HOST_CARD_IMAGE     "card.img"
+#endif
+#ifndef HOST_CARD_IMAGE_MB
+#define HOST_CARD_IMAGE_MB  256
+#endif
+
+static const char *TAG = "mock_sd_card";
+
+static sdmmc_card_t s_card = { .fd = -1 };
+static sdmmc_card_t *sd_card = NULL;
+
+static void sd_card_open_index(uint32_t budget_ms)
+{
+#ifdef CONFIG_APP_CAPTURE_INDEX_ENABLE
+    capture_index_config_t index_config = CAPTURE_INDEX_DEFAULT_CONFIG(MOUNT_POINT);
+    index_config.budget_ms = budget_ms;
+    esp_err_t ret = capture_index_open(&index_config);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Capture index not available: %s", esp_err_to_name(ret));
+    }
+#endif
+}
+
+static void sd_card_recover(void)
+{
+    int64_t start = esp_timer_get_time();
+    sd_card_open_index(CONFIG_APP_RECOVERY_BUDGET_MS);
+    ESP_LOGI(TAG, "Recovery took %lu ms", (unsigned long)((esp_timer_get_time() - start) / 1000));
+}
+
+esp_err_t sd_card_init(void)
+{
+    if (mkdir(MOUNT_POINT, 0755) != 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "Failed to create %s: errno %d", MOUNT_POINT, errno);
+        return ESP_FAIL;
+    }
+
+    /* Sparse, so only written sectors take space */
+    off_t image_size = (off_t)HOST_CARD_IMAGE_MB * 1024 * 1024;
+    struct stat st;
+    s_card.fd = open(HOST_CARD_IMAGE, O_RDWR | O_CREAT, 0644);
+    if (s_card.fd < 0 || fstat(s_card.fd, &st) != 0 ||
+        (st.st_size < image_size && ftruncate(s_card.fd, image_size) != 0)) {
+        ESP_LOGE(TAG, "Failed to open card image %s: errno %d", HOST_CARD_IMAGE, errno);
+        return ESP_FAIL;
+    }
+    s_card.csd.capacity = (int)((st.st_size > image_size ? st.st_size : image_size) / 512);
+    s_card.csd.sector_size = 512;
+
+    sd_card = &s_card;
+    ESP_LOGI(TAG, "Using directory %s as the SD card, %s for its sectors", MOUNT_POINT, HOST_CARD_IMAGE);
+
+    file_write_init(sd_card_get_write_chunk_size());
+    sd_card_recover();
+    return ESP_OK;
+}
+
+void sd_card_cleanup(void)
+{
+    if (sd_card) {
+        capture_index_close();
+        close(s_card.fd);
+        s_card.fd = -1;
+        sd_card = NULL;
+    }
+}
+
+esp_err_t sdmmc_read_sectors(sdmmc_card_t *card, void *dst, size_t start_sector, size_t sector_count)
+{
+    if (start_sector + sector_count > (size_t)card->csd.capacity) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t len = sector_count * 512;
+    ssize_t done = pread(card->fd, dst, len, (off_t)start_sector * 512);
+    return done == (ssize_t)len ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t sdmmc_write_sectors(sdmmc_card_t *card, const void *src, size_t start_sector, size_t sector_count)
+{
+    if (start_sector + sector_count > (size_t)card->csd.capacity) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t len = sector_count * 512;
+    ssize_t done = pwrite(card->fd, src, len, (off_t)start_sector * 512);
+    return done == (ssize_t)len ? ESP_OK : ESP_FAIL;
+}
+
+sdmmc_card_t* sd_card_get_handle(void)
+{
+    return sd_card;
+}
+
+esp_err_t sd_card_get_calibration(sd_card_calibration_t *cal)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+size_t sd_card_get_write_chunk_size(void)
+{
+    return FILE_WRITE_CHUNK_SIZE;
+}
+
+/**
+ * @brief Delete the files and subdirectories of a directory
+ */
+static esp_err_t sd_card_clear_dir(const char *base)
+{
+    DIR *dir = opendir(base);
+    if (dir == NULL) {
+        return ESP_FAIL;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char path[EXAMPLE_MAX_CHAR_SIZE + sizeof(entry->d_name)];
+        snprintf(path, sizeof(path), "%s/%s", base, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+        if (S_ISREG(st.st_mode)) {
+            unlink(path);
+        } else if (S_ISDIR(st.st_mode) && sd_card_clear_dir(path) == ESP_OK) {
+            rmdir(path);
+        }
+    }
+    closedir(dir);
+    return ESP_OK;
+}
+
+esp_err_t sd_card_format(void)
+{
+    if (sd_card == NULL) {
+        ESP_LOGE(TAG, "SD card not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    capture_index_close();
+    if (sd_card_clear_dir(MOUNT_POINT) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Directory %s cleared", MOUNT_POINT);
+    sd_card_open_index(0);
+    return ESP_OK;
+}
@@ -0,0 +1,303 @@
+/**
+ * @file mock_sensor.c
+ * @brief Host stand-in for esp32-camera with an OV2640 register model
+ */
+
+#include "mock_sensor.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Frames already filled by the driver when the registers change */
+#define MOCK_SENSOR_BUFFERED    2
+
+/* Bytes of a delivered frame: SOI, a baseline SOF0 header and EOI */
+#define MOCK_FRAME_LEN          (2 + 2 + 17 + 2)
+
+const resolution_info_t resolution[] = {
+    [FRAMESIZE_96X96]   = { 96, 96 },
+    [FRAMESIZE_QQVGA]   = { 160, 120 },
+    [FRAMESIZE_QCIF]    = { 176, 144 },
+    [FRAMESIZE_HQVGA]   = { 240, 176 },
+    [FRAMESIZE_240X240] = { 240, 240 },
+    [FRAMESIZE_QVGA]    = { 320, 240 },
+    [FRAMESIZE_CIF]     = { 400, 296 },
+    [FRAMESIZE_HVGA]    = { 480, 320 },
+    [FRAMESIZE_VGA]     = { 640, 480 },
+    [FRAMESIZE_SVGA]    = { 800, 600 },
+    [FRAMESIZE_XGA]     = { 1024, 768 },
+    [FRAMESIZE_HD]      = { 1280, 720 },
+    [FRAMESIZE_SXGA]    = { 1280, 1024 },
+    [FRAMESIZE_UXGA]    = { 1600, 1200 },
+};
+
+/*
+ * Registers written by set_framesize(), as the OV2640 driver does: the
+ * sensor bank readout window and clock for one of three readout modes
+ * (CIF, SVGA, UXGA), then the DSP input window and output size.
+ */
+static const uint16_t s_framesize_regs[] = {
+    0x112, 0x103, 0x132, 0x117, 0x118, 0x119, 0x11A, 0x111, 0x14F, 0x150,
+    0x15A, 0x16D, 0x13D, 0x139, 0x135, 0x122, 0x137, 0x123, 0x134, 0x106,
+    0x107, 0x10D, 0x10E, 0x142, 0x14C,
+    0x0C0, 0x0C1, 0x08C, 0x051, 0x052, 0x053, 0x054, 0x055, 0x057, 0x086,
+    0x050, 0x05A, 0x05B, 0x05C, 0x0D3,
+};
+
+typedef struct {
+    int reg;
+    uint32_t count;
+} mock_fault_t;
+
+static sensor_t s_sensor;
+static uint8_t s_regs[MOCK_SENSOR_REG_COUNT];
+static mock_sensor_stats_t s_stats;
+static mock_fault_t s_fail;
+static mock_fault_t s_drop;
+static uint32_t s_fail_framesize;
+static camera_sensor_info_t s_info = { .name = "OV2640 (mock)" };
+
+/* Output sizes of the frames already filled, oldest first */
+static uint16_t s_pending[MOCK_SENSOR_BUFFERED][2];
+
+static int mock_readout_mode(framesize_t framesize)
+{
+    return framesize <= FRAMESIZE_CIF ? 0 : framesize <= FRAMESIZE_SVGA ? 1 : 2;
+}
+
+/**
+ * @brief Value set_framesize() gives a register
+ *
+ * Every third register keeps its value in all modes, so a switch between
+ * profiles changes only some of them.
+ */
+static uint8_t mock_framesize_value(uint16_t reg, framesize_t framesize)
+{
+    uint16_t out_w = resolution[framesize].width / 4;
+    uint16_t out_h = resolution[framesize].height / 4;
+
+    switch (reg) {
+    case MOCK_SENSOR_REG_ZMOW:
+        return (uint8_t)out_w;
+    case MOCK_SENSOR_REG_ZMOH:
+        return (uint8_t)out_h;
+    case MOCK_SENSOR_REG_ZMHH:
+        return (uint8_t)(((out_w >> 8) & 0x03) | ((out_h >> 6) & 0x04));
+    default:
+        break;
+    }
+    uint32_t value = reg * 37u;
+    if (reg % 3 != 0) {
+        value += (uint32_t)mock_readout_mode(framesize) * 11u;
+    }
+    return (uint8_t)value;
+}
+
+static void mock_output_size(uint16_t *width, uint16_t *height)
+{
+    uint8_t zmhh = s_regs[MOCK_SENSOR_REG_ZMHH];
+    *width = (uint16_t)((s_regs[MOCK_SENSOR_REG_ZMOW] | ((zmhh & 0x03) << 8)) * 4);
+    *height = (uint16_t)((s_regs[MOCK_SENSOR_REG_ZMOH] | ((zmhh & 0x04) << 6)) * 4);
+}
+
+static void mock_apply_framesize(framesize_t framesize)
+{
+    for (size_t i = 0; i < sizeof(s_framesize_regs) / sizeof(s_framesize_regs[0]); i++) {
+        s_regs[s_framesize_regs[i]] = mock_framesize_value(s_framesize_regs[i], framesize);
+    }
+}
+
+static int mock_set_framesize(sensor_t *sensor, framesize_t framesize)
+{
+    s_stats.set_framesize_calls++;
+    if (framesize >= FRAMESIZE_INVALID) {
+        return -1;
+    }
+    if (s_fail_framesize > 0) {
+        s_fail_framesize--;
+        return -1;
+    }
+    mock_apply_framesize(framesize);
+    sensor->status.framesize = framesize;
+    return 0;
+}
+
+static int mock_set_quality(sensor_t *sensor, int quality)
+{
+    s_stats.set_quality_calls++;
+    if (quality < 0 || quality > 63) {
+        return -1;
+    }
+    s_regs[MOCK_SENSOR_REG_QS] = (uint8_t)quality;
+    sensor->status.quality = (uint8_t)quality;
+    return 0;
+}
+
+static int mock_get_reg(sensor_t *sensor, int reg, int mask)
+{
+    s_stats.get_reg_calls++;
+    if (reg < 0 || reg >= MOCK_SENSOR_REG_COUNT) {
+        return -1;
+    }
+    return s_regs[reg] & mask;
+}
+
+static int mock_set_reg(sensor_t *sensor, int reg, int mask, int value)
+{
+    s_stats.set_reg_calls++;
+    if (s_stats.first_reg < 0) {
+        s_stats.first_reg = reg;
+        s_stats.first_value = value;
+    }
+    s_stats.last_reg = reg;
+    s_stats.last_value = value;
+
+    if (reg < 0 || reg >= MOCK_SENSOR_REG_COUNT) {
+        return -1;
+    }
+    if (s_fail.count > 0 && s_fail.reg == reg) {
+        s_fail.count--;
+        return -1;
+    }
+    if (s_drop.count > 0 && s_drop.reg == reg) {
+        s_drop.count--;
+        return 0;
+    }
+    s_regs[reg] = (uint8_t)((s_regs[reg] & ~mask) | (value & mask));
+    return 0;
+}
+
+void mock_sensor_reset(uint16_t pid)
+{
+    memset(s_regs, 0, sizeof(s_regs));
+    memset(&s_stats, 0, sizeof(s_stats));
+    memset(&s_fail, 0, sizeof(s_fail));
+    memset(&s_drop, 0, sizeof(s_drop));
+    s_stats.first_reg = -1;
+    s_stats.last_reg = -1;
+    s_fail_framesize = 0;
+    memset(s_pending, 0, sizeof(s_pending));
+
+    memset(&s_sensor, 0, sizeof(s_sensor));
+    s_sensor.id.PID = pid;
+    s_sensor.set_framesize = mock_set_framesize;
+    s_sensor.set_quality = mock_set_quality;
+    s_sensor.get_reg = mock_get_reg;
+    s_sensor.set_reg = mock_set_reg;
+}
+
+void mock_sensor_get_regs(uint8_t regs[MOCK_SENSOR_REG_COUNT])
+{
+    memcpy(regs, s_regs, MOCK_SENSOR_REG_COUNT);
+}
+
+void mock_sensor_get_output_size(uint16_t *width, uint16_t *height)
+{
+    mock_output_size(width, height);
+}
+
+void mock_sensor_fail_reg(int reg, uint32_t count)
+{
+    s_fail.reg = reg;
+    s_fail.count = count;
+}
+
+void mock_sensor_drop_reg(int reg, uint32_t count)
+{
+    s_drop.reg = reg;
+    s_drop.count = count;
+}
+
+void mock_sensor_fail_framesize(uint32_t count)
+{
+    s_fail_framesize = count;
+}
+
+void mock_sensor_take_stats(mock_sensor_stats_t *stats)
+{
+    uint32_t held = s_stats.frames_held;
+    *stats = s_stats;
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_stats.first_reg = -1;
+    s_stats.last_reg = -1;
+    s_stats.frames_held = held;
+}
+
+esp_err_t esp_camera_init(const camera_config_t *config)
+{
+    if (s_sensor.set_reg == NULL) {
+        mock_sensor_reset(OV2640_PID);
+    }
+    mock_apply_framesize(config->frame_size);
+    s_regs[MOCK_SENSOR_REG_QS] = (uint8_t)config->jpeg_quality;
+    s_sensor.status.framesize = config->frame_size;
+    s_sensor.status.quality = (uint8_t)config->jpeg_quality;
+    for (int i = 0; i < MOCK_SENSOR_BUFFERED; i++) {
+        mock_output_size(&s_pending[i][0], &s_pending[i][1]);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Deliver the oldest filled frame and start filling one with the current output size
+ *
+ * A frame exposed with the DSP bypassed has no JPEG header.
+ */
+camera_fb_t *esp_camera_fb_get(void)
+{
+    camera_fb_t *fb = calloc(1, sizeof(*fb));
+    uint8_t *buf = calloc(1, MOCK_FRAME_LEN);
+    if (fb == NULL || buf == NULL) {
+        free(fb);
+        free(buf);
+        return NULL;
+    }
+
+    uint16_t width = s_pending[0][0];
+    uint16_t height = s_pending[0][1];
+    memmove(s_pending[0], s_pending[1], sizeof(s_pending) - sizeof(s_pending[0]));
+    if (s_regs[MOCK_SENSOR_REG_R_BYPASS] & 0x01) {
+        s_pending[MOCK_SENSOR_BUFFERED - 1][0] = 0;
+        s_pending[MOCK_SENSOR_BUFFERED - 1][1] = 0;
+    } else {
+        mock_output_size(&s_pending[MOCK_SENSOR_BUFFERED - 1][0], &s_pending[MOCK_SENSOR_BUFFERED - 1][1]);
+    }
+
+    const uint8_t header[MOCK_FRAME_LEN] = {
+        0xFF, 0xD8,
+        0xFF, 0xC0, 0x00, 0x11, 8, (uint8_t)(height >> 8), (uint8_t)height,
+        (uint8_t)(width >> 8), (uint8_t)width, 3, 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1,
+        0xFF, 0xD9,
+    };
+    if (width != 0) {
+        memcpy(buf, header, sizeof(header));
+    }
+
+    /* The driver labels frames with the configured size, not what the sensor sent */
+    fb->buf = buf;
+    fb->len = MOCK_FRAME_LEN;
+    fb->width = resolution[s_sensor.status.framesize].width;
+    fb->height = resolution[s_sensor.status.framesize].height;
+    fb->format = PIXFORMAT_JPEG;
+    s_stats.frames++;
+    s_stats.frames_held++;
+    return fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb)
+{
+    if (fb != NULL) {
+        s_stats.frames_held--;
+        free(fb->buf);
+        free(fb);
+    }
+}
+
+sensor_t *esp_camera_sensor_get(void)
+{
+    return s_sensor.set_reg != NULL ? &s_sensor : NULL;
+}
+
+camera_sensor_info_t *esp_camera_sensor_get_info(sensor_id_t *id)
+{
+    return &s_info;
+}
@@ -0,0 +1,91 @@
+/**
+ * @file mock_sensor.h
+ * @brief Host stand-in for esp32-camera with an OV2640 register model
+ *
+ * Lets camera_driver.c run on a host. The sensor has the OV2640's two
+ * register banks (bit 8 of the register number selects the sensor bank, as
+ * with get_reg()/set_reg()). set_framesize() and set_quality() write a fixed
+ * set of registers with values derived from the frame size and quality, as
+ * the real driver does, and only the DSP output size registers (ZMOW, ZMOH,
+ * ZMHH) decide the size of the frames delivered afterwards. Frames are
+ * minimal JPEG headers; the frame buffers already filled when the registers
+ * change still carry the old size.
+ *
+ * Register writes can be made to fail or to be silently dropped, to exercise
+ * the driver's fallback paths.
+ */
+
+#pragma once
+
+#include "esp_camera.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Register numbers as passed to get_reg()/set_reg() */
+#define MOCK_SENSOR_REG_COUNT       0x200
+#define MOCK_SENSOR_REG_R_BYPASS    0x005
+#define MOCK_SENSOR_REG_ZMOW        0x05A
+#define MOCK_SENSOR_REG_ZMOH        0x05B
+#define MOCK_SENSOR_REG_ZMHH        0x05C
+#define MOCK_SENSOR_REG_QS          0x044
+
+/**
+ * @brief Calls and writes seen by the mock since the last reset
+ */
+typedef struct {
+    uint32_t set_framesize_calls;
+    uint32_t set_quality_calls;
+    uint32_t set_reg_calls;         /**< Including failed and dropped ones */
+    uint32_t get_reg_calls;
+    uint32_t frames;                /**< Frames delivered by esp_camera_fb_get() */
+    uint32_t frames_held;           /**< Frames not yet returned */
+    int first_reg;                  /**< First register written by set_reg(), -1 if none */
+    int first_value;
+    int last_reg;                   /**< Last register written by set_reg(), -1 if none */
+    int last_value;
+} mock_sensor_stats_t;
+
+/**
+ * @brief Reset the sensor: clear the registers, faults and statistics
+ * @param pid Sensor product id reported in sensor_t::id
+ */
+void mock_sensor_reset(uint16_t pid);
+
+/**
+ * @brief Copy both register banks, indexed by register number
+ */
+void mock_sensor_get_regs(uint8_t regs[MOCK_SENSOR_REG_COUNT]);
+
+/**
+ * @brief Frame size the sensor currently outputs, from its DSP registers
+ */
+void mock_sensor_get_output_size(uint16_t *width, uint16_t *height);
+
+/**
+ * @brief Make the next @p count set_reg() calls on @p reg return an error without writing
+ */
+void mock_sensor_fail_reg(int reg, uint32_t count);
+
+/**
+ * @brief Make the next @p count set_reg() calls on @p reg succeed without writing
+ */
+void mock_sensor_drop_reg(int reg, uint32_t count);
+
+/**
+ * @brief Make the next @p count set_framesize() calls fail without writing
+ */
+void mock_sensor_fail_framesize(uint32_t count);
+
+/**
+ * @brief Get the statistics and clear them
+ */
+void mock_sensor_take_stats(mock_sensor_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
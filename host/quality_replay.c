@@ -0,0 +1,191 @@
+/**
+ * @file quality_replay.c
+ * @brief Replay a recorded frame size trace through the JPEG quality controller
+ *
+ * Each trace line is "timestamp_us,quality,bytes,write_us": a frame stored
+ * at the given JPEG quality. Lines in the device log format
+ * ("D (...) quality_ctrl: trace,...", from the controller at debug level)
+ * are accepted as they are; other lines are skipped.
+ *
+ * The controller's decisions are applied to the replayed frames after a
+ * lag of the settle frames, with the same model the controller uses: size
+ * scales with recorded quality / new quality and with the pixel count of
+ * the frame size step. Write times scale with the size. Prints one line
+ * per frame and a summary.
+ *
+ * Usage: quality_replay [-t target_kb] [-b budget_kbps] [-w headroom_pct] [-m min_quality]
+ *                       [-M max_quality] [-S max_step] [-d deadband_pct] [-s settle_frames]
+ *                       [-z size_steps] [-q] [-v] trace.csv
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+
+#include "quality_controller.h"
+
+/* Pixels of UXGA, SXGA, XGA and SVGA, the camera driver's capture frame size steps */
+static const uint32_t s_step_pixels[] = { 1600 * 1200, 1280 * 1024, 1024 * 768, 800 * 600 };
+
+#define REPLAY_MAX_STEPS    (sizeof(s_step_pixels) / sizeof(s_step_pixels[0]))
+
+/* Decisions waiting for the frames captured before them to pass */
+#define REPLAY_MAX_LAG      16
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] trace.csv\n"
+            "  -t kb         target frame size in KB, 0 = none (default %d)\n"
+            "  -b kbps       sustained budget in KB/s, 0 = none (default %d)\n"
+            "  -w pct        share of the write throughput, 0 = ignore it (default %d)\n"
+            "  -m quality    best quality allowed (default %d)\n"
+            "  -M quality    worst quality allowed (default %d)\n"
+            "  -S step       largest quality change per frame (default %d)\n"
+            "  -d pct        tolerance around the target (default %d)\n"
+            "  -s frames     frames before a change takes effect (default %d)\n"
+            "  -z steps      frame sizes, 1 = quality only, up to %zu (default %d)\n"
+            "  -q            print the summary only\n"
+            "  -v            log the controller's decisions\n",
+            prog, CONFIG_APP_QUALITY_TARGET_KB, CONFIG_APP_QUALITY_BUDGET_KBPS,
+            CONFIG_APP_QUALITY_WRITE_HEADROOM, CONFIG_APP_QUALITY_MIN, CONFIG_APP_QUALITY_MAX,
+            CONFIG_APP_QUALITY_MAX_STEP, CONFIG_APP_QUALITY_DEADBAND, CONFIG_APP_QUALITY_SETTLE_FRAMES,
+            REPLAY_MAX_STEPS, QUALITY_CONTROLLER_SIZE_STEPS);
+}
+
+/**
+ * @brief Parse a trace line, with or without the device log prefix
+ * @return true if the line holds a frame
+ */
+static bool parse_trace_line(const char *line, quality_sample_t *sample, unsigned *quality)
+{
+    const char *fields = strstr(line, "trace,");
+    fields = fields ? fields + strlen("trace,") : line;
+
+    long long timestamp_us;
+    unsigned long bytes, write_us;
+    if (sscanf(fields, "%lld,%u,%lu,%lu", &timestamp_us, quality, &bytes, &write_us) != 4 ||
+        *quality == 0 || *quality > 63) {
+        return false;
+    }
+    sample->timestamp_us = timestamp_us;
+    sample->bytes = (uint32_t)bytes;
+    sample->write_us = (uint32_t)write_us;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    quality_controller_config_t config = QUALITY_CONTROLLER_DEFAULT_CONFIG();
+    bool quiet = false;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:b:w:m:M:S:d:s:z:qvh")) != -1) {
+        switch (opt) {
+        case 't': config.target_frame_bytes = (uint32_t)strtoul(optarg, NULL, 0) * 1024; break;
+        case 'b': config.budget_kb_per_s = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'w': config.write_headroom_pct = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 'm': config.min_quality = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 'M': config.max_quality = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 'S': config.max_step = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 'd': config.deadband_pct = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 's': config.settle_frames = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 'z': config.size_steps = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 'q': quiet = true; break;
+        case 'v': verbose = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind != argc - 1 || config.size_steps > REPLAY_MAX_STEPS || config.settle_frames >= REPLAY_MAX_LAG) {
+        usage(argv[0]);
+        return 2;
+    }
+    esp_log_level_set("*", verbose ? ESP_LOG_INFO : ESP_LOG_ERROR);
+
+    FILE *trace = fopen(argv[optind], "r");
+    if (trace == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    quality_controller_handle_t controller = NULL;
+    quality_sample_t sample;
+    unsigned recorded_quality;
+    char line[256];
+    uint32_t frames = 0, over = 0;
+    uint64_t recorded_bytes = 0, replayed_bytes = 0;
+
+    /* Decisions of the last frames; a frame is captured with the one made 1 + settle frames earlier */
+    quality_decision_t history[REPLAY_MAX_LAG];
+    quality_decision_t initial = { 0 };
+
+    while (fgets(line, sizeof(line), trace) != NULL) {
+        if (!parse_trace_line(line, &sample, &recorded_quality)) {
+            continue;
+        }
+        if (controller == NULL) {
+            if (quality_controller_create(&config, (uint8_t)recorded_quality, &controller) != ESP_OK) {
+                fprintf(stderr, "Invalid controller configuration\n");
+                fclose(trace);
+                return 2;
+            }
+            initial.quality = (uint8_t)recorded_quality;
+        }
+
+        /* The frame as it would have come out with the settings in effect */
+        uint32_t lag = 1 + config.settle_frames;
+        quality_decision_t applied = frames >= lag ? history[(frames - lag) % REPLAY_MAX_LAG] : initial;
+        uint64_t bytes = (uint64_t)sample.bytes * recorded_quality / applied.quality *
+                         s_step_pixels[applied.size_step] / s_step_pixels[0];
+        uint32_t recorded = sample.bytes;
+        if (sample.bytes != 0) {
+            sample.write_us = (uint32_t)((uint64_t)sample.write_us * bytes / sample.bytes);
+        }
+        sample.bytes = bytes > UINT32_MAX ? UINT32_MAX : (uint32_t)bytes;
+
+        quality_decision_t decision;
+        bool changed = quality_controller_update(controller, &sample, &decision);
+        history[frames % REPLAY_MAX_LAG] = decision;
+
+        if (!quiet) {
+            printf("%lu,%u,%u,%lu,%lu,%lu%s\n", (unsigned long)frames, applied.quality, applied.size_step,
+                   (unsigned long)recorded, (unsigned long)sample.bytes, (unsigned long)decision.target_bytes,
+                   changed ? ",changed" : "");
+        }
+
+        frames++;
+        recorded_bytes += recorded;
+        replayed_bytes += sample.bytes;
+        if (decision.target_bytes != 0 &&
+            sample.bytes > (uint64_t)decision.target_bytes * (100 + config.deadband_pct) / 100) {
+            over++;
+        }
+    }
+    fclose(trace);
+
+    if (controller == NULL) {
+        fprintf(stderr, "No trace lines in %s\n", argv[optind]);
+        return 1;
+    }
+
+    quality_controller_stats_t stats;
+    quality_controller_get_stats(controller, &stats);
+    quality_controller_delete(controller);
+
+    printf("Quality replay of %lu frames\n", (unsigned long)frames);
+    printf("  recorded          avg %lu bytes\n", (unsigned long)(recorded_bytes / frames));
+    printf("  replayed          avg %lu bytes, %lu frames (%.1f%%) above target + tolerance\n",
+           (unsigned long)(replayed_bytes / frames), (unsigned long)over, 100.0 * over / frames);
+    printf("  controller        %lu changes (%lu frame size), final quality %u, size step %u, "
+           "target %lu bytes\n",
+           (unsigned long)stats.changes, (unsigned long)stats.size_changes, stats.quality,
+           stats.size_step, (unsigned long)stats.target_bytes);
+    return 0;
+}
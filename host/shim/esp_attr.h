@@ -0,0 +1,11 @@
+/**
+ * @file esp_attr.h
+ * @brief Host shim: memory placement attributes have no effect
+ */
+
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define EXT_RAM_BSS_ATTR
+#define RTC_NOINIT_ATTR
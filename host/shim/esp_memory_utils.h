@@ -0,0 +1,23 @@
+/**
+ * @file esp_memory_utils.h
+ * @brief Host shim: all memory counts as DMA capable
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+static inline bool esp_ptr_dma_capable(const void *p)
+{
+    return true;
+}
+
+static inline bool esp_ptr_dma_ext_capable(const void *p)
+{
+    return true;
+}
+
+static inline bool esp_ptr_external_ram(const void *p)
+{
+    return false;
+}
@@ -0,0 +1,18 @@
+/**
+ * @file esp_rom_crc.h
+ * @brief Host shim: CRC32 matching the ROM implementation (and zlib.crc32)
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,29 @@
+/**
+ * @file esp_vfs_fat.h
+ * @brief Host shim: FAT helpers on a local directory
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Create a file of @p size bytes; the space is reserved with posix_fallocate()
+ */
+esp_err_t esp_vfs_fat_create_contiguous_file(const char *base_path, const char *full_path,
+                                             uint64_t size, bool alloc_now);
+
+/**
+ * @brief Total and free bytes of the file system holding @p base_path
+ */
+esp_err_t esp_vfs_fat_info(const char *base_path, uint64_t *out_total_bytes, uint64_t *out_free_bytes);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,68 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host shim: the subset of FreeRTOS used by the application, on POSIX threads
+ *
+ * One tick is one millisecond. Critical sections are mutexes; priorities
+ * and core affinity are ignored.
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE             ((BaseType_t)0)
+#define pdTRUE              ((BaseType_t)1)
+#define pdFAIL              pdFALSE
+#define pdPASS              pdTRUE
+
+#define portMAX_DELAY       ((TickType_t)0xFFFFFFFFUL)
+#define portTICK_PERIOD_MS  ((TickType_t)1)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+#define portNUM_PROCESSORS  2
+#define tskNO_AFFINITY      0x7FFFFFFF
+
+#define configASSERT(x)     assert(x)
+
+typedef struct {
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { PTHREAD_MUTEX_INITIALIZER }
+#define portMUX_INITIALIZE(mux)         pthread_mutex_init(&(mux)->mutex, NULL)
+
+#define portENTER_CRITICAL(mux)         pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux)          pthread_mutex_unlock(&(mux)->mutex)
+#define portENTER_CRITICAL_ISR(mux)     portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux)      portEXIT_CRITICAL(mux)
+#define portENTER_CRITICAL_SAFE(mux)    portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_SAFE(mux)     portEXIT_CRITICAL(mux)
+#define portYIELD_FROM_ISR(...)         ((void)0)
+
+/**
+ * @brief Milliseconds since the process started
+ */
+TickType_t xTaskGetTickCount(void);
+
+/**
+ * @brief Core of the calling task; host threads all count as core 0
+ */
+static inline BaseType_t xPortGetCoreID(void)
+{
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,30 @@
+/**
+ * @file semphr.h
+ * @brief Host shim: FreeRTOS semaphores and mutexes on POSIX threads
+ *
+ * Mutexes are binary semaphores that start available; there is no priority
+ * inheritance and no recursive locking.
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_semaphore_t *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks_to_wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *higher_priority_task_woken);
+
+#define xSemaphoreCreateBinary()    xSemaphoreCreateCounting(1, 0)
+#define xSemaphoreCreateMutex()     xSemaphoreCreateCounting(1, 1)
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,44 @@
+/**
+ * @file task.h
+ * @brief Host shim: FreeRTOS tasks and direct-to-task notifications on POSIX threads
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_task_t *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *ret_task,
+                                   BaseType_t core_id);
+
+static inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                     void *arg, UBaseType_t priority, TaskHandle_t *ret_task)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, ret_task, tskNO_AFFINITY);
+}
+
+/**
+ * @brief Delete a task; only a task deleting itself (NULL) is supported
+ */
+void vTaskDelete(TaskHandle_t task);
+
+void vTaskDelay(TickType_t ticks);
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken);
+
+#ifdef __cplusplus
+}
+#endif
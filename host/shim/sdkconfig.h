@@ -0,0 +1,114 @@
+/**
+ * @file sdkconfig.h
+ * @brief Host shim: Kconfig defaults of main/Kconfig.projbuild for the modules built on the host
+ *
+ * Keep in sync with the defaults in Kconfig.projbuild. Options of the
+ * camera, SDMMC and trigger drivers are omitted; those are mocked or not
+ * built on the host.
+ */
+
+#pragma once
+
+/* Capture Pipeline Configuration */
+#define CONFIG_APP_CAMERA_FB_COUNT 3
+#define CONFIG_APP_PIPELINE_QUEUE_LEN 2
+#define CONFIG_APP_PIPELINE_FRAMES_PER_TRIGGER 3
+#define CONFIG_APP_PIPELINE_CAPTURE_CORE 0
+#define CONFIG_APP_PIPELINE_WRITER_CORE 1
+#define CONFIG_APP_PIPELINE_CAPTURE_PRIORITY 10
+#define CONFIG_APP_PIPELINE_WRITER_PRIORITY 5
+#define CONFIG_APP_PRETRIGGER_ENABLE 1
+#define CONFIG_APP_PRETRIGGER_MAX_FRAMES 8
+#define CONFIG_APP_PRETRIGGER_ARENA_KB 1536
+#define CONFIG_APP_PRETRIGGER_INTERVAL_MS 250
+#define CONFIG_APP_PRETRIGGER_WINDOW_MS 2000
+#define CONFIG_APP_BURST_ENABLE 1
+#define CONFIG_APP_BURST_ARENA_KB 2048
+#define CONFIG_APP_BURST_MAX_FRAMES 32
+#define CONFIG_APP_BURST_FRAMES 16
+#define CONFIG_APP_FRAME_POOL_ENABLE 1
+#define CONFIG_APP_FRAME_POOL_KB 4096
+
+/* Time-lapse; capture_bench -T runs the schedule */
+#define CONFIG_APP_TIMELAPSE_INTERVAL_MS 60000
+#define CONFIG_APP_TIMELAPSE_FRAMES_PER_SLOT 1
+#define CONFIG_APP_TIMELAPSE_BATCH_FRAMES 8
+#define CONFIG_APP_TIMELAPSE_BATCH_ARENA_KB 2048
+#define CONFIG_APP_TIMELAPSE_PRIORITY 8
+
+/* Storage Configuration; the host CMake options HOST_STORAGE_JPEG_FILES and
+ * HOST_STORAGE_SECTOR_LOG select the other formats */
+#if defined(HOST_STORAGE_JPEG_FILES)
+#define CONFIG_APP_STORAGE_JPEG_FILES 1
+#define CONFIG_APP_FILE_WRITE_SYNC_ON_CLOSE 1
+#define CONFIG_APP_FILE_WRITE_ATOMIC 1
+#define CONFIG_APP_EXIF_ENABLE 1
+#define CONFIG_APP_EXIF_DEVICE_ID ""
+#elif defined(HOST_STORAGE_SECTOR_LOG)
+#define CONFIG_APP_STORAGE_SECTOR_LOG 1
+#define CONFIG_APP_SECTOR_LOG_START_MB 0
+#define CONFIG_APP_SECTOR_LOG_SIZE_MB 0
+#define CONFIG_APP_SECTOR_LOG_CHECKPOINT_EVERY 16
+#else
+#define CONFIG_APP_STORAGE_SEGMENTS 1
+#define CONFIG_APP_SEGMENT_SIZE_MB 64
+#define CONFIG_APP_SEGMENT_SYNC_EVERY 1
+#endif
+#ifndef HOST_STORAGE_SECTOR_LOG
+#define CONFIG_APP_CAPTURE_INDEX_ENABLE 1
+#define CONFIG_APP_CAPTURE_INDEX_SYNC_EVERY 16
+#endif
+#define CONFIG_APP_FILE_WRITE_CHUNK_KB 32
+#define CONFIG_APP_RECOVERY_BUDGET_MS 300
+
+/* Retention */
+#define CONFIG_APP_RETENTION_ENABLE 1
+#define CONFIG_APP_RETENTION_HIGH_WATERMARK 90
+#define CONFIG_APP_RETENTION_LOW_WATERMARK 80
+#define CONFIG_APP_RETENTION_BATCH_FILES 8
+#define CONFIG_APP_RETENTION_IDLE_MS 500
+#define CONFIG_APP_RETENTION_CHECK_INTERVAL_MS 5000
+#define CONFIG_APP_RETENTION_REFRESH_INTERVAL_S 60
+#define CONFIG_APP_RETENTION_PRIORITY 1
+
+/* Thumbnails; capture_bench -t starts the stage */
+#define CONFIG_APP_THUMBNAIL_QUALITY 75
+#define CONFIG_APP_THUMBNAIL_ARENA_KB 512
+#define CONFIG_APP_THUMBNAIL_MAX_PENDING 4
+#define CONFIG_APP_THUMBNAIL_PRIORITY 1
+
+/* Motion Confirmation */
+#define CONFIG_APP_MOTION_PIXEL_THRESHOLD 12
+#define CONFIG_APP_MOTION_MIN_BLOCKS 2
+#define CONFIG_APP_MOTION_LEARN_SHIFT 3
+
+/* Duplicate Suppression; capture_bench -D and dedup_scan use it */
+#define CONFIG_APP_DEDUP_MAX_DISTANCE 4
+#define CONFIG_APP_DEDUP_HISTORY 4
+#define CONFIG_APP_DEDUP_KEEP_INTERVAL_MS 10000
+
+/* JPEG Quality Control; the controller is driven by quality_replay, not the pipeline */
+#define CONFIG_APP_QUALITY_TARGET_KB 200
+#define CONFIG_APP_QUALITY_BUDGET_KBPS 0
+#define CONFIG_APP_QUALITY_WRITE_HEADROOM 80
+#define CONFIG_APP_QUALITY_MIN 4
+#define CONFIG_APP_QUALITY_MAX 30
+#define CONFIG_APP_QUALITY_MAX_STEP 4
+#define CONFIG_APP_QUALITY_DEADBAND 10
+#define CONFIG_APP_QUALITY_SETTLE_FRAMES 2
+
+/* Latency Statistics */
+#define CONFIG_APP_LATENCY_STATS 1
+#define CONFIG_APP_LATENCY_STATS_DUMP_INTERVAL_S 60
+
+/* Startup */
+#define CONFIG_APP_STARTUP_PARALLEL 1
+#define CONFIG_APP_STARTUP_STACK_SIZE 6144
+#define CONFIG_APP_STARTUP_PRIORITY 5
+
+/* Read-back Verification; capture_bench -S starts the scrub */
+#define CONFIG_APP_SCRUB_CHUNK_KB 16
+#define CONFIG_APP_SCRUB_RATE_KBPS 1024
+#define CONFIG_APP_SCRUB_IDLE_MS 2000
+#define CONFIG_APP_SCRUB_INTERVAL_S 3600
+#define CONFIG_APP_SCRUB_PRIORITY 1
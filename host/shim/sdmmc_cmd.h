@@ -0,0 +1,25 @@
+/**
+ * @file sdmmc_cmd.h
+ * @brief Host shim: SD card handle and raw sector access
+ *
+ * The card is a local image file opened by the mock SD card driver; the
+ * CSD carries its size in sectors as on the device.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+
+typedef struct {
+    int capacity;               /**< Card size in sectors */
+    int sector_size;            /**< Sector size in bytes */
+} sdmmc_csd_t;
+
+typedef struct sdmmc_card_t {
+    sdmmc_csd_t csd;
+    int fd;                     /**< Host: card image file */
+} sdmmc_card_t;
+
+esp_err_t sdmmc_read_sectors(sdmmc_card_t *card, void *dst, size_t start_sector, size_t sector_count);
+esp_err_t sdmmc_write_sectors(sdmmc_card_t *card, const void *src, size_t start_sector, size_t sector_count);
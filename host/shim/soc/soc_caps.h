@@ -0,0 +1,6 @@
+/**
+ * @file soc_caps.h
+ * @brief Host shim: no SoC capabilities
+ */
+
+#pragma once
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""
+Regenerate the host test fixtures (needs Pillow).
+
+The images are synthetic and deterministic: gradients, shapes and a fixed
+pseudo-random texture, small enough to keep in the repository. Run from any
+directory; files are written next to this script.
+
+    python3 host/tests/fixtures/make_fixtures.py
+"""
+
+import os
+
+from PIL import Image, ImageDraw
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def texture(width, height, seed):
+    """Gradient background, a few shapes and xorshift32 noise."""
+    img = Image.linear_gradient("L").resize((width, height)).convert("RGB")
+    draw = ImageDraw.Draw(img)
+    draw.ellipse((width // 5, height // 6, width // 2, height // 2), fill=(230, 40, 40))
+    draw.rectangle((width // 2, height // 2, width - 4, height - 3), fill=(20, 90, 200))
+    draw.line((0, height - 1, width - 1, 0), fill=(250, 250, 250), width=3)
+    px = img.load()
+    state = seed
+    for y in range(height):
+        for x in range(width):
+            state ^= (state << 13) & 0xFFFFFFFF
+            state ^= state >> 17
+            state ^= (state << 5) & 0xFFFFFFFF
+            r, g, b = px[x, y]
+            n = (state & 31) - 16
+            px[x, y] = (max(0, min(255, r + n)), max(0, min(255, g + n)), max(0, min(255, b + n)))
+    return img
+
+
+def save(img, name, **kwargs):
+    img.save(os.path.join(HERE, name), "JPEG", **kwargs)
+
+
+def xorshift32(state):
+    state ^= (state << 13) & 0xFFFFFFFF
+    state ^= state >> 17
+    state ^= (state << 5) & 0xFFFFFFFF
+    return state
+
+
+def quality_trace():
+    """
+    Frame size trace for the quality controller, recorded at quality 10:
+    a busy scene on a fast card, the card slowing down, a quiet scene, each
+    in 10 fps bursts of 20 frames with 2 s between bursts.
+    """
+    phases = [
+        # frames, bytes at quality 10, write throughput in bytes/s
+        (60, 300 * 1024, 8 * 1024 * 1024),
+        (60, 300 * 1024, 1 * 1024 * 1024),
+        (60, 60 * 1024, 8 * 1024 * 1024),
+    ]
+    state = 0x1D872B41
+    timestamp = 1000000
+    lines = ["# timestamp_us,quality,bytes,write_us (make_fixtures.py)"]
+    frame = 0
+    for count, size, throughput in phases:
+        for _ in range(count):
+            state = xorshift32(state)
+            noise = (state % 101 - 50) / 1000.0     # +-5 %
+            size_now = int(size * (1 + noise))
+            lines.append("%d,10,%d,%d" % (timestamp, size_now, size_now * 1000000 // throughput))
+            frame += 1
+            timestamp += 2000000 if frame % 20 == 0 else 100000
+    with open(os.path.join(HERE, "quality_trace.csv"), "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def jpeg_dc_fixtures():
+    """Coding variants the DC parser has to handle, checked against libjpeg."""
+    img = texture(96, 64, 0x2545F491)
+    save(img.convert("L"), "jpeg_dc_gray.jpg", quality=85)
+    save(img, "jpeg_dc_444.jpg", quality=85, subsampling=0)
+    save(img, "jpeg_dc_422.jpg", quality=85, subsampling=1)
+    save(img, "jpeg_dc_420.jpg", quality=85, subsampling=2)
+    save(img, "jpeg_dc_420_rst.jpg", quality=85, subsampling=2, restart_marker_blocks=5)
+    save(img, "jpeg_dc_444_rst_rows.jpg", quality=60, subsampling=0, restart_marker_rows=1)
+    save(img, "jpeg_dc_progressive.jpg", quality=85, progressive=True)
+    # Sizes that are not whole MCUs, and coarse quantization
+    odd = texture(75, 45, 0x6C8E9CF5)
+    save(odd, "jpeg_dc_420_odd.jpg", quality=20, subsampling=2)
+    save(odd.convert("L"), "jpeg_dc_gray_odd_rst.jpg", quality=95, restart_marker_blocks=3)
+
+
+def dedup_fixtures():
+    """
+    One scene as a camera sees it from frame to frame, and frames that differ
+    from it: a duplicate suppressor keeps the latter and drops the former.
+    """
+    # Light across the scene, so no two neighbouring cells tie
+    light = Image.linear_gradient("L").rotate(90).resize((160, 120)).convert("RGB")
+
+    def lit(seed, transpose=None):
+        img = texture(160, 120, seed)
+        return Image.blend(img if transpose is None else img.transpose(transpose), light, 0.25)
+
+    scene = lit(0x7A3B9E15)
+    save(scene, "dedup_scene.jpg", quality=80)
+    # The same scene: coarser coding, fresh sensor noise, a brighter exposure
+    save(scene, "dedup_scene_q30.jpg", quality=30)
+    save(lit(0x0BADCAFE), "dedup_scene_noise.jpg", quality=80)
+    save(scene.point(lambda v: min(255, v + 24)), "dedup_scene_bright.jpg", quality=80)
+    # Something new in the scene, and another scene
+    moved = scene.copy()
+    ImageDraw.Draw(moved).rectangle((20, 50, 60, 118), fill=(35, 30, 25))
+    save(moved, "dedup_object.jpg", quality=80)
+    save(lit(0x7A3B9E15, Image.ROTATE_180), "dedup_other.jpg", quality=80)
+
+
+if __name__ == "__main__":
+    jpeg_dc_fixtures()
+    quality_trace()
+    dedup_fixtures()
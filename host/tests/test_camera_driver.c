@@ -0,0 +1,200 @@
+/**
+ * @file test_camera_driver.c
+ * @brief Profile switching of camera_driver against the OV2640 mock sensor
+ *
+ * The first switch into each profile runs the full frame size setup and
+ * caches the registers; later switches replay only the registers that
+ * differ, with the DSP bypassed, and must leave the sensor exactly as the
+ * full setup did. A replay that fails or does not produce frames of the new
+ * size falls back to the full setup.
+ */
+
+#include <string.h>
+
+#include "camera_driver.h"
+#include "jpeg_dc.h"
+#include "mock_sensor.h"
+#include "test_common.h"
+
+static uint8_t s_capture_regs[MOCK_SENSOR_REG_COUNT];
+static uint8_t s_monitor_regs[MOCK_SENSOR_REG_COUNT];
+
+/**
+ * @brief Registers that differ between two register files
+ */
+static int regs_differing(const uint8_t *a, const uint8_t *b)
+{
+    int n = 0;
+    for (int reg = 0; reg < MOCK_SENSOR_REG_COUNT; reg++) {
+        n += a[reg] != b[reg];
+    }
+    return n;
+}
+
+/**
+ * @brief The sensor registers match @p expected
+ */
+static void check_regs(const uint8_t *expected)
+{
+    uint8_t regs[MOCK_SENSOR_REG_COUNT];
+    mock_sensor_get_regs(regs);
+    TEST_CHECK_EQ(regs_differing(regs, expected), 0);
+}
+
+/**
+ * @brief The next captured frame has the given size in its JPEG header
+ */
+static void check_frame(uint16_t want_width, uint16_t want_height)
+{
+    camera_fb_t *fb = camera_capture_photo();
+    TEST_CHECK(fb != NULL);
+    if (fb == NULL) {
+        return;
+    }
+    uint16_t width = 0, height = 0;
+    TEST_CHECK_EQ(jpeg_dc_get_size(fb->buf, fb->len, &width, &height), ESP_OK);
+    TEST_CHECK_EQ(width, want_width);
+    TEST_CHECK_EQ(height, want_height);
+    TEST_CHECK_EQ(fb->width, want_width);
+    camera_return_frame_buffer(fb);
+}
+
+static void check_profile_stats(camera_profile_t profile, uint32_t switches, uint32_t cached,
+                                uint32_t misses, uint32_t failures)
+{
+    camera_profile_stats_t stats;
+    camera_get_profile_stats(profile, &stats);
+    TEST_CHECK_EQ(stats.switches, switches);
+    TEST_CHECK_EQ(stats.cached_switches, cached);
+    TEST_CHECK_EQ(stats.cache_misses, misses);
+    TEST_CHECK_EQ(stats.failures, failures);
+}
+
+/**
+ * @brief A replayed switch: bypass on, the differing registers, bypass off, nothing read back
+ */
+static void check_replayed(const uint8_t *from, const uint8_t *to)
+{
+    mock_sensor_stats_t ms;
+    mock_sensor_take_stats(&ms);
+    TEST_CHECK_EQ(ms.set_framesize_calls, 0);
+    TEST_CHECK_EQ(ms.set_quality_calls, 0);
+    TEST_CHECK_EQ(ms.get_reg_calls, 0);
+    TEST_CHECK_EQ(ms.set_reg_calls, 2 + regs_differing(from, to));
+    TEST_CHECK_EQ(ms.first_reg, MOCK_SENSOR_REG_R_BYPASS);
+    TEST_CHECK_EQ(ms.first_value, 0x01);
+    TEST_CHECK_EQ(ms.last_reg, MOCK_SENSOR_REG_R_BYPASS);
+    TEST_CHECK_EQ(ms.last_value, 0x00);
+    check_regs(to);
+}
+
+/**
+ * @brief A switch done by the sensor driver's frame size setup
+ */
+static void check_full_setup(void)
+{
+    mock_sensor_stats_t ms;
+    mock_sensor_take_stats(&ms);
+    TEST_CHECK_EQ(ms.set_framesize_calls, 1);
+    TEST_CHECK_EQ(ms.set_quality_calls, 1);
+}
+
+int main(void)
+{
+    mock_sensor_stats_t ms;
+
+    mock_sensor_reset(OV2640_PID);
+    TEST_CHECK_EQ(camera_init(), ESP_OK);
+    TEST_CHECK_EQ(camera_get_profile(), CAMERA_PROFILE_CAPTURE);
+    mock_sensor_get_regs(s_capture_regs);
+    mock_sensor_take_stats(&ms);
+
+    /* First switches: full setup, registers of both profiles read back */
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_MONITOR), ESP_OK);
+    mock_sensor_get_regs(s_monitor_regs);
+    TEST_CHECK(regs_differing(s_capture_regs, s_monitor_regs) > 0);
+    mock_sensor_take_stats(&ms);
+    TEST_CHECK_EQ(ms.set_framesize_calls, 1);
+    TEST_CHECK_EQ(ms.set_reg_calls, 0);
+    TEST_CHECK(ms.get_reg_calls > 0);
+    check_frame(640, 480);
+    check_profile_stats(CAMERA_PROFILE_MONITOR, 1, 0, 0, 0);
+
+    /* Frames buffered before the switch and the settle frame are discarded */
+    camera_profile_stats_t stats;
+    camera_get_profile_stats(CAMERA_PROFILE_MONITOR, &stats);
+    TEST_CHECK_EQ(stats.frames_discarded, 2 + CONFIG_APP_CAMERA_PROFILE_SETTLE_FRAMES);
+
+    /* Both profiles cached: later switches replay the differing registers */
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_CAPTURE), ESP_OK);
+    check_replayed(s_monitor_regs, s_capture_regs);
+    check_frame(1600, 1200);
+    check_profile_stats(CAMERA_PROFILE_CAPTURE, 1, 1, 0, 0);
+
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_MONITOR), ESP_OK);
+    check_replayed(s_capture_regs, s_monitor_regs);
+    check_frame(640, 480);
+    check_profile_stats(CAMERA_PROFILE_MONITOR, 2, 1, 0, 0);
+
+    /* Switching to the active profile does nothing */
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_MONITOR), ESP_OK);
+    mock_sensor_take_stats(&ms);
+    TEST_CHECK_EQ(ms.set_reg_calls + ms.set_framesize_calls + ms.frames, 0);
+
+    /* A lost write leaves the old output size: the wait times out and the full setup takes over */
+    mock_sensor_drop_reg(MOCK_SENSOR_REG_ZMOW, 1);
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_CAPTURE), ESP_OK);
+    mock_sensor_take_stats(&ms);
+    TEST_CHECK_EQ(ms.set_framesize_calls, 1);
+    check_regs(s_capture_regs);
+    check_frame(1600, 1200);
+    check_profile_stats(CAMERA_PROFILE_CAPTURE, 2, 1, 1, 0);
+
+    /* The cache was dropped: the monitor profile is set up in full once, then replayed again */
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_MONITOR), ESP_OK);
+    check_full_setup();
+    check_regs(s_monitor_regs);
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_CAPTURE), ESP_OK);
+    check_replayed(s_monitor_regs, s_capture_regs);
+    check_profile_stats(CAMERA_PROFILE_CAPTURE, 3, 2, 1, 0);
+
+    /* A failed write ends the replay at once and falls back the same way */
+    mock_sensor_fail_reg(MOCK_SENSOR_REG_ZMOH, 1);
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_MONITOR), ESP_OK);
+    mock_sensor_take_stats(&ms);
+    TEST_CHECK_EQ(ms.set_framesize_calls, 1);
+    check_regs(s_monitor_regs);
+    check_frame(640, 480);
+    check_profile_stats(CAMERA_PROFILE_MONITOR, 4, 1, 1, 0);
+
+    /*
+     * Replay and full setup both failing is reported. No cache is trusted
+     * afterwards, and the registers left by the failed switch are not taken
+     * for the capture profile's, so both profiles are set up in full once.
+     */
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_CAPTURE), ESP_OK);
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_MONITOR), ESP_OK);
+    mock_sensor_take_stats(&ms);
+    mock_sensor_fail_reg(MOCK_SENSOR_REG_R_BYPASS, 1);
+    mock_sensor_fail_framesize(1);
+    TEST_CHECK(camera_set_profile(CAMERA_PROFILE_CAPTURE) != ESP_OK);
+    check_profile_stats(CAMERA_PROFILE_CAPTURE, 5, 2, 2, 1);
+    mock_sensor_take_stats(&ms);
+
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_MONITOR), ESP_OK);
+    check_full_setup();
+    check_regs(s_monitor_regs);
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_CAPTURE), ESP_OK);
+    check_full_setup();
+    check_regs(s_capture_regs);
+    check_frame(1600, 1200);
+    check_profile_stats(CAMERA_PROFILE_CAPTURE, 6, 2, 2, 1);
+    TEST_CHECK_EQ(camera_set_profile(CAMERA_PROFILE_MONITOR), ESP_OK);
+    check_replayed(s_capture_regs, s_monitor_regs);
+    check_frame(640, 480);
+    check_profile_stats(CAMERA_PROFILE_MONITOR, 7, 3, 1, 0);
+
+    mock_sensor_take_stats(&ms);
+    TEST_CHECK_EQ(ms.frames_held, 0);
+    return TEST_RESULT();
+}
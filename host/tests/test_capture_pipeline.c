@@ -0,0 +1,256 @@
+/**
+ * @file test_capture_pipeline.c
+ * @brief Capture pipeline queue with a frame source faster than the writer
+ *
+ * The source hands out frames at once and the sink is held closed or made
+ * slow, so the queue between the capture and writer tasks fills up. Frames
+ * that find it full are released unstored; the rest must reach the sink in
+ * capture order, and every acquired frame must be released exactly once.
+ */
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capture_pipeline.h"
+#include "freertos/semphr.h"
+#include "test_common.h"
+
+#define MAX_FRAMES      8192
+
+static const uint8_t s_jpeg[64] = { 0xFF, 0xD8 };
+
+/* Source and sink bookkeeping, indexed by sequence number */
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_acquired;
+static uint32_t s_released;
+static uint8_t s_release_count[MAX_FRAMES];
+static uint32_t s_stored[MAX_FRAMES];
+static uint32_t s_stored_count;
+static uint32_t s_acquire_delay_us;
+static uint32_t s_sink_delay_us;
+
+/* The sink waits for the gate while it is closed */
+static SemaphoreHandle_t s_sink_entered;
+static SemaphoreHandle_t s_gate;
+static volatile bool s_gate_closed;
+
+static esp_err_t source_acquire(void *ctx, capture_frame_t *frame)
+{
+    if (s_acquire_delay_us) {
+        usleep(s_acquire_delay_us);
+    }
+    portENTER_CRITICAL(&s_lock);
+    bool full = s_acquired >= MAX_FRAMES;
+    if (!full) {
+        s_acquired++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (full) {
+        return ESP_FAIL;
+    }
+    frame->buf = s_jpeg;
+    frame->len = sizeof(s_jpeg);
+    frame->width = 8;
+    frame->height = 8;
+    return ESP_OK;
+}
+
+static void source_release(void *ctx, capture_frame_t *frame)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_released++;
+    if (frame->seq < MAX_FRAMES) {
+        s_release_count[frame->seq]++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static esp_err_t sink_store(void *ctx, const capture_frame_t *frame)
+{
+    if (s_gate_closed) {
+        xSemaphoreGive(s_sink_entered);
+        xSemaphoreTake(s_gate, portMAX_DELAY);
+    }
+    if (s_sink_delay_us) {
+        usleep(s_sink_delay_us);
+    }
+    portENTER_CRITICAL(&s_lock);
+    if (s_stored_count < MAX_FRAMES) {
+        s_stored[s_stored_count++] = frame->seq;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return ESP_OK;
+}
+
+static const capture_source_t s_source = {
+    .acquire = source_acquire,
+    .release = source_release,
+    .set_mode = NULL,
+    .ctx = NULL,
+};
+
+static void reset_counts(void)
+{
+    s_acquired = 0;
+    s_released = 0;
+    s_stored_count = 0;
+    memset(s_release_count, 0, sizeof(s_release_count));
+}
+
+static capture_pipeline_config_t make_config(size_t queue_length, bool continuous)
+{
+    capture_pipeline_config_t config = CAPTURE_PIPELINE_DEFAULT_CONFIG();
+    config.source = &s_source;
+    config.sink = sink_store;
+    config.queue_length = queue_length;
+    config.continuous = continuous;
+    config.frames_per_trigger = 1;
+    return config;
+}
+
+/**
+ * @brief Poll the statistics until @p done holds or about 5 s pass
+ */
+static bool wait_for(bool (*done)(const capture_pipeline_stats_t *, uint32_t), uint32_t arg,
+                     capture_pipeline_stats_t *stats)
+{
+    for (int i = 0; i < 5000; i++) {
+        capture_pipeline_get_stats(stats);
+        if (done(stats, arg)) {
+            return true;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+
+static bool captured_at_least(const capture_pipeline_stats_t *stats, uint32_t frames)
+{
+    return stats->frames_captured >= frames;
+}
+
+static bool written_at_least(const capture_pipeline_stats_t *stats, uint32_t frames)
+{
+    return stats->frames_written >= frames;
+}
+
+/**
+ * @brief Survivors reach the sink in capture order and every frame is released exactly once
+ * @return Frames stored
+ */
+static uint32_t check_accounting(const capture_pipeline_stats_t *stats)
+{
+    TEST_CHECK_EQ(s_acquired, stats->frames_captured);
+    TEST_CHECK_EQ(s_released, s_acquired);
+    TEST_CHECK_EQ(s_stored_count, stats->frames_written);
+    TEST_CHECK_EQ(stats->frames_written + stats->frames_dropped, stats->frames_captured);
+
+    uint32_t out_of_order = 0;
+    for (uint32_t i = 1; i < s_stored_count; i++) {
+        out_of_order += s_stored[i] <= s_stored[i - 1];
+    }
+    TEST_CHECK_EQ(out_of_order, 0);
+
+    uint32_t wrong_releases = 0;
+    for (uint32_t seq = 0; seq < s_acquired && seq < MAX_FRAMES; seq++) {
+        wrong_releases += s_release_count[seq] != 1;
+    }
+    TEST_CHECK_EQ(wrong_releases, 0);
+    return s_stored_count;
+}
+
+/**
+ * @brief A sink held closed: the queue fills to its length and every later frame is dropped
+ */
+static void check_held_sink(void)
+{
+    enum { QUEUE_LENGTH = 4, BURST = 40 };
+    reset_counts();
+    s_acquire_delay_us = 0;
+    s_sink_delay_us = 0;
+    s_gate_closed = true;
+
+    capture_pipeline_config_t config = make_config(QUEUE_LENGTH, false);
+    TEST_CHECK_EQ(capture_pipeline_start(&config), ESP_OK);
+
+    /* Frame 0 is taken by the writer and held in the sink, frames 1-4 fill the queue */
+    TEST_CHECK_EQ(capture_pipeline_trigger_scheduled(esp_timer_get_time(), 1), ESP_OK);
+    TEST_CHECK(xSemaphoreTake(s_sink_entered, pdMS_TO_TICKS(5000)) == pdTRUE);
+    TEST_CHECK_EQ(capture_pipeline_trigger_scheduled(esp_timer_get_time(), BURST), ESP_OK);
+
+    capture_pipeline_stats_t stats;
+    TEST_CHECK(wait_for(captured_at_least, 1 + BURST, &stats));
+    TEST_CHECK_EQ(stats.frames_captured, 1 + BURST);
+    TEST_CHECK_EQ(stats.frames_dropped, BURST - QUEUE_LENGTH);
+    TEST_CHECK_EQ(stats.queue_depth, QUEUE_LENGTH);
+    TEST_CHECK_EQ(stats.queue_high_water, QUEUE_LENGTH);
+    TEST_CHECK_EQ(stats.frames_written, 0);
+
+    /* Dropped frames went straight back to the source; the queued ones and frame 0 are held */
+    TEST_CHECK_EQ(s_released, BURST - QUEUE_LENGTH);
+    for (uint32_t seq = 0; seq <= BURST; seq++) {
+        TEST_CHECK_EQ(s_release_count[seq], seq > QUEUE_LENGTH);
+    }
+
+    s_gate_closed = false;
+    xSemaphoreGive(s_gate);
+    TEST_CHECK(wait_for(written_at_least, 1 + QUEUE_LENGTH, &stats));
+    capture_pipeline_stop();
+
+    capture_pipeline_get_stats(&stats);
+    TEST_CHECK_EQ(check_accounting(&stats), 1 + QUEUE_LENGTH);
+    for (uint32_t i = 0; i < s_stored_count; i++) {
+        TEST_CHECK_EQ(s_stored[i], i);
+    }
+    TEST_CHECK_EQ(stats.queue_high_water, QUEUE_LENGTH);
+    TEST_CHECK_EQ(stats.queue_depth, 0);
+}
+
+/**
+ * @brief Continuous capture about ten times faster than the writer
+ */
+static void check_continuous_overload(void)
+{
+    enum { QUEUE_LENGTH = 3 };
+    reset_counts();
+    s_acquire_delay_us = 200;
+    s_sink_delay_us = 2000;
+    s_gate_closed = false;
+
+    capture_pipeline_config_t config = make_config(QUEUE_LENGTH, true);
+    TEST_CHECK_EQ(capture_pipeline_start(&config), ESP_OK);
+    capture_pipeline_stats_t stats;
+    TEST_CHECK(wait_for(written_at_least, 20, &stats));
+    capture_pipeline_stop();
+
+    capture_pipeline_get_stats(&stats);
+    uint32_t stored = check_accounting(&stats);
+    TEST_CHECK(stored >= 20);
+    TEST_CHECK(stats.frames_dropped > stats.frames_captured / 2);
+    TEST_CHECK_EQ(stats.queue_high_water, QUEUE_LENGTH);
+    TEST_CHECK_EQ(stats.capture_errors, 0);
+    TEST_CHECK_EQ(stats.write_errors, 0);
+
+    /* The first frame always finds an empty queue */
+    TEST_CHECK(stored > 0 && s_stored[0] == 0);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    s_sink_entered = xSemaphoreCreateBinary();
+    s_gate = xSemaphoreCreateBinary();
+
+    capture_pipeline_config_t config = make_config(0, false);
+    TEST_CHECK_EQ(capture_pipeline_start(&config), ESP_ERR_INVALID_ARG);
+
+    check_held_sink();
+    check_continuous_overload();
+
+    vSemaphoreDelete(s_gate);
+    vSemaphoreDelete(s_sink_entered);
+    return TEST_RESULT();
+}
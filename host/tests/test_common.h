@@ -0,0 +1,80 @@
+/**
+ * @file test_common.h
+ * @brief Checks and helpers shared by the host tests
+ *
+ * Each test is a plain executable run by CTest. A failed check prints its
+ * location and the test goes on, so one run reports every failure; the
+ * exit status is non-zero if any check failed.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int s_test_checks = 0;
+static int s_test_failures = 0;
+
+/** Check a condition, printing it on failure */
+#define TEST_CHECK(cond) do {                                                       \
+    s_test_checks++;                                                                \
+    if (!(cond)) {                                                                  \
+        s_test_failures++;                                                          \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);    \
+    }                                                                               \
+} while (0)
+
+/** Check that two integers are equal, printing both on failure */
+#define TEST_CHECK_EQ(actual, expected) do {                                        \
+    long long _a = (long long)(actual), _e = (long long)(expected);                 \
+    s_test_checks++;                                                                \
+    if (_a != _e) {                                                                 \
+        s_test_failures++;                                                          \
+        fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__,   \
+                #actual, _a, _e);                                                   \
+    }                                                                               \
+} while (0)
+
+/** Print the summary; the value to return from main() */
+#define TEST_RESULT() (printf("%d checks, %d failed\n", s_test_checks, s_test_failures), \
+                       s_test_failures ? 1 : 0)
+
+/**
+ * @brief Deterministic pseudo-random numbers (xorshift32), same on every host
+ */
+static inline uint32_t test_rand(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/**
+ * @brief Read a whole file
+ * @return Buffer to free, NULL on error
+ */
+static inline uint8_t *test_read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = size > 0 ? malloc((size_t)size) : NULL;
+    if (buf == NULL || fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = (size_t)size;
+    return buf;
+}
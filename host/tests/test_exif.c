@@ -0,0 +1,282 @@
+/**
+ * @file test_exif.c
+ * @brief EXIF segments from exif_frame_build(), parsed back tag by tag
+ *
+ * Each frame is stored as the concatenation of the parts and read like an
+ * EXIF reader would: SOI, the JFIF APP0 if it stays in front, the APP1
+ * segment with its TIFF header, IFD0 and the Exif IFD it points to, then
+ * the untouched rest of the frame.
+ */
+
+#define _GNU_SOURCE     /* timegm() */
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "exif.h"
+#include "test_common.h"
+
+#define MAX_ENTRIES     16
+
+typedef struct {
+    uint16_t tag;
+    uint16_t type;
+    uint32_t count;
+    const uint8_t *value;       /* Inline or at the offset, checked to lie inside the TIFF data */
+} ifd_entry_t;
+
+typedef struct {
+    ifd_entry_t entries[MAX_ENTRIES];
+    int count;
+} ifd_t;
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static uint16_t get16_be(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/**
+ * @brief Parse the IFD at @p offset of the TIFF data; tags ascend and values stay inside
+ */
+static void parse_ifd(const uint8_t *tiff, size_t size, uint32_t offset, ifd_t *ifd)
+{
+    ifd->count = 0;
+    TEST_CHECK_EQ(offset % 2, 0);
+    TEST_CHECK(offset + 2 <= size);
+    if (offset + 2 > size) {
+        return;
+    }
+    int count = get16(tiff + offset);
+    TEST_CHECK(count <= MAX_ENTRIES);
+    TEST_CHECK(offset + 2 + 12 * (size_t)count + 4 <= size);
+    if (count > MAX_ENTRIES || offset + 2 + 12 * (size_t)count + 4 > size) {
+        return;
+    }
+    TEST_CHECK_EQ(get32(tiff + offset + 2 + 12 * count), 0);
+
+    for (int i = 0; i < count; i++) {
+        const uint8_t *raw = tiff + offset + 2 + 12 * i;
+        ifd_entry_t *e = &ifd->entries[i];
+        e->tag = get16(raw);
+        e->type = get16(raw + 2);
+        e->count = get32(raw + 4);
+        e->value = raw + 8;
+        if (i > 0) {
+            TEST_CHECK(e->tag > ifd->entries[i - 1].tag);
+        }
+        /* ASCII and UNDEFINED are bytes, LONG is 4 */
+        size_t len = e->count * (e->type == 4 ? 4 : 1);
+        if (len > 4) {
+            uint32_t at = get32(raw + 8);
+            TEST_CHECK_EQ(at % 2, 0);
+            TEST_CHECK(at >= 8 && at + len <= size);
+            e->value = at + len <= size ? tiff + at : NULL;
+        }
+        if (e->type == 2 && e->value != NULL) {
+            TEST_CHECK_EQ(e->value[e->count - 1], 0);
+        }
+    }
+    ifd->count = count;
+}
+
+static const ifd_entry_t *find(const ifd_t *ifd, uint16_t tag)
+{
+    for (int i = 0; i < ifd->count; i++) {
+        if (ifd->entries[i].tag == tag) {
+            return &ifd->entries[i];
+        }
+    }
+    return NULL;
+}
+
+static const char *ascii(const ifd_t *ifd, uint16_t tag)
+{
+    const ifd_entry_t *e = find(ifd, tag);
+    TEST_CHECK(e != NULL);
+    if (e == NULL || e->value == NULL) {
+        return "";
+    }
+    TEST_CHECK_EQ(e->type, 2);
+    return (const char *)e->value;
+}
+
+static uint32_t long_value(const ifd_t *ifd, uint16_t tag)
+{
+    const ifd_entry_t *e = find(ifd, tag);
+    TEST_CHECK(e != NULL);
+    if (e == NULL) {
+        return 0;
+    }
+    TEST_CHECK_EQ(e->type, 4);
+    TEST_CHECK_EQ(e->count, 1);
+    return get32(e->value);
+}
+
+/**
+ * @brief Seconds since the epoch of an EXIF date "YYYY:MM:DD HH:MM:SS" in UTC, -1 if malformed
+ */
+static long long parse_date(const char *text)
+{
+    struct tm tm = { 0 };
+    if (strlen(text) != 19 || strptime(text, "%Y:%m:%d %H:%M:%S", &tm) == NULL) {
+        return -1;
+    }
+    return (long long)timegm(&tm);
+}
+
+/**
+ * @brief Build the EXIF frame and check it; APP1 is expected @p insert bytes into the file
+ */
+static void check_frame(const capture_frame_t *frame, const char *device_id, const char *description,
+                        size_t insert)
+{
+    exif_frame_t out;
+    TEST_CHECK_EQ(exif_frame_build(frame, device_id, &out), ESP_OK);
+    TEST_CHECK(out.part_count == 1 || out.part_count == 2);
+    TEST_CHECK_EQ(out.parts[0].data, out.head);
+    TEST_CHECK(out.parts[0].size <= EXIF_HEAD_MAX_SIZE);
+
+    /* Frame data in place starts 4-byte aligned, and so at every sector boundary of the file */
+    if (out.part_count == 2) {
+        TEST_CHECK_EQ((uintptr_t)out.parts[1].data % 4, 0);
+        TEST_CHECK_EQ(out.parts[0].size % 4, 0);
+        TEST_CHECK(out.parts[1].data + out.parts[1].size == frame->buf + frame->len);
+    }
+
+    uint8_t *file = malloc(out.size);
+    size_t size = 0;
+    for (size_t i = 0; i < out.part_count; i++) {
+        memcpy(file + size, out.parts[i].data, out.parts[i].size);
+        size += out.parts[i].size;
+    }
+    TEST_CHECK_EQ(size, out.size);
+
+    /* SOI and APP0 as in the frame, then APP1, then the rest of the frame */
+    TEST_CHECK(memcmp(file, frame->buf, insert) == 0);
+    const uint8_t *app1 = file + insert;
+    TEST_CHECK_EQ(app1[0], 0xFF);
+    TEST_CHECK_EQ(app1[1], 0xE1);
+    size_t app1_size = 2 + get16_be(app1 + 2);
+    TEST_CHECK_EQ(out.size, frame->len + app1_size);
+    TEST_CHECK(memcmp(file + insert + app1_size, frame->buf + insert, frame->len - insert) == 0);
+    TEST_CHECK(memcmp(app1 + 4, "Exif\0\0", 6) == 0);
+
+    /* TIFF header: little endian, IFD0 right after it */
+    const uint8_t *tiff = app1 + 10;
+    size_t tiff_size = app1_size - 10;
+    TEST_CHECK(memcmp(tiff, "II*\0", 4) == 0);
+    TEST_CHECK_EQ(get32(tiff + 4), 8);
+
+    ifd_t ifd0, exif_ifd;
+    parse_ifd(tiff, tiff_size, get32(tiff + 4), &ifd0);
+    TEST_CHECK_EQ(ifd0.count, 3);
+    TEST_CHECK(strcmp(ascii(&ifd0, 0x010E), description) == 0);
+    const char *date_time = ascii(&ifd0, 0x0132);
+    parse_ifd(tiff, tiff_size, long_value(&ifd0, 0x8769), &exif_ifd);
+    bool has_serial = device_id != NULL && device_id[0] != '\0';
+    TEST_CHECK_EQ(exif_ifd.count, has_serial ? 7 : 6);
+
+    const ifd_entry_t *version = find(&exif_ifd, 0x9000);
+    TEST_CHECK(version != NULL && version->type == 7 && version->count == 4 &&
+               memcmp(version->value, "0232", 4) == 0);
+    TEST_CHECK_EQ(long_value(&exif_ifd, 0xA002), frame->width);
+    TEST_CHECK_EQ(long_value(&exif_ifd, 0xA003), frame->height);
+    TEST_CHECK(strcmp(ascii(&exif_ifd, 0x9011), "+00:00") == 0);
+
+    /* Capture time: the clock now, less the frame's age, within the drift between the two clocks */
+    TEST_CHECK(strcmp(ascii(&exif_ifd, 0x9003), date_time) == 0);
+    const char *subsec = ascii(&exif_ifd, 0x9291);
+    TEST_CHECK_EQ(strlen(subsec), 6);
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    double captured = (double)parse_date(date_time) + atoi(subsec) / 1e6;
+    double expected = now.tv_sec + now.tv_usec / 1e6 - (esp_timer_get_time() - frame->timestamp_us) / 1e6;
+    TEST_CHECK(captured > expected - 0.01 && captured < expected + 0.01);
+
+    if (has_serial) {
+        const char *serial = ascii(&exif_ifd, 0xA431);
+        TEST_CHECK_EQ(strlen(serial), strlen(device_id) < EXIF_DEVICE_ID_MAX ? strlen(device_id) : EXIF_DEVICE_ID_MAX);
+        TEST_CHECK(strncmp(serial, device_id, EXIF_DEVICE_ID_MAX) == 0);
+    } else {
+        TEST_CHECK(find(&exif_ifd, 0xA431) == NULL);
+    }
+    free(file);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_ERROR);
+
+    size_t jpeg_len = 0;
+    uint8_t *jpeg = test_read_file(TEST_FIXTURE_DIR "/jpeg_dc_420.jpg", &jpeg_len);
+    TEST_CHECK(jpeg != NULL);
+    if (jpeg == NULL) {
+        return TEST_RESULT();
+    }
+    /* Pillow writes a 16-byte JFIF APP0 */
+    TEST_CHECK_EQ(jpeg[3], 0xE0);
+    size_t app0_end = 4 + get16_be(jpeg + 4);
+    TEST_CHECK_EQ(app0_end, 20);
+
+    /* The frame at every alignment of its buffer */
+    uint8_t *buf = malloc(jpeg_len + 4);
+    for (int shift = 0; shift < 4; shift++) {
+        memcpy(buf + shift, jpeg, jpeg_len);
+        capture_frame_t frame = {
+            .buf = buf + shift,
+            .len = jpeg_len,
+            .width = 64,
+            .height = 48,
+            .seq = 1234,
+            .timestamp_us = esp_timer_get_time() - 1500000,
+        };
+        check_frame(&frame, "cam-0042", "frame 1234", app0_end);
+
+        frame.trigger = (capture_trigger_t){ .id = 7, .source = 13 };
+        check_frame(&frame, NULL, "frame 1234, trigger 7 on GPIO 13", app0_end);
+
+        frame.trigger.source = CAPTURE_TRIGGER_SOURCE_SCHEDULE;
+        check_frame(&frame, "a-device-id-much-longer-than-thirty-two-characters",
+                    "frame 1234, schedule trigger 7", app0_end);
+
+        frame.trigger.source = CAPTURE_TRIGGER_SOURCE_SOFTWARE;
+        check_frame(&frame, "", "frame 1234, software trigger 7", app0_end);
+    }
+
+    /* Without APP0, and with one too large to stay in front, APP1 follows SOI */
+    static const uint8_t bare[] = { 0xFF, 0xD8, 0xFF, 0xDB, 0x00, 0x02, 0xFF, 0xD9 };
+    capture_frame_t frame = { .buf = bare, .len = sizeof(bare), .width = 1, .height = 1,
+                              .timestamp_us = esp_timer_get_time() };
+    check_frame(&frame, "x", "frame 0", 2);
+
+    uint8_t big_app0[2 + 2 + 100 + 2] = { 0xFF, 0xD8, 0xFF, 0xE0, 0x00, 100, 'J', 'F', 'I', 'F', 0 };
+    big_app0[sizeof(big_app0) - 2] = 0xFF;
+    big_app0[sizeof(big_app0) - 1] = 0xD9;
+    frame.buf = big_app0;
+    frame.len = sizeof(big_app0);
+    check_frame(&frame, "x", "frame 0", 2);
+
+    /* Not a JPEG */
+    frame.buf = jpeg + 2;
+    TEST_CHECK_EQ(exif_frame_build(&frame, "x", &(exif_frame_t){ 0 }), ESP_ERR_INVALID_ARG);
+    frame.buf = jpeg;
+    frame.len = 3;
+    TEST_CHECK_EQ(exif_frame_build(&frame, "x", &(exif_frame_t){ 0 }), ESP_ERR_INVALID_ARG);
+
+    free(buf);
+    free(jpeg);
+    return TEST_RESULT();
+}
@@ -0,0 +1,273 @@
+/**
+ * @file test_frame_dedup.c
+ * @brief Hashes, duplicate decisions and keep interval thinning on fixture frames
+ *
+ * The dedup_*.jpg fixtures are one scene as the camera sees it from frame
+ * to frame (recoded, fresh sensor noise, brighter) and frames that differ
+ * from it (an object in the scene, another scene); fixtures/make_fixtures.py
+ * regenerates them.
+ */
+
+#include <esp_log.h>
+#include <string.h>
+
+#include "frame_dedup.h"
+#include "test_common.h"
+
+enum {
+    SCENE,
+    SCENE_Q30,
+    SCENE_NOISE,
+    SCENE_BRIGHT,
+    OBJECT,
+    OTHER,
+    PROGRESSIVE,
+    FIXTURE_COUNT,
+};
+
+static const char *s_names[FIXTURE_COUNT] = {
+    "dedup_scene.jpg",
+    "dedup_scene_q30.jpg",
+    "dedup_scene_noise.jpg",
+    "dedup_scene_bright.jpg",
+    "dedup_object.jpg",
+    "dedup_other.jpg",
+    "jpeg_dc_progressive.jpg",
+};
+
+static uint8_t *s_jpeg[FIXTURE_COUNT];
+static size_t s_len[FIXTURE_COUNT];
+static uint64_t s_hash[FIXTURE_COUNT];
+
+static capture_frame_t fixture_frame(int fixture, uint32_t seq, int64_t timestamp_us)
+{
+    capture_frame_t frame = {
+        .buf = s_jpeg[fixture],
+        .len = s_len[fixture],
+        .seq = seq,
+        .timestamp_us = timestamp_us,
+    };
+    return frame;
+}
+
+/**
+ * @brief Difference hash bits on images built to set known bits
+ */
+static void check_hash_gray(void)
+{
+    /* 72x16: 9 columns of 8 pixels, 8 rows of 2 */
+    enum { W = 72, H = 16, STRIDE = 80 };
+    static uint8_t gray[H * STRIDE];
+
+    memset(gray, 100, sizeof(gray));
+    TEST_CHECK_EQ(frame_dedup_hash_gray(gray, W, H, STRIDE), 0);
+
+    /* Brightness falling to the right sets every bit, rising clears them */
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            gray[y * STRIDE + x] = (uint8_t)(200 - 2 * x);
+        }
+    }
+    TEST_CHECK_EQ(frame_dedup_hash_gray(gray, W, H, STRIDE), UINT64_MAX);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            gray[y * STRIDE + x] = (uint8_t)(50 + 2 * x);
+        }
+    }
+    TEST_CHECK_EQ(frame_dedup_hash_gray(gray, W, H, STRIDE), 0);
+
+    /* One bright cell (x, y) is brighter than its right neighbour: bit 8 * y + x; the padding is ignored */
+    memset(gray, 100, sizeof(gray));
+    for (int y = 0; y < H; y++) {
+        memset(gray + y * STRIDE + W, 255, STRIDE - W);
+    }
+    for (int y = 6; y < 8; y++) {
+        memset(gray + y * STRIDE + 5 * 8, 101, 8);
+    }
+    TEST_CHECK_EQ(frame_dedup_hash_gray(gray, W, H, STRIDE), 1ull << (3 * 8 + 5));
+
+    /* A uniform exposure change keeps the order of the cells */
+    uint32_t state = 0x12345678;
+    for (int i = 0; i < H * STRIDE; i++) {
+        gray[i] = (uint8_t)(test_rand(&state) % 200);
+    }
+    uint64_t hash = frame_dedup_hash_gray(gray, W, H, STRIDE);
+    for (int i = 0; i < H * STRIDE; i++) {
+        gray[i] += 40;
+    }
+    TEST_CHECK_EQ(frame_dedup_hash_gray(gray, W, H, STRIDE), hash);
+}
+
+/**
+ * @brief Fixture hashes: the scene's variants are duplicates, the changed frames are far off
+ */
+static void check_fixture_hashes(frame_dedup_handle_t dedup, uint8_t max_distance)
+{
+    for (int i = 0; i < FIXTURE_COUNT; i++) {
+        capture_frame_t frame = fixture_frame(i, 0, 0);
+        esp_err_t ret = frame_dedup_hash_jpeg(dedup, &frame, &s_hash[i]);
+        TEST_CHECK_EQ(ret, i == PROGRESSIVE ? ESP_ERR_NOT_SUPPORTED : ESP_OK);
+    }
+
+    for (int i = SCENE_Q30; i <= SCENE_BRIGHT; i++) {
+        TEST_CHECK(frame_dedup_distance(s_hash[SCENE], s_hash[i]) <= max_distance);
+    }
+    for (int i = SCENE; i <= SCENE_BRIGHT; i++) {
+        TEST_CHECK(frame_dedup_distance(s_hash[OBJECT], s_hash[i]) >= 3 * max_distance);
+        TEST_CHECK(frame_dedup_distance(s_hash[OTHER], s_hash[i]) >= 3 * max_distance);
+    }
+    TEST_CHECK(frame_dedup_distance(s_hash[OBJECT], s_hash[OTHER]) >= 3 * max_distance);
+    TEST_CHECK_EQ(frame_dedup_distance(s_hash[OBJECT], s_hash[OBJECT]), 0);
+
+    /* Hashing again gives the same hash */
+    capture_frame_t frame = fixture_frame(SCENE, 0, 0);
+    uint64_t again = 0;
+    TEST_CHECK_EQ(frame_dedup_hash_jpeg(dedup, &frame, &again), ESP_OK);
+    TEST_CHECK_EQ(again, s_hash[SCENE]);
+}
+
+/**
+ * @brief Keep or skip decisions of the pipeline filter on a sequence of fixture frames
+ */
+static void check_decisions(uint8_t history)
+{
+    frame_dedup_config_t config = FRAME_DEDUP_DEFAULT_CONFIG();
+    config.history = history;
+    config.keep_interval_ms = 0;
+    frame_dedup_handle_t dedup = NULL;
+    TEST_CHECK_EQ(frame_dedup_create(&config, &dedup), ESP_OK);
+    if (dedup == NULL) {
+        return;
+    }
+
+    /* With one stored hash, the scene after the object is new again, and so is the object after it */
+    static const struct {
+        int fixture;
+        bool keep;
+        bool keep_history_1;
+    } sequence[] = {
+        { SCENE,        true,  true },
+        { SCENE_Q30,    false, false },
+        { SCENE_NOISE,  false, false },
+        { OBJECT,       true,  true },
+        { SCENE_BRIGHT, false, true },
+        { OBJECT,       false, true },
+        { PROGRESSIVE,  true,  true },
+        { OTHER,        true,  true },
+        { OTHER,        false, false },
+    };
+    uint32_t kept = 0, skipped = 0, errors = 0;
+    uint64_t saved = 0;
+    for (size_t i = 0; i < sizeof(sequence) / sizeof(sequence[0]); i++) {
+        capture_frame_t frame = fixture_frame(sequence[i].fixture, (uint32_t)i, (int64_t)i * 100000);
+        bool want = history == 1 ? sequence[i].keep_history_1 : sequence[i].keep;
+        TEST_CHECK_EQ(frame_dedup_filter(dedup, &frame), want);
+        if (sequence[i].fixture == PROGRESSIVE) {
+            errors++;
+        } else if (want) {
+            kept++;
+        } else {
+            skipped++;
+            saved += frame.len;
+        }
+    }
+
+    frame_dedup_stats_t stats;
+    frame_dedup_get_stats(dedup, &stats);
+    TEST_CHECK_EQ(stats.frames, kept + skipped);
+    TEST_CHECK_EQ(stats.kept, kept);
+    TEST_CHECK_EQ(stats.skipped, skipped);
+    TEST_CHECK_EQ(stats.errors, errors);
+    TEST_CHECK_EQ(stats.thinned, 0);
+    TEST_CHECK_EQ(stats.bytes_saved, saved);
+
+    /* After a reset nothing is a duplicate */
+    frame_dedup_reset(dedup);
+    frame_dedup_result_t result;
+    frame_dedup_check(dedup, s_hash[OTHER], 1000000, &result);
+    TEST_CHECK_EQ(result.distance, 64);
+    TEST_CHECK(!result.duplicate);
+    TEST_CHECK(result.keep);
+    frame_dedup_delete(dedup);
+}
+
+/**
+ * @brief A static scene at 10 fps is thinned to one frame per keep interval
+ */
+static void check_thinning(void)
+{
+    frame_dedup_config_t config = FRAME_DEDUP_DEFAULT_CONFIG();
+    config.keep_interval_ms = 1000;
+    frame_dedup_handle_t dedup = NULL;
+    TEST_CHECK_EQ(frame_dedup_create(&config, &dedup), ESP_OK);
+    if (dedup == NULL) {
+        return;
+    }
+
+    /* Scene variants for 3 s, then the object at 3.05 s and 3.15 s */
+    static const int variants[] = { SCENE, SCENE_Q30, SCENE_NOISE, SCENE_BRIGHT };
+    frame_dedup_result_t result;
+    uint32_t kept = 0;
+    for (int i = 0; i <= 30; i++) {
+        int64_t t = (int64_t)i * 100000;
+        frame_dedup_check(dedup, s_hash[variants[i % 4]], t, &result);
+        TEST_CHECK_EQ(result.duplicate, i != 0);
+        TEST_CHECK_EQ(result.keep, i % 10 == 0);
+        kept += result.keep;
+    }
+    TEST_CHECK_EQ(kept, 4);
+
+    /* A new frame is kept at once and restarts the interval */
+    frame_dedup_check(dedup, s_hash[OBJECT], 3050000, &result);
+    TEST_CHECK(result.keep && !result.duplicate);
+    frame_dedup_check(dedup, s_hash[OBJECT], 3150000, &result);
+    TEST_CHECK(!result.keep && result.duplicate);
+    TEST_CHECK_EQ(result.distance, 0);
+    frame_dedup_check(dedup, s_hash[SCENE], 3999999, &result);
+    TEST_CHECK(!result.keep);
+    frame_dedup_check(dedup, s_hash[SCENE], 4050000, &result);
+    TEST_CHECK(result.keep && result.duplicate);
+
+    frame_dedup_stats_t stats;
+    frame_dedup_get_stats(dedup, &stats);
+    TEST_CHECK_EQ(stats.frames, 35);
+    TEST_CHECK_EQ(stats.kept, 6);
+    TEST_CHECK_EQ(stats.thinned, 4);
+    TEST_CHECK_EQ(stats.skipped, 29);
+    frame_dedup_delete(dedup);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    bool loaded = true;
+    for (int i = 0; i < FIXTURE_COUNT; i++) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", TEST_FIXTURE_DIR, s_names[i]);
+        s_jpeg[i] = test_read_file(path, &s_len[i]);
+        loaded = loaded && s_jpeg[i] != NULL;
+    }
+    TEST_CHECK(loaded);
+
+    frame_dedup_config_t config = FRAME_DEDUP_DEFAULT_CONFIG();
+    frame_dedup_handle_t dedup = NULL;
+    TEST_CHECK_EQ(frame_dedup_create(&config, &dedup), ESP_OK);
+    config.history = 0;
+    TEST_CHECK_EQ(frame_dedup_create(&config, &(frame_dedup_handle_t){ NULL }), ESP_ERR_INVALID_ARG);
+    config.history = FRAME_DEDUP_MAX_HISTORY + 1;
+    TEST_CHECK_EQ(frame_dedup_create(&config, &(frame_dedup_handle_t){ NULL }), ESP_ERR_INVALID_ARG);
+
+    check_hash_gray();
+    if (loaded && dedup != NULL) {
+        check_fixture_hashes(dedup, CONFIG_APP_DEDUP_MAX_DISTANCE);
+        check_decisions(CONFIG_APP_DEDUP_HISTORY);
+        check_decisions(1);
+        check_thinning();
+    }
+    frame_dedup_delete(dedup);
+    for (int i = 0; i < FIXTURE_COUNT; i++) {
+        free(s_jpeg[i]);
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,227 @@
+/**
+ * @file test_frame_pool.c
+ * @brief Frame pool size classes, statistics, exhaustion and the fallback to ring arenas
+ */
+
+#include <esp_log.h>
+#include <string.h>
+
+#include "frame_pool.h"
+#include "frame_ring.h"
+#include "test_common.h"
+
+#define ARENA_SIZE      (1024 * 1024)
+#define TYPICAL_SIZE    40000
+#define MAX_SIZE        200000
+#define MAX_BLOCKS      256
+
+/* Typical size times 3/4, 1, 5/4, 3/2 and 2, rounded up to 64 bytes, then the largest frame */
+static const size_t s_class_sizes[] = { 30016, 40000, 50048, 60032, 80000, 200000 };
+#define CLASS_COUNT     (sizeof(s_class_sizes) / sizeof(s_class_sizes[0]))
+
+static frame_pool_handle_t create_pool(void)
+{
+    frame_pool_config_t config = FRAME_POOL_DEFAULT_CONFIG(TYPICAL_SIZE, MAX_SIZE);
+    config.arena_size = ARENA_SIZE;
+    frame_pool_handle_t pool = NULL;
+    TEST_CHECK_EQ(frame_pool_create(&config, &pool), ESP_OK);
+    return pool;
+}
+
+/**
+ * @brief Class layout: the sizes above, most blocks around the typical size, the arena filled
+ */
+static void check_layout(frame_pool_handle_t pool, frame_pool_stats_t *stats)
+{
+    frame_pool_get_stats(pool, stats);
+    TEST_CHECK_EQ(stats->arena_size, ARENA_SIZE);
+    TEST_CHECK_EQ(stats->classes, CLASS_COUNT);
+    TEST_CHECK_EQ(frame_pool_max_size(pool), MAX_SIZE);
+
+    size_t used = 0;
+    for (size_t i = 0; i < CLASS_COUNT; i++) {
+        TEST_CHECK_EQ(stats->class_stats[i].block_size, s_class_sizes[i]);
+        TEST_CHECK(stats->class_stats[i].blocks > 0);
+        used += stats->class_stats[i].block_size * stats->class_stats[i].blocks;
+    }
+    TEST_CHECK(used <= ARENA_SIZE);
+    TEST_CHECK(ARENA_SIZE - used < s_class_sizes[1]);
+    TEST_CHECK(stats->class_stats[1].blocks >= stats->class_stats[0].blocks);
+    TEST_CHECK(stats->class_stats[1].blocks > stats->class_stats[CLASS_COUNT - 1].blocks);
+}
+
+/**
+ * @brief Each size lands in the smallest class that fits, on a cache line boundary
+ */
+static void check_size_classes(frame_pool_handle_t pool)
+{
+    frame_pool_stats_t stats;
+    for (size_t i = 0; i < CLASS_COUNT; i++) {
+        size_t sizes[] = { i == 0 ? 1 : s_class_sizes[i - 1] + 1, s_class_sizes[i] };
+        for (size_t k = 0; k < 2; k++) {
+            uint8_t *block = frame_pool_alloc(pool, sizes[k]);
+            TEST_CHECK(block != NULL);
+            TEST_CHECK_EQ((uintptr_t)block % 64, 0);
+            frame_pool_get_stats(pool, &stats);
+            TEST_CHECK_EQ(stats.class_stats[i].in_use, 1);
+            TEST_CHECK_EQ(stats.bytes_in_use, s_class_sizes[i]);
+            TEST_CHECK_EQ(stats.requested, sizes[k]);
+            TEST_CHECK_EQ(stats.waste, s_class_sizes[i] - sizes[k]);
+            memset(block, 0xA5, sizes[k]);
+            frame_pool_free(pool, block);
+
+            /* The block just freed is the next one taken */
+            uint8_t *again = frame_pool_alloc(pool, sizes[k]);
+            TEST_CHECK(again == block);
+            frame_pool_free(pool, again);
+        }
+    }
+
+    frame_pool_get_stats(pool, &stats);
+    TEST_CHECK_EQ(stats.allocs, 4 * CLASS_COUNT);
+    TEST_CHECK_EQ(stats.frees, 4 * CLASS_COUNT);
+    TEST_CHECK_EQ(stats.bytes_in_use, 0);
+    TEST_CHECK_EQ(stats.requested, 0);
+    TEST_CHECK_EQ(stats.waste, 0);
+    TEST_CHECK_EQ(stats.bytes_high_water, MAX_SIZE);
+    TEST_CHECK_EQ(stats.waste_high_water, MAX_SIZE - s_class_sizes[CLASS_COUNT - 2] - 1);
+    for (size_t i = 0; i < CLASS_COUNT; i++) {
+        TEST_CHECK_EQ(stats.class_stats[i].high_water, 1);
+        TEST_CHECK_EQ(stats.class_stats[i].fallbacks, 0);
+    }
+}
+
+/**
+ * @brief Small frames spill into larger classes until every block is taken
+ */
+static void check_exhaustion(frame_pool_handle_t pool, const frame_pool_stats_t *layout)
+{
+    uint8_t *blocks[MAX_BLOCKS];
+    uint32_t total = 0;
+    for (size_t i = 0; i < CLASS_COUNT; i++) {
+        total += layout->class_stats[i].blocks;
+    }
+    TEST_CHECK(total <= MAX_BLOCKS);
+
+    uint32_t n = 0;
+    while (n < MAX_BLOCKS && (blocks[n] = frame_pool_alloc(pool, 1000)) != NULL) {
+        n++;
+    }
+    TEST_CHECK_EQ(n, total);
+    TEST_CHECK(!frame_pool_can_alloc(pool, 1));
+
+    /* Blocks are distinct, inside the arena and do not overlap */
+    int overlaps = 0;
+    for (uint32_t a = 0; a < n; a++) {
+        for (uint32_t b = a + 1; b < n; b++) {
+            overlaps += llabs((long long)(blocks[a] - blocks[b])) < (long long)s_class_sizes[0];
+        }
+        memset(blocks[a], (int)a, 1000);
+    }
+    TEST_CHECK_EQ(overlaps, 0);
+
+    frame_pool_stats_t stats;
+    frame_pool_get_stats(pool, &stats);
+    TEST_CHECK_EQ(stats.failed, 1);
+    TEST_CHECK_EQ(stats.bytes_in_use, (size_t)(stats.bytes_high_water));
+    TEST_CHECK_EQ(stats.requested, (size_t)n * 1000);
+    for (size_t i = 0; i < CLASS_COUNT; i++) {
+        TEST_CHECK_EQ(stats.class_stats[i].in_use, layout->class_stats[i].blocks);
+        TEST_CHECK_EQ(stats.class_stats[i].fallbacks, i == 0 ? 0 : layout->class_stats[i].blocks);
+    }
+
+    /* Larger than the largest class: refused as oversize, not as a full pool */
+    TEST_CHECK(frame_pool_alloc(pool, MAX_SIZE + 1) == NULL);
+    frame_pool_get_stats(pool, &stats);
+    TEST_CHECK_EQ(stats.oversize, 1);
+    TEST_CHECK_EQ(stats.failed, 1);
+
+    /* A freed block serves frames up to its own size */
+    frame_pool_free(pool, blocks[0]);
+    TEST_CHECK(frame_pool_can_alloc(pool, s_class_sizes[0]));
+    TEST_CHECK(!frame_pool_can_alloc(pool, s_class_sizes[0] + 1));
+    frame_pool_free(pool, blocks[n - 1]);
+    TEST_CHECK(frame_pool_can_alloc(pool, MAX_SIZE));
+    for (uint32_t i = 1; i < n - 1; i++) {
+        TEST_CHECK_EQ(blocks[i][999], (uint8_t)i);
+        frame_pool_free(pool, blocks[i]);
+    }
+
+    /* A pointer that is not a block is ignored */
+    uint8_t outside[64];
+    frame_pool_free(pool, outside);
+    frame_pool_get_stats(pool, &stats);
+    TEST_CHECK_EQ(stats.bytes_in_use, 0);
+    TEST_CHECK_EQ(stats.frees, stats.allocs);
+}
+
+/**
+ * @brief Without a pool, held frames go to each ring's own heap arena
+ */
+static void check_heap_fallback(void)
+{
+    frame_pool_config_t config = FRAME_POOL_DEFAULT_CONFIG(TYPICAL_SIZE, MAX_SIZE);
+    frame_pool_handle_t pool = NULL;
+
+    config.arena_size = MAX_SIZE - 64;
+    TEST_CHECK_EQ(frame_pool_create(&config, &pool), ESP_ERR_INVALID_ARG);
+    config.arena_size = ARENA_SIZE;
+    config.typical_size = MAX_SIZE + 1;
+    TEST_CHECK_EQ(frame_pool_create(&config, &pool), ESP_ERR_INVALID_ARG);
+
+    /* An arena the heap cannot hold */
+    config.typical_size = TYPICAL_SIZE;
+    config.arena_size = SIZE_MAX / 2;
+    TEST_CHECK_EQ(frame_pool_create(&config, &pool), ESP_ERR_NO_MEM);
+    TEST_CHECK(pool == NULL);
+
+    frame_ring_config_t ring_config = {
+        .arena_size = 3 * MAX_SIZE,
+        .max_frames = 8,
+        .caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+        .pool = pool,
+    };
+    frame_ring_handle_t ring = NULL;
+    TEST_CHECK_EQ(frame_ring_create(&ring_config, &ring), ESP_OK);
+    if (ring == NULL) {
+        return;
+    }
+
+    static uint8_t data[MAX_SIZE + 1];
+    memset(data, 0x3C, sizeof(data));
+    capture_frame_t frame = { .buf = data, .len = MAX_SIZE + 1, .seq = 1 };
+    TEST_CHECK_EQ(frame_ring_push(ring, &frame), ESP_OK);
+
+    capture_frame_t held;
+    TEST_CHECK(frame_ring_peek_oldest(ring, &held));
+    TEST_CHECK(held.buf != data);
+    TEST_CHECK_EQ(held.len, MAX_SIZE + 1);
+    TEST_CHECK(memcmp(held.buf, data, held.len) == 0);
+    frame_ring_delete(ring);
+
+    /* With the pool, a frame larger than its largest block is refused */
+    pool = create_pool();
+    ring_config.pool = pool;
+    TEST_CHECK_EQ(frame_ring_create(&ring_config, &ring), ESP_OK);
+    TEST_CHECK_EQ(frame_ring_push(ring, &frame), ESP_ERR_INVALID_SIZE);
+    frame.len = MAX_SIZE;
+    TEST_CHECK_EQ(frame_ring_push(ring, &frame), ESP_OK);
+    frame_ring_delete(ring);
+    frame_pool_delete(pool);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    frame_pool_handle_t pool = create_pool();
+    if (pool != NULL) {
+        frame_pool_stats_t layout;
+        check_layout(pool, &layout);
+        check_size_classes(pool);
+        check_exhaustion(pool, &layout);
+        frame_pool_delete(pool);
+    }
+    check_heap_fallback();
+    return TEST_RESULT();
+}
@@ -0,0 +1,492 @@
+/**
+ * @file test_jpeg_dc.c
+ * @brief DC level maps against libjpeg's 1/8 scale decode
+ *
+ * At scale 1/8 libjpeg reduces each 8x8 block to its dequantized DC
+ * coefficient, the same value jpeg_dc derives without the AC data, so the
+ * luminance maps have to match exactly, as do full resolution chroma maps.
+ * The fixtures cover grayscale, 4:4:4, 4:2:2, 4:2:0, sizes that are not
+ * whole MCUs and restart intervals; fixtures/make_fixtures.py makes them.
+ *
+ * Truncated and corrupted copies must fail cleanly, or decode without
+ * writing outside the map, and a corrupted restart interval must not
+ * affect the intervals after it.
+ */
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+#include "jpeg_dc.h"
+#include "test_common.h"
+
+#define MAP_GUARD       0x5A
+#define MAP_MARGIN      8       /* Extra columns and rows checked for stray writes */
+
+typedef struct {
+    const char *name;
+    bool restart;               /* Has restart markers */
+} fixture_t;
+
+static const fixture_t s_fixtures[] = {
+    { "jpeg_dc_gray.jpg", false },
+    { "jpeg_dc_444.jpg", false },
+    { "jpeg_dc_422.jpg", false },
+    { "jpeg_dc_420.jpg", false },
+    { "jpeg_dc_420_odd.jpg", false },
+    { "jpeg_dc_420_rst.jpg", true },
+    { "jpeg_dc_444_rst_rows.jpg", true },
+    { "jpeg_dc_gray_odd_rst.jpg", true },
+};
+
+static jpeg_dc_handle_t s_parser;
+
+typedef struct {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} ref_error_t;
+
+static void ref_error_exit(j_common_ptr cinfo)
+{
+    longjmp(((ref_error_t *)cinfo->err)->jump, 1);
+}
+
+/**
+ * @brief Decode at 1/8 scale with libjpeg
+ * @param color JCS_GRAYSCALE or JCS_YCbCr
+ * @return Interleaved pixels to free, NULL on error
+ */
+static uint8_t *ref_decode(const uint8_t *jpeg, size_t len, J_COLOR_SPACE color,
+                           unsigned *width, unsigned *height, unsigned *restart_interval)
+{
+    struct jpeg_decompress_struct cinfo;
+    ref_error_t err;
+    uint8_t *volatile pixels = NULL;
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = ref_error_exit;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(pixels);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *)jpeg, (unsigned long)len);
+    jpeg_read_header(&cinfo, TRUE);
+    *restart_interval = cinfo.restart_interval;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 8;
+    cinfo.out_color_space = color;
+    cinfo.do_fancy_upsampling = FALSE;
+    jpeg_start_decompress(&cinfo);
+
+    size_t row_size = (size_t)cinfo.output_width * cinfo.output_components;
+    pixels = malloc(row_size * cinfo.output_height);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = pixels + row_size * cinfo.output_scanline;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return pixels;
+}
+
+static uint8_t *load_fixture(const char *name, size_t *len)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", TEST_FIXTURE_DIR, name);
+    return test_read_file(path, len);
+}
+
+/**
+ * @brief Map buffer with guard bytes right of and below the map
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t stride;
+    size_t rows;
+} guarded_map_t;
+
+static void map_init(guarded_map_t *m, size_t width, size_t height)
+{
+    m->stride = width + MAP_MARGIN;
+    m->rows = height + MAP_MARGIN;
+    m->buf = malloc(m->stride * m->rows);
+    memset(m->buf, MAP_GUARD, m->stride * m->rows);
+}
+
+/**
+ * @return Guard bytes outside width x height that were overwritten
+ */
+static int map_stray_writes(const guarded_map_t *m, size_t width, size_t height)
+{
+    int stray = 0;
+    for (size_t y = 0; y < m->rows; y++) {
+        for (size_t x = 0; x < m->stride; x++) {
+            if ((x >= width || y >= height) && m->buf[y * m->stride + x] != MAP_GUARD) {
+                stray++;
+            }
+        }
+    }
+    return stray;
+}
+
+/**
+ * @brief Luminance blocks per chroma block, from the frame header
+ */
+static void sof_chroma_scale(const uint8_t *jpeg, size_t len, unsigned *h, unsigned *v)
+{
+    size_t p = 2;
+    while (p + 4 <= len && jpeg[p] == 0xFF) {
+        size_t seg_len = (size_t)(jpeg[p + 2] << 8 | jpeg[p + 3]);
+        if ((jpeg[p + 1] == 0xC0 || jpeg[p + 1] == 0xC1) && jpeg[p + 9] > 1 && p + 15 < len) {
+            uint8_t y = jpeg[p + 11], c = jpeg[p + 14];
+            *h = (y >> 4) / (c >> 4);
+            *v = (y & 0x0F) / (c & 0x0F);
+            return;
+        }
+        p += 2 + seg_len;
+    }
+}
+
+/**
+ * @brief Header info, the luminance map and the YCbCr maps of one fixture against libjpeg
+ */
+static void check_against_libjpeg(const fixture_t *f)
+{
+    size_t len;
+    uint8_t *jpeg = load_fixture(f->name, &len);
+    TEST_CHECK(jpeg != NULL);
+    if (jpeg == NULL) {
+        return;
+    }
+
+    unsigned ref_w, ref_h, ref_restart;
+    uint8_t *ref_y = ref_decode(jpeg, len, JCS_GRAYSCALE, &ref_w, &ref_h, &ref_restart);
+    TEST_CHECK(ref_y != NULL);
+    if (ref_y == NULL) {
+        free(jpeg);
+        return;
+    }
+
+    uint16_t width = 0, height = 0;
+    TEST_CHECK_EQ(jpeg_dc_get_size(jpeg, len, &width, &height), ESP_OK);
+
+    jpeg_dc_info_t info;
+    TEST_CHECK_EQ(jpeg_dc_get_info(s_parser, jpeg, len, &info), ESP_OK);
+    TEST_CHECK_EQ(info.width, width);
+    TEST_CHECK_EQ(info.height, height);
+    TEST_CHECK_EQ(info.map_width, ref_w);
+    TEST_CHECK_EQ(info.map_height, ref_h);
+    TEST_CHECK_EQ(info.restart_interval, ref_restart);
+    TEST_CHECK_EQ(info.restart_interval != 0, f->restart);
+
+    guarded_map_t y;
+    map_init(&y, ref_w, ref_h);
+    TEST_CHECK_EQ(jpeg_dc_luma(s_parser, jpeg, len, y.buf, y.stride, NULL), ESP_OK);
+    int mismatches = 0;
+    for (unsigned row = 0; row < ref_h; row++) {
+        for (unsigned col = 0; col < ref_w; col++) {
+            if (y.buf[row * y.stride + col] != ref_y[row * ref_w + col]) {
+                mismatches++;
+            }
+        }
+    }
+    if (mismatches) {
+        fprintf(stderr, "%s: %d of %u luminance levels differ from libjpeg\n", f->name, mismatches, ref_w * ref_h);
+    }
+    TEST_CHECK_EQ(mismatches, 0);
+    TEST_CHECK_EQ(map_stray_writes(&y, ref_w, ref_h), 0);
+
+    /*
+     * Y, Cb and Cr against a YCbCr decode; grayscale has neutral chroma.
+     * libjpeg scales subsampled chroma with a larger IDCT instead of
+     * upsampling it (a 2x2 IDCT for 4:2:0 at 1/8), so those levels are
+     * checked against the mean of the pixels one chroma block covers.
+     */
+    unsigned w, h, restart;
+    uint8_t *ref_ycc = ref_decode(jpeg, len, info.components == 1 ? JCS_GRAYSCALE : JCS_YCbCr, &w, &h, &restart);
+    unsigned group_h = 1, group_v = 1;
+    sof_chroma_scale(jpeg, len, &group_h, &group_v);
+    guarded_map_t maps[3];
+    for (int k = 0; k < 3; k++) {
+        map_init(&maps[k], ref_w, ref_h);
+    }
+    TEST_CHECK_EQ(jpeg_dc_ycbcr(s_parser, jpeg, len, maps[0].buf, maps[1].buf, maps[2].buf,
+                                maps[0].stride, NULL), ESP_OK);
+    unsigned pixel_size = info.components == 1 ? 1 : 3;
+    mismatches = 0;
+    for (unsigned row = 0; row < ref_h; row++) {
+        for (unsigned col = 0; col < ref_w; col++) {
+            if (maps[0].buf[row * maps[0].stride + col] != ref_ycc[(row * ref_w + col) * pixel_size]) {
+                mismatches++;
+            }
+            for (int k = 1; k < 3; k++) {
+                int level = maps[k].buf[row * maps[k].stride + col];
+                if (info.components == 1) {
+                    mismatches += level != 128;
+                    continue;
+                }
+                unsigned sum = 0, n = 0;
+                for (unsigned r = row / group_v * group_v; r < (row / group_v + 1) * group_v && r < ref_h; r++) {
+                    for (unsigned c = col / group_h * group_h; c < (col / group_h + 1) * group_h && c < ref_w; c++) {
+                        sum += ref_ycc[(r * ref_w + c) * 3 + k];
+                        n++;
+                    }
+                }
+                int mean = (int)((sum + n / 2) / n);
+                mismatches += abs(level - mean) > (group_h * group_v > 1 ? 1 : 0);
+            }
+        }
+    }
+    if (mismatches) {
+        fprintf(stderr, "%s: %d YCbCr levels differ from libjpeg\n", f->name, mismatches);
+    }
+    TEST_CHECK_EQ(mismatches, 0);
+    for (int k = 0; k < 3; k++) {
+        TEST_CHECK_EQ(map_stray_writes(&maps[k], ref_w, ref_h), 0);
+        free(maps[k].buf);
+    }
+
+    free(ref_ycc);
+    free(y.buf);
+    free(ref_y);
+    free(jpeg);
+}
+
+/**
+ * @brief Offset of the entropy-coded data (after the SOS segment)
+ */
+static size_t scan_data_offset(const uint8_t *jpeg, size_t len)
+{
+    size_t p = 2;
+    while (p + 4 <= len && jpeg[p] == 0xFF) {
+        size_t seg_len = (size_t)(jpeg[p + 2] << 8 | jpeg[p + 3]);
+        if (jpeg[p + 1] == 0xDA) {
+            return p + 2 + seg_len;
+        }
+        p += 2 + seg_len;
+    }
+    return 0;
+}
+
+/**
+ * @brief Every truncation before the EOI marker fails; the headers with ESP_FAIL, the data with ESP_ERR_INVALID_SIZE
+ */
+static void check_truncated(const fixture_t *f)
+{
+    size_t len;
+    uint8_t *jpeg = load_fixture(f->name, &len);
+    if (jpeg == NULL) {
+        TEST_CHECK(jpeg != NULL);
+        return;
+    }
+
+    jpeg_dc_info_t info;
+    TEST_CHECK_EQ(jpeg_dc_get_info(s_parser, jpeg, len, &info), ESP_OK);
+    size_t data = scan_data_offset(jpeg, len);
+    TEST_CHECK(data > 0 && data < len);
+
+    guarded_map_t map;
+    map_init(&map, info.map_width, info.map_height);
+
+    /* Without the EOI marker nothing is missing */
+    TEST_CHECK_EQ(jpeg_dc_luma(s_parser, jpeg, len - 2, map.buf, map.stride, NULL), ESP_OK);
+
+    int header_wrong = 0, data_wrong = 0, stray = 0;
+    for (size_t cut = 0; cut < len - 3; cut++) {
+        uint8_t *copy = malloc(cut ? cut : 1);
+        memcpy(copy, jpeg, cut);
+        esp_err_t ret = jpeg_dc_luma(s_parser, copy, cut, map.buf, map.stride, NULL);
+        if (cut < data ? ret != ESP_FAIL : ret != ESP_ERR_INVALID_SIZE) {
+            if (cut < data) {
+                header_wrong++;
+            } else {
+                data_wrong++;
+                fprintf(stderr, "%s cut at %zu of %zu: %s\n", f->name, cut, len, esp_err_to_name(ret));
+            }
+        }
+        stray += map_stray_writes(&map, info.map_width, info.map_height);
+        free(copy);
+    }
+    TEST_CHECK_EQ(header_wrong, 0);
+    TEST_CHECK_EQ(data_wrong, 0);
+    TEST_CHECK_EQ(stray, 0);
+
+    /* Removing a restart marker loses the rest of the scan */
+    if (f->restart) {
+        size_t rst = data;
+        while (rst + 1 < len && !(jpeg[rst] == 0xFF && jpeg[rst + 1] >= 0xD0 && jpeg[rst + 1] <= 0xD7)) {
+            rst++;
+        }
+        TEST_CHECK(rst + 1 < len);
+        TEST_CHECK_EQ(jpeg_dc_luma(s_parser, jpeg, rst, map.buf, map.stride, NULL), ESP_ERR_INVALID_SIZE);
+    }
+
+    free(map.buf);
+    free(jpeg);
+}
+
+/**
+ * @brief Random byte corruption anywhere in the file never writes outside the map
+ */
+static void check_corrupt(const fixture_t *f, uint32_t *seed)
+{
+    size_t len;
+    uint8_t *jpeg = load_fixture(f->name, &len);
+    if (jpeg == NULL) {
+        TEST_CHECK(jpeg != NULL);
+        return;
+    }
+
+    jpeg_dc_info_t info;
+    TEST_CHECK_EQ(jpeg_dc_get_info(s_parser, jpeg, len, &info), ESP_OK);
+    size_t data = scan_data_offset(jpeg, len);
+    uint8_t *copy = malloc(len);
+    int stray = 0, unexpected = 0;
+
+    for (int round = 0; round < 2000; round++) {
+        memcpy(copy, jpeg, len);
+        /* Mostly the entropy-coded data, sometimes the headers */
+        int flips = 1 + (int)(test_rand(seed) % 4);
+        for (int i = 0; i < flips; i++) {
+            size_t at = (round % 4 == 0) ? test_rand(seed) % len : data + test_rand(seed) % (len - data);
+            copy[at] ^= (uint8_t)(1 + test_rand(seed) % 255);
+        }
+
+        /* A corrupted header may change the geometry, so the map is sized for the worst case */
+        jpeg_dc_info_t corrupt_info;
+        if (jpeg_dc_get_info(s_parser, copy, len, &corrupt_info) != ESP_OK) {
+            corrupt_info = info;
+        } else if ((size_t)corrupt_info.map_width * corrupt_info.map_height > 1 << 20) {
+            continue;   /* Implausible size, not worth the allocation */
+        }
+        guarded_map_t maps[3];
+        for (int k = 0; k < 3; k++) {
+            map_init(&maps[k], corrupt_info.map_width, corrupt_info.map_height);
+        }
+        esp_err_t ret = jpeg_dc_ycbcr(s_parser, copy, len, maps[0].buf, maps[1].buf, maps[2].buf,
+                                      maps[0].stride, NULL);
+        if (ret != ESP_OK && ret != ESP_FAIL && ret != ESP_ERR_INVALID_SIZE && ret != ESP_ERR_NOT_SUPPORTED) {
+            unexpected++;
+        }
+        for (int k = 0; k < 3; k++) {
+            stray += map_stray_writes(&maps[k], corrupt_info.map_width, corrupt_info.map_height);
+            free(maps[k].buf);
+        }
+    }
+    TEST_CHECK_EQ(unexpected, 0);
+    TEST_CHECK_EQ(stray, 0);
+
+    free(copy);
+    free(jpeg);
+}
+
+/**
+ * @brief Damage in one restart interval does not reach the blocks after the next marker
+ *
+ * Uses the grayscale fixture, one block per MCU, so interval n covers map
+ * entries [n * interval, (n + 1) * interval) in raster order.
+ */
+static void check_restart_resync(uint32_t *seed)
+{
+    size_t len;
+    uint8_t *jpeg = load_fixture("jpeg_dc_gray_odd_rst.jpg", &len);
+    if (jpeg == NULL) {
+        TEST_CHECK(jpeg != NULL);
+        return;
+    }
+
+    jpeg_dc_info_t info;
+    TEST_CHECK_EQ(jpeg_dc_get_info(s_parser, jpeg, len, &info), ESP_OK);
+    TEST_CHECK(info.restart_interval > 0);
+    size_t blocks = (size_t)info.map_width * info.map_height;
+    uint8_t *clean = malloc(blocks);
+    uint8_t *damaged = malloc(blocks);
+    TEST_CHECK_EQ(jpeg_dc_luma(s_parser, jpeg, len, clean, info.map_width, NULL), ESP_OK);
+
+    size_t data = scan_data_offset(jpeg, len);
+    size_t first_rst = data;
+    while (!(jpeg[first_rst] == 0xFF && jpeg[first_rst + 1] >= 0xD0 && jpeg[first_rst + 1] <= 0xD7)) {
+        first_rst++;
+    }
+
+    uint8_t *copy = malloc(len);
+    int decoded = 0, leaked = 0;
+    for (int round = 0; round < 500; round++) {
+        memcpy(copy, jpeg, len);
+        size_t at = data + test_rand(seed) % (first_rst - data);
+        copy[at] ^= (uint8_t)(1 + test_rand(seed) % 255);
+        if (copy[at] == 0xFF) {
+            continue;   /* Would read as a marker */
+        }
+        if (jpeg_dc_luma(s_parser, copy, len, damaged, info.map_width, NULL) != ESP_OK) {
+            continue;
+        }
+        decoded++;
+        for (size_t i = info.restart_interval; i < blocks; i++) {
+            if (damaged[i] != clean[i]) {
+                leaked++;
+                break;
+            }
+        }
+    }
+    /* Most single-byte damage still decodes; none of it may leak */
+    TEST_CHECK(decoded > 0);
+    TEST_CHECK_EQ(leaked, 0);
+
+    free(copy);
+    free(damaged);
+    free(clean);
+    free(jpeg);
+}
+
+static void check_unsupported(void)
+{
+    size_t len;
+    uint8_t *jpeg = load_fixture("jpeg_dc_progressive.jpg", &len);
+    if (jpeg == NULL) {
+        TEST_CHECK(jpeg != NULL);
+        return;
+    }
+
+    uint16_t width = 0, height = 0;
+    TEST_CHECK_EQ(jpeg_dc_get_size(jpeg, len, &width, &height), ESP_OK);
+    TEST_CHECK_EQ(width, 96);
+    TEST_CHECK_EQ(height, 64);
+
+    jpeg_dc_info_t info;
+    uint8_t map[16 * 16];
+    TEST_CHECK_EQ(jpeg_dc_get_info(s_parser, jpeg, len, &info), ESP_ERR_NOT_SUPPORTED);
+    TEST_CHECK_EQ(jpeg_dc_luma(s_parser, jpeg, len, map, 16, NULL), ESP_ERR_NOT_SUPPORTED);
+
+    /* Not a JPEG, and a stride narrower than the map */
+    TEST_CHECK_EQ(jpeg_dc_get_size(jpeg + 2, len - 2, &width, &height), ESP_FAIL);
+    TEST_CHECK_EQ(jpeg_dc_luma(s_parser, jpeg + 2, len - 2, map, 16, NULL), ESP_FAIL);
+    free(jpeg);
+
+    jpeg = load_fixture("jpeg_dc_444.jpg", &len);
+    TEST_CHECK_EQ(jpeg_dc_luma(s_parser, jpeg, len, map, 4, NULL), ESP_ERR_INVALID_SIZE);
+    free(jpeg);
+}
+
+int main(void)
+{
+    uint32_t seed = 0xC0FFEE11;
+
+    TEST_CHECK_EQ(jpeg_dc_create(&s_parser), ESP_OK);
+    for (size_t i = 0; i < sizeof(s_fixtures) / sizeof(s_fixtures[0]); i++) {
+        check_against_libjpeg(&s_fixtures[i]);
+        check_truncated(&s_fixtures[i]);
+        check_corrupt(&s_fixtures[i], &seed);
+    }
+    check_restart_resync(&seed);
+    check_unsupported();
+    jpeg_dc_delete(s_parser);
+    return TEST_RESULT();
+}
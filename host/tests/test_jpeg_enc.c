@@ -0,0 +1,455 @@
+/**
+ * @file test_jpeg_enc.c
+ * @brief Thumbnail encoder and stage output, decoded back with libjpeg
+ *
+ * The encoder gets the DC maps of the jpeg_dc fixtures, as in the thumbnail
+ * stage, and synthetic gradients and checkerboards. At quality 100 every
+ * quantizer step is 1, so the decoded luminance must stay within rounding of
+ * the input and the 4:2:0 chroma within rounding of the mean of each 2x2
+ * group. At the thumbnail quality the small, busy maps lose much of their
+ * detail, so the bounds there only catch broken tables or coefficient
+ * order. The thumbnail stage is then run on fixture frames, and its files
+ * must hold exactly what the encoder makes of the same maps.
+ */
+
+#include <esp_log.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <jpeglib.h>
+
+#include "app_config.h"
+#include "esp_rom_crc.h"
+#include "jpeg_dc.h"
+#include "jpeg_enc.h"
+#include "segment_store.h"
+#include "thumbnail.h"
+#include "test_common.h"
+
+#define THUMB_BASE      "thumb_test"
+#define MAX_PIXELS      (512 * 512)
+
+static const char *s_fixtures[] = {
+    "jpeg_dc_gray.jpg",
+    "jpeg_dc_444.jpg",
+    "jpeg_dc_422.jpg",
+    "jpeg_dc_420.jpg",
+    "jpeg_dc_420_odd.jpg",
+    "jpeg_dc_420_rst.jpg",
+    "jpeg_dc_gray_odd_rst.jpg",
+    "dedup_scene.jpg",
+    "dedup_object.jpg",
+};
+#define FIXTURE_COUNT   (sizeof(s_fixtures) / sizeof(s_fixtures[0]))
+
+static jpeg_dc_handle_t s_parser;
+static uint8_t s_planes[3][MAX_PIXELS];
+static uint8_t s_out[4 * MAX_PIXELS + 1024];
+
+typedef struct {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} ref_error_t;
+
+static void ref_error_exit(j_common_ptr cinfo)
+{
+    longjmp(((ref_error_t *)cinfo->err)->jump, 1);
+}
+
+/**
+ * @brief Decode at full size with libjpeg, without colour conversion or smoothed upsampling
+ * @return Interleaved Y or YCbCr pixels to free, NULL on error
+ */
+static uint8_t *ref_decode(const uint8_t *jpeg, size_t len, unsigned *width, unsigned *height,
+                           unsigned *components)
+{
+    struct jpeg_decompress_struct cinfo;
+    ref_error_t err;
+    uint8_t *volatile pixels = NULL;
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = ref_error_exit;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(pixels);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *)jpeg, (unsigned long)len);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_YCbCr;
+    cinfo.do_fancy_upsampling = FALSE;
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress(&cinfo);
+
+    size_t row_size = (size_t)cinfo.output_width * cinfo.output_components;
+    pixels = malloc(row_size * cinfo.output_height);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = pixels + row_size * cinfo.output_scanline;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    *components = cinfo.output_components;
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return pixels;
+}
+
+/**
+ * @brief Mean of the 2x2 group of @p plane holding (x, y), repeating the last row and column
+ */
+static int group_mean(const jpeg_enc_image_t *image, const uint8_t *plane, unsigned x, unsigned y)
+{
+    unsigned x0 = x & ~1u, y0 = y & ~1u;
+    unsigned x1 = x0 + 1 < image->width ? x0 + 1 : x0;
+    unsigned y1 = y0 + 1 < image->height ? y0 + 1 : y0;
+    const uint8_t *row0 = plane + y0 * image->stride;
+    const uint8_t *row1 = plane + y1 * image->stride;
+    return (row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) / 4;
+}
+
+/**
+ * @brief Decode a JPEG made of @p image and compare it pixel by pixel
+ * @param max_error Largest difference allowed at any pixel, per component
+ * @param max_mean Largest mean difference allowed, per component
+ */
+static void check_decoded(const jpeg_enc_image_t *image, const uint8_t *jpeg, size_t len,
+                          int max_error, double max_mean)
+{
+    unsigned width = 0, height = 0, components = 0;
+    uint8_t *pixels = ref_decode(jpeg, len, &width, &height, &components);
+    TEST_CHECK(pixels != NULL);
+    if (pixels == NULL) {
+        return;
+    }
+    TEST_CHECK_EQ(width, image->width);
+    TEST_CHECK_EQ(height, image->height);
+    TEST_CHECK_EQ(components, image->cb != NULL ? 3 : 1);
+    if (width != image->width || height != image->height || components != (image->cb != NULL ? 3u : 1u)) {
+        free(pixels);
+        return;
+    }
+
+    const uint8_t *planes[3] = { image->y, image->cb, image->cr };
+    for (unsigned c = 0; c < components; c++) {
+        int worst = 0;
+        uint64_t total = 0;
+        for (unsigned y = 0; y < height; y++) {
+            for (unsigned x = 0; x < width; x++) {
+                int want = c == 0 ? planes[0][y * image->stride + x] : group_mean(image, planes[c], x, y);
+                int error = abs(pixels[(y * width + x) * components + c] - want);
+                worst = error > worst ? error : worst;
+                total += error;
+            }
+        }
+        TEST_CHECK(worst <= max_error);
+        TEST_CHECK((double)total / (width * height) <= max_mean);
+    }
+    free(pixels);
+}
+
+/**
+ * @brief Encode @p image at each quality and check the decoded result
+ */
+static void check_image(const jpeg_enc_image_t *image)
+{
+    static const struct {
+        uint8_t quality;
+        int max_error;
+        double max_mean;
+    } levels[] = {
+        { 100, 2, 1.0 },
+        { CONFIG_APP_THUMBNAIL_QUALITY, 64, 16.0 },
+    };
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        jpeg_enc_handle_t encoder = NULL;
+        TEST_CHECK_EQ(jpeg_enc_create(levels[i].quality, &encoder), ESP_OK);
+        if (encoder == NULL) {
+            return;
+        }
+        size_t len = 0;
+        TEST_CHECK_EQ(jpeg_enc_encode(encoder, image, s_out, sizeof(s_out), &len), ESP_OK);
+        check_decoded(image, s_out, len, levels[i].max_error, levels[i].max_mean);
+
+        /* The thumbnail stage sizes its output for 2 bytes per pixel */
+        if (levels[i].quality == CONFIG_APP_THUMBNAIL_QUALITY) {
+            TEST_CHECK(len <= (size_t)image->width * image->height * 2 + 1024);
+        }
+        jpeg_enc_delete(encoder);
+    }
+}
+
+/**
+ * @brief DC maps of the fixtures, the thumbnails the stage makes of them
+ */
+static void check_fixture_maps(void)
+{
+    for (size_t i = 0; i < FIXTURE_COUNT; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", TEST_FIXTURE_DIR, s_fixtures[i]);
+        size_t len = 0;
+        uint8_t *jpeg = test_read_file(path, &len);
+        TEST_CHECK(jpeg != NULL);
+        if (jpeg == NULL) {
+            continue;
+        }
+
+        jpeg_dc_info_t info;
+        TEST_CHECK_EQ(jpeg_dc_get_info(s_parser, jpeg, len, &info), ESP_OK);
+        TEST_CHECK((size_t)info.map_width * info.map_height <= MAX_PIXELS);
+        TEST_CHECK_EQ(jpeg_dc_ycbcr(s_parser, jpeg, len, s_planes[0], s_planes[1], s_planes[2],
+                                    info.map_width, NULL), ESP_OK);
+        jpeg_enc_image_t image = {
+            .y = s_planes[0],
+            .cb = info.components == 3 ? s_planes[1] : NULL,
+            .cr = info.components == 3 ? s_planes[2] : NULL,
+            .width = info.map_width,
+            .height = info.map_height,
+            .stride = info.map_width,
+        };
+        check_image(&image);
+        free(jpeg);
+    }
+}
+
+/**
+ * @brief Gradients and checkerboards, in colour and grayscale, in whole and partial MCUs
+ */
+static void check_synthetic(void)
+{
+    static const struct {
+        uint16_t width;
+        uint16_t height;
+    } sizes[] = { { 64, 48 }, { 37, 23 }, { 1, 1 }, { 200, 9 } };
+    enum { STRIDE = 256 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint16_t w = sizes[s].width, h = sizes[s].height;
+        for (int pattern = 0; pattern < 3; pattern++) {
+            for (unsigned y = 0; y < h; y++) {
+                for (unsigned x = 0; x < w; x++) {
+                    uint8_t *p[3] = { &s_planes[0][y * STRIDE + x], &s_planes[1][y * STRIDE + x],
+                                      &s_planes[2][y * STRIDE + x] };
+                    if (pattern == 0) {
+                        /* Diagonal gradients over the full range */
+                        *p[0] = (uint8_t)(w + h > 2 ? (x + y) * 255 / (w + h - 2) : 128);
+                        *p[1] = (uint8_t)(w > 1 ? x * 255 / (w - 1) : 128);
+                        *p[2] = (uint8_t)(h > 1 ? 255 - y * 255 / (h - 1) : 128);
+                    } else {
+                        /* Checkerboards of 1 and 4 pixel squares, the hardest case for the DCT */
+                        int cell = pattern == 1 ? 1 : 4;
+                        bool on = ((x / cell) + (y / cell)) % 2;
+                        *p[0] = on ? 235 : 16;
+                        *p[1] = on ? 90 : 200;
+                        *p[2] = on ? 60 : 180;
+                    }
+                }
+            }
+
+            jpeg_enc_image_t image = {
+                .y = s_planes[0],
+                .cb = s_planes[1],
+                .cr = s_planes[2],
+                .width = w,
+                .height = h,
+                .stride = STRIDE,
+            };
+            check_image(&image);
+            image.cb = image.cr = NULL;
+            check_image(&image);
+        }
+    }
+}
+
+/**
+ * @brief Invalid arguments and an output buffer too small
+ */
+static void check_errors(void)
+{
+    jpeg_enc_handle_t encoder = NULL;
+    TEST_CHECK_EQ(jpeg_enc_create(0, &encoder), ESP_ERR_INVALID_ARG);
+    TEST_CHECK_EQ(jpeg_enc_create(101, &encoder), ESP_ERR_INVALID_ARG);
+    TEST_CHECK_EQ(jpeg_enc_create(50, &encoder), ESP_OK);
+    if (encoder == NULL) {
+        return;
+    }
+
+    memset(s_planes, 128, sizeof(s_planes));
+    jpeg_enc_image_t image = { .y = s_planes[0], .width = 0, .height = 8, .stride = 64 };
+    size_t len = 0;
+    TEST_CHECK_EQ(jpeg_enc_encode(encoder, &image, s_out, sizeof(s_out), &len), ESP_ERR_INVALID_ARG);
+    image.width = 64;
+    TEST_CHECK_EQ(jpeg_enc_encode(encoder, &image, s_out, sizeof(s_out), &len), ESP_OK);
+    TEST_CHECK_EQ(jpeg_enc_encode(encoder, &image, s_out, len - 1, &len), ESP_ERR_INVALID_SIZE);
+    jpeg_enc_delete(encoder);
+}
+
+/**
+ * @brief Encode the DC maps of a fixture as the thumbnail stage does
+ * @return JPEG length, 0 on error
+ */
+static size_t expected_thumbnail(const uint8_t *jpeg, size_t len, uint8_t quality, uint8_t *out, size_t out_size)
+{
+    jpeg_dc_info_t info;
+    if (jpeg_dc_get_info(s_parser, jpeg, len, &info) != ESP_OK ||
+        jpeg_dc_ycbcr(s_parser, jpeg, len, s_planes[0], s_planes[1], s_planes[2], info.map_width, NULL) != ESP_OK) {
+        return 0;
+    }
+    jpeg_enc_image_t image = {
+        .y = s_planes[0],
+        .cb = info.components == 3 ? s_planes[1] : NULL,
+        .cr = info.components == 3 ? s_planes[2] : NULL,
+        .width = info.map_width,
+        .height = info.map_height,
+        .stride = info.map_width,
+    };
+
+    jpeg_enc_handle_t encoder = NULL;
+    size_t out_len = 0;
+    if (jpeg_enc_create(quality, &encoder) == ESP_OK) {
+        jpeg_enc_encode(encoder, &image, out, out_size, &out_len);
+    }
+    jpeg_enc_delete(encoder);
+    return out_len;
+}
+
+/**
+ * @brief Wait for the thumbnail task to work through what was submitted
+ */
+static void wait_idle(thumbnail_stats_t *stats)
+{
+    for (int i = 0; i < 500; i++) {
+        thumbnail_get_stats(stats);
+        if (stats->pending == 0) {
+            return;
+        }
+        usleep(10000);
+    }
+}
+
+/**
+ * @brief The stage's JPEG files and segment records hold the encoder's output for each frame
+ */
+static void check_thumbnail_stage(bool segments)
+{
+    /* Segment thumbnails are appended to, so start without one left by an earlier run */
+    mkdir(THUMB_BASE, 0755);
+    unlink(THUMB_BASE "/" THUMBNAIL_DIR "/" SEGMENT_NAME_PREFIX "00007" THUMBNAIL_SEGMENT_EXT);
+    thumbnail_config_t config = THUMBNAIL_DEFAULT_CONFIG(THUMB_BASE);
+    config.segments = segments;
+    config.max_pending = FIXTURE_COUNT + 1;
+    config.arena_size = 1024 * 1024;
+    TEST_CHECK_EQ(thumbnail_start(&config), ESP_OK);
+
+    uint8_t *frames[FIXTURE_COUNT];
+    size_t lengths[FIXTURE_COUNT];
+    for (size_t i = 0; i < FIXTURE_COUNT; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", TEST_FIXTURE_DIR, s_fixtures[i]);
+        frames[i] = test_read_file(path, &lengths[i]);
+        TEST_CHECK(frames[i] != NULL);
+        capture_frame_t frame = { .buf = frames[i], .len = frames[i] ? lengths[i] : 0, .seq = 100 + i,
+                                  .timestamp_us = 1000 * (int64_t)i };
+        /* Segments: all frames in one segment; photos: one file each */
+        TEST_CHECK_EQ(thumbnail_submit(&frame, segments ? 7 : 40 + i, segments ? 512 * i : 0), ESP_OK);
+    }
+
+    /* Not a JPEG: counted as failed, no thumbnail */
+    static const uint8_t garbage[64] = { 0xFF, 0xD8 };
+    capture_frame_t bad = { .buf = garbage, .len = sizeof(garbage), .seq = 99 };
+    TEST_CHECK_EQ(thumbnail_submit(&bad, segments ? 7 : 99, 0), ESP_OK);
+
+    thumbnail_stats_t stats;
+    wait_idle(&stats);
+    TEST_CHECK_EQ(stats.submitted, FIXTURE_COUNT + 1);
+    TEST_CHECK_EQ(stats.written, FIXTURE_COUNT);
+    TEST_CHECK_EQ(stats.failed, 1);
+
+    static uint8_t expected[4 * MAX_PIXELS + 1024];
+    size_t segment_len = 0;
+    uint8_t *segment = NULL;
+    if (segments) {
+        segment = test_read_file(THUMB_BASE "/" THUMBNAIL_DIR "/" SEGMENT_NAME_PREFIX "00007" THUMBNAIL_SEGMENT_EXT,
+                                 &segment_len);
+        TEST_CHECK(segment != NULL);
+    }
+    size_t at = 0;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < FIXTURE_COUNT; i++) {
+        size_t expected_len = frames[i] ? expected_thumbnail(frames[i], lengths[i], config.quality,
+                                                             expected, sizeof(expected)) : 0;
+        TEST_CHECK(expected_len > 0);
+
+        const uint8_t *thumb = NULL;
+        size_t thumb_len = 0;
+        uint8_t *file = NULL;
+        if (segments) {
+            thumbnail_record_header_t header = { 0 };
+            if (segment != NULL && at + sizeof(header) <= segment_len) {
+                memcpy(&header, segment + at, sizeof(header));
+            }
+            TEST_CHECK_EQ(header.magic, THUMBNAIL_RECORD_MAGIC);
+            TEST_CHECK_EQ(header.header_size, sizeof(header));
+            TEST_CHECK_EQ(header.header_crc, esp_rom_crc32_le(0, (const uint8_t *)&header,
+                                                              offsetof(thumbnail_record_header_t, header_crc)));
+            TEST_CHECK_EQ(header.offset, 512 * i);
+            TEST_CHECK_EQ(header.seq, 100 + i);
+            TEST_CHECK_EQ(header.timestamp_us, 1000 * (int64_t)i);
+            at += sizeof(header);
+            if (segment != NULL && at + header.length <= segment_len) {
+                thumb = segment + at;
+                thumb_len = header.length;
+                TEST_CHECK_EQ(header.data_crc, esp_rom_crc32_le(0, thumb, thumb_len));
+            }
+            at += header.length;
+        } else {
+            char path[256];
+            snprintf(path, sizeof(path), THUMB_BASE "/" THUMBNAIL_DIR "/" PHOTO_NAME_PREFIX "%05lu" PHOTO_NAME_EXT,
+                     (unsigned long)(40 + i));
+            file = test_read_file(path, &thumb_len);
+            thumb = file;
+        }
+        TEST_CHECK(thumb != NULL);
+        TEST_CHECK_EQ(thumb_len, expected_len);
+        TEST_CHECK(thumb != NULL && thumb_len == expected_len && memcmp(thumb, expected, thumb_len) == 0);
+        bytes += thumb_len;
+        free(file);
+        free(frames[i]);
+    }
+    if (segments) {
+        TEST_CHECK_EQ(at, segment_len);
+    } else {
+        TEST_CHECK(access(THUMB_BASE "/" THUMBNAIL_DIR "/" PHOTO_NAME_PREFIX "00099" PHOTO_NAME_EXT, F_OK) != 0);
+    }
+    TEST_CHECK_EQ(stats.bytes, bytes);
+    free(segment);
+
+    /* Thumbnails go with their capture */
+    size_t removed = thumbnail_remove(segments ? 7 : 40);
+    TEST_CHECK(removed > 0);
+    TEST_CHECK_EQ(thumbnail_remove(segments ? 7 : 40), 0);
+    thumbnail_stop();
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    TEST_CHECK_EQ(jpeg_dc_create(&s_parser), ESP_OK);
+    if (s_parser == NULL) {
+        return TEST_RESULT();
+    }
+    check_errors();
+    check_fixture_maps();
+    check_synthetic();
+    check_thumbnail_stage(false);
+    check_thumbnail_stage(true);
+    jpeg_dc_delete(s_parser);
+    return TEST_RESULT();
+}
@@ -0,0 +1,234 @@
+/**
+ * @file test_motion_kernel.c
+ * @brief Block difference and background update kernels against a plain reference
+ *
+ * The references are written pixel by pixel from the definitions, with no
+ * sharing of code or loop structure with motion_kernel.c. Images are random,
+ * all-extreme and checkerboard, in sizes from a single block to frames whose
+ * width and height are not multiples of the block size (padded as the
+ * motion detector pads them). Every available kernel is checked.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "motion_kernel.h"
+#include "test_common.h"
+
+/**
+ * @brief SAD of block (bx, by) from the definition
+ */
+static uint32_t ref_block_sad(const uint8_t *a, const uint8_t *b, size_t stride, size_t bx, size_t by)
+{
+    uint32_t sad = 0;
+    for (size_t y = by * MOTION_BLOCK_SIZE; y < (by + 1) * MOTION_BLOCK_SIZE; y++) {
+        for (size_t x = bx * MOTION_BLOCK_SIZE; x < (bx + 1) * MOTION_BLOCK_SIZE; x++) {
+            int pa = a[y * stride + x];
+            int pb = b[y * stride + x];
+            sad += (uint32_t)abs(pa - pb);
+        }
+    }
+    return sad;
+}
+
+/**
+ * @brief Floor of n / 2^shift, as an arithmetic right shift rounds
+ */
+static int32_t ref_floor_div(int32_t n, unsigned shift)
+{
+    int32_t d = 1 << shift;
+    return n >= 0 ? n / d : -((-n + d - 1) / d);
+}
+
+typedef enum {
+    FILL_RANDOM,
+    FILL_EXTREMES,          /* 0 in one image where the other has 255 */
+    FILL_CHECKER,
+} fill_t;
+
+static void fill_images(uint8_t *a, uint8_t *b, size_t size, fill_t fill, uint32_t *seed)
+{
+    for (size_t i = 0; i < size; i++) {
+        switch (fill) {
+        case FILL_RANDOM:
+            a[i] = (uint8_t)test_rand(seed);
+            b[i] = (uint8_t)test_rand(seed);
+            break;
+        case FILL_EXTREMES:
+            a[i] = (test_rand(seed) & 1) ? 255 : 0;
+            b[i] = 255 - a[i];
+            break;
+        case FILL_CHECKER:
+            a[i] = (i & 1) ? 255 : 0;
+            b[i] = (uint8_t)(i * 7);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief motion_block_diff() on a width x height frame, padded to whole blocks
+ */
+static void check_block_diff(size_t width, size_t height, size_t extra_stride, fill_t fill, uint32_t *seed)
+{
+    size_t stride = MOTION_PAD(width) + extra_stride;
+    size_t rows = MOTION_PAD(height);
+    size_t blocks_x = MOTION_PAD(width) / MOTION_BLOCK_SIZE;
+    size_t blocks_y = rows / MOTION_BLOCK_SIZE;
+    size_t size = stride * rows;
+
+    uint8_t *a = aligned_alloc(MOTION_ALIGN, size);
+    uint8_t *b = aligned_alloc(MOTION_ALIGN, size);
+    uint32_t *sad = malloc(blocks_x * blocks_y * sizeof(*sad));
+    fill_images(a, b, size, fill, seed);
+
+    /* The pixels right of the last block up to the stride must not count */
+    for (size_t y = 0; y < rows; y++) {
+        memset(a + y * stride + blocks_x * MOTION_BLOCK_SIZE, 0xAA, extra_stride);
+        memset(b + y * stride + blocks_x * MOTION_BLOCK_SIZE, 0x11, extra_stride);
+    }
+
+    motion_block_diff(a, b, stride, blocks_x, blocks_y, sad);
+    int mismatches = 0;
+    for (size_t by = 0; by < blocks_y; by++) {
+        for (size_t bx = 0; bx < blocks_x; bx++) {
+            if (sad[by * blocks_x + bx] != ref_block_sad(a, b, stride, bx, by)) {
+                mismatches++;
+            }
+        }
+    }
+    if (mismatches) {
+        fprintf(stderr, "%s: %zux%zu (stride %zu, fill %d): %d blocks differ\n",
+                motion_kernel_name(motion_kernel_active()), width, height, stride, (int)fill, mismatches);
+    }
+    TEST_CHECK_EQ(mismatches, 0);
+
+    /* A frame against itself is still */
+    motion_block_diff(a, a, stride, blocks_x, blocks_y, sad);
+    uint32_t total = 0;
+    for (size_t i = 0; i < blocks_x * blocks_y; i++) {
+        total += sad[i];
+    }
+    TEST_CHECK_EQ(total, 0);
+
+    free(a);
+    free(b);
+    free(sad);
+}
+
+static void check_block_diff_sizes(void)
+{
+    static const size_t sizes[][2] = {
+        { 16, 16 },         /* One block */
+        { 16, 64 },         /* One column */
+        { 128, 16 },        /* One row */
+        { 17, 33 },         /* Just over whole blocks, padded */
+        { 31, 15 },         /* Just under */
+        { 200, 150 },       /* 1/8 scale UXGA */
+        { 100, 75 },        /* 1/8 scale SVGA */
+    };
+    static const size_t extra_strides[] = { 0, 16, 48 };
+    uint32_t seed = 0x9E3779B9;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t e = 0; e < sizeof(extra_strides) / sizeof(extra_strides[0]); e++) {
+            for (int fill = FILL_RANDOM; fill <= FILL_CHECKER; fill++) {
+                check_block_diff(sizes[s][0], sizes[s][1], extra_strides[e], (fill_t)fill, &seed);
+            }
+        }
+    }
+
+    /* Largest possible block sum */
+    uint8_t a[MOTION_BLOCK_SIZE * MOTION_BLOCK_SIZE] __attribute__((aligned(MOTION_ALIGN)));
+    uint8_t b[MOTION_BLOCK_SIZE * MOTION_BLOCK_SIZE] __attribute__((aligned(MOTION_ALIGN)));
+    memset(a, 255, sizeof(a));
+    memset(b, 0, sizeof(b));
+    uint32_t sad = 0;
+    motion_block_diff(a, b, MOTION_BLOCK_SIZE, 1, 1, &sad);
+    TEST_CHECK_EQ(sad, 255 * MOTION_BLOCK_SIZE * MOTION_BLOCK_SIZE);
+}
+
+/**
+ * @brief motion_background_update() against acc += floor((cur * 256 - acc) / 2^shift)
+ */
+static void check_background_update(void)
+{
+    enum { COUNT = 4099 };      /* Not a multiple of any vector width */
+    uint16_t *acc = malloc(COUNT * sizeof(*acc));
+    uint16_t *ref_acc = malloc(COUNT * sizeof(*ref_acc));
+    uint8_t *bg = malloc(COUNT);
+    uint8_t *cur = malloc(COUNT);
+    uint32_t seed = 0x12345678;
+
+    for (unsigned shift = 0; shift <= 8; shift++) {
+        for (size_t i = 0; i < COUNT; i++) {
+            /* Start at the extremes as well as in between; every 16-bit value is a valid 8.8 level */
+            acc[i] = (i % 3 == 0) ? 0 : (i % 3 == 1) ? 255 << 8 : (uint16_t)test_rand(&seed);
+            ref_acc[i] = acc[i];
+        }
+
+        int mismatches = 0;
+        for (int round = 0; round < 20; round++) {
+            for (size_t i = 0; i < COUNT; i++) {
+                cur[i] = (round % 5 == 0) ? ((i & 1) ? 255 : 0) : (uint8_t)test_rand(&seed);
+            }
+            motion_background_update(acc, bg, cur, COUNT, shift);
+            for (size_t i = 0; i < COUNT; i++) {
+                int32_t r = ref_acc[i];
+                r += ref_floor_div((int32_t)cur[i] * 256 - r, shift);
+                ref_acc[i] = (uint16_t)r;
+                if (acc[i] != ref_acc[i] || bg[i] != ref_acc[i] / 256) {
+                    mismatches++;
+                }
+            }
+        }
+        if (mismatches) {
+            fprintf(stderr, "background update, shift %u: %d pixels differ\n", shift, mismatches);
+        }
+        TEST_CHECK_EQ(mismatches, 0);
+    }
+
+    /* A still scene pulls the background to within one level of it */
+    for (size_t i = 0; i < COUNT; i++) {
+        acc[i] = (uint16_t)(test_rand(&seed) % (256 << 8));
+        cur[i] = (uint8_t)test_rand(&seed);
+    }
+    for (int round = 0; round < 200; round++) {
+        motion_background_update(acc, bg, cur, COUNT, 3);
+    }
+    int far = 0;
+    for (size_t i = 0; i < COUNT; i++) {
+        if (abs((int)bg[i] - (int)cur[i]) > 1) {
+            far++;
+        }
+    }
+    TEST_CHECK_EQ(far, 0);
+
+    /* Zero pixels leave everything as it was */
+    acc[0] = 0x1234;
+    bg[0] = 0x56;
+    motion_background_update(acc, bg, cur, 0, 3);
+    TEST_CHECK_EQ(acc[0], 0x1234);
+    TEST_CHECK_EQ(bg[0], 0x56);
+
+    free(acc);
+    free(ref_acc);
+    free(bg);
+    free(cur);
+}
+
+int main(void)
+{
+    static const motion_kernel_t kernels[] = { MOTION_KERNEL_SCALAR, MOTION_KERNEL_PIE };
+
+    motion_kernel_init();
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!motion_kernel_select(kernels[k])) {
+            printf("%s kernel not available on this target\n", motion_kernel_name(kernels[k]));
+            continue;
+        }
+        check_block_diff_sizes();
+    }
+    check_background_update();
+    return TEST_RESULT();
+}
@@ -0,0 +1,233 @@
+/**
+ * @file test_quality_controller.c
+ * @brief Quality decisions on the recorded trace fixtures/quality_trace.csv
+ *
+ * The trace was recorded at quality 10 in 10 fps bursts: 60 frames of a
+ * busy scene (about 300 KB) on a fast card, 60 more with the card slowed to
+ * 1 MB/s, then 60 frames of a quiet scene (about 60 KB) on the fast card.
+ * As in host/quality_replay.c, each frame is scaled to the settings decided
+ * 1 + settle frames earlier, so the controller sees the effect of its own
+ * decisions.
+ */
+
+#include <esp_log.h>
+
+#include "quality_controller.h"
+#include "test_common.h"
+
+#define TRACE_FRAMES        180
+#define PHASE_FRAMES        60
+
+/* Pixels of the capture frame size steps, as in quality_replay.c */
+static const uint32_t s_step_pixels[] = { 1600 * 1200, 1280 * 1024, 1024 * 768, 800 * 600 };
+
+typedef struct {
+    quality_sample_t recorded;
+    uint32_t replayed_bytes;        /* Size at the settings in effect */
+    uint8_t applied_quality;        /* Settings the frame was captured with */
+    uint8_t applied_step;
+    quality_decision_t decision;    /* Decision after the frame */
+    bool changed;
+} replay_frame_t;
+
+static replay_frame_t s_frames[TRACE_FRAMES];
+
+static int load_trace(void)
+{
+    FILE *f = fopen(TEST_FIXTURE_DIR "/quality_trace.csv", "r");
+    if (f == NULL) {
+        perror("quality_trace.csv");
+        return 0;
+    }
+
+    char line[128];
+    int count = 0;
+    while (count < TRACE_FRAMES && fgets(line, sizeof(line), f) != NULL) {
+        long long timestamp_us;
+        unsigned quality;
+        unsigned long bytes, write_us;
+        if (sscanf(line, "%lld,%u,%lu,%lu", &timestamp_us, &quality, &bytes, &write_us) != 4) {
+            continue;
+        }
+        TEST_CHECK_EQ(quality, 10);
+        s_frames[count].recorded.timestamp_us = timestamp_us;
+        s_frames[count].recorded.bytes = (uint32_t)bytes;
+        s_frames[count].recorded.write_us = (uint32_t)write_us;
+        count++;
+    }
+    fclose(f);
+    return count;
+}
+
+/**
+ * @brief Run the trace through a controller with @p config
+ */
+static void replay(const quality_controller_config_t *config, int count, quality_controller_stats_t *stats)
+{
+    quality_controller_handle_t ctl = NULL;
+    TEST_CHECK_EQ(quality_controller_create(config, 10, &ctl), ESP_OK);
+    if (ctl == NULL) {
+        return;
+    }
+
+    int lag = 1 + config->settle_frames;
+    for (int i = 0; i < count; i++) {
+        replay_frame_t *f = &s_frames[i];
+        f->applied_quality = i >= lag ? s_frames[i - lag].decision.quality : 10;
+        f->applied_step = i >= lag ? s_frames[i - lag].decision.size_step : 0;
+
+        quality_sample_t sample = f->recorded;
+        uint64_t bytes = (uint64_t)sample.bytes * 10 / f->applied_quality *
+                         s_step_pixels[f->applied_step] / s_step_pixels[0];
+        sample.write_us = (uint32_t)((uint64_t)sample.write_us * bytes / sample.bytes);
+        sample.bytes = (uint32_t)bytes;
+        f->replayed_bytes = sample.bytes;
+        f->changed = quality_controller_update(ctl, &sample, &f->decision);
+    }
+    quality_controller_get_stats(ctl, stats);
+    quality_controller_delete(ctl);
+}
+
+/**
+ * @brief Invariants of every decision: limits, step size, settling
+ */
+static void check_decisions(const quality_controller_config_t *config, int count)
+{
+    int out_of_range = 0, big_steps = 0, misreported = 0, unsettled = 0, size_too_early = 0;
+    uint8_t quality = 10, step = 0;
+    int last_change = -1000;
+
+    for (int i = 0; i < count; i++) {
+        const quality_decision_t *d = &s_frames[i].decision;
+        out_of_range += d->quality < config->min_quality || d->quality > config->max_quality ||
+                        d->size_step >= config->size_steps;
+        big_steps += abs((int)d->quality - (int)quality) > config->max_step ||
+                     abs((int)d->size_step - (int)step) > 1;
+        misreported += s_frames[i].changed != (d->quality != quality || d->size_step != step);
+        if (s_frames[i].changed) {
+            /* No decision while frames at the old settings are still arriving */
+            unsettled += i - last_change <= config->settle_frames;
+            last_change = i;
+        }
+        /* The frame size goes down only at the worst quality, and up only at the best */
+        if (d->size_step > step && quality != config->max_quality) {
+            size_too_early++;
+        }
+        if (d->size_step < step && quality != config->min_quality) {
+            size_too_early++;
+        }
+        quality = d->quality;
+        step = d->size_step;
+    }
+    TEST_CHECK_EQ(out_of_range, 0);
+    TEST_CHECK_EQ(big_steps, 0);
+    TEST_CHECK_EQ(misreported, 0);
+    TEST_CHECK_EQ(unsettled, 0);
+    TEST_CHECK_EQ(size_too_early, 0);
+}
+
+/**
+ * @return Frames in [first, last) whose replayed size is off the target by more than @p pct
+ */
+static int frames_off_target(int first, int last, uint32_t target, int pct)
+{
+    int off = 0;
+    for (int i = first; i < last; i++) {
+        int64_t diff = (int64_t)s_frames[i].replayed_bytes - target;
+        off += llabs(diff) * 100 > (int64_t)target * pct;
+    }
+    return off;
+}
+
+static int changes_in(int first, int last)
+{
+    int n = 0;
+    for (int i = first; i < last; i++) {
+        n += s_frames[i].changed;
+    }
+    return n;
+}
+
+/**
+ * @brief Quality only, Kconfig defaults: 200 KB per frame, 80 % of the write throughput
+ */
+static void check_quality_only(int count)
+{
+    quality_controller_config_t config = QUALITY_CONTROLLER_DEFAULT_CONFIG();
+    config.size_steps = 1;
+    quality_controller_stats_t stats;
+    replay(&config, count, &stats);
+    check_decisions(&config, count);
+
+    /* First frame: 300 KB at 10 wants ceil(300 * 10 / 200) = 15, limited to 10 + max_step */
+    TEST_CHECK(s_frames[0].changed);
+    TEST_CHECK_EQ(s_frames[0].decision.target_bytes, 200 * 1024);
+    TEST_CHECK_EQ(s_frames[0].decision.quality, 10 + config.max_step);
+
+    /* Busy scene, fast card: settled within the deadband (plus the scene's 5 % noise) */
+    TEST_CHECK_EQ(changes_in(10, PHASE_FRAMES), 0);
+    TEST_CHECK_EQ(s_frames[PHASE_FRAMES - 1].decision.quality, 14);
+    TEST_CHECK_EQ(frames_off_target(10, PHASE_FRAMES, 200 * 1024, config.deadband_pct + 5), 0);
+
+    /* Slow card: the target drops to 80 % of 1 MB/s at 10 fps and quality runs to its limit */
+    uint32_t writable = 1024 * 1024 * 80 / 100 / 10;
+    const quality_decision_t *end_b = &s_frames[2 * PHASE_FRAMES - 1].decision;
+    TEST_CHECK(abs((int)end_b->target_bytes - (int)writable) * 100 <= (int)writable);
+    TEST_CHECK_EQ(end_b->quality, config.max_quality);
+    TEST_CHECK_EQ(changes_in(PHASE_FRAMES + 30, 2 * PHASE_FRAMES), 0);
+
+    /* Quiet scene: back to the full target and down to the best quality */
+    const quality_decision_t *end_c = &s_frames[count - 1].decision;
+    TEST_CHECK_EQ(end_c->target_bytes, 200 * 1024);
+    TEST_CHECK_EQ(end_c->quality, config.min_quality);
+    TEST_CHECK_EQ(changes_in(count - 30, count), 0);
+
+    TEST_CHECK_EQ(stats.samples, count);
+    TEST_CHECK_EQ(stats.size_changes, 0);
+    TEST_CHECK_EQ(stats.ignored, stats.changes * config.settle_frames);
+}
+
+/**
+ * @brief With frame size steps the slow card's target is met at a smaller size
+ */
+static void check_size_steps(int count)
+{
+    quality_controller_config_t config = QUALITY_CONTROLLER_DEFAULT_CONFIG();
+    config.size_steps = 4;
+    quality_controller_stats_t stats;
+    replay(&config, count, &stats);
+    check_decisions(&config, count);
+
+    /* Nothing changes while quality alone meets the target */
+    for (int i = 0; i < PHASE_FRAMES; i++) {
+        TEST_CHECK_EQ(s_frames[i].decision.size_step, 0);
+    }
+
+    /* One step down (SXGA) once quality is at its limit, then quality backs off within it */
+    TEST_CHECK_EQ(stats.size_changes, 1);
+    const quality_decision_t *end_b = &s_frames[2 * PHASE_FRAMES - 1].decision;
+    TEST_CHECK_EQ(end_b->size_step, 1);
+    TEST_CHECK(end_b->quality < config.max_quality);
+    TEST_CHECK_EQ(frames_off_target(2 * PHASE_FRAMES - 20, 2 * PHASE_FRAMES, end_b->target_bytes,
+                                    config.deadband_pct + 5), 0);
+
+    /*
+     * Quiet scene: the full size only comes back when even the best quality
+     * would be under half the target, so it stays at SXGA near 105 KB.
+     */
+    const quality_decision_t *end_c = &s_frames[count - 1].decision;
+    TEST_CHECK_EQ(end_c->size_step, 1);
+    TEST_CHECK_EQ(end_c->quality, config.min_quality);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    int count = load_trace();
+    TEST_CHECK_EQ(count, TRACE_FRAMES);
+    if (count == TRACE_FRAMES) {
+        check_quality_only(count);
+        check_size_steps(count);
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,315 @@
+/**
+ * @file test_sector_log.c
+ * @brief Sector log on a card image: append, power cuts, torn records and wrap
+ *
+ * The card is a private image file, so records and superblocks can be read
+ * back and damaged with plain pread()/pwrite(). A power cut is simulated by
+ * closing the log and putting back the superblocks it had before, which
+ * leaves the card as it was after the last record write.
+ */
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sector_log.h"
+#include "test_common.h"
+
+#define IMAGE_PATH          "test_sector_log.img"
+#define IMAGE_SECTORS       16384
+#define REGION_START        4096
+#define REGION_SECTORS      256
+#define MAX_LSN             256
+#define MAX_FRAME           3000
+
+typedef struct {
+    uint32_t sector;        /* Region sector of the header */
+    uint32_t len;
+    uint32_t seed;          /* Frame data seed */
+} expected_record_t;
+
+static sdmmc_card_t s_card;
+static expected_record_t s_expected[MAX_LSN];
+static uint8_t s_frame_buf[MAX_FRAME + 4];
+
+static void read_sectors(uint32_t sector, void *buf, uint32_t count)
+{
+    TEST_CHECK_EQ(pread(s_card.fd, buf, (size_t)count * 512, (off_t)sector * 512), (ssize_t)count * 512);
+}
+
+static void write_sectors(uint32_t sector, const void *buf, uint32_t count)
+{
+    TEST_CHECK_EQ(pwrite(s_card.fd, buf, (size_t)count * 512, (off_t)sector * 512), (ssize_t)count * 512);
+}
+
+static sector_log_config_t log_config(uint32_t checkpoint_every)
+{
+    sector_log_config_t config = {
+        .card = &s_card,
+        .start_sector = REGION_START,
+        .sector_count = REGION_SECTORS,
+        .checkpoint_every = checkpoint_every,
+        .chunk_size = 1024,
+    };
+    return config;
+}
+
+/**
+ * @brief Frame data for @p seed; odd seeds start off a word boundary so the data is bounced
+ */
+static capture_frame_t make_frame(uint32_t seed, uint32_t len)
+{
+    uint8_t *buf = s_frame_buf + (seed & 1);
+    uint32_t state = seed * 2654435761u + 1;
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)test_rand(&state);
+    }
+    capture_frame_t frame = {
+        .buf = buf,
+        .len = len,
+        .seq = seed,
+        .timestamp_us = (int64_t)seed * 100000,
+        .trigger = { .id = seed / 3, .source = CAPTURE_TRIGGER_SOURCE_SOFTWARE },
+    };
+    return frame;
+}
+
+/**
+ * @brief Append record @p lsn from @p seed, some of whole sectors and the rest of any length
+ */
+static sector_log_location_t append(uint64_t lsn, uint32_t seed)
+{
+    uint32_t state = seed + 7;
+    uint32_t len = seed % 5 == 2 ? 1024 : 1 + test_rand(&state) % MAX_FRAME;
+    capture_frame_t frame = make_frame(seed, len);
+
+    sector_log_location_t loc = { 0 };
+    TEST_CHECK_EQ(sector_log_append(&frame, &loc), ESP_OK);
+    TEST_CHECK_EQ(loc.lsn, lsn);
+    TEST_CHECK_EQ(loc.sectors, 1 + (len + 511) / 512);
+    if (lsn < MAX_LSN) {
+        s_expected[lsn] = (expected_record_t){ .sector = loc.sector, .len = len, .seed = seed };
+    }
+    return loc;
+}
+
+/**
+ * @brief Record @p lsn is on the card as appended, header and data
+ */
+static void check_record(uint64_t lsn, uint32_t nonce)
+{
+    const expected_record_t *e = &s_expected[lsn];
+    uint32_t sectors = 1 + (e->len + 511) / 512;
+    uint8_t *raw = malloc((size_t)sectors * 512);
+    read_sectors(REGION_START + e->sector, raw, sectors);
+
+    sector_log_record_header_t header;
+    memcpy(&header, raw, sizeof(header));
+    TEST_CHECK_EQ(header.magic, SECTOR_LOG_RECORD_MAGIC);
+    TEST_CHECK_EQ(header.nonce, nonce);
+    TEST_CHECK_EQ(header.lsn, lsn);
+    TEST_CHECK_EQ(header.sectors, sectors);
+    TEST_CHECK_EQ(header.length, e->len);
+    TEST_CHECK_EQ(header.seq, e->seed);
+    TEST_CHECK_EQ(header.timestamp_us, (int64_t)e->seed * 100000);
+    TEST_CHECK_EQ(header.trigger_source, CAPTURE_TRIGGER_SOURCE_SOFTWARE);
+    TEST_CHECK_EQ(header.header_crc,
+                  esp_rom_crc32_le(0, raw, offsetof(sector_log_record_header_t, header_crc)));
+
+    capture_frame_t frame = make_frame(e->seed, e->len);
+    TEST_CHECK_EQ(header.data_crc, esp_rom_crc32_le(0, frame.buf, e->len));
+    TEST_CHECK(memcmp(raw + 512, frame.buf, e->len) == 0);
+    free(raw);
+}
+
+/**
+ * @brief Power lost after the last record: the log is dropped without its closing checkpoint
+ */
+static void power_cut(void)
+{
+    uint8_t superblocks[2 * 512];
+    read_sectors(REGION_START, superblocks, 2);
+    sector_log_close();
+    write_sectors(REGION_START, superblocks, 2);
+}
+
+/**
+ * @brief Superblock copy (0 or 1) holding the newest checkpoint
+ */
+static int newest_superblock(void)
+{
+    sector_log_superblock_t sb[2];
+    uint8_t raw[2 * 512];
+    read_sectors(REGION_START, raw, 2);
+    memcpy(&sb[0], raw, sizeof(sb[0]));
+    memcpy(&sb[1], raw + 512, sizeof(sb[1]));
+    return sb[1].checkpoint > sb[0].checkpoint ? 1 : 0;
+}
+
+static void check_resumed(const sector_log_stats_t *before, uint32_t recovered)
+{
+    sector_log_stats_t stats;
+    sector_log_get_stats(&stats);
+    TEST_CHECK_EQ(stats.recovered, recovered);
+    TEST_CHECK_EQ(stats.nonce, before->nonce);
+    TEST_CHECK_EQ(stats.next_lsn, before->next_lsn);
+    TEST_CHECK_EQ(stats.head, before->head);
+    TEST_CHECK_EQ(stats.wraps, before->wraps);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    /* A fresh, all zero card: no partition table */
+    s_card.fd = open(IMAGE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    TEST_CHECK(s_card.fd >= 0);
+    TEST_CHECK_EQ(ftruncate(s_card.fd, (off_t)IMAGE_SECTORS * 512), 0);
+    s_card.csd.capacity = IMAGE_SECTORS;
+    s_card.csd.sector_size = 512;
+
+    sector_log_config_t config = log_config(4);
+    sector_log_stats_t stats, before;
+    uint64_t lsn = 0;
+    uint32_t seed = 1;
+
+    /* Append: records follow each other from the first data sector, a checkpoint every 4 */
+    TEST_CHECK_EQ(sector_log_format(&config), ESP_OK);
+    sector_log_get_stats(&stats);
+    uint32_t nonce = stats.nonce;
+    TEST_CHECK_EQ(stats.start_sector, REGION_START);
+    TEST_CHECK_EQ(stats.head, SECTOR_LOG_DATA_SECTOR);
+    TEST_CHECK_EQ(stats.next_lsn, 0);
+
+    uint32_t head = SECTOR_LOG_DATA_SECTOR;
+    for (int i = 0; i < 10; i++) {
+        sector_log_location_t loc = append(lsn++, seed++);
+        TEST_CHECK_EQ(loc.sector, head);
+        head += loc.sectors;
+    }
+    for (uint64_t i = 0; i < lsn; i++) {
+        check_record(i, nonce);
+    }
+    sector_log_get_stats(&before);
+    TEST_CHECK_EQ(before.records, 10);
+    TEST_CHECK_EQ(before.head, head);
+    TEST_CHECK_EQ(before.checkpoints, 2 + 10 / 4);
+    TEST_CHECK(before.bounced > 0);
+
+    /* Power cut: the 2 records after the last checkpoint are rolled forward */
+    power_cut();
+    TEST_CHECK_EQ(sector_log_open(&config), ESP_OK);
+    check_resumed(&before, 10 % 4);
+
+    /* A clean close leaves nothing to roll forward */
+    sector_log_close();
+    TEST_CHECK_EQ(sector_log_open(&config), ESP_OK);
+    check_resumed(&before, 0);
+
+    /* Torn tail: the last record's data is written but its header is not */
+    append(lsn++, seed++);
+    sector_log_get_stats(&before);
+    sector_log_location_t torn = append(lsn, seed++);
+    uint8_t sector[512] = { 0 };
+    write_sectors(REGION_START + torn.sector, sector, 1);
+    power_cut();
+    TEST_CHECK_EQ(sector_log_open(&config), ESP_OK);
+    check_resumed(&before, 1);
+
+    /* The record is written again in its place */
+    TEST_CHECK_EQ(append(lsn, seed++).sector, torn.sector);
+    check_record(lsn, nonce);
+
+    /* A header sector cut short fails its CRC the same way */
+    read_sectors(REGION_START + torn.sector, sector, 1);
+    memset(sector + offsetof(sector_log_record_header_t, length), 0, 512 - offsetof(sector_log_record_header_t, length));
+    write_sectors(REGION_START + torn.sector, sector, 1);
+    power_cut();
+    TEST_CHECK_EQ(sector_log_open(&config), ESP_OK);
+    check_resumed(&before, 0);
+    append(lsn++, seed++);
+    check_record(lsn - 1, nonce);
+
+    /*
+     * Wrap, checkpointing only on wrap and close. The wrap checkpoint is
+     * torn by the power cut, so the log opens from the checkpoint before it
+     * and rolls forward over the end of the region and on from the start.
+     */
+    sector_log_close();
+    uint64_t closed_lsn = lsn;
+    config = log_config(0);
+    TEST_CHECK_EQ(sector_log_open(&config), ESP_OK);
+    uint64_t wrap_lsn = 0;
+    while (wrap_lsn == 0 || lsn < wrap_lsn + 3) {
+        sector_log_location_t loc = append(lsn++, seed++);
+        if (loc.sector == SECTOR_LOG_DATA_SECTOR) {
+            wrap_lsn = loc.lsn;
+        }
+        TEST_CHECK(lsn < MAX_LSN);
+    }
+    sector_log_get_stats(&before);
+    TEST_CHECK_EQ(before.wraps, 1);
+    TEST_CHECK_EQ(before.head, s_expected[lsn - 1].sector + 1 + (s_expected[lsn - 1].len + 511) / 512);
+
+    int wrap_copy = newest_superblock();
+    power_cut();
+    read_sectors(REGION_START + wrap_copy, sector, 1);
+    memset(sector + sizeof(sector_log_superblock_t) / 2, 0xFF, 512 - sizeof(sector_log_superblock_t) / 2);
+    write_sectors(REGION_START + wrap_copy, sector, 1);
+
+    /* Records from the last clean close up to the wrap, and the 3 after it */
+    TEST_CHECK_EQ(sector_log_open(&config), ESP_OK);
+    check_resumed(&before, (uint32_t)(lsn - closed_lsn));
+    for (uint64_t i = wrap_lsn; i < lsn; i++) {
+        check_record(i, nonce);
+    }
+
+    /* The log keeps its size until formatted */
+    sector_log_close();
+    config.sector_count = REGION_SECTORS * 2;
+    TEST_CHECK_EQ(sector_log_open(&config), ESP_ERR_INVALID_STATE);
+
+    /* Formatting starts over with a new nonce: the old records at the start are not taken */
+    TEST_CHECK_EQ(sector_log_format(&config), ESP_OK);
+    sector_log_get_stats(&stats);
+    TEST_CHECK(stats.nonce != nonce);
+    power_cut();
+    TEST_CHECK_EQ(sector_log_open(&config), ESP_OK);
+    sector_log_get_stats(&stats);
+    TEST_CHECK_EQ(stats.recovered, 0);
+    TEST_CHECK_EQ(stats.next_lsn, 0);
+    TEST_CHECK_EQ(stats.head, SECTOR_LOG_DATA_SECTOR);
+    sector_log_close();
+
+    /* With a partition table the region must lie after the last partition */
+    memset(sector, 0, sizeof(sector));
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+    uint8_t *entry = sector + 446;
+    entry[4] = 0x0C;                        /* FAT32 LBA */
+    entry[8] = 0x00, entry[9] = 0x08;       /* First sector 2048 */
+    entry[12] = 0xB8, entry[13] = 0x0B;     /* 3000 sectors */
+    write_sectors(0, sector, 1);
+    TEST_CHECK_EQ(sector_log_open(&config), ESP_ERR_INVALID_STATE);
+    config.start_sector = 0;
+    TEST_CHECK_EQ(sector_log_open(&config), ESP_OK);
+    sector_log_get_stats(&stats);
+    TEST_CHECK_EQ(stats.start_sector, SECTOR_LOG_AUTO_ALIGN);
+    sector_log_close();
+
+    /* A boot sector in sector 0 means FAT covers the whole card */
+    memset(sector, 0, sizeof(sector));
+    sector[0] = 0xEB;
+    sector[12] = 0x02;
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+    write_sectors(0, sector, 1);
+    TEST_CHECK_EQ(sector_log_open(&config), ESP_ERR_INVALID_STATE);
+
+    close(s_card.fd);
+    unlink(IMAGE_PATH);
+    return TEST_RESULT();
+}
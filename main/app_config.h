@@ -12,7 +12,14 @@
 
 /* Application constants */
 #define EXAMPLE_MAX_CHAR_SIZE 64
+#ifndef MOUNT_POINT
 #define MOUNT_POINT "/sdcard"
+#endif
+
+/* Photo file names when storing one JPEG file per frame, 8.3 compatible */
+#define PHOTO_NAME_PREFIX "IMG"
+#define PHOTO_NAME_EXT ".JPG"
+#define PHOTO_NAME_FORMAT "%s/" PHOTO_NAME_PREFIX "%05lu" PHOTO_NAME_EXT
 #define EXAMPLE_IS_UHS1 (CONFIG_EXAMPLE_SDMMC_SPEED_UHS_I_SDR50 || CONFIG_EXAMPLE_SDMMC_SPEED_UHS_I_DDR50)
 
 /* ESP32-CAM (AI-Thinker) Pin Definitions */
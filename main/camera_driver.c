@@ -5,10 +5,41 @@
 
 #include "camera_driver.h"
 #include "app_config.h"
+#include "jpeg_dc.h"
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
 
 static const char *TAG = "camera_driver";
 
+#ifndef CONFIG_APP_CAMERA_MONITOR_QUALITY
+#define CONFIG_APP_CAMERA_MONITOR_QUALITY       12
+#endif
+#ifndef CONFIG_APP_CAMERA_PROFILE_SETTLE_FRAMES
+#define CONFIG_APP_CAMERA_PROFILE_SETTLE_FRAMES 1
+#endif
+
+#if defined(CONFIG_APP_CAMERA_MONITOR_QVGA)
+#define CAMERA_MONITOR_FRAMESIZE    FRAMESIZE_QVGA
+#elif defined(CONFIG_APP_CAMERA_MONITOR_CIF)
+#define CAMERA_MONITOR_FRAMESIZE    FRAMESIZE_CIF
+#elif defined(CONFIG_APP_CAMERA_MONITOR_SVGA)
+#define CAMERA_MONITOR_FRAMESIZE    FRAMESIZE_SVGA
+#else
+#define CAMERA_MONITOR_FRAMESIZE    FRAMESIZE_VGA
+#endif
+
+/* The camera is initialized in the capture profile so the frame buffers fit its frames */
+#define CAMERA_CAPTURE_FRAMESIZE    FRAMESIZE_UXGA
+#define CAMERA_CAPTURE_QUALITY      4
+
+/* Frames beyond the buffered ones and the settle frames before a switch gives up */
+#define CAMERA_PROFILE_EXTRA_FRAMES 3
+
+/* A frame kept from a profile switch is only handed out while it is this fresh */
+#define CAMERA_HELD_FRAME_MAX_AGE_US    100000
+
 /* Camera Configuration */
 #if ESP_CAMERA_SUPPORTED
 static camera_config_t camera_config = {
@@ -39,12 +70,110 @@ static camera_config_t camera_config = {
 
     /* Image configuration */
     .pixel_format   = PIXFORMAT_JPEG,
-    .frame_size     = FRAMESIZE_UXGA,    // UXGA for better performance
-    .jpeg_quality   = 4,                // 0-63, lower = higher quality
-    .fb_count       = 1,
+    .frame_size     = CAMERA_CAPTURE_FRAMESIZE,    // UXGA for better performance
+    .jpeg_quality   = CAMERA_CAPTURE_QUALITY,      // 0-63, lower = higher quality
+    .fb_count       = CONFIG_APP_CAMERA_FB_COUNT,
     .fb_location    = CAMERA_FB_IN_PSRAM,
+#ifdef CONFIG_APP_CAMERA_GRAB_LATEST
+    .grab_mode      = CAMERA_GRAB_LATEST,   // Always deliver the most recent frame
+#else
     .grab_mode      = CAMERA_GRAB_WHEN_EMPTY,
+#endif
+};
+
+/**
+ * @brief Frame size and quality of a sensor profile
+ */
+typedef struct {
+    framesize_t frame_size;
+    int jpeg_quality;
+    uint8_t settle_frames;      /* Frames discarded after the first frame of the new size */
+} camera_profile_config_t;
+
+/* The capture profile's settings change at runtime through camera_set_capture_settings() */
+static camera_profile_config_t s_profiles[CAMERA_PROFILE_MAX] = {
+    [CAMERA_PROFILE_MONITOR] = {
+        .frame_size = CAMERA_MONITOR_FRAMESIZE,
+        .jpeg_quality = CONFIG_APP_CAMERA_MONITOR_QUALITY,
+        .settle_frames = CONFIG_APP_CAMERA_PROFILE_SETTLE_FRAMES,
+    },
+    [CAMERA_PROFILE_CAPTURE] = {
+        .frame_size = CAMERA_CAPTURE_FRAMESIZE,
+        .jpeg_quality = CAMERA_CAPTURE_QUALITY,
+        .settle_frames = CONFIG_APP_CAMERA_PROFILE_SETTLE_FRAMES,
+    },
+};
+
+/*
+ * OV2640 registers written by set_framesize() and set_quality(), in the order
+ * the sensor driver writes them. Bit 8 selects the bank (1 = sensor, 0 = DSP),
+ * as expected by get_reg()/set_reg().
+ */
+static const uint16_t s_ov2640_profile_regs[] = {
+    /* Sensor bank: readout mode, window, clock, banding */
+    0x112, 0x103, 0x132, 0x117, 0x118, 0x119, 0x11A, 0x111, 0x14F, 0x150,
+    0x15A, 0x16D, 0x13D, 0x139, 0x135, 0x122, 0x137, 0x123, 0x134, 0x106,
+    0x107, 0x10D, 0x10E, 0x142, 0x14C,
+    /* DSP bank: input size, output size, zoom, DVP clock, JPEG quality */
+    0x0C0, 0x0C1, 0x08C, 0x051, 0x052, 0x053, 0x054, 0x055, 0x057, 0x086,
+    0x050, 0x05A, 0x05B, 0x05C, 0x0D3, 0x044,
+};
+
+#define OV2640_REG_R_BYPASS         0x005   /* DSP bank */
+#define OV2640_R_BYPASS_DSP_BYPASS  0x01
+#define OV2640_R_BYPASS_DSP_EN      0x00
+
+#define CAMERA_PROFILE_MAX_REGS     (sizeof(s_ov2640_profile_regs) / sizeof(s_ov2640_profile_regs[0]))
+
+/**
+ * @brief Register values read back after a profile was applied by the sensor driver
+ */
+typedef struct {
+    bool valid;
+    uint8_t values[CAMERA_PROFILE_MAX_REGS];
+} camera_reg_cache_t;
+
+/* Registers cached for the detected sensor, NULL if it has no cache support */
+static const uint16_t *s_cache_regs = NULL;
+static size_t s_cache_reg_count = 0;
+static camera_reg_cache_t s_reg_cache[CAMERA_PROFILE_MAX];
+
+static camera_profile_t s_profile = CAMERA_PROFILE_CAPTURE;
+
+/* The sensor registers are as the driver set them for s_profile; false after a failed switch */
+static bool s_profile_applied = true;
+
+/* First frame of the new profile, returned by the next capture */
+static camera_fb_t *s_held_fb = NULL;
+static int64_t s_held_us = 0;
+
+/* Capture profile frame sizes by size step; none exceeds the frame buffers sized at init */
+static const framesize_t s_capture_framesizes[] = {
+    CAMERA_CAPTURE_FRAMESIZE, FRAMESIZE_SXGA, FRAMESIZE_XGA, FRAMESIZE_SVGA,
 };
+
+/* Capture settings requested from another task, applied by the capturing task:
+ * CAMERA_REQUEST_PENDING | size step << 8 | quality, 0 when none is pending */
+#define CAMERA_REQUEST_PENDING      0x10000UL
+static uint32_t s_capture_request = 0;
+
+/**
+ * @brief Accumulated switch statistics of one profile
+ */
+typedef struct {
+    uint32_t switches;
+    uint32_t cached_switches;
+    uint32_t cache_misses;
+    uint32_t failures;
+    uint64_t apply_us;
+    uint64_t switch_us;
+    uint32_t max_switch_us;
+    uint32_t frames_discarded;
+    uint32_t max_frames_discarded;
+} camera_profile_counters_t;
+
+static portMUX_TYPE s_profile_lock = portMUX_INITIALIZER_UNLOCKED;
+static camera_profile_counters_t s_profile_counters[CAMERA_PROFILE_MAX];
 #endif
 
 esp_err_t camera_init(void)
@@ -57,6 +186,16 @@ esp_err_t camera_init(void)
         ESP_LOGE(TAG, "Camera initialization failed: %s", esp_err_to_name(err));
         return err;
     }
+
+    s_profile = CAMERA_PROFILE_CAPTURE;
+    s_profile_applied = true;
+#ifdef CONFIG_APP_CAMERA_PROFILE_CACHE
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (sensor != NULL && sensor->id.PID == OV2640_PID) {
+        s_cache_regs = s_ov2640_profile_regs;
+        s_cache_reg_count = CAMERA_PROFILE_MAX_REGS;
+    }
+#endif
     
     ESP_LOGI(TAG, "Camera initialized successfully");
     return ESP_OK;
@@ -66,18 +205,166 @@ esp_err_t camera_init(void)
 #endif
 }
 
+#if ESP_CAMERA_SUPPORTED
+/**
+ * @brief Read the current exposure and gain from the sensor registers
+ * @return false if the sensor model is not known or a read failed
+ */
+static bool camera_read_exposure(sensor_t *sensor, uint32_t *exposure, uint16_t *gain)
+{
+    int r[5];
+
+    switch (sensor->id.PID) {
+    case OV2640_PID:
+        /* AEC[15:10] in REG45, AEC[9:2] in AEC, AEC[1:0] in REG04; GAIN (sensor bank) */
+        r[0] = sensor->get_reg(sensor, 0x145, 0x3F);
+        r[1] = sensor->get_reg(sensor, 0x110, 0xFF);
+        r[2] = sensor->get_reg(sensor, 0x104, 0x03);
+        r[3] = sensor->get_reg(sensor, 0x100, 0xFF);
+        if (r[0] < 0 || r[1] < 0 || r[2] < 0 || r[3] < 0) {
+            return false;
+        }
+        *exposure = ((uint32_t)r[0] << 10) | ((uint32_t)r[1] << 2) | (uint32_t)r[2];
+        *gain = (uint16_t)r[3];
+        return true;
+    case OV3660_PID:
+    case OV5640_PID:
+        /* AEC PK exposure 0x3500-0x3502 (20 bits), real gain 0x350A-0x350B (10 bits) */
+        r[0] = sensor->get_reg(sensor, 0x3500, 0x0F);
+        r[1] = sensor->get_reg(sensor, 0x3501, 0xFF);
+        r[2] = sensor->get_reg(sensor, 0x3502, 0xFF);
+        r[3] = sensor->get_reg(sensor, 0x350A, 0x03);
+        r[4] = sensor->get_reg(sensor, 0x350B, 0xFF);
+        if (r[0] < 0 || r[1] < 0 || r[2] < 0 || r[3] < 0 || r[4] < 0) {
+            return false;
+        }
+        *exposure = ((uint32_t)r[0] << 16) | ((uint32_t)r[1] << 8) | (uint32_t)r[2];
+        *gain = (uint16_t)((r[3] << 8) | r[4]);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Check that two readings differ by at most @p pct percent (or one unit)
+ */
+static bool camera_reading_stable(uint32_t a, uint32_t b, uint8_t pct)
+{
+    uint32_t diff = a > b ? a - b : b - a;
+    uint32_t larger = a > b ? a : b;
+    return diff <= 1 || (uint64_t)diff * 100 <= (uint64_t)larger * pct;
+}
+#endif
+
+esp_err_t camera_warmup(const camera_warmup_config_t *config, camera_warmup_result_t *result)
+{
+#if ESP_CAMERA_SUPPORTED
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (config == NULL || sensor == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    camera_warmup_result_t local = { 0 };
+    camera_warmup_result_t *res = result ? result : &local;
+    memset(res, 0, sizeof(*res));
+
+    int64_t start = esp_timer_get_time();
+    int64_t deadline = start + (int64_t)config->timeout_ms * 1000;
+    uint32_t stable = 0;
+    size_t prev_len = 0;
+    uint32_t prev_exposure = 0;
+    uint16_t prev_gain = 0;
+
+    while (esp_timer_get_time() < deadline) {
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (fb == NULL) {
+            ESP_LOGW(TAG, "Failed to get frame buffer during warm-up");
+            continue;
+        }
+        size_t len = fb->len;
+        esp_camera_fb_return(fb);
+        res->frames++;
+
+        uint32_t exposure = 0;
+        uint16_t gain = 0;
+        bool known = camera_read_exposure(sensor, &exposure, &gain);
+
+        /* Each frame is compared with the one before it */
+        bool steady = (res->frames > config->min_frames && prev_len != 0 &&
+                       camera_reading_stable(len, prev_len, config->size_tolerance_pct));
+        if (steady && known && res->exposure_known) {
+            steady = camera_reading_stable(exposure, prev_exposure, config->exposure_tolerance_pct) &&
+                     camera_reading_stable(gain, prev_gain, config->exposure_tolerance_pct);
+        }
+        stable = steady ? stable + 1 : 0;
+
+        prev_len = len;
+        prev_exposure = exposure;
+        prev_gain = gain;
+        res->exposure_known = known;
+        res->exposure = exposure;
+        res->gain = gain;
+        res->last_len = len;
+
+        if (stable >= config->stable_frames) {
+            res->converged = true;
+            break;
+        }
+    }
+    res->elapsed_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+
+    camera_sensor_info_t *info = esp_camera_sensor_get_info(&sensor->id);
+    const char *model = (info && info->name) ? info->name : "unknown sensor";
+    if (!res->converged) {
+        ESP_LOGW(TAG, "Warm-up (%s): not converged after %lu frames in %lu ms, continuing",
+                 model, (unsigned long)res->frames, (unsigned long)res->elapsed_ms);
+        return ESP_ERR_TIMEOUT;
+    }
+    if (res->exposure_known) {
+        ESP_LOGI(TAG, "Warm-up (%s): ready after %lu frames in %lu ms (exposure %lu, gain %u, %zu bytes)",
+                 model, (unsigned long)res->frames, (unsigned long)res->elapsed_ms,
+                 (unsigned long)res->exposure, res->gain, res->last_len);
+    } else {
+        ESP_LOGI(TAG, "Warm-up (%s): ready after %lu frames in %lu ms (JPEG size only, %zu bytes)",
+                 model, (unsigned long)res->frames, (unsigned long)res->elapsed_ms, res->last_len);
+    }
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+#if ESP_CAMERA_SUPPORTED
+static void camera_apply_capture_settings(int quality, uint8_t size_step);
+#endif
+
 camera_fb_t* camera_capture_photo(void)
 {
 #if ESP_CAMERA_SUPPORTED
-    ESP_LOGI(TAG, "Capturing photo...");
-    
-    camera_fb_t *frame_buffer = esp_camera_fb_get();
+    ESP_LOGD(TAG, "Capturing photo...");
+
+    uint32_t request = __atomic_exchange_n(&s_capture_request, 0, __ATOMIC_ACQUIRE);
+    if (request != 0) {
+        camera_apply_capture_settings((int)(request & 0xFF), (uint8_t)((request >> 8) & 0xFF));
+    }
+
+    /* The frame that completed a profile switch, unless it has gone stale */
+    camera_fb_t *frame_buffer = s_held_fb;
+    s_held_fb = NULL;
+    if (frame_buffer != NULL && esp_timer_get_time() - s_held_us > CAMERA_HELD_FRAME_MAX_AGE_US) {
+        esp_camera_fb_return(frame_buffer);
+        frame_buffer = NULL;
+    }
+    if (frame_buffer == NULL) {
+        frame_buffer = esp_camera_fb_get();
+    }
     if (frame_buffer == NULL) {
         ESP_LOGE(TAG, "Failed to capture photo");
         return NULL;
     }
     
-    ESP_LOGI(TAG, "Photo captured successfully (%zu bytes)", frame_buffer->len);
+    ESP_LOGD(TAG, "Photo captured successfully (%zu bytes)", frame_buffer->len);
     return frame_buffer;
 #else
     ESP_LOGW(TAG, "Camera not supported on this platform");
@@ -102,3 +389,388 @@ bool camera_is_supported(void)
     return false;
 #endif
 }
+
+#if ESP_CAMERA_SUPPORTED
+/**
+ * @brief Apply a profile through the sensor driver
+ */
+static esp_err_t camera_apply_profile(sensor_t *sensor, const camera_profile_config_t *config)
+{
+    if (sensor->set_framesize(sensor, config->frame_size) != 0 ||
+        sensor->set_quality(sensor, config->jpeg_quality) != 0) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Read back the registers of the active profile into its cache
+ */
+static void camera_snapshot_registers(sensor_t *sensor, camera_profile_t profile)
+{
+    camera_reg_cache_t *cache = &s_reg_cache[profile];
+
+    cache->valid = false;
+    for (size_t i = 0; i < s_cache_reg_count; i++) {
+        int value = sensor->get_reg(sensor, s_cache_regs[i], 0xFF);
+        if (value < 0) {
+            ESP_LOGW(TAG, "Failed to read register 0x%03x, profile %d not cached",
+                     s_cache_regs[i], (int)profile);
+            return;
+        }
+        cache->values[i] = (uint8_t)value;
+    }
+    cache->valid = true;
+}
+
+/**
+ * @brief Switch profiles by writing the cached registers that differ
+ *
+ * The DSP is bypassed while the window and output size are inconsistent,
+ * as the sensor driver does. The driver's status is updated by hand so
+ * frame buffers report the new size.
+ */
+static esp_err_t camera_replay_registers(sensor_t *sensor, camera_profile_t from, camera_profile_t to)
+{
+    const uint8_t *current = s_reg_cache[from].values;
+    const uint8_t *target = s_reg_cache[to].values;
+
+    if (sensor->set_reg(sensor, OV2640_REG_R_BYPASS, 0xFF, OV2640_R_BYPASS_DSP_BYPASS) != 0) {
+        return ESP_FAIL;
+    }
+    esp_err_t ret = ESP_OK;
+    for (size_t i = 0; i < s_cache_reg_count && ret == ESP_OK; i++) {
+        if (current[i] != target[i] &&
+            sensor->set_reg(sensor, s_cache_regs[i], 0xFF, target[i]) != 0) {
+            ret = ESP_FAIL;
+        }
+    }
+    if (sensor->set_reg(sensor, OV2640_REG_R_BYPASS, 0xFF, OV2640_R_BYPASS_DSP_EN) != 0) {
+        ret = ESP_FAIL;
+    }
+
+    sensor->status.framesize = s_profiles[to].frame_size;
+    sensor->status.quality = s_profiles[to].jpeg_quality;
+    return ret;
+}
+
+/**
+ * @brief Discard frames until one has the profile's size and the settle frames have passed
+ *
+ * Frames already buffered by the driver, and the one being exposed during
+ * the switch, still have the old size; the JPEG header is checked because
+ * the driver labels every frame with the configured size. The first usable
+ * frame is kept for the next capture.
+ */
+static esp_err_t camera_wait_for_profile(const camera_profile_config_t *config, uint32_t *discarded)
+{
+    uint16_t want_width = resolution[config->frame_size].width;
+    uint16_t want_height = resolution[config->frame_size].height;
+    uint32_t limit = CONFIG_APP_CAMERA_FB_COUNT + CAMERA_PROFILE_EXTRA_FRAMES + config->settle_frames;
+    uint32_t settled = 0;
+
+    for (uint32_t i = 0; i < limit; i++) {
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (fb == NULL) {
+            continue;
+        }
+
+        uint16_t width = 0;
+        uint16_t height = 0;
+        bool match = (jpeg_dc_get_size(fb->buf, fb->len, &width, &height) == ESP_OK &&
+                      width == want_width && height == want_height);
+        if (match && settled == config->settle_frames) {
+            s_held_fb = fb;
+            s_held_us = esp_timer_get_time();
+            return ESP_OK;
+        }
+        if (match) {
+            settled++;
+        }
+        (*discarded)++;
+        esp_camera_fb_return(fb);
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+/**
+ * @brief Change the capture profile's quality and frame size, from the capturing task
+ *
+ * In the capture profile the sensor is updated at once, waiting for the new
+ * size when it changes; in the monitor profile the next switch applies it.
+ * The capture profile's register cache no longer matches and is dropped.
+ */
+static void camera_apply_capture_settings(int quality, uint8_t size_step)
+{
+    camera_profile_config_t *config = &s_profiles[CAMERA_PROFILE_CAPTURE];
+    size_t steps = sizeof(s_capture_framesizes) / sizeof(s_capture_framesizes[0]);
+    framesize_t frame_size = s_capture_framesizes[size_step < steps ? size_step : steps - 1];
+
+    if (quality == config->jpeg_quality && frame_size == config->frame_size) {
+        return;
+    }
+    bool resize = (frame_size != config->frame_size);
+    config->jpeg_quality = quality;
+    config->frame_size = frame_size;
+    s_reg_cache[CAMERA_PROFILE_CAPTURE].valid = false;
+
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (s_profile != CAMERA_PROFILE_CAPTURE || sensor == NULL) {
+        return;
+    }
+
+    esp_err_t ret;
+    if (resize) {
+        if (s_held_fb != NULL) {
+            esp_camera_fb_return(s_held_fb);
+            s_held_fb = NULL;
+        }
+        uint32_t discarded = 0;
+        ret = camera_apply_profile(sensor, config);
+        if (ret == ESP_OK) {
+            ret = camera_wait_for_profile(config, &discarded);
+        }
+    } else {
+        ret = (sensor->set_quality(sensor, quality) == 0) ? ESP_OK : ESP_FAIL;
+    }
+    s_profile_applied = (ret == ESP_OK);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to apply capture quality %d, %ux%u: %s", quality,
+                 resolution[frame_size].width, resolution[frame_size].height, esp_err_to_name(ret));
+    }
+}
+#endif
+
+esp_err_t camera_set_profile(camera_profile_t profile)
+{
+#if ESP_CAMERA_SUPPORTED
+    if (profile >= CAMERA_PROFILE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (profile == s_profile) {
+        return ESP_OK;
+    }
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (sensor == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const camera_profile_config_t *config = &s_profiles[profile];
+    camera_profile_t previous = s_profile;
+    int64_t start = esp_timer_get_time();
+
+    /* A held frame belongs to the old profile */
+    if (s_held_fb != NULL) {
+        esp_camera_fb_return(s_held_fb);
+        s_held_fb = NULL;
+    }
+
+    /* The profile being left is still applied exactly as the driver set it, unless switching to it failed */
+    if (s_cache_regs != NULL && s_profile_applied && !s_reg_cache[previous].valid) {
+        camera_snapshot_registers(sensor, previous);
+    }
+
+    bool cached = (s_cache_regs != NULL && s_reg_cache[previous].valid && s_reg_cache[profile].valid);
+    esp_err_t ret = cached ? camera_replay_registers(sensor, previous, profile)
+                           : camera_apply_profile(sensor, config);
+    int64_t applied = esp_timer_get_time();
+
+    uint32_t discarded = 0;
+    if (ret == ESP_OK) {
+        ret = camera_wait_for_profile(config, &discarded);
+    }
+
+    bool cache_miss = false;
+    if (ret != ESP_OK && cached) {
+        /* The sensor is in an unknown state: drop the cache and set the profile up from scratch */
+        ESP_LOGW(TAG, "Cached switch to profile %d failed (%s), using full setup",
+                 (int)profile, esp_err_to_name(ret));
+        memset(s_reg_cache, 0, sizeof(s_reg_cache));
+        cache_miss = true;
+        cached = false;
+        ret = camera_apply_profile(sensor, config);
+        applied = esp_timer_get_time();
+        if (ret == ESP_OK) {
+            ret = camera_wait_for_profile(config, &discarded);
+        }
+    }
+
+    /* Even on failure the sensor was last told to use this profile, but no
+     * cached register set matches its state any more */
+    s_profile = profile;
+    s_profile_applied = (ret == ESP_OK);
+    if (ret != ESP_OK) {
+        memset(s_reg_cache, 0, sizeof(s_reg_cache));
+    } else if (!cached && s_cache_regs != NULL) {
+        camera_snapshot_registers(sensor, profile);
+    }
+
+    int64_t end = esp_timer_get_time();
+    uint32_t switch_us = (uint32_t)(end - start);
+
+    portENTER_CRITICAL(&s_profile_lock);
+    camera_profile_counters_t *counters = &s_profile_counters[profile];
+    counters->switches++;
+    if (cached) {
+        counters->cached_switches++;
+    }
+    if (cache_miss) {
+        counters->cache_misses++;
+    }
+    counters->frames_discarded += discarded;
+    if (discarded > counters->max_frames_discarded) {
+        counters->max_frames_discarded = discarded;
+    }
+    if (ret == ESP_OK) {
+        counters->apply_us += applied - start;
+        counters->switch_us += switch_us;
+        if (switch_us > counters->max_switch_us) {
+            counters->max_switch_us = switch_us;
+        }
+    } else {
+        counters->failures++;
+    }
+    portEXIT_CRITICAL(&s_profile_lock);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to switch to profile %d: %s", (int)profile, esp_err_to_name(ret));
+        return ret;
+    }
+    ESP_LOGD(TAG, "Profile %d: %s switch in %lu us, %lu frames discarded", (int)profile,
+             cached ? "cached" : "full", (unsigned long)switch_us, (unsigned long)discarded);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void camera_set_capture_settings(uint8_t quality, uint8_t size_step)
+{
+#if ESP_CAMERA_SUPPORTED
+    uint32_t request = CAMERA_REQUEST_PENDING | ((uint32_t)size_step << 8) | (quality & 0x3F);
+    __atomic_store_n(&s_capture_request, request, __ATOMIC_RELEASE);
+#endif
+}
+
+uint8_t camera_get_capture_quality(void)
+{
+#if ESP_CAMERA_SUPPORTED
+    return (uint8_t)s_profiles[CAMERA_PROFILE_CAPTURE].jpeg_quality;
+#else
+    return 0;
+#endif
+}
+
+size_t camera_get_max_frame_size(void)
+{
+#if ESP_CAMERA_SUPPORTED
+    /* esp32-camera sizes its JPEG frame buffers to a fifth of the pixel count */
+    return (size_t)resolution[CAMERA_CAPTURE_FRAMESIZE].width * resolution[CAMERA_CAPTURE_FRAMESIZE].height / 5;
+#else
+    return 0;
+#endif
+}
+
+camera_profile_t camera_get_profile(void)
+{
+#if ESP_CAMERA_SUPPORTED
+    return s_profile;
+#else
+    return CAMERA_PROFILE_CAPTURE;
+#endif
+}
+
+void camera_get_profile_stats(camera_profile_t profile, camera_profile_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+#if ESP_CAMERA_SUPPORTED
+    if (profile >= CAMERA_PROFILE_MAX) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_profile_lock);
+    const camera_profile_counters_t *counters = &s_profile_counters[profile];
+    uint32_t succeeded = counters->switches - counters->failures;
+    stats->switches = counters->switches;
+    stats->cached_switches = counters->cached_switches;
+    stats->cache_misses = counters->cache_misses;
+    stats->failures = counters->failures;
+    stats->avg_apply_us = succeeded ? (uint32_t)(counters->apply_us / succeeded) : 0;
+    stats->avg_switch_us = succeeded ? (uint32_t)(counters->switch_us / succeeded) : 0;
+    stats->max_switch_us = counters->max_switch_us;
+    stats->frames_discarded = counters->frames_discarded;
+    stats->max_frames_discarded = counters->max_frames_discarded;
+    portEXIT_CRITICAL(&s_profile_lock);
+#endif
+}
+
+void camera_log_profile_stats(void)
+{
+    static const char *const names[CAMERA_PROFILE_MAX] = { "monitor", "capture" };
+
+    for (int profile = 0; profile < CAMERA_PROFILE_MAX; profile++) {
+        camera_profile_stats_t stats;
+        camera_get_profile_stats((camera_profile_t)profile, &stats);
+        if (stats.switches == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "Profile %s: %lu switches (%lu cached, %lu cache misses, %lu failed), "
+                 "apply %lu us, to first frame avg %lu us max %lu us, "
+                 "%lu frames discarded (max %lu per switch)",
+                 names[profile], (unsigned long)stats.switches, (unsigned long)stats.cached_switches,
+                 (unsigned long)stats.cache_misses, (unsigned long)stats.failures,
+                 (unsigned long)stats.avg_apply_us, (unsigned long)stats.avg_switch_us,
+                 (unsigned long)stats.max_switch_us, (unsigned long)stats.frames_discarded,
+                 (unsigned long)stats.max_frames_discarded);
+    }
+}
+
+#if ESP_CAMERA_SUPPORTED
+static esp_err_t camera_source_acquire(void *ctx, capture_frame_t *frame)
+{
+    camera_fb_t *fb = camera_capture_photo();
+    if (fb == NULL) {
+        return ESP_FAIL;
+    }
+
+    frame->buf = fb->buf;
+    frame->len = fb->len;
+    frame->width = fb->width;
+    frame->height = fb->height;
+    frame->timestamp_us = esp_timer_get_time();
+    frame->priv = fb;
+    return ESP_OK;
+}
+
+static void camera_source_release(void *ctx, capture_frame_t *frame)
+{
+    camera_return_frame_buffer((camera_fb_t *)frame->priv);
+    frame->priv = NULL;
+}
+
+#ifdef CONFIG_APP_CAMERA_MONITOR_PROFILE
+static esp_err_t camera_source_set_mode(void *ctx, capture_source_mode_t mode)
+{
+    return camera_set_profile(mode == CAPTURE_SOURCE_MODE_CAPTURE ? CAMERA_PROFILE_CAPTURE
+                                                                 : CAMERA_PROFILE_MONITOR);
+}
+#endif
+
+static const capture_source_t camera_source = {
+    .acquire = camera_source_acquire,
+    .release = camera_source_release,
+#ifdef CONFIG_APP_CAMERA_MONITOR_PROFILE
+    .set_mode = camera_source_set_mode,
+#endif
+    .ctx = NULL,
+};
+#endif
+
+const capture_source_t* camera_get_frame_source(void)
+{
+#if ESP_CAMERA_SUPPORTED
+    return &camera_source;
+#else
+    return NULL;
+#endif
+}
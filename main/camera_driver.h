@@ -7,17 +7,109 @@
 
 #include "esp_err.h"
 #include "esp_camera.h"
+#include "capture_frame.h"
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief Sensor profile
+ */
+typedef enum {
+    CAMERA_PROFILE_MONITOR = 0,     /**< Small frames while waiting for triggers */
+    CAMERA_PROFILE_CAPTURE,         /**< Full resolution frames for storage */
+    CAMERA_PROFILE_MAX,
+} camera_profile_t;
+
+/**
+ * @brief Profile switch statistics, per target profile
+ */
+typedef struct {
+    uint32_t switches;              /**< Switches into the profile */
+    uint32_t cached_switches;       /**< Switches done by replaying cached registers */
+    uint32_t cache_misses;          /**< Cached switches that failed and fell back to the full setup */
+    uint32_t failures;              /**< Switches that did not produce a frame of the new size */
+    uint32_t avg_apply_us;          /**< Average time to write the sensor registers */
+    uint32_t avg_switch_us;         /**< Average time from the request to the first usable frame */
+    uint32_t max_switch_us;         /**< Longest time from the request to the first usable frame */
+    uint32_t frames_discarded;      /**< Frames dropped while switching */
+    uint32_t max_frames_discarded;  /**< Most frames dropped by a single switch */
+} camera_profile_stats_t;
+
+#ifndef CONFIG_APP_CAMERA_WARMUP_TIMEOUT_MS
+#define CONFIG_APP_CAMERA_WARMUP_TIMEOUT_MS         3000
+#endif
+#ifndef CONFIG_APP_CAMERA_WARMUP_MIN_FRAMES
+#define CONFIG_APP_CAMERA_WARMUP_MIN_FRAMES         3
+#endif
+#ifndef CONFIG_APP_CAMERA_WARMUP_STABLE_FRAMES
+#define CONFIG_APP_CAMERA_WARMUP_STABLE_FRAMES      3
+#endif
+#ifndef CONFIG_APP_CAMERA_WARMUP_SIZE_TOLERANCE
+#define CONFIG_APP_CAMERA_WARMUP_SIZE_TOLERANCE     5
+#endif
+#ifndef CONFIG_APP_CAMERA_WARMUP_EXPOSURE_TOLERANCE
+#define CONFIG_APP_CAMERA_WARMUP_EXPOSURE_TOLERANCE 5
+#endif
+
+/**
+ * @brief Sensor warm-up configuration
+ */
+typedef struct {
+    uint32_t timeout_ms;            /**< Give up waiting for convergence after this long */
+    uint8_t min_frames;             /**< Frames always discarded before checking */
+    uint8_t stable_frames;          /**< Consecutive stable frames that mark the sensor ready */
+    uint8_t size_tolerance_pct;     /**< Largest JPEG size change between stable frames, percent */
+    uint8_t exposure_tolerance_pct; /**< Largest exposure or gain change between stable frames, percent */
+} camera_warmup_config_t;
+
+/**
+ * @brief Default warm-up configuration from Kconfig
+ */
+#define CAMERA_WARMUP_DEFAULT_CONFIG() {                                        \
+    .timeout_ms             = CONFIG_APP_CAMERA_WARMUP_TIMEOUT_MS,              \
+    .min_frames             = CONFIG_APP_CAMERA_WARMUP_MIN_FRAMES,              \
+    .stable_frames          = CONFIG_APP_CAMERA_WARMUP_STABLE_FRAMES,           \
+    .size_tolerance_pct     = CONFIG_APP_CAMERA_WARMUP_SIZE_TOLERANCE,          \
+    .exposure_tolerance_pct = CONFIG_APP_CAMERA_WARMUP_EXPOSURE_TOLERANCE,      \
+}
+
+/**
+ * @brief Outcome of a sensor warm-up
+ */
+typedef struct {
+    bool converged;                 /**< Frame statistics settled before the timeout */
+    uint32_t frames;                /**< Frames discarded */
+    uint32_t elapsed_ms;            /**< Time until ready or timed out */
+    bool exposure_known;            /**< Exposure and gain could be read from this sensor model */
+    uint32_t exposure;              /**< Last exposure reading, sensor units */
+    uint16_t gain;                  /**< Last gain reading, sensor units */
+    size_t last_len;                /**< Size of the last JPEG frame */
+} camera_warmup_result_t;
+
 /**
  * @brief Initialize the camera module
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t camera_init(void);
 
+/**
+ * @brief Discard frames until auto exposure has converged
+ *
+ * The sensor is ready once consecutive frames have a stable JPEG size and,
+ * on sensors whose registers are known (OV2640, OV3660, OV5640), stable
+ * exposure and gain readings. Logs the warm-up time and frame count.
+ *
+ * @param config Warm-up configuration
+ * @param[out] result Warm-up outcome (may be NULL)
+ * @return ESP_OK once converged, ESP_ERR_TIMEOUT if the timeout passed first
+ *         (the camera is still usable), error code otherwise
+ */
+esp_err_t camera_warmup(const camera_warmup_config_t *config, camera_warmup_result_t *result);
+
 /**
  * @brief Capture a photo and return the frame buffer
  * @return Pointer to camera frame buffer on success, NULL on failure
@@ -37,6 +129,64 @@ void camera_return_frame_buffer(camera_fb_t* fb);
  */
 bool camera_is_supported(void);
 
+/**
+ * @brief Get a frame source backed by the camera driver
+ * @return Frame source for the capture pipeline, NULL if camera is not supported
+ */
+const capture_source_t* camera_get_frame_source(void);
+
+/**
+ * @brief Switch the sensor to another profile
+ *
+ * Changes the frame size and JPEG quality through the sensor handle, without
+ * re-initializing the camera, then discards frames until one has the new
+ * size. That frame is kept and returned by the next camera_capture_photo().
+ * Call from the task that captures frames.
+ *
+ * @param profile Profile to switch to
+ * @return ESP_OK on success (or if already active), ESP_ERR_TIMEOUT if no frame
+ *         of the new size arrived, error code otherwise
+ */
+esp_err_t camera_set_profile(camera_profile_t profile);
+
+/**
+ * @brief Request new JPEG quality and frame size for the capture profile
+ *
+ * Safe from any task; the capturing task applies the latest request before
+ * its next capture. A frame size change discards frames until the new size
+ * arrives, as a profile switch does.
+ *
+ * @param quality JPEG quality, 0-63, lower is better
+ * @param size_step 0 for UXGA, then SXGA, XGA and SVGA
+ */
+void camera_set_capture_settings(uint8_t quality, uint8_t size_step);
+
+/**
+ * @brief Get the JPEG quality of the capture profile
+ */
+uint8_t camera_get_capture_quality(void);
+
+/**
+ * @brief Get the largest JPEG frame the camera can deliver at the capture frame size
+ * @return Size of the driver's frame buffers in bytes, 0 if the camera is not supported
+ */
+size_t camera_get_max_frame_size(void);
+
+/**
+ * @brief Get the active profile (CAMERA_PROFILE_CAPTURE after camera_init())
+ */
+camera_profile_t camera_get_profile(void);
+
+/**
+ * @brief Get a snapshot of the switch statistics of a profile
+ */
+void camera_get_profile_stats(camera_profile_t profile, camera_profile_stats_t *stats);
+
+/**
+ * @brief Log the switch statistics of every profile
+ */
+void camera_log_profile_stats(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,78 @@
+/**
+ * @file capture_frame.h
+ * @brief Frame descriptor and frame source interface shared by the capture modules
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Motion score of frames that were not scored */
+#define CAPTURE_FRAME_NO_SCORE  0xFFFF
+
+/** Trigger source of software triggers */
+#define CAPTURE_TRIGGER_SOURCE_SOFTWARE (-1)
+
+/** Trigger source of time-lapse schedule slots */
+#define CAPTURE_TRIGGER_SOURCE_SCHEDULE (-2)
+
+/**
+ * @brief Event that caused a capture
+ */
+typedef struct {
+    uint32_t id;            /**< Trigger event id, 0 for untriggered captures */
+    int source;             /**< Trigger source (GPIO number) or CAPTURE_TRIGGER_SOURCE_* */
+    int64_t edge_us;        /**< esp_timer time of the trigger edge */
+} capture_trigger_t;
+
+/**
+ * @brief A captured JPEG frame travelling through the capture/storage path
+ *
+ * The descriptor does not own the image data; @c priv identifies the
+ * buffer to the source that produced it so it can be released later.
+ */
+typedef struct {
+    const uint8_t *buf;     /**< JPEG data */
+    size_t len;             /**< JPEG data length in bytes */
+    uint16_t width;         /**< Frame width in pixels */
+    uint16_t height;        /**< Frame height in pixels */
+    uint32_t seq;           /**< Sequence number assigned by the pipeline */
+    int64_t timestamp_us;   /**< esp_timer time at which the frame was acquired */
+    capture_trigger_t trigger; /**< Event that caused the capture */
+    uint16_t motion_score;  /**< Set by a motion filter, CAPTURE_FRAME_NO_SCORE if not scored */
+    void *priv;             /**< Source-private handle (e.g. camera_fb_t) */
+} capture_frame_t;
+
+/**
+ * @brief Operating mode requested from a frame source
+ */
+typedef enum {
+    CAPTURE_SOURCE_MODE_MONITOR = 0,    /**< Waiting for triggers; frames may be smaller */
+    CAPTURE_SOURCE_MODE_CAPTURE,        /**< Frames are stored; full resolution */
+} capture_source_mode_t;
+
+/**
+ * @brief Source of frames for the capture pipeline
+ *
+ * The camera driver provides one backed by esp_camera_fb_get(); a host
+ * build can provide a synthetic one.
+ */
+typedef struct {
+    /** Acquire the next frame; fills @p frame and returns ESP_OK on success */
+    esp_err_t (*acquire)(void *ctx, capture_frame_t *frame);
+    /** Give a frame obtained from acquire() back to the source */
+    void (*release)(void *ctx, capture_frame_t *frame);
+    /** Switch the operating mode; optional, NULL if the source has a single mode */
+    esp_err_t (*set_mode)(void *ctx, capture_source_mode_t mode);
+    void *ctx;              /**< Opaque context passed to the callbacks */
+} capture_source_t;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,609 @@
+/**
+ * @file capture_index.c
+ * @brief On-card capture index implementation
+ */
+
+#include "capture_index.h"
+#include "segment_store.h"
+#include "file_operations.h"
+#include "app_config.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_rom_crc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/* Clock values before 2020-01-01 mean the system time was never set */
+#define CAPTURE_INDEX_MIN_UNIX_TIME 1577836800
+
+static const char *TAG = "capture_index";
+
+static capture_index_config_t s_config;
+static int s_fd = -1;
+static SemaphoreHandle_t s_lock = NULL;
+static size_t s_count = 0;              /* Entries in the file */
+static size_t s_first = 0;              /* First entry at or above the low water mark */
+static uint32_t s_low_water = 0;
+static capture_index_entry_t s_last;    /* Newest entry, valid if s_count > 0 */
+static uint32_t s_unsynced = 0;
+static int64_t s_timer_base = 0;        /* Index time of esp_timer 0 when the clock is not set */
+static int64_t s_recover_prev_ts = -1;  /* Timestamp of the previous record added from a segment */
+static int64_t s_deadline_us = 0;       /* End of the catch-up budget, 0 for none */
+static capture_index_stats_t s_stats;
+
+/**
+ * @brief Progress of a segment scan that adds records to the index
+ */
+typedef struct {
+    uint32_t segment_id;
+    bool resume;                /* Skip records up to and including the last indexed one */
+    bool matched;               /* The last indexed record was found */
+    uint32_t after_offset;
+    esp_err_t err;
+} index_scan_ctx_t;
+
+static uint32_t index_crc(const void *data, size_t len)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)data, len);
+}
+
+static bool index_entry_valid(const capture_index_entry_t *entry)
+{
+    return entry->entry_crc == index_crc(entry, offsetof(capture_index_entry_t, entry_crc));
+}
+
+static void index_path(char *path, size_t size)
+{
+    snprintf(path, size, "%s/" CAPTURE_INDEX_FILE_NAME, s_config.base_path);
+}
+
+static esp_err_t index_read_entry(size_t position, capture_index_entry_t *entry)
+{
+    off_t offset = (off_t)(position + 1) * CAPTURE_INDEX_ENTRY_SIZE;
+    if (lseek(s_fd, offset, SEEK_SET) < 0 || read(s_fd, entry, sizeof(*entry)) != sizeof(*entry)) {
+        return ESP_FAIL;
+    }
+    return index_entry_valid(entry) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+/**
+ * @brief Append an entry, keeping entry times strictly increasing
+ */
+static esp_err_t index_write_entry(capture_index_entry_t *entry)
+{
+    if (s_count > 0 && entry->time_us <= s_last.time_us) {
+        entry->time_us = s_last.time_us + 1;
+    }
+    entry->entry_crc = index_crc(entry, offsetof(capture_index_entry_t, entry_crc));
+
+    off_t offset = (off_t)(s_count + 1) * CAPTURE_INDEX_ENTRY_SIZE;
+    if (lseek(s_fd, offset, SEEK_SET) < 0 || write(s_fd, entry, sizeof(*entry)) != sizeof(*entry)) {
+        ESP_LOGE(TAG, "Failed to append index entry %u", (unsigned)s_count);
+        return ESP_FAIL;
+    }
+
+    s_last = *entry;
+    s_count++;
+
+    if (s_config.sync_every > 0 && ++s_unsynced >= s_config.sync_every) {
+        s_unsynced = 0;
+        if (fsync(s_fd) != 0) {
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+static void index_close_file(void)
+{
+    if (s_fd >= 0) {
+        fsync(s_fd);
+        close(s_fd);
+        s_fd = -1;
+    }
+    s_count = 0;
+    s_first = 0;
+    s_low_water = 0;
+}
+
+static esp_err_t index_write_header(void)
+{
+    capture_index_header_t header = {
+        .magic = CAPTURE_INDEX_MAGIC,
+        .version = CAPTURE_INDEX_VERSION,
+        .entry_size = CAPTURE_INDEX_ENTRY_SIZE,
+        .flags = s_config.segments ? CAPTURE_INDEX_FLAG_SEGMENT : 0,
+        .low_water = s_low_water,
+    };
+    header.header_crc = index_crc(&header, offsetof(capture_index_header_t, header_crc));
+
+    if (lseek(s_fd, 0, SEEK_SET) < 0 || write(s_fd, &header, sizeof(header)) != sizeof(header)) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Position of the first entry with file_id >= s_low_water (binary search)
+ *
+ * File numbers only grow along the index. Entries that cannot be read are
+ * treated as below the mark.
+ */
+static size_t index_first_kept(void)
+{
+    size_t low = 0, high = s_count;
+    capture_index_entry_t entry;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index_read_entry(mid, &entry) != ESP_OK || entry.file_id < s_low_water) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief Open an existing index and drop torn entries at its end
+ */
+static esp_err_t index_load(const char *path)
+{
+    s_fd = open(path, O_RDWR);
+    if (s_fd < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    capture_index_header_t header;
+    if (read(s_fd, &header, sizeof(header)) != sizeof(header) ||
+        header.magic != CAPTURE_INDEX_MAGIC ||
+        header.version != CAPTURE_INDEX_VERSION ||
+        header.entry_size != CAPTURE_INDEX_ENTRY_SIZE ||
+        header.header_crc != index_crc(&header, offsetof(capture_index_header_t, header_crc))) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (((header.flags & CAPTURE_INDEX_FLAG_SEGMENT) != 0) != s_config.segments) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    off_t size = lseek(s_fd, 0, SEEK_END);
+    if (size < CAPTURE_INDEX_ENTRY_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    size_t count = size / CAPTURE_INDEX_ENTRY_SIZE - 1;
+    while (count > 0 && index_read_entry(count - 1, &s_last) != ESP_OK) {
+        count--;
+        s_stats.dropped++;
+    }
+
+    off_t valid_size = (off_t)(count + 1) * CAPTURE_INDEX_ENTRY_SIZE;
+    if (valid_size != size && ftruncate(s_fd, valid_size) != 0) {
+        return ESP_FAIL;
+    }
+
+    s_count = count;
+    s_low_water = header.low_water;
+    s_first = index_first_kept();
+    return ESP_OK;
+}
+
+/**
+ * @brief Replace the index with an empty one
+ */
+static esp_err_t index_create(const char *path)
+{
+    index_close_file();
+
+    s_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (s_fd < 0) {
+        ESP_LOGE(TAG, "Failed to create index: %s", path);
+        return ESP_FAIL;
+    }
+
+    if (index_write_header() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write index header: %s", path);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Index time of a record found in a segment
+ *
+ * Record timestamps are esp_timer times of the boot that wrote them; their
+ * spacing is kept within a boot, and a timestamp going backwards (a reboot)
+ * continues right after the previous entry.
+ */
+static int64_t index_recovered_time(int64_t record_ts)
+{
+    int64_t delta = (s_recover_prev_ts >= 0 && record_ts > s_recover_prev_ts) ?
+                    record_ts - s_recover_prev_ts : 1;
+    s_recover_prev_ts = record_ts;
+    return (s_count > 0 ? s_last.time_us : 0) + delta;
+}
+
+static bool index_out_of_time(void)
+{
+    return s_deadline_us > 0 && esp_timer_get_time() >= s_deadline_us;
+}
+
+static bool index_scan_record(void *ctx, const segment_record_header_t *header, uint32_t offset)
+{
+    index_scan_ctx_t *scan = ctx;
+
+    if (scan->resume) {
+        if (offset < scan->after_offset) {
+            return true;
+        }
+        if (offset == scan->after_offset) {
+            scan->matched = (header->length == s_last.length);
+            return scan->matched;
+        }
+        if (!scan->matched) {
+            return false;
+        }
+    }
+
+    if (index_out_of_time()) {
+        scan->err = ESP_ERR_TIMEOUT;
+        return false;
+    }
+
+    capture_index_entry_t entry = {
+        .time_us = index_recovered_time(header->timestamp_us),
+        .file_id = scan->segment_id,
+        .offset = offset,
+        .length = header->length,
+        .trigger_id = header->trigger_id,
+        .trigger_source = (int8_t)header->trigger_source,
+        .flags = CAPTURE_INDEX_FLAG_SEGMENT,
+        .motion_score = CAPTURE_INDEX_NO_SCORE,
+    };
+    scan->err = index_write_entry(&entry);
+    if (scan->err == ESP_OK) {
+        s_stats.recovered++;
+    }
+    return scan->err == ESP_OK;
+}
+
+/**
+ * @brief Add the segment records stored after the last indexed one
+ * @return ESP_ERR_INVALID_STATE if the index does not match the segments
+ */
+static esp_err_t index_catch_up_segments(void)
+{
+    uint32_t first = 0, next = 0;
+    file_index_range(s_config.base_path, SEGMENT_NAME_PREFIX, SEGMENT_NAME_EXT, &first, &next);
+
+    index_scan_ctx_t scan = { .err = ESP_OK };
+    uint32_t segment_id = first;
+
+    if (s_count > 0) {
+        if (s_last.file_id >= next) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        segment_id = s_last.file_id;
+        scan.resume = true;
+        scan.after_offset = s_last.offset;
+    }
+
+    for (; segment_id < next; segment_id++) {
+        scan.segment_id = segment_id;
+        esp_err_t err = segment_store_scan(s_config.base_path, segment_id, index_scan_record, &scan, NULL);
+        if (scan.err != ESP_OK) {
+            return scan.err;
+        }
+        if (scan.resume) {
+            if (err != ESP_OK || !scan.matched) {
+                return ESP_ERR_INVALID_STATE;
+            }
+            scan.resume = false;
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Add the JPEG files numbered after the last indexed one
+ * @return ESP_ERR_INVALID_STATE if the index does not match the files
+ */
+static esp_err_t index_catch_up_files(void)
+{
+    uint32_t first = 0, next = 0;
+    file_index_range(s_config.base_path, PHOTO_NAME_PREFIX, PHOTO_NAME_EXT, &first, &next);
+
+    char path[EXAMPLE_MAX_CHAR_SIZE];
+    struct stat st;
+    uint32_t file_id = first;
+
+    if (s_count > 0) {
+        snprintf(path, sizeof(path), PHOTO_NAME_FORMAT, s_config.base_path, (unsigned long)s_last.file_id);
+        if (s_last.file_id >= next || stat(path, &st) != 0 || st.st_size != s_last.length) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        file_id = s_last.file_id + 1;
+    }
+
+    for (; file_id < next; file_id++) {
+        if (index_out_of_time()) {
+            return ESP_ERR_TIMEOUT;
+        }
+        snprintf(path, sizeof(path), PHOTO_NAME_FORMAT, s_config.base_path, (unsigned long)file_id);
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+
+        capture_index_entry_t entry = {
+            .time_us = st.st_mtime >= CAPTURE_INDEX_MIN_UNIX_TIME ? (int64_t)st.st_mtime * 1000000 : 0,
+            .file_id = file_id,
+            .length = st.st_size,
+            .trigger_source = -1,
+            .motion_score = CAPTURE_INDEX_NO_SCORE,
+        };
+        esp_err_t err = index_write_entry(&entry);
+        if (err != ESP_OK) {
+            return err;
+        }
+        s_stats.recovered++;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t index_catch_up(void)
+{
+    s_recover_prev_ts = -1;
+    s_deadline_us = s_config.budget_ms ? esp_timer_get_time() + (int64_t)s_config.budget_ms * 1000 : 0;
+    return s_config.segments ? index_catch_up_segments() : index_catch_up_files();
+}
+
+esp_err_t capture_index_open(const capture_index_config_t *config)
+{
+    if (config == NULL || config->base_path == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    capture_index_close();
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateMutex();
+        if (s_lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    s_config = *config;
+    memset(&s_stats, 0, sizeof(s_stats));
+
+    char path[EXAMPLE_MAX_CHAR_SIZE];
+    index_path(path, sizeof(path));
+
+    esp_err_t ret = index_load(path);
+    if (ret == ESP_OK) {
+        ret = index_catch_up();
+    }
+    if (ret != ESP_OK && ret != ESP_ERR_TIMEOUT) {
+        ESP_LOGW(TAG, "Rebuilding capture index (%s)", esp_err_to_name(ret));
+        s_stats.recovered = 0;
+        s_stats.rebuilt = true;
+        ret = index_create(path);
+        if (ret == ESP_OK) {
+            ret = index_catch_up();
+        }
+    }
+    if (ret == ESP_ERR_TIMEOUT) {
+        /* Keep what was added; the next open continues from the last entry */
+        ESP_LOGW(TAG, "Capture index incomplete after %lu ms (%u entries), continuing at next open",
+                 (unsigned long)s_config.budget_ms, (unsigned)s_count);
+        index_close_file();
+        return ret;
+    }
+    if (ret != ESP_OK || fsync(s_fd) != 0) {
+        ESP_LOGE(TAG, "Failed to open capture index: %s", path);
+        index_close_file();
+        return ret != ESP_OK ? ret : ESP_FAIL;
+    }
+
+    s_unsynced = 0;
+    s_timer_base = (s_count > 0 ? s_last.time_us + 1 : 0) - esp_timer_get_time();
+
+    ESP_LOGI(TAG, "Capture index: %u entries (%lu recovered, %lu dropped%s)", (unsigned)(s_count - s_first),
+             (unsigned long)s_stats.recovered, (unsigned long)s_stats.dropped,
+             s_stats.rebuilt ? ", rebuilt" : "");
+    return ESP_OK;
+}
+
+void capture_index_close(void)
+{
+    if (s_lock) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+    }
+    index_close_file();
+    if (s_lock) {
+        xSemaphoreGive(s_lock);
+    }
+}
+
+bool capture_index_is_open(void)
+{
+    return s_fd >= 0;
+}
+
+esp_err_t capture_index_append(const capture_frame_t *frame, uint32_t file_id, uint32_t offset,
+                               uint16_t motion_score)
+{
+    if (s_fd < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    capture_index_entry_t entry = {
+        .file_id = file_id,
+        .offset = offset,
+        .length = frame->len,
+        .trigger_id = frame->trigger.id,
+        .trigger_source = (int8_t)frame->trigger.source,
+        .flags = s_config.segments ? CAPTURE_INDEX_FLAG_SEGMENT : 0,
+        .motion_score = motion_score,
+    };
+
+    /* Unix time once the clock is set, otherwise continue after the previous boot */
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec >= CAPTURE_INDEX_MIN_UNIX_TIME) {
+        entry.time_us = (int64_t)now.tv_sec * 1000000 + now.tv_usec -
+                        (esp_timer_get_time() - frame->timestamp_us);
+    } else {
+        entry.time_us = s_timer_base + frame->timestamp_us;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    esp_err_t ret = (s_fd >= 0) ? index_write_entry(&entry) : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(s_lock);
+    return ret;
+}
+
+esp_err_t capture_index_sync(void)
+{
+    if (s_fd < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_unsynced = 0;
+    esp_err_t ret = (fsync(s_fd) == 0) ? ESP_OK : ESP_FAIL;
+    xSemaphoreGive(s_lock);
+    return ret;
+}
+
+esp_err_t capture_index_discard_before(uint32_t file_id)
+{
+    if (s_fd < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    esp_err_t ret = ESP_OK;
+    if (file_id > s_low_water) {
+        s_low_water = file_id;
+        ret = index_write_header();
+        if (ret == ESP_OK && fsync(s_fd) != 0) {
+            ret = ESP_FAIL;
+        }
+        s_first = index_first_kept();
+    }
+    xSemaphoreGive(s_lock);
+    return ret;
+}
+
+size_t capture_index_count(void)
+{
+    return s_count - s_first;
+}
+
+esp_err_t capture_index_get(size_t position, capture_index_entry_t *entry)
+{
+    if (s_fd < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    esp_err_t ret = (position < s_count - s_first) ? index_read_entry(s_first + position, entry)
+                                                   : ESP_ERR_NOT_FOUND;
+    xSemaphoreGive(s_lock);
+    return ret;
+}
+
+/**
+ * @brief Binary search for the first entry at or after @p time_us, lock held
+ *
+ * Entries that cannot be read are treated as older than @p time_us.
+ */
+static size_t index_lower_bound(int64_t time_us)
+{
+    size_t low = s_first, high = s_count;
+    capture_index_entry_t entry;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index_read_entry(mid, &entry) != ESP_OK || entry.time_us < time_us) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+size_t capture_index_lower_bound(int64_t time_us)
+{
+    if (s_fd < 0) {
+        return 0;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    size_t position = index_lower_bound(time_us) - s_first;
+    xSemaphoreGive(s_lock);
+    return position;
+}
+
+esp_err_t capture_index_find_range(int64_t from_us, int64_t to_us, capture_index_entry_t *entries,
+                                   size_t max_entries, size_t *found)
+{
+    if (entries == NULL || found == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *found = 0;
+    if (s_fd < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (size_t position = index_lower_bound(from_us); position < s_count && *found < max_entries; position++) {
+        capture_index_entry_t *entry = &entries[*found];
+        if (index_read_entry(position, entry) != ESP_OK) {
+            continue;
+        }
+        if (entry->time_us >= to_us) {
+            break;
+        }
+        (*found)++;
+    }
+    xSemaphoreGive(s_lock);
+    return ESP_OK;
+}
+
+esp_err_t capture_index_latest(size_t count, capture_index_entry_t *entries, size_t *found)
+{
+    if (entries == NULL || found == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *found = 0;
+    if (s_fd < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (size_t position = s_count; position > s_first && *found < count; position--) {
+        if (index_read_entry(position - 1, &entries[*found]) == ESP_OK) {
+            (*found)++;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return ESP_OK;
+}
+
+void capture_index_get_stats(capture_index_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    *stats = s_stats;
+    stats->entries = s_count - s_first;
+}
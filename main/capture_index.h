@@ -0,0 +1,222 @@
+/**
+ * @file capture_index.h
+ * @brief On-card index of all captures, searchable by time
+ *
+ * Every stored frame gets a fixed-size entry appended to CAPTURES.IDX next
+ * to the captures. Entry times are strictly increasing, so lookups by time
+ * range or "latest N" are binary searches over the index file and never
+ * touch image data or walk the directory.
+ *
+ * On-card layout (little endian):
+ *
+ *   offset 0                               capture_index_header_t
+ *   CAPTURE_INDEX_ENTRY_SIZE * (n + 1)     capture_index_entry_t n
+ *
+ * capture_index_open() validates the index, drops torn entries at its end
+ * and appends entries for captures stored after the last indexed one (e.g.
+ * lost with an unsynced tail). If the index is missing or does not match the
+ * captures on the card, it is rebuilt from them. Adding entries stops at the
+ * configured time budget; the index is then left closed and completed by the
+ * next open, so a large rebuild is spread over several boots.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "capture_frame.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPTURE_INDEX_MAGIC         0x31584449  /**< "IDX1" */
+#define CAPTURE_INDEX_VERSION       1
+#define CAPTURE_INDEX_ENTRY_SIZE    32
+#define CAPTURE_INDEX_FILE_NAME     "CAPTURES.IDX"
+
+/** Entry flag: the capture is a record in a segment file, not a JPEG file */
+#define CAPTURE_INDEX_FLAG_SEGMENT  0x01
+
+/** Motion score of captures that were not scored */
+#define CAPTURE_INDEX_NO_SCORE      CAPTURE_FRAME_NO_SCORE
+
+/**
+ * @brief Header at the start of the index file, one entry in size
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             /**< CAPTURE_INDEX_MAGIC */
+    uint16_t version;           /**< CAPTURE_INDEX_VERSION */
+    uint16_t entry_size;        /**< CAPTURE_INDEX_ENTRY_SIZE */
+    uint32_t flags;             /**< CAPTURE_INDEX_FLAG_SEGMENT if built from segments */
+    uint32_t low_water;         /**< Entries with a lower file_id refer to deleted captures */
+    uint8_t reserved[12];
+    uint32_t header_crc;        /**< CRC32 of the preceding header bytes */
+} capture_index_header_t;
+
+/**
+ * @brief Index entry of one capture
+ */
+typedef struct __attribute__((packed)) {
+    int64_t time_us;            /**< Capture time: Unix time if the clock was set, else continuing the previous entry */
+    uint32_t file_id;           /**< Segment number or JPEG file number */
+    uint32_t offset;            /**< Record offset in the segment, 0 for JPEG files */
+    uint32_t length;            /**< JPEG data length */
+    uint32_t trigger_id;        /**< Trigger event id, 0 if untriggered */
+    int8_t trigger_source;      /**< Trigger GPIO, -1 for software/untriggered */
+    uint8_t flags;              /**< CAPTURE_INDEX_FLAG_* */
+    uint16_t motion_score;      /**< Motion score, CAPTURE_INDEX_NO_SCORE if not scored */
+    uint32_t entry_crc;         /**< CRC32 of the preceding entry bytes */
+} capture_index_entry_t;
+
+_Static_assert(sizeof(capture_index_header_t) == CAPTURE_INDEX_ENTRY_SIZE, "index header size");
+_Static_assert(sizeof(capture_index_entry_t) == CAPTURE_INDEX_ENTRY_SIZE, "index entry size");
+
+/**
+ * @brief Index configuration
+ */
+typedef struct {
+    const char *base_path;      /**< Directory holding the captures and the index */
+    bool segments;              /**< Captures are segment records (true) or JPEG files (false) */
+    uint32_t sync_every;        /**< fsync after this many entries, 0 to sync only on close */
+    uint32_t budget_ms;         /**< Time limit for adding missing entries at open, 0 for none */
+} capture_index_config_t;
+
+#ifndef CONFIG_APP_CAPTURE_INDEX_SYNC_EVERY
+#define CONFIG_APP_CAPTURE_INDEX_SYNC_EVERY 16
+#endif
+#ifndef CONFIG_APP_RECOVERY_BUDGET_MS
+#define CONFIG_APP_RECOVERY_BUDGET_MS 300
+#endif
+
+#if CONFIG_APP_STORAGE_SEGMENTS
+#define CAPTURE_INDEX_SEGMENTS_DEFAULT true
+#else
+#define CAPTURE_INDEX_SEGMENTS_DEFAULT false
+#endif
+
+/**
+ * @brief Default index configuration from Kconfig
+ */
+#define CAPTURE_INDEX_DEFAULT_CONFIG(path) {                \
+    .base_path  = (path),                                   \
+    .segments   = CAPTURE_INDEX_SEGMENTS_DEFAULT,           \
+    .sync_every = CONFIG_APP_CAPTURE_INDEX_SYNC_EVERY,      \
+    .budget_ms  = CONFIG_APP_RECOVERY_BUDGET_MS,            \
+}
+
+/**
+ * @brief Index statistics
+ */
+typedef struct {
+    uint32_t entries;           /**< Entries in the index */
+    uint32_t recovered;         /**< Entries added from the captures by the last open */
+    uint32_t dropped;           /**< Torn entries dropped by the last open */
+    bool rebuilt;               /**< The last open rebuilt the whole index */
+} capture_index_stats_t;
+
+/**
+ * @brief Open the index, repairing or rebuilding it from the captures if needed
+ * @param config Index configuration
+ * @return ESP_OK on success, ESP_ERR_TIMEOUT if the budget ran out before the
+ *         index was complete (it stays closed), other error code otherwise
+ */
+esp_err_t capture_index_open(const capture_index_config_t *config);
+
+/**
+ * @brief Sync and close the index
+ */
+void capture_index_close(void);
+
+/**
+ * @brief Whether the index is open
+ */
+bool capture_index_is_open(void);
+
+/**
+ * @brief Append an entry for a stored frame
+ * @param frame Stored frame
+ * @param file_id Segment number or JPEG file number
+ * @param offset Record offset in the segment, 0 for JPEG files
+ * @param motion_score Motion score, CAPTURE_INDEX_NO_SCORE if not scored
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the index is not open
+ */
+esp_err_t capture_index_append(const capture_frame_t *frame, uint32_t file_id, uint32_t offset,
+                               uint16_t motion_score);
+
+/**
+ * @brief Drop the entries of captures that are about to be deleted
+ *
+ * Entries with a lower @p file_id are hidden from all queries from now on.
+ * Call before deleting the captures, so the index never refers to missing
+ * files.
+ *
+ * @param file_id Oldest segment or JPEG file number that is kept
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t capture_index_discard_before(uint32_t file_id);
+
+/**
+ * @brief Flush appended entries to the card
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t capture_index_sync(void);
+
+/**
+ * @brief Number of entries in the index, excluding discarded ones
+ */
+size_t capture_index_count(void);
+
+/**
+ * @brief Read one entry
+ * @param position Entry position, 0 is the oldest kept entry
+ * @param[out] entry Entry
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if out of range,
+ *         ESP_ERR_INVALID_CRC if the entry is corrupt
+ */
+esp_err_t capture_index_get(size_t position, capture_index_entry_t *entry);
+
+/**
+ * @brief Position of the first entry at or after a time (binary search)
+ * @param time_us Time in index time
+ * @return Entry position, capture_index_count() if all entries are older
+ */
+size_t capture_index_lower_bound(int64_t time_us);
+
+/**
+ * @brief Read the entries with from_us <= time < to_us, oldest first
+ *
+ * If more than @p max_entries match, the first ones are returned; continue
+ * from the time of the last returned entry plus one.
+ *
+ * @param from_us Start of the range, inclusive
+ * @param to_us End of the range, exclusive
+ * @param[out] entries Output entries
+ * @param max_entries Capacity of @p entries
+ * @param[out] found Number of entries returned
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t capture_index_find_range(int64_t from_us, int64_t to_us, capture_index_entry_t *entries,
+                                   size_t max_entries, size_t *found);
+
+/**
+ * @brief Read the newest entries, newest first
+ * @param count Number of entries wanted
+ * @param[out] entries Output entries
+ * @param[out] found Number of entries returned
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t capture_index_latest(size_t count, capture_index_entry_t *entries, size_t *found);
+
+/**
+ * @brief Get index statistics
+ * @param[out] stats Output statistics
+ */
+void capture_index_get_stats(capture_index_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,932 @@
+/**
+ * @file capture_pipeline.c
+ * @brief Double-buffered capture/write pipeline implementation
+ */
+
+#include "capture_pipeline.h"
+#include "latency_stats.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_attr.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#define PIPELINE_TASK_STACK_SIZE    4096
+#define PIPELINE_MAX_PENDING_TRIGGERS 8
+
+static const char *TAG = "capture_pipeline";
+
+/* Items passed from the capture task to the writer task */
+typedef enum {
+    PIPELINE_ITEM_FRAME,            /* Camera frame, released after writing */
+    PIPELINE_ITEM_PRETRIGGER,       /* Write out the pre-trigger ring for frame.trigger */
+    PIPELINE_ITEM_BURST,            /* Write out the burst buffer for frame.trigger */
+    PIPELINE_ITEM_BATCH,            /* Write out the batch buffer */
+    PIPELINE_ITEM_STOP,             /* Stop the writer task */
+} pipeline_item_kind_t;
+
+typedef struct {
+    pipeline_item_kind_t kind;
+    capture_frame_t frame;
+    int64_t queued_us;              /* Time the item was queued, for the queue wait statistics */
+} pipeline_item_t;
+
+/* Pending trigger event */
+typedef struct {
+    capture_trigger_t trigger;
+    uint32_t frames;                /* Frames to capture, 0 for frames_per_trigger */
+    uint32_t burst_frames;          /* Frames of a burst, 0 to capture through the queue */
+} pipeline_event_t;
+
+static capture_pipeline_config_t s_config;
+static QueueHandle_t s_queue = NULL;
+static SemaphoreHandle_t s_exit_sem = NULL;
+static TaskHandle_t s_capture_task = NULL;
+static TaskHandle_t s_writer_task = NULL;
+static volatile bool s_running = false;
+static uint32_t s_next_seq = 0;
+
+/* Set while the writer owns the pre-trigger ring */
+static volatile bool s_pretrigger_busy = false;
+
+/* Set while the writer owns the burst buffer */
+static volatile bool s_burst_busy = false;
+
+/* Set while the writer owns the batch buffer */
+static volatile bool s_batch_busy = false;
+
+/* Smoothed size of frames captured for storing, used to size bursts; capture task only */
+static size_t s_frame_len_avg = 0;
+
+/* Statistics are updated from both tasks */
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static capture_pipeline_stats_t s_stats;
+static uint64_t s_capture_time_us = 0;
+static uint64_t s_write_time_us = 0;
+static uint64_t s_filter_time_us = 0;
+static uint32_t s_filter_calls = 0;
+static int64_t s_start_us = 0;
+static uint64_t s_edge_to_frame_us = 0;
+static uint64_t s_edge_to_closed_us = 0;
+static uint32_t s_closed_events = 0;
+
+/* Pending trigger events, filled from interrupt context */
+static portMUX_TYPE s_trigger_lock = portMUX_INITIALIZER_UNLOCKED;
+static pipeline_event_t s_triggers[PIPELINE_MAX_PENDING_TRIGGERS];
+static uint32_t s_trigger_head = 0;
+static uint32_t s_trigger_count = 0;
+static uint32_t s_next_trigger_id = 1;
+static uint32_t s_triggers_dropped = 0;
+
+/**
+ * @brief Map a configured core number to a valid FreeRTOS affinity
+ */
+static BaseType_t pipeline_core(int core)
+{
+    return (core >= 0 && core < portNUM_PROCESSORS) ? core : tskNO_AFFINITY;
+}
+
+/**
+ * @brief Latency from a trigger edge, clamped at zero for frames exposed before the edge
+ */
+static inline uint32_t pipeline_latency(int64_t edge_us, int64_t now_us)
+{
+    return now_us > edge_us ? (uint32_t)(now_us - edge_us) : 0;
+}
+
+/**
+ * @brief Queue a trigger event; caller holds s_trigger_lock
+ */
+static inline bool IRAM_ATTR pipeline_push_trigger(int source, int64_t edge_us, uint32_t frames,
+                                                   uint32_t burst_frames)
+{
+    if (s_trigger_count == PIPELINE_MAX_PENDING_TRIGGERS) {
+        s_triggers_dropped++;
+        return false;
+    }
+
+    uint32_t slot = (s_trigger_head + s_trigger_count) % PIPELINE_MAX_PENDING_TRIGGERS;
+    s_triggers[slot].trigger.id = s_next_trigger_id++;
+    s_triggers[slot].trigger.source = source;
+    s_triggers[slot].trigger.edge_us = edge_us;
+    s_triggers[slot].frames = frames;
+    s_triggers[slot].burst_frames = burst_frames;
+    s_trigger_count++;
+    return true;
+}
+
+static bool pipeline_pop_trigger(pipeline_event_t *event)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&s_trigger_lock);
+    if (s_trigger_count > 0) {
+        *event = s_triggers[s_trigger_head];
+        s_trigger_head = (s_trigger_head + 1) % PIPELINE_MAX_PENDING_TRIGGERS;
+        s_trigger_count--;
+        found = true;
+    }
+    portEXIT_CRITICAL(&s_trigger_lock);
+
+    return found;
+}
+
+/**
+ * @brief Fold the size of a frame captured for storing into the running average
+ */
+static inline void pipeline_note_frame_len(size_t len)
+{
+    s_frame_len_avg = s_frame_len_avg ? (s_frame_len_avg * 3 + len) / 4 : len;
+}
+
+/**
+ * @brief Whether a trigger's latency is tracked; schedule slots are not events
+ */
+static inline bool pipeline_is_event(const capture_trigger_t *trigger)
+{
+    return trigger->id != 0 && trigger->source != CAPTURE_TRIGGER_SOURCE_SCHEDULE;
+}
+
+/**
+ * @brief Acquire a frame for storing and stamp it with the pipeline fields
+ * @return true if a frame was acquired
+ */
+static bool pipeline_acquire(const capture_trigger_t *trigger, bool first, capture_frame_t *frame)
+{
+    const capture_source_t *source = s_config.source;
+    memset(frame, 0, sizeof(*frame));
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = source->acquire(source->ctx, frame);
+    int64_t elapsed = esp_timer_get_time() - start;
+    latency_stats_record(LATENCY_STAGE_CAPTURE, (uint32_t)elapsed);
+
+    if (err != ESP_OK) {
+        portENTER_CRITICAL(&s_stats_lock);
+        s_stats.capture_errors++;
+        portEXIT_CRITICAL(&s_stats_lock);
+        return false;
+    }
+
+    frame->seq = s_next_seq++;
+    frame->motion_score = CAPTURE_FRAME_NO_SCORE;
+    if (frame->timestamp_us == 0) {
+        frame->timestamp_us = start + elapsed;
+    }
+    frame->trigger = *trigger;
+    pipeline_note_frame_len(frame->len);
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.frames_captured++;
+    s_capture_time_us += elapsed;
+    if (first && pipeline_is_event(trigger)) {
+        uint32_t latency = pipeline_latency(trigger->edge_us, frame->timestamp_us);
+        s_stats.trigger_events++;
+        s_edge_to_frame_us += latency;
+        if (latency > s_stats.max_edge_to_frame_us) {
+            s_stats.max_edge_to_frame_us = latency;
+        }
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+    return true;
+}
+
+/**
+ * @brief Queue an acquired frame for the writer, or release it if the queue is full
+ */
+static void pipeline_queue_frame(capture_frame_t *frame)
+{
+    const capture_source_t *source = s_config.source;
+
+    /* Never block the sensor on the writer: drop when the queue is full */
+    pipeline_item_t item = { .kind = PIPELINE_ITEM_FRAME, .frame = *frame, .queued_us = esp_timer_get_time() };
+    bool queued = (xQueueSend(s_queue, &item, 0) == pdTRUE);
+    if (!queued) {
+        source->release(source->ctx, frame);
+    }
+    uint32_t depth = uxQueueMessagesWaiting(s_queue);
+
+    portENTER_CRITICAL(&s_stats_lock);
+    if (!queued) {
+        s_stats.frames_dropped++;
+    }
+    if (depth > s_stats.queue_high_water) {
+        s_stats.queue_high_water = depth;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    if (!queued) {
+        ESP_LOGW(TAG, "Queue full, dropped frame %lu", (unsigned long)frame->seq);
+    }
+}
+
+static void pipeline_capture_one(const capture_trigger_t *trigger, bool first)
+{
+    capture_frame_t frame;
+
+    if (pipeline_acquire(trigger, first, &frame)) {
+        pipeline_queue_frame(&frame);
+    }
+}
+
+/**
+ * @brief Ask the source for a different operating mode, if it has modes
+ */
+static void pipeline_set_source_mode(capture_source_mode_t mode)
+{
+    const capture_source_t *source = s_config.source;
+
+    if (source->set_mode != NULL && source->set_mode(source->ctx, mode) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to switch source to %s mode",
+                 mode == CAPTURE_SOURCE_MODE_CAPTURE ? "capture" : "monitor");
+    }
+}
+
+static bool pipeline_triggers_pending(void)
+{
+    portENTER_CRITICAL(&s_trigger_lock);
+    bool pending = (s_trigger_count > 0);
+    portEXIT_CRITICAL(&s_trigger_lock);
+    return pending;
+}
+
+/**
+ * @brief Copy the latest frame into the pre-trigger ring
+ */
+static void pipeline_fill_pretrigger(void)
+{
+    const capture_source_t *source = s_config.source;
+    capture_frame_t frame = {0};
+
+    if (source->acquire(source->ctx, &frame) != ESP_OK) {
+        return;
+    }
+
+    frame.seq = s_next_seq++;
+    frame.motion_score = CAPTURE_FRAME_NO_SCORE;
+    if (frame.timestamp_us == 0) {
+        frame.timestamp_us = esp_timer_get_time();
+    }
+    frame.trigger.source = CAPTURE_TRIGGER_SOURCE_SOFTWARE;
+
+    if (frame_ring_push(s_config.pretrigger, &frame) != ESP_OK) {
+        ESP_LOGW(TAG, "Frame %lu (%zu bytes) does not fit the pre-trigger ring",
+                 (unsigned long)frame.seq, frame.len);
+    }
+    source->release(source->ctx, &frame);
+}
+
+/**
+ * @brief Hand the pre-trigger ring to the writer ahead of the post-trigger frames
+ */
+static void pipeline_flush_pretrigger(const capture_trigger_t *trigger)
+{
+    if (s_config.pretrigger == NULL || s_pretrigger_busy ||
+        frame_ring_count(s_config.pretrigger) == 0) {
+        return;
+    }
+
+    pipeline_item_t item = { .kind = PIPELINE_ITEM_PRETRIGGER };
+    item.frame.trigger = *trigger;
+
+    s_pretrigger_busy = true;
+    if (xQueueSend(s_queue, &item, 0) != pdTRUE) {
+        /* Keep the frames; they are written with the next trigger or evicted */
+        s_pretrigger_busy = false;
+        ESP_LOGW(TAG, "Queue full, pre-trigger frames not written for trigger %lu",
+                 (unsigned long)trigger->id);
+    }
+}
+
+/**
+ * @brief Capture a burst into the burst buffer as fast as the source delivers, then hand it to the writer
+ * @return false if the burst was refused and nothing was captured
+ */
+static bool pipeline_run_burst(const capture_trigger_t *trigger, uint32_t requested)
+{
+    const capture_source_t *source = s_config.source;
+    frame_ring_handle_t ring = s_config.burst;
+
+    /* Frames expected to fit at the recent frame size */
+    frame_ring_stats_t ring_stats;
+    frame_ring_get_stats(ring, &ring_stats);
+    uint32_t planned = requested < ring_stats.max_frames ? requested : (uint32_t)ring_stats.max_frames;
+    if (s_frame_len_avg != 0 && ring_stats.arena_size / s_frame_len_avg < planned) {
+        planned = (uint32_t)(ring_stats.arena_size / s_frame_len_avg);
+    }
+
+    if (s_burst_busy || planned == 0) {
+        portENTER_CRITICAL(&s_stats_lock);
+        s_stats.bursts_refused++;
+        portEXIT_CRITICAL(&s_stats_lock);
+        ESP_LOGW(TAG, "Burst of %lu frames refused: %s", (unsigned long)requested,
+                 s_burst_busy ? "previous burst still being written" : "frames do not fit the burst buffer");
+        return false;
+    }
+
+    uint32_t captured = 0;
+    int64_t first_us = 0;
+    int64_t last_us = 0;
+    bool full = false;
+
+    for (uint32_t i = 0; i < planned && !full && s_running; i++) {
+        capture_frame_t frame;
+        if (!pipeline_acquire(trigger, i == 0, &frame)) {
+            continue;
+        }
+
+        /* The buffer was sized from the average; a larger frame ends the burst */
+        full = frame_ring_try_push(ring, &frame) != ESP_OK;
+        if (!full) {
+            if (captured++ == 0) {
+                first_us = frame.timestamp_us;
+            }
+            last_us = frame.timestamp_us;
+        }
+        source->release(source->ctx, &frame);
+    }
+
+    float fps = (captured > 1 && last_us > first_us) ? (captured - 1) * 1e6f / (last_us - first_us) : 0.0f;
+    bool shrunk = captured < requested && s_running;
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.bursts++;
+    s_stats.bursts_shrunk += shrunk ? 1 : 0;
+    s_stats.last_burst_frames = captured;
+    s_stats.last_burst_fps = fps;
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    ESP_LOGI(TAG, "Burst %lu: %lu of %lu frames at %.1f fps", (unsigned long)trigger->id,
+             (unsigned long)captured, (unsigned long)requested, fps);
+    if (captured == 0) {
+        return true;
+    }
+
+    /* The frames exist only in the buffer; wait for room rather than lose them */
+    pipeline_item_t item = { .kind = PIPELINE_ITEM_BURST, .queued_us = esp_timer_get_time() };
+    item.frame.trigger = *trigger;
+    s_burst_busy = true;
+    xQueueSend(s_queue, &item, portMAX_DELAY);
+    return true;
+}
+
+/**
+ * @brief Hand the frames held in the batch buffer to the writer
+ */
+static void pipeline_flush_batch(void)
+{
+    if (s_config.batch == NULL || s_batch_busy || frame_ring_count(s_config.batch) == 0) {
+        return;
+    }
+
+    /* As for bursts, the frames exist only in the buffer */
+    pipeline_item_t item = { .kind = PIPELINE_ITEM_BATCH, .queued_us = esp_timer_get_time() };
+    s_batch_busy = true;
+    xQueueSend(s_queue, &item, portMAX_DELAY);
+}
+
+/**
+ * @brief Capture frames into the batch buffer, handing it to the writer once it holds batch_frames frames
+ */
+static void pipeline_capture_batched(const capture_trigger_t *trigger, uint32_t frames)
+{
+    const capture_source_t *source = s_config.source;
+    frame_ring_handle_t ring = s_config.batch;
+
+    for (uint32_t i = 0; i < frames && s_running; i++) {
+        capture_frame_t frame;
+        if (!pipeline_acquire(trigger, i == 0, &frame)) {
+            continue;
+        }
+
+        /* A full buffer is written early; frames go through the queue while it is written */
+        if (!frame_ring_fits(ring, frame.len)) {
+            pipeline_flush_batch();
+        }
+        if (s_batch_busy || frame_ring_try_push(ring, &frame) != ESP_OK) {
+            pipeline_queue_frame(&frame);
+            continue;
+        }
+
+        source->release(source->ctx, &frame);
+        if (frame_ring_count(ring) >= s_config.batch_frames) {
+            pipeline_flush_batch();
+        }
+    }
+}
+
+static void capture_task(void *arg)
+{
+    static const capture_trigger_t no_trigger = {
+        .id = 0, .source = CAPTURE_TRIGGER_SOURCE_SOFTWARE, .edge_us = 0
+    };
+
+    /* Sources with several modes idle in monitor mode between triggers */
+    if (!s_config.continuous) {
+        pipeline_set_source_mode(CAPTURE_SOURCE_MODE_MONITOR);
+    }
+
+    while (s_running) {
+        /* Each notification corresponds to one queued trigger event; in
+         * continuous mode triggers only tag the frames that follow them.
+         * With a pre-trigger ring the wait doubles as the fill interval. */
+        TickType_t wait = portMAX_DELAY;
+        if (s_config.continuous) {
+            wait = 0;
+        } else if (s_config.pretrigger) {
+            wait = pdMS_TO_TICKS(s_config.pretrigger_interval_ms);
+        }
+        pipeline_event_t event;
+
+        if (ulTaskNotifyTake(pdFALSE, wait) > 0 && pipeline_pop_trigger(&event)) {
+            const capture_trigger_t *trigger = &event.trigger;
+            bool scheduled = (trigger->source == CAPTURE_TRIGGER_SOURCE_SCHEDULE);
+            uint32_t frames = event.frames ? event.frames : s_config.frames_per_trigger;
+            if (!s_config.continuous) {
+                /* The pre-trigger ring is kept for the next real event */
+                if (!scheduled) {
+                    pipeline_flush_pretrigger(trigger);
+                }
+                pipeline_set_source_mode(CAPTURE_SOURCE_MODE_CAPTURE);
+            }
+            if (scheduled && s_config.batch) {
+                pipeline_capture_batched(trigger, frames);
+            } else if (event.burst_frames == 0 || !pipeline_run_burst(trigger, event.burst_frames)) {
+                for (uint32_t i = 0; i < frames && s_running; i++) {
+                    pipeline_capture_one(trigger, i == 0);
+                }
+            }
+            /* Back-to-back triggers stay in capture mode */
+            if (!s_config.continuous && !pipeline_triggers_pending()) {
+                pipeline_set_source_mode(CAPTURE_SOURCE_MODE_MONITOR);
+            }
+        } else if (s_config.continuous && s_running) {
+            pipeline_capture_one(&no_trigger, false);
+        } else if (s_config.pretrigger && !s_pretrigger_busy && s_running) {
+            pipeline_fill_pretrigger();
+        }
+    }
+
+    /* The writer is still running and stores a partial batch before it stops */
+    pipeline_flush_batch();
+
+    xSemaphoreGive(s_exit_sem);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Run the configured filter on a frame
+ * @return true if the frame should be stored
+ */
+static bool pipeline_filter_frame(capture_frame_t *frame)
+{
+    /* Schedule slots are kept whatever they show */
+    if (s_config.filter == NULL || frame->trigger.source == CAPTURE_TRIGGER_SOURCE_SCHEDULE) {
+        return true;
+    }
+
+    int64_t start = esp_timer_get_time();
+    bool keep = s_config.filter(s_config.filter_ctx, frame);
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_filter_calls++;
+    s_filter_time_us += elapsed;
+    if (!keep) {
+        s_stats.frames_filtered++;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+    return keep;
+}
+
+/**
+ * @brief Store one frame through the sink and update statistics
+ * @return true if the frame was stored
+ */
+static bool pipeline_store_frame(const capture_frame_t *frame)
+{
+    static uint32_t last_trigger_id = 0;
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = s_config.sink(s_config.sink_ctx, frame);
+    int64_t closed = esp_timer_get_time();
+    latency_stats_record(LATENCY_STAGE_STORE, (uint32_t)(closed - start));
+
+    /* Latency is measured on the first post-edge frame of each event that was stored */
+    const capture_trigger_t *trigger = &frame->trigger;
+    bool first = (err == ESP_OK && pipeline_is_event(trigger) && trigger->id != last_trigger_id &&
+                  frame->timestamp_us >= trigger->edge_us);
+
+    portENTER_CRITICAL(&s_stats_lock);
+    if (err == ESP_OK) {
+        s_stats.frames_written++;
+        s_write_time_us += closed - start;
+    } else {
+        s_stats.write_errors++;
+    }
+    if (first) {
+        uint32_t latency = pipeline_latency(trigger->edge_us, closed);
+        s_closed_events++;
+        s_edge_to_closed_us += latency;
+        if (latency > s_stats.max_edge_to_closed_us) {
+            s_stats.max_edge_to_closed_us = latency;
+        }
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to store frame %lu: %s",
+                 (unsigned long)frame->seq, esp_err_to_name(err));
+    } else if (first) {
+        last_trigger_id = trigger->id;
+        ESP_LOGD(TAG, "Trigger %lu (source %d): edge->frame %lld us, edge->file closed %lld us",
+                 (unsigned long)trigger->id, trigger->source,
+                 (long long)pipeline_latency(trigger->edge_us, frame->timestamp_us),
+                 (long long)pipeline_latency(trigger->edge_us, closed));
+    }
+    return err == ESP_OK;
+}
+
+/**
+ * @brief Write out the pre-trigger ring, oldest frame first, then give it back
+ */
+static void pipeline_write_pretrigger(const capture_trigger_t *trigger)
+{
+    frame_ring_handle_t ring = s_config.pretrigger;
+    int64_t window_us = (int64_t)s_config.pretrigger_window_ms * 1000;
+    uint32_t written = 0;
+    capture_frame_t frame;
+
+    while (frame_ring_peek_oldest(ring, &frame)) {
+        if (window_us == 0 || frame.timestamp_us >= trigger->edge_us - window_us) {
+            frame.trigger = *trigger;
+            if (pipeline_store_frame(&frame)) {
+                written++;
+            }
+        }
+        frame_ring_pop_oldest(ring);
+    }
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.pretrigger_flushes++;
+    s_stats.pretrigger_written += written;
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    s_pretrigger_busy = false;
+}
+
+/**
+ * @brief Store the frames held in a burst or batch buffer, oldest first, emptying it
+ * @return Frames stored
+ */
+static uint32_t pipeline_write_held(frame_ring_handle_t ring)
+{
+    uint32_t written = 0;
+    capture_frame_t frame;
+
+    while (frame_ring_peek_oldest(ring, &frame)) {
+        if (pipeline_filter_frame(&frame) && pipeline_store_frame(&frame)) {
+            written++;
+        }
+        frame_ring_pop_oldest(ring);
+    }
+    return written;
+}
+
+/**
+ * @brief Write out the burst buffer, then give it back
+ */
+static void pipeline_write_burst(const pipeline_item_t *item)
+{
+    uint32_t written = pipeline_write_held(s_config.burst);
+    uint32_t flush_ms = (uint32_t)((esp_timer_get_time() - item->queued_us) / 1000);
+    s_burst_busy = false;
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.bursts_written++;
+    s_stats.burst_frames_written += written;
+    s_stats.last_burst_flush_ms = flush_ms;
+    if (flush_ms > s_stats.max_burst_flush_ms) {
+        s_stats.max_burst_flush_ms = flush_ms;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    ESP_LOGI(TAG, "Burst %lu: %lu frames written in %lu ms", (unsigned long)item->frame.trigger.id,
+             (unsigned long)written, (unsigned long)flush_ms);
+}
+
+/**
+ * @brief Write out the batch buffer, then give it back
+ */
+static void pipeline_write_batch(void)
+{
+    uint32_t written = pipeline_write_held(s_config.batch);
+    s_batch_busy = false;
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.batches_written++;
+    s_stats.batch_frames_written += written;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+static void writer_task(void *arg)
+{
+    const capture_source_t *source = s_config.source;
+    pipeline_item_t item;
+
+    for (;;) {
+        if (xQueueReceive(s_queue, &item, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        if (item.kind == PIPELINE_ITEM_STOP) {
+            break;
+        } else if (item.kind == PIPELINE_ITEM_PRETRIGGER) {
+            pipeline_write_pretrigger(&item.frame.trigger);
+        } else if (item.kind == PIPELINE_ITEM_BURST) {
+            pipeline_write_burst(&item);
+        } else if (item.kind == PIPELINE_ITEM_BATCH) {
+            pipeline_write_batch();
+        } else {
+            latency_stats_record(LATENCY_STAGE_QUEUE, (uint32_t)(esp_timer_get_time() - item.queued_us));
+            if (pipeline_filter_frame(&item.frame)) {
+                pipeline_store_frame(&item.frame);
+            }
+            source->release(source->ctx, &item.frame);
+        }
+    }
+
+    xSemaphoreGive(s_exit_sem);
+    vTaskDelete(NULL);
+}
+
+esp_err_t capture_pipeline_start(const capture_pipeline_config_t *config)
+{
+    if (config == NULL || config->source == NULL || config->sink == NULL ||
+        config->queue_length == 0 || (config->batch != NULL && config->batch_frames == 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    s_config = *config;
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_capture_time_us = 0;
+    s_write_time_us = 0;
+    s_filter_time_us = 0;
+    s_filter_calls = 0;
+    s_edge_to_frame_us = 0;
+    s_edge_to_closed_us = 0;
+    s_closed_events = 0;
+    s_next_seq = 0;
+    s_trigger_head = 0;
+    s_trigger_count = 0;
+    s_triggers_dropped = 0;
+
+    s_pretrigger_busy = false;
+    if (s_config.pretrigger) {
+        frame_ring_clear(s_config.pretrigger);
+    }
+    s_burst_busy = false;
+    s_frame_len_avg = 0;
+    if (s_config.burst) {
+        frame_ring_clear(s_config.burst);
+    }
+    s_batch_busy = false;
+    if (s_config.batch) {
+        frame_ring_clear(s_config.batch);
+    }
+
+    s_queue = xQueueCreate(s_config.queue_length, sizeof(pipeline_item_t));
+    s_exit_sem = xSemaphoreCreateCounting(2, 0);
+    if (s_queue == NULL || s_exit_sem == NULL) {
+        ESP_LOGE(TAG, "Failed to create pipeline queue");
+        capture_pipeline_stop();
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_running = true;
+    s_start_us = esp_timer_get_time();
+
+    if (xTaskCreatePinnedToCore(writer_task, "cap_writer", PIPELINE_TASK_STACK_SIZE, NULL,
+                                s_config.writer_priority, &s_writer_task,
+                                pipeline_core(s_config.writer_core)) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create writer task");
+        s_running = false;
+        s_writer_task = NULL;
+        capture_pipeline_stop();
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreatePinnedToCore(capture_task, "cap_capture", PIPELINE_TASK_STACK_SIZE, NULL,
+                                s_config.capture_priority, &s_capture_task,
+                                pipeline_core(s_config.capture_core)) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create capture task");
+        s_capture_task = NULL;
+        capture_pipeline_stop();
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Pipeline started (queue %u, capture core %d, writer core %d, %s)",
+             (unsigned)s_config.queue_length, s_config.capture_core, s_config.writer_core,
+             s_config.continuous ? "continuous" : "triggered");
+    return ESP_OK;
+}
+
+void capture_pipeline_stop(void)
+{
+    s_running = false;
+
+    if (s_capture_task) {
+        xTaskNotifyGive(s_capture_task);
+        xSemaphoreTake(s_exit_sem, portMAX_DELAY);
+        s_capture_task = NULL;
+    }
+
+    if (s_writer_task) {
+        /* The capture task has exited, so everything queued before the
+         * sentinel is written before the writer stops */
+        pipeline_item_t stop = { .kind = PIPELINE_ITEM_STOP };
+        xQueueSend(s_queue, &stop, portMAX_DELAY);
+        xSemaphoreTake(s_exit_sem, portMAX_DELAY);
+        s_writer_task = NULL;
+    }
+
+    if (s_queue) {
+        pipeline_item_t item;
+        while (xQueueReceive(s_queue, &item, 0) == pdTRUE) {
+            if (item.kind == PIPELINE_ITEM_FRAME) {
+                s_config.source->release(s_config.source->ctx, &item.frame);
+            }
+        }
+        vQueueDelete(s_queue);
+        s_queue = NULL;
+    }
+
+    if (s_exit_sem) {
+        vSemaphoreDelete(s_exit_sem);
+        s_exit_sem = NULL;
+    }
+}
+
+esp_err_t capture_pipeline_trigger(void)
+{
+    if (!s_running || s_capture_task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    portENTER_CRITICAL(&s_trigger_lock);
+    bool queued = pipeline_push_trigger(CAPTURE_TRIGGER_SOURCE_SOFTWARE, esp_timer_get_time(), 0, 0);
+    portEXIT_CRITICAL(&s_trigger_lock);
+
+    if (!queued) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotifyGive(s_capture_task);
+    return ESP_OK;
+}
+
+esp_err_t capture_pipeline_burst(uint32_t frames)
+{
+    if (!s_running || s_capture_task == NULL || s_config.burst == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (frames == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&s_trigger_lock);
+    bool queued = pipeline_push_trigger(CAPTURE_TRIGGER_SOURCE_SOFTWARE, esp_timer_get_time(), 0, frames);
+    portEXIT_CRITICAL(&s_trigger_lock);
+
+    if (!queued) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotifyGive(s_capture_task);
+    return ESP_OK;
+}
+
+esp_err_t capture_pipeline_trigger_scheduled(int64_t slot_us, uint32_t frames)
+{
+    if (!s_running || s_capture_task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    portENTER_CRITICAL(&s_trigger_lock);
+    bool queued = pipeline_push_trigger(CAPTURE_TRIGGER_SOURCE_SCHEDULE, slot_us, frames, 0);
+    portEXIT_CRITICAL(&s_trigger_lock);
+
+    if (!queued) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotifyGive(s_capture_task);
+    return ESP_OK;
+}
+
+bool IRAM_ATTR capture_pipeline_trigger_from_isr(int source, int64_t edge_us,
+                                                 BaseType_t *higher_priority_task_woken)
+{
+    if (!s_running || s_capture_task == NULL) {
+        return false;
+    }
+
+    portENTER_CRITICAL_ISR(&s_trigger_lock);
+    bool queued = pipeline_push_trigger(source, edge_us, 0, s_config.burst ? s_config.burst_frames : 0);
+    portEXIT_CRITICAL_ISR(&s_trigger_lock);
+
+    if (queued) {
+        vTaskNotifyGiveFromISR(s_capture_task, higher_priority_task_woken);
+    }
+    return queued;
+}
+
+void capture_pipeline_get_stats(capture_pipeline_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_stats_lock);
+    *stats = s_stats;
+    uint64_t capture_time_us = s_capture_time_us;
+    uint64_t write_time_us = s_write_time_us;
+    uint64_t filter_time_us = s_filter_time_us;
+    uint32_t filter_calls = s_filter_calls;
+    uint64_t edge_to_frame_us = s_edge_to_frame_us;
+    uint64_t edge_to_closed_us = s_edge_to_closed_us;
+    uint32_t closed_events = s_closed_events;
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    portENTER_CRITICAL(&s_trigger_lock);
+    stats->triggers_dropped = s_triggers_dropped;
+    portEXIT_CRITICAL(&s_trigger_lock);
+
+    stats->avg_edge_to_frame_us = stats->trigger_events ?
+                                  (uint32_t)(edge_to_frame_us / stats->trigger_events) : 0;
+    stats->avg_edge_to_closed_us = closed_events ?
+                                   (uint32_t)(edge_to_closed_us / closed_events) : 0;
+    stats->queue_depth = s_queue ? uxQueueMessagesWaiting(s_queue) : 0;
+    stats->avg_capture_us = stats->frames_captured ?
+                            (uint32_t)(capture_time_us / stats->frames_captured) : 0;
+    stats->avg_write_us = stats->frames_written ?
+                          (uint32_t)(write_time_us / stats->frames_written) : 0;
+    stats->avg_filter_us = filter_calls ? (uint32_t)(filter_time_us / filter_calls) : 0;
+
+    int64_t elapsed_us = esp_timer_get_time() - s_start_us;
+    stats->write_fps = elapsed_us > 0 ? stats->frames_written * 1e6f / elapsed_us : 0.0f;
+}
+
+void capture_pipeline_log_stats(void)
+{
+    capture_pipeline_stats_t stats;
+    capture_pipeline_get_stats(&stats);
+
+    ESP_LOGI(TAG, "captured %lu, written %lu, dropped %lu, errors %lu/%lu, "
+             "queue %lu (max %lu), capture %lu us, write %lu us, %.2f fps",
+             (unsigned long)stats.frames_captured, (unsigned long)stats.frames_written,
+             (unsigned long)stats.frames_dropped, (unsigned long)stats.capture_errors,
+             (unsigned long)stats.write_errors, (unsigned long)stats.queue_depth,
+             (unsigned long)stats.queue_high_water, (unsigned long)stats.avg_capture_us,
+             (unsigned long)stats.avg_write_us, stats.write_fps);
+    ESP_LOGI(TAG, "triggers %lu (dropped %lu), edge->frame avg %lu us max %lu us, "
+             "edge->file closed avg %lu us max %lu us",
+             (unsigned long)stats.trigger_events, (unsigned long)stats.triggers_dropped,
+             (unsigned long)stats.avg_edge_to_frame_us, (unsigned long)stats.max_edge_to_frame_us,
+             (unsigned long)stats.avg_edge_to_closed_us, (unsigned long)stats.max_edge_to_closed_us);
+
+    if (s_config.filter) {
+        ESP_LOGI(TAG, "filtered out %lu frames, filter %lu us",
+                 (unsigned long)stats.frames_filtered, (unsigned long)stats.avg_filter_us);
+    }
+
+    if (s_config.pretrigger) {
+        /* Snapshot only: the capture task keeps filling the ring */
+        frame_ring_stats_t ring;
+        frame_ring_get_stats(s_config.pretrigger, &ring);
+        ESP_LOGI(TAG, "pre-trigger ring %zu/%zu frames, %zu/%zu bytes (max %zu frames, %zu bytes), "
+                 "evicted %lu, flushes %lu, written %lu",
+                 ring.frames, ring.max_frames, ring.bytes_used, ring.arena_size,
+                 ring.frames_high_water, ring.bytes_high_water, (unsigned long)ring.evicted,
+                 (unsigned long)stats.pretrigger_flushes, (unsigned long)stats.pretrigger_written);
+    }
+
+    if (s_config.burst) {
+        ESP_LOGI(TAG, "bursts %lu (refused %lu, shrunk %lu), written %lu frames, "
+                 "last %lu frames at %.1f fps flushed in %lu ms, max flush %lu ms",
+                 (unsigned long)stats.bursts, (unsigned long)stats.bursts_refused,
+                 (unsigned long)stats.bursts_shrunk, (unsigned long)stats.burst_frames_written,
+                 (unsigned long)stats.last_burst_frames, stats.last_burst_fps,
+                 (unsigned long)stats.last_burst_flush_ms, (unsigned long)stats.max_burst_flush_ms);
+    }
+
+    if (s_config.batch) {
+        ESP_LOGI(TAG, "batches written %lu (%lu frames), %u frames held",
+                 (unsigned long)stats.batches_written, (unsigned long)stats.batch_frames_written,
+                 s_batch_busy ? 0 : (unsigned)frame_ring_count(s_config.batch));
+    }
+}
@@ -0,0 +1,242 @@
+/**
+ * @file capture_pipeline.h
+ * @brief Double-buffered capture/write pipeline
+ *
+ * A capture task and a writer task, pinned to different cores, are linked by
+ * a bounded FreeRTOS queue of frames so the sensor keeps capturing while the
+ * previous frame is written to the SD card. Between triggers the capture task
+ * can keep a ring of recent frames that is written out ahead of the
+ * post-trigger frames when a trigger arrives.
+ *
+ * For bursts the capture task copies frames into a reserved buffer as fast
+ * as the source delivers them instead of queueing them one by one; the
+ * writer flushes the buffer afterwards while the capture task goes back to
+ * waiting for triggers. Frames of schedule slots can likewise be held in a
+ * batch buffer and written several at a time.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "capture_frame.h"
+#include "frame_ring.h"
+#include "freertos/FreeRTOS.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Sink called by the writer task for every dequeued frame
+ * @param ctx Sink context from the pipeline configuration
+ * @param frame Frame to store; released back to the source after the call
+ * @return ESP_OK on success, error code otherwise
+ */
+typedef esp_err_t (*capture_sink_fn)(void *ctx, const capture_frame_t *frame);
+
+/**
+ * @brief Filter called by the writer task before the sink
+ *
+ * Pre-trigger frames are not filtered.
+ *
+ * @param ctx Filter context from the pipeline configuration
+ * @param frame Frame to check; the filter may set its motion score
+ * @return true to store the frame, false to release it unstored
+ */
+typedef bool (*capture_filter_fn)(void *ctx, capture_frame_t *frame);
+
+/**
+ * @brief Pipeline configuration
+ */
+typedef struct {
+    const capture_source_t *source;     /**< Frame source */
+    capture_sink_fn sink;               /**< Frame sink run by the writer task */
+    void *sink_ctx;                     /**< Context passed to the sink */
+    capture_filter_fn filter;           /**< Frame filter, NULL to store every frame */
+    void *filter_ctx;                   /**< Context passed to the filter */
+    size_t queue_length;                /**< Maximum frames waiting for the writer */
+    uint32_t frames_per_trigger;        /**< Frames captured per trigger */
+    bool continuous;                    /**< Capture continuously instead of per trigger */
+    int capture_core;                   /**< Core for the capture task */
+    int writer_core;                    /**< Core for the writer task */
+    unsigned capture_priority;          /**< Capture task priority */
+    unsigned writer_priority;           /**< Writer task priority */
+    frame_ring_handle_t pretrigger;     /**< Ring kept filled between triggers, NULL to disable */
+    uint32_t pretrigger_interval_ms;    /**< Interval between frames copied into the ring */
+    uint32_t pretrigger_window_ms;      /**< Age limit of ring frames stored on a trigger, 0 for all */
+    frame_ring_handle_t burst;          /**< Buffer reserved for bursts, NULL to disable bursts */
+    uint32_t burst_frames;              /**< Frames per triggered burst, 0 to capture frames_per_trigger through the queue */
+    frame_ring_handle_t batch;          /**< Buffer holding schedule slot frames between writes, NULL to queue them */
+    uint32_t batch_frames;              /**< Frames held in the batch buffer before it is written */
+} capture_pipeline_config_t;
+
+#ifdef CONFIG_APP_PIPELINE_CONTINUOUS
+#define CAPTURE_PIPELINE_CONTINUOUS_DEFAULT true
+#else
+#define CAPTURE_PIPELINE_CONTINUOUS_DEFAULT false
+#endif
+
+#ifdef CONFIG_APP_PRETRIGGER_ENABLE
+#define CAPTURE_PIPELINE_PRETRIGGER_INTERVAL_MS CONFIG_APP_PRETRIGGER_INTERVAL_MS
+#define CAPTURE_PIPELINE_PRETRIGGER_WINDOW_MS   CONFIG_APP_PRETRIGGER_WINDOW_MS
+#else
+#define CAPTURE_PIPELINE_PRETRIGGER_INTERVAL_MS 0
+#define CAPTURE_PIPELINE_PRETRIGGER_WINDOW_MS   0
+#endif
+
+#ifdef CONFIG_APP_BURST_ENABLE
+#define CAPTURE_PIPELINE_BURST_FRAMES   CONFIG_APP_BURST_FRAMES
+#else
+#define CAPTURE_PIPELINE_BURST_FRAMES   0
+#endif
+
+#ifdef CONFIG_APP_TIMELAPSE_ENABLE
+#define CAPTURE_PIPELINE_BATCH_FRAMES   CONFIG_APP_TIMELAPSE_BATCH_FRAMES
+#else
+#define CAPTURE_PIPELINE_BATCH_FRAMES   1
+#endif
+
+/**
+ * @brief Default pipeline configuration from Kconfig (source, sink, filter and frame buffers left empty)
+ */
+#define CAPTURE_PIPELINE_DEFAULT_CONFIG() {                             \
+    .source             = NULL,                                         \
+    .sink               = NULL,                                         \
+    .sink_ctx           = NULL,                                         \
+    .filter             = NULL,                                         \
+    .filter_ctx         = NULL,                                         \
+    .queue_length       = CONFIG_APP_PIPELINE_QUEUE_LEN,                \
+    .frames_per_trigger = CONFIG_APP_PIPELINE_FRAMES_PER_TRIGGER,       \
+    .continuous         = CAPTURE_PIPELINE_CONTINUOUS_DEFAULT,          \
+    .capture_core       = CONFIG_APP_PIPELINE_CAPTURE_CORE,             \
+    .writer_core        = CONFIG_APP_PIPELINE_WRITER_CORE,              \
+    .capture_priority   = CONFIG_APP_PIPELINE_CAPTURE_PRIORITY,         \
+    .writer_priority    = CONFIG_APP_PIPELINE_WRITER_PRIORITY,          \
+    .pretrigger         = NULL,                                         \
+    .pretrigger_interval_ms = CAPTURE_PIPELINE_PRETRIGGER_INTERVAL_MS,  \
+    .pretrigger_window_ms   = CAPTURE_PIPELINE_PRETRIGGER_WINDOW_MS,    \
+    .burst              = NULL,                                         \
+    .burst_frames       = CAPTURE_PIPELINE_BURST_FRAMES,                \
+    .batch              = NULL,                                         \
+    .batch_frames       = CAPTURE_PIPELINE_BATCH_FRAMES,                \
+}
+
+/**
+ * @brief Pipeline statistics
+ */
+typedef struct {
+    uint32_t frames_captured;       /**< Frames acquired from the source */
+    uint32_t frames_written;        /**< Frames stored successfully by the sink */
+    uint32_t frames_dropped;        /**< Frames dropped because the queue was full */
+    uint32_t capture_errors;        /**< Failed acquire calls */
+    uint32_t write_errors;          /**< Failed sink calls */
+    uint32_t queue_depth;           /**< Frames currently waiting for the writer */
+    uint32_t queue_high_water;      /**< Highest queue depth observed */
+    uint32_t avg_capture_us;        /**< Average acquire duration */
+    uint32_t avg_write_us;          /**< Average sink duration */
+    float write_fps;                /**< Frames written per second since start */
+    uint32_t trigger_events;        /**< Trigger events accepted */
+    uint32_t triggers_dropped;      /**< Trigger events lost because too many were pending */
+    uint32_t avg_edge_to_frame_us;  /**< Average trigger edge to first frame latency */
+    uint32_t max_edge_to_frame_us;  /**< Worst trigger edge to first frame latency */
+    uint32_t avg_edge_to_closed_us; /**< Average trigger edge to first file closed latency */
+    uint32_t max_edge_to_closed_us; /**< Worst trigger edge to first file closed latency */
+    uint32_t pretrigger_flushes;    /**< Pre-trigger rings written out on triggers */
+    uint32_t pretrigger_written;    /**< Pre-trigger frames written */
+    uint32_t frames_filtered;       /**< Frames discarded by the filter */
+    uint32_t avg_filter_us;         /**< Average filter duration */
+    uint32_t bursts;                /**< Bursts captured into the burst buffer */
+    uint32_t bursts_refused;        /**< Bursts refused because the buffer was busy or too small */
+    uint32_t bursts_shrunk;         /**< Bursts cut short to fit the burst buffer */
+    uint32_t bursts_written;        /**< Bursts whose frames have all been handed to the sink */
+    uint32_t burst_frames_written;  /**< Burst frames written */
+    float last_burst_fps;           /**< Frame rate reached by the last burst */
+    uint32_t last_burst_frames;     /**< Frames in the last burst */
+    uint32_t last_burst_flush_ms;   /**< Time from the end of the last burst until its frames were written */
+    uint32_t max_burst_flush_ms;    /**< Longest burst flush */
+    uint32_t batches_written;       /**< Batch buffers written */
+    uint32_t batch_frames_written;  /**< Frames written from the batch buffer */
+} capture_pipeline_stats_t;
+
+/**
+ * @brief Create the queue and start the capture and writer tasks
+ * @param config Pipeline configuration (source and sink are required)
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t capture_pipeline_start(const capture_pipeline_config_t *config);
+
+/**
+ * @brief Stop both tasks and release any frames still queued
+ */
+void capture_pipeline_stop(void);
+
+/**
+ * @brief Request a capture of frames_per_trigger frames (software trigger)
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the pipeline is not running,
+ *         ESP_ERR_NO_MEM if too many triggers are pending
+ */
+esp_err_t capture_pipeline_trigger(void);
+
+/**
+ * @brief Request a burst of frames into the burst buffer (software trigger)
+ *
+ * The burst is shrunk to the frames expected to fit the buffer at the
+ * recent frame size, and ends early when a frame does not fit. A burst
+ * that cannot fit a single frame, or that arrives while the previous one
+ * is still being written, is refused and frames_per_trigger frames are
+ * captured through the queue instead.
+ *
+ * @param frames Frames to capture
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the pipeline is not running or has no
+ *         burst buffer, ESP_ERR_INVALID_ARG if frames is 0, ESP_ERR_NO_MEM if too many triggers are pending
+ */
+esp_err_t capture_pipeline_burst(uint32_t frames);
+
+/**
+ * @brief Request the frames of a schedule slot (time-lapse)
+ *
+ * The frames are tagged with CAPTURE_TRIGGER_SOURCE_SCHEDULE and the slot
+ * time. They do not flush the pre-trigger ring, are not filtered and are
+ * not counted in the trigger latency statistics. With a batch buffer they
+ * are held there and written batch_frames at a time; a partial batch is
+ * written when the pipeline stops.
+ *
+ * @param slot_us esp_timer time of the slot
+ * @param frames Frames to capture, 0 for frames_per_trigger
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the pipeline is not running,
+ *         ESP_ERR_NO_MEM if too many triggers are pending
+ */
+esp_err_t capture_pipeline_trigger_scheduled(int64_t slot_us, uint32_t frames);
+
+/**
+ * @brief Request a capture from an interrupt handler
+ *
+ * Queues the event and wakes the capture task with a task notification.
+ * With a burst buffer and burst_frames set, the event runs a burst.
+ * Safe to call from an IRAM interrupt handler.
+ *
+ * @param source Trigger source (GPIO number)
+ * @param edge_us esp_timer time of the edge
+ * @param[out] higher_priority_task_woken Set to pdTRUE if a context switch is needed
+ * @return true if the event was queued, false if it was dropped
+ */
+bool capture_pipeline_trigger_from_isr(int source, int64_t edge_us, BaseType_t *higher_priority_task_woken);
+
+/**
+ * @brief Get a snapshot of the pipeline statistics
+ * @param stats Output statistics
+ */
+void capture_pipeline_get_stats(capture_pipeline_stats_t *stats);
+
+/**
+ * @brief Log the pipeline statistics
+ */
+void capture_pipeline_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
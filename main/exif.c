@@ -0,0 +1,260 @@
+/**
+ * @file exif.c
+ * @brief EXIF metadata implementation
+ */
+
+#include "exif.h"
+#include <esp_timer.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+/* Earliest system time taken as a set clock (2020-01-01) */
+#define EXIF_MIN_UNIX_TIME      1577836800
+
+/* APP1 marker, length and "Exif\0\0" in front of the TIFF data */
+#define EXIF_APP1_PREFIX_SIZE   10
+
+#define TIFF_ASCII              2
+#define TIFF_LONG               4
+#define TIFF_UNDEFINED          7
+
+#define TAG_IMAGE_DESCRIPTION   0x010E
+#define TAG_DATE_TIME           0x0132
+#define TAG_EXIF_IFD            0x8769
+#define TAG_EXIF_VERSION        0x9000
+#define TAG_DATE_TIME_ORIGINAL  0x9003
+#define TAG_OFFSET_TIME_ORIGINAL 0x9011
+#define TAG_SUBSEC_TIME_ORIGINAL 0x9291
+#define TAG_PIXEL_X_DIMENSION   0xA002
+#define TAG_PIXEL_Y_DIMENSION   0xA003
+#define TAG_BODY_SERIAL_NUMBER  0xA431
+
+/**
+ * @brief Little-endian TIFF structure being written into a fixed buffer
+ */
+typedef struct {
+    uint8_t *base;              /* TIFF header; offsets are relative to it */
+    size_t size;
+    size_t entry;               /* Next IFD entry */
+    size_t data;                /* Next out-of-line value */
+    bool overflow;
+} tiff_writer_t;
+
+static void tiff_put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void tiff_put32(uint8_t *p, uint32_t v)
+{
+    tiff_put16(p, (uint16_t)v);
+    tiff_put16(p + 2, (uint16_t)(v >> 16));
+}
+
+/**
+ * @brief Start an IFD of @p count entries at the current data position
+ * @return Offset of the IFD
+ */
+static uint32_t tiff_begin_ifd(tiff_writer_t *w, uint16_t count)
+{
+    size_t ifd = (w->data + 1) & ~(size_t)1;
+    size_t end = ifd + 2 + 12 * (size_t)count + 4;
+    if (end > w->size) {
+        w->overflow = true;
+        return 0;
+    }
+    tiff_put16(w->base + ifd, count);
+    tiff_put32(w->base + end - 4, 0);
+    w->entry = ifd + 2;
+    w->data = end;
+    return (uint32_t)ifd;
+}
+
+/**
+ * @brief Add an entry to the current IFD; values over 4 bytes go to the data area
+ */
+static void tiff_entry(tiff_writer_t *w, uint16_t tag, uint16_t type, uint32_t count,
+                       const void *value, size_t len)
+{
+    if (w->overflow) {
+        return;
+    }
+    uint8_t *entry = w->base + w->entry;
+    tiff_put16(entry, tag);
+    tiff_put16(entry + 2, type);
+    tiff_put32(entry + 4, count);
+    memset(entry + 8, 0, 4);
+    if (len <= 4) {
+        memcpy(entry + 8, value, len);
+    } else {
+        size_t offset = (w->data + 1) & ~(size_t)1;
+        if (offset + len > w->size) {
+            w->overflow = true;
+            return;
+        }
+        memcpy(w->base + offset, value, len);
+        tiff_put32(entry + 8, (uint32_t)offset);
+        w->data = offset + len;
+    }
+    w->entry += 12;
+}
+
+static void tiff_ascii(tiff_writer_t *w, uint16_t tag, const char *text)
+{
+    size_t len = strlen(text) + 1;
+    tiff_entry(w, tag, TIFF_ASCII, (uint32_t)len, text, len);
+}
+
+static void tiff_long(tiff_writer_t *w, uint16_t tag, uint32_t value)
+{
+    uint8_t v[4];
+    tiff_put32(v, value);
+    tiff_entry(w, tag, TIFF_LONG, 1, v, sizeof(v));
+}
+
+/**
+ * @brief Describe the frame and its trigger for ImageDescription
+ */
+static void exif_describe(const capture_frame_t *frame, char *text, size_t size)
+{
+    if (frame->trigger.id == 0) {
+        snprintf(text, size, "frame %lu", (unsigned long)frame->seq);
+    } else if (frame->trigger.source >= 0) {
+        snprintf(text, size, "frame %lu, trigger %lu on GPIO %d", (unsigned long)frame->seq,
+                 (unsigned long)frame->trigger.id, frame->trigger.source);
+    } else {
+        snprintf(text, size, "frame %lu, %s trigger %lu", (unsigned long)frame->seq,
+                 frame->trigger.source == CAPTURE_TRIGGER_SOURCE_SCHEDULE ? "schedule" : "software",
+                 (unsigned long)frame->trigger.id);
+    }
+}
+
+/**
+ * @brief Write the APP1 marker, "Exif" identifier and TIFF data; the segment length is set by the caller
+ * @return Segment size, 0 if it does not fit
+ */
+static size_t exif_write_app1(const capture_frame_t *frame, const char *device_id,
+                              uint8_t *out, size_t size)
+{
+    if (size < EXIF_APP1_PREFIX_SIZE + 8) {
+        return 0;
+    }
+
+    char description[64];
+    exif_describe(frame, description, sizeof(description));
+
+    char serial[EXIF_DEVICE_ID_MAX + 1] = "";
+    if (device_id != NULL) {
+        strncpy(serial, device_id, EXIF_DEVICE_ID_MAX);
+    }
+
+    /* Capture time from the system clock, as in the capture index */
+    char date_time[20] = "";
+    char subsec[12] = "";
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec >= EXIF_MIN_UNIX_TIME) {
+        int64_t time_us = (int64_t)now.tv_sec * 1000000 + now.tv_usec -
+                          (esp_timer_get_time() - frame->timestamp_us);
+        time_t seconds = (time_t)(time_us / 1000000);
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        strftime(date_time, sizeof(date_time), "%Y:%m:%d %H:%M:%S", &tm);
+        snprintf(subsec, sizeof(subsec), "%06ld", (long)(time_us % 1000000));
+    }
+    bool dated = date_time[0] != '\0';
+
+    tiff_writer_t w = {
+        .base = out + EXIF_APP1_PREFIX_SIZE,
+        .size = size - EXIF_APP1_PREFIX_SIZE,
+        .data = 8,
+    };
+    memcpy(w.base, "II*\0", 4);
+    tiff_put32(w.base + 4, 8);
+
+    tiff_begin_ifd(&w, dated ? 3 : 2);
+    tiff_ascii(&w, TAG_IMAGE_DESCRIPTION, description);
+    if (dated) {
+        tiff_ascii(&w, TAG_DATE_TIME, date_time);
+    }
+    /* The Exif IFD follows the values of IFD0 */
+    size_t pointer_entry = w.entry;
+    tiff_long(&w, TAG_EXIF_IFD, 0);
+
+    uint16_t exif_count = 3 + (dated ? 3 : 0) + (serial[0] != '\0' ? 1 : 0);
+    uint32_t exif_ifd = tiff_begin_ifd(&w, exif_count);
+    if (!w.overflow) {
+        tiff_put32(w.base + pointer_entry + 8, exif_ifd);
+    }
+    tiff_entry(&w, TAG_EXIF_VERSION, TIFF_UNDEFINED, 4, "0232", 4);
+    if (dated) {
+        tiff_ascii(&w, TAG_DATE_TIME_ORIGINAL, date_time);
+        tiff_ascii(&w, TAG_OFFSET_TIME_ORIGINAL, "+00:00");
+        tiff_ascii(&w, TAG_SUBSEC_TIME_ORIGINAL, subsec);
+    }
+    tiff_long(&w, TAG_PIXEL_X_DIMENSION, frame->width);
+    tiff_long(&w, TAG_PIXEL_Y_DIMENSION, frame->height);
+    if (serial[0] != '\0') {
+        tiff_ascii(&w, TAG_BODY_SERIAL_NUMBER, serial);
+    }
+    if (w.overflow) {
+        return 0;
+    }
+
+    out[0] = 0xFF;
+    out[1] = 0xE1;
+    memcpy(out + 4, "Exif\0\0", 6);
+    return EXIF_APP1_PREFIX_SIZE + w.data;
+}
+
+esp_err_t exif_frame_build(const capture_frame_t *frame, const char *device_id, exif_frame_t *out)
+{
+    const uint8_t *buf = frame->buf;
+    size_t len = frame->len;
+    if (buf == NULL || len < 4 || buf[0] != 0xFF || buf[1] != 0xD8) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* JFIF readers expect APP0 right after SOI, so a small one stays in front */
+    size_t insert = 2;
+    if (buf[2] == 0xFF && buf[3] == 0xE0 && len >= 11) {
+        size_t app0 = 2 + ((size_t)buf[4] << 8 | buf[5]);
+        if (app0 <= EXIF_APP0_MAX_SIZE && 2 + app0 <= len && memcmp(buf + 6, "JFIF", 4) == 0) {
+            insert = 2 + app0;
+        }
+    }
+
+    /* A few frame bytes move into the head so the rest starts 4-byte aligned */
+    size_t split = insert + ((4 - ((uintptr_t)(buf + insert) & 3)) & 3);
+    if (split > len) {
+        split = len;
+    }
+
+    size_t room = EXIF_HEAD_MAX_SIZE - insert - (split - insert) - 3;
+    size_t app1 = exif_write_app1(frame, device_id, out->head + insert, room);
+    if (app1 == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    /* Padding inside APP1 keeps frame data aligned at every sector boundary of the file */
+    size_t pad = (4 - (insert + app1 + (split - insert)) % 4) % 4;
+    memset(out->head + insert + app1, 0, pad);
+    app1 += pad;
+    out->head[insert + 2] = (uint8_t)((app1 - 2) >> 8);
+    out->head[insert + 3] = (uint8_t)(app1 - 2);
+
+    memcpy(out->head, buf, insert);
+    memcpy(out->head + insert + app1, buf + insert, split - insert);
+    size_t head_size = split + app1;
+
+    out->parts[0].data = out->head;
+    out->parts[0].size = head_size;
+    out->parts[1].data = buf + split;
+    out->parts[1].size = len - split;
+    out->part_count = len > split ? 2 : 1;
+    out->size = head_size + len - split;
+    return ESP_OK;
+}
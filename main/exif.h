@@ -0,0 +1,70 @@
+/**
+ * @file exif.h
+ * @brief EXIF metadata for stored JPEG frames, written without copying the image
+ *
+ * exif_frame_build() makes a small head holding the frame's SOI marker (and
+ * JFIF APP0 segment, if any) followed by an EXIF APP1 segment, and describes
+ * the stored file as two parts for file_write_binary_fast_v(): the head,
+ * then the rest of the frame buffer in place. Only the head, at most
+ * EXIF_HEAD_MAX_SIZE bytes, is built in memory.
+ *
+ * The APP1 segment carries:
+ * - IFD0: ImageDescription (frame sequence and trigger), DateTime
+ * - Exif IFD: ExifVersion, DateTimeOriginal, SubSecTimeOriginal,
+ *   OffsetTimeOriginal (UTC), PixelXDimension, PixelYDimension,
+ *   BodySerialNumber (device id)
+ *
+ * Times are the capture time in UTC once the system clock is set; before
+ * that the date tags are left out.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "capture_frame.h"
+#include "file_operations.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Longest device id kept in BodySerialNumber */
+#define EXIF_DEVICE_ID_MAX          32
+
+/** Largest JFIF APP0 segment kept in front of the EXIF segment; larger ones follow it */
+#define EXIF_APP0_MAX_SIZE          64
+
+/** Size of the head built by exif_frame_build() */
+#define EXIF_HEAD_MAX_SIZE          512
+
+/**
+ * @brief A frame with EXIF metadata, as parts of a gather write
+ */
+typedef struct {
+    uint8_t head[EXIF_HEAD_MAX_SIZE];   /**< SOI, JFIF APP0, EXIF APP1 and up to 3 frame bytes */
+    file_write_part_t parts[2];         /**< The head, then the rest of the frame in place */
+    size_t part_count;                  /**< Parts used */
+    size_t size;                        /**< Bytes of the stored file */
+} exif_frame_t;
+
+/**
+ * @brief Describe a frame with an EXIF APP1 segment inserted after its SOI (and JFIF APP0)
+ *
+ * The parts reference @p frame's buffer, which must stay valid until they are written.
+ * The head is sized so that the frame data starts 4-byte aligned at every
+ * sector boundary of the file.
+ *
+ * @param frame Frame to describe
+ * @param device_id Device id for BodySerialNumber, truncated to EXIF_DEVICE_ID_MAX
+ * @param[out] out Head and parts
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the frame does not start with a JPEG SOI marker,
+ *         ESP_ERR_INVALID_SIZE if the EXIF segment does not fit in the head
+ */
+esp_err_t exif_frame_build(const capture_frame_t *frame, const char *device_id, exif_frame_t *out);
+
+#ifdef __cplusplus
+}
+#endif
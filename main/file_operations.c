@@ -5,14 +5,66 @@
 
 #include "file_operations.h"
 #include "app_config.h"
+#include "latency_stats.h"
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <esp_memory_utils.h>
+#include <esp_vfs_fat.h>
+#include "soc/soc_caps.h"
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <dirent.h>
 
 static const char *TAG = "file_operations";
 
+/* Staging buffer for chunks the SDMMC DMA cannot read, claimed by one write at a time */
+static uint8_t *s_bounce = NULL;
+static size_t s_bounce_size = 0;
+static bool s_bounce_busy = false;
+static uint32_t s_bounce_fallbacks = 0;
+
+esp_err_t file_write_init(size_t chunk_size)
+{
+    if (chunk_size < FILE_SECTOR_SIZE || (chunk_size % FILE_SECTOR_SIZE) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_bounce != NULL && s_bounce_size == chunk_size) {
+        return ESP_OK;
+    }
+
+    heap_caps_free(s_bounce);
+    s_bounce_size = 0;
+    s_bounce = heap_caps_malloc(chunk_size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    if (s_bounce == NULL) {
+        ESP_LOGW(TAG, "No DMA-capable memory for a %zu byte bounce buffer", chunk_size);
+        return ESP_ERR_NO_MEM;
+    }
+    s_bounce_size = chunk_size;
+    return ESP_OK;
+}
+
+uint32_t file_write_get_fallbacks(void)
+{
+    return __atomic_load_n(&s_bounce_fallbacks, __ATOMIC_RELAXED);
+}
+
 esp_err_t file_write_binary(const char *path, const uint8_t *data, size_t size)
 {
+    file_write_part_t part = { .data = data, .size = size };
+    return file_write_binary_v(path, &part, 1);
+}
+
+esp_err_t file_write_binary_v(const char *path, const file_write_part_t *parts, size_t count)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size += parts[i].size;
+    }
     ESP_LOGI(TAG, "Writing binary file: %s (%zu bytes)", path, size);
     
     FILE *file = fopen(path, "wb");
@@ -21,7 +73,10 @@ esp_err_t file_write_binary(const char *path, const uint8_t *data, size_t size)
         return ESP_FAIL;
     }
     
-    size_t written = fwrite(data, 1, size, file);
+    size_t written = 0;
+    for (size_t i = 0; i < count; i++) {
+        written += fwrite(parts[i].data, 1, parts[i].size, file);
+    }
     fclose(file);
     
     if (written != size) {
@@ -33,6 +88,221 @@ esp_err_t file_write_binary(const char *path, const uint8_t *data, size_t size)
     return ESP_OK;
 }
 
+bool file_buffer_dma_capable(const void *buf)
+{
+    if (((uintptr_t)buf & 3) != 0) {
+        return false;
+    }
+    if (esp_ptr_dma_capable(buf)) {
+        return true;
+    }
+#if SOC_SDMMC_PSRAM_DMA_CAPABLE
+    return esp_ptr_dma_ext_capable(buf);
+#else
+    return false;
+#endif
+}
+
+esp_err_t file_write_chunked(int fd, const uint8_t *data, size_t size, size_t chunk_size,
+                             bool sync_every_chunk)
+{
+    if (chunk_size < FILE_SECTOR_SIZE || (chunk_size % FILE_SECTOR_SIZE) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    off_t position = lseek(fd, 0, SEEK_CUR);
+    if (position < 0) {
+        return ESP_FAIL;
+    }
+
+    bool bounce = false;
+    esp_err_t ret = ESP_OK;
+    size_t done = 0;
+
+    while (done < size) {
+        /* Buffers the DMA cannot read (e.g. PSRAM on ESP32) would otherwise be
+         * written one sector per command by the SDMMC driver */
+        const uint8_t *src = data + done;
+        size_t max_len = chunk_size;
+        bool stage = false;
+        if (!file_buffer_dma_capable(src)) {
+            if (!bounce && s_bounce != NULL) {
+                bounce = !__atomic_exchange_n(&s_bounce_busy, true, __ATOMIC_ACQUIRE);
+            }
+            stage = bounce;
+            if (stage) {
+                max_len = chunk_size < s_bounce_size ? chunk_size : s_bounce_size;
+            } else if (__atomic_fetch_add(&s_bounce_fallbacks, 1, __ATOMIC_RELAXED) == 0) {
+                ESP_LOGW(TAG, "Writing from a buffer the DMA cannot read, without a bounce buffer");
+            }
+        }
+
+        /* Shorten a chunk that starts inside a sector so the following ones start on a boundary */
+        size_t len = max_len - (size_t)((position + done) % FILE_SECTOR_SIZE);
+        if (len > size - done) {
+            len = size - done;
+        }
+        if (stage) {
+            memcpy(s_bounce, src, len);
+            src = s_bounce;
+        }
+
+        ssize_t written = write(fd, src, len);
+        if (written < 0 || (size_t)written != len) {
+            ret = ESP_FAIL;
+            break;
+        }
+        if (sync_every_chunk && fsync(fd) != 0) {
+            ret = ESP_FAIL;
+            break;
+        }
+        done += len;
+    }
+
+    if (bounce) {
+        __atomic_store_n(&s_bounce_busy, false, __ATOMIC_RELEASE);
+    }
+    return ret;
+}
+
+/**
+ * @brief Name of the temporary file for @p path: same name, FILE_TEMP_EXT extension
+ */
+static esp_err_t file_temp_path(const char *path, char *temp, size_t size)
+{
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(path, '.');
+    size_t stem_len = (dot != NULL && (slash == NULL || dot > slash)) ? (size_t)(dot - path) : strlen(path);
+
+    if (stem_len + sizeof(FILE_TEMP_EXT) > size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(temp, path, stem_len);
+    memcpy(temp + stem_len, FILE_TEMP_EXT, sizeof(FILE_TEMP_EXT));
+    return ESP_OK;
+}
+
+esp_err_t file_write_binary_fast(const char *path, const uint8_t *data, size_t size,
+                                 const file_write_options_t *options, file_write_result_t *result)
+{
+    file_write_part_t part = { .data = data, .size = size };
+    return file_write_binary_fast_v(path, &part, 1, options, result);
+}
+
+esp_err_t file_write_binary_fast_v(const char *path, const file_write_part_t *parts, size_t count,
+                                   const file_write_options_t *options, file_write_result_t *result)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size += parts[i].size;
+    }
+
+    file_write_options_t defaults = FILE_WRITE_OPTIONS_DEFAULT();
+    if (options == NULL) {
+        options = &defaults;
+    }
+
+    /* Atomic writes go to a temporary name that is renamed once complete */
+    char temp_path[EXAMPLE_MAX_CHAR_SIZE];
+    const char *write_path = path;
+    if (options->atomic) {
+        if (file_temp_path(path, temp_path, sizeof(temp_path)) != ESP_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        write_path = temp_path;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    /* Reserve the whole cluster chain up front instead of extending it per write */
+    bool contiguous = false;
+    if (options->preallocate && size > 0) {
+        unlink(write_path);
+        contiguous = (esp_vfs_fat_create_contiguous_file(MOUNT_POINT, write_path, size, true) == ESP_OK);
+    }
+
+    int fd = open(write_path, contiguous ? O_WRONLY : (O_WRONLY | O_CREAT | O_TRUNC), 0644);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to open file for writing: %s", write_path);
+        if (contiguous) {
+            unlink(write_path);
+        }
+        return ESP_FAIL;
+    }
+    int64_t opened = esp_timer_get_time();
+
+    esp_err_t ret = ESP_OK;
+    for (size_t i = 0; i < count && ret == ESP_OK; i++) {
+        ret = file_write_chunked(fd, parts[i].data, parts[i].size, options->chunk_size,
+                                 options->sync == FILE_SYNC_EVERY_CHUNK);
+    }
+    int64_t written = esp_timer_get_time();
+
+    if (ret == ESP_OK && options->sync == FILE_SYNC_BEFORE_CLOSE && fsync(fd) != 0) {
+        ret = ESP_FAIL;
+    }
+    int64_t synced = esp_timer_get_time();
+
+    if (close(fd) != 0) {
+        ret = ESP_FAIL;
+    }
+    int64_t closed = esp_timer_get_time();
+
+    /* FATFS does not rename over an existing file */
+    if (ret == ESP_OK && options->atomic) {
+        unlink(path);
+        if (rename(write_path, path) != 0) {
+            ret = ESP_FAIL;
+        }
+    }
+    int64_t committed = esp_timer_get_time();
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write complete data to file: %s", path);
+        if (options->atomic) {
+            unlink(write_path);
+        }
+        return ret;
+    }
+
+    latency_stats_record(LATENCY_STAGE_OPEN, (uint32_t)(opened - start));
+    latency_stats_record(LATENCY_STAGE_WRITE, (uint32_t)(written - opened));
+    if (options->sync == FILE_SYNC_BEFORE_CLOSE) {
+        latency_stats_record(LATENCY_STAGE_FSYNC, (uint32_t)(synced - written));
+    }
+    latency_stats_record(LATENCY_STAGE_CLOSE, (uint32_t)(committed - synced));
+
+    uint32_t total_us = (uint32_t)(committed - start);
+    float mb_per_s = total_us ? (float)size / total_us : 0.0f;
+    if (result) {
+        result->open_us = (uint32_t)(opened - start);
+        result->write_us = (uint32_t)(written - opened);
+        result->sync_us = (uint32_t)(synced - written);
+        result->close_us = (uint32_t)(closed - synced);
+        result->rename_us = (uint32_t)(committed - closed);
+        result->total_us = total_us;
+        result->mb_per_s = mb_per_s;
+        result->contiguous = contiguous;
+    }
+
+    ESP_LOGD(TAG, "Binary file written: %s (%zu bytes, %lu us, %.2f MB/s%s)", path, size,
+             (unsigned long)total_us, mb_per_s, contiguous ? ", contiguous" : "");
+    return ESP_OK;
+}
+
+esp_err_t file_remove_temp_file(const char *path)
+{
+    char temp_path[EXAMPLE_MAX_CHAR_SIZE];
+    if (file_temp_path(path, temp_path, sizeof(temp_path)) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (unlink(temp_path) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGW(TAG, "Removed uncommitted file: %s", temp_path);
+    return ESP_OK;
+}
+
 esp_err_t file_read_text(const char *path)
 {
     ESP_LOGI(TAG, "Reading text file: %s", path);
@@ -78,3 +348,112 @@ esp_err_t file_write_text(const char *path, const char *text)
     ESP_LOGI(TAG, "Text file written successfully");
     return ESP_OK;
 }
+
+uint32_t file_next_index(const char *dir, const char *prefix, const char *ext)
+{
+    uint32_t next = 0;
+    file_index_range(dir, prefix, ext, NULL, &next);
+    return next;
+}
+
+uint32_t file_index_range(const char *dir, const char *prefix, const char *ext,
+                          uint32_t *first, uint32_t *next)
+{
+    uint32_t lowest = 0, highest_next = 0, count = 0;
+
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        ESP_LOGW(TAG, "Failed to open directory: %s", dir);
+    } else {
+        size_t prefix_len = strlen(prefix);
+        size_t ext_len = strlen(ext);
+        struct dirent *entry;
+
+        while ((entry = readdir(d)) != NULL) {
+            const char *name = entry->d_name;
+            size_t name_len = strlen(name);
+            if (name_len <= prefix_len + ext_len ||
+                strncasecmp(name, prefix, prefix_len) != 0 ||
+                strcasecmp(name + name_len - ext_len, ext) != 0) {
+                continue;
+            }
+
+            char *end;
+            unsigned long index = strtoul(name + prefix_len, &end, 10);
+            if (end != name + name_len - ext_len) {
+                continue;
+            }
+            if (count == 0 || index < lowest) {
+                lowest = index;
+            }
+            if (index + 1 > highest_next) {
+                highest_next = index + 1;
+            }
+            count++;
+        }
+
+        closedir(d);
+    }
+
+    if (first) {
+        *first = lowest;
+    }
+    if (next) {
+        *next = highest_next;
+    }
+    return count;
+}
+
+esp_err_t file_write_benchmark(const char *dir, size_t size, int iterations)
+{
+    uint8_t *data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (data == NULL) {
+        data = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    if (data == NULL || iterations <= 0) {
+        heap_caps_free(data);
+        return data == NULL ? ESP_ERR_NO_MEM : ESP_ERR_INVALID_ARG;
+    }
+
+    /* Incompressible content, like JPEG data */
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+
+    static const char *const names[] = { "stdio", "fast" };
+    esp_err_t ret = ESP_OK;
+    char path[EXAMPLE_MAX_CHAR_SIZE];
+
+    for (int mode = 0; mode < 2 && ret == ESP_OK; mode++) {
+        uint32_t min_us = UINT32_MAX, max_us = 0;
+        uint64_t total_us = 0;
+
+        for (int i = 0; i < iterations && ret == ESP_OK; i++) {
+            snprintf(path, sizeof(path), "%s/BENCH%03d.BIN", dir, i);
+            int64_t start = esp_timer_get_time();
+            ret = (mode == 0) ? file_write_binary(path, data, size)
+                              : file_write_binary_fast(path, data, size, NULL, NULL);
+            uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+
+            total_us += elapsed;
+            min_us = elapsed < min_us ? elapsed : min_us;
+            max_us = elapsed > max_us ? elapsed : max_us;
+        }
+
+        for (int i = 0; i < iterations; i++) {
+            snprintf(path, sizeof(path), "%s/BENCH%03d.BIN", dir, i);
+            unlink(path);
+        }
+
+        if (ret == ESP_OK) {
+            ESP_LOGI(TAG, "Benchmark %s: %d x %zu bytes, %.2f MB/s, latency min %lu / avg %lu / max %lu us",
+                     names[mode], iterations, size, (float)size * iterations / total_us,
+                     (unsigned long)min_us, (unsigned long)(total_us / iterations), (unsigned long)max_us);
+        }
+    }
+
+    heap_caps_free(data);
+    return ret;
+}
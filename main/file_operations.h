@@ -5,7 +5,9 @@
 
 #pragma once
 
+#include "sdkconfig.h"
 #include "esp_err.h"
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -13,6 +15,82 @@
 extern "C" {
 #endif
 
+/** SD card sector size; chunks are aligned to it */
+#define FILE_SECTOR_SIZE 512
+
+/** Extension of files being written atomically, removed by recovery if left behind */
+#define FILE_TEMP_EXT ".TMP"
+
+/**
+ * @brief When data written by file_write_binary_fast() is flushed to the card
+ */
+typedef enum {
+    FILE_SYNC_ON_CLOSE,         /**< Flushed by close() only */
+    FILE_SYNC_BEFORE_CLOSE,     /**< Explicit fsync() before close(), timed separately */
+    FILE_SYNC_EVERY_CHUNK,      /**< fsync() after every chunk */
+} file_sync_policy_t;
+
+/**
+ * @brief Options for the high-throughput write path
+ */
+typedef struct {
+    size_t chunk_size;          /**< Bytes per write() call, multiple of FILE_SECTOR_SIZE */
+    bool preallocate;           /**< Reserve contiguous clusters for the whole file first */
+    file_sync_policy_t sync;    /**< Flush policy */
+    bool atomic;                /**< Write to a temporary name and rename when complete */
+} file_write_options_t;
+
+#ifndef CONFIG_APP_FILE_WRITE_CHUNK_KB
+#define CONFIG_APP_FILE_WRITE_CHUNK_KB 32
+#endif
+#define FILE_WRITE_CHUNK_SIZE (CONFIG_APP_FILE_WRITE_CHUNK_KB * 1024)
+
+#if CONFIG_APP_FILE_WRITE_SYNC_EVERY_CHUNK
+#define FILE_WRITE_SYNC_DEFAULT FILE_SYNC_EVERY_CHUNK
+#elif CONFIG_APP_FILE_WRITE_SYNC_BEFORE_CLOSE
+#define FILE_WRITE_SYNC_DEFAULT FILE_SYNC_BEFORE_CLOSE
+#else
+#define FILE_WRITE_SYNC_DEFAULT FILE_SYNC_ON_CLOSE
+#endif
+
+#if CONFIG_APP_FILE_WRITE_ATOMIC
+#define FILE_WRITE_ATOMIC_DEFAULT true
+#else
+#define FILE_WRITE_ATOMIC_DEFAULT false
+#endif
+
+/**
+ * @brief Default write options from Kconfig
+ */
+#define FILE_WRITE_OPTIONS_DEFAULT() {                      \
+    .chunk_size  = FILE_WRITE_CHUNK_SIZE,                   \
+    .preallocate = true,                                    \
+    .sync        = FILE_WRITE_SYNC_DEFAULT,                 \
+    .atomic      = FILE_WRITE_ATOMIC_DEFAULT,               \
+}
+
+/**
+ * @brief One buffer of a gather write
+ */
+typedef struct {
+    const uint8_t *data;        /**< Data to write */
+    size_t size;                /**< Bytes at data */
+} file_write_part_t;
+
+/**
+ * @brief Timing of a single file_write_binary_fast() call
+ */
+typedef struct {
+    uint32_t open_us;           /**< Pre-allocation and open */
+    uint32_t write_us;          /**< All write() calls (and per-chunk syncs) */
+    uint32_t sync_us;           /**< Explicit fsync() before close */
+    uint32_t close_us;          /**< close() including the implicit flush */
+    uint32_t rename_us;         /**< Rename to the final name of an atomic write */
+    uint32_t total_us;          /**< Whole call */
+    float mb_per_s;             /**< Throughput over the whole call */
+    bool contiguous;            /**< Clusters were pre-allocated contiguously */
+} file_write_result_t;
+
 /**
  * @brief Write data to a file on the SD card
  * @param path File path to write to
@@ -22,6 +100,129 @@ extern "C" {
  */
 esp_err_t file_write_binary(const char *path, const uint8_t *data, size_t size);
 
+/**
+ * @brief Write the concatenation of several buffers to a file on the SD card
+ * @param path File path to write to
+ * @param parts Buffers, written in order
+ * @param count Number of buffers
+ * @return ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t file_write_binary_v(const char *path, const file_write_part_t *parts, size_t count);
+
+/**
+ * @brief Write a binary file through the high-throughput path
+ *
+ * Pre-allocates contiguous clusters for @p size bytes, then writes with
+ * POSIX write() (no stdio buffering) in sector-aligned chunks. Buffers the
+ * SDMMC DMA can read (internal RAM, or PSRAM on targets that support it)
+ * are written directly; other buffers are staged through an internal
+ * DMA-capable chunk buffer so the card still sees multi-block writes.
+ *
+ * With @c atomic set, the data is written to the same name with the
+ * FILE_TEMP_EXT extension and renamed once closed, so a power cut leaves
+ * either the complete file or a temporary file that recovery removes.
+ *
+ * @param path File path to write to
+ * @param data Data buffer to write
+ * @param size Size of data to write
+ * @param options Write options, NULL for FILE_WRITE_OPTIONS_DEFAULT()
+ * @param[out] result Timing of the call (may be NULL)
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t file_write_binary_fast(const char *path, const uint8_t *data, size_t size,
+                                 const file_write_options_t *options, file_write_result_t *result);
+
+/**
+ * @brief Write the concatenation of several buffers through the high-throughput path
+ *
+ * As file_write_binary_fast() for the whole file, without first copying the
+ * buffers together: each one is written in place, its first chunk shortened
+ * to the next sector boundary of the file. A buffer whose sector-aligned
+ * chunks start on 4-byte boundaries is written by the DMA directly.
+ *
+ * @param path File path to write to
+ * @param parts Buffers, written in order
+ * @param count Number of buffers
+ * @param options Write options, NULL for FILE_WRITE_OPTIONS_DEFAULT()
+ * @param[out] result Timing of the call (may be NULL)
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t file_write_binary_fast_v(const char *path, const file_write_part_t *parts, size_t count,
+                                   const file_write_options_t *options, file_write_result_t *result);
+
+/**
+ * @brief Check whether the SDMMC DMA can read a buffer directly
+ *
+ * Other buffers (e.g. PSRAM on the ESP32) are written one sector per command
+ * by the SDMMC driver, so callers should stage them in internal memory.
+ */
+bool file_buffer_dma_capable(const void *buf);
+
+/**
+ * @brief Allocate the internal DMA-capable buffer that file_write_chunked() stages through
+ *
+ * Allocated once instead of per write. Calling it again with another size
+ * replaces the buffer (e.g. after calibration picked the chunk size); this
+ * must not happen while a write is in progress. Chunks larger than the
+ * buffer are staged in buffer-sized pieces.
+ *
+ * @param chunk_size Buffer size, multiple of FILE_SECTOR_SIZE
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if there is no DMA-capable memory
+ */
+esp_err_t file_write_init(size_t chunk_size);
+
+/**
+ * @brief Number of chunks written from a buffer the DMA cannot read, without staging
+ *
+ * Counts writes made before file_write_init() or while another write held
+ * the buffer; these go to the card one sector per command.
+ */
+uint32_t file_write_get_fallbacks(void);
+
+/**
+ * @brief Write to an open file descriptor in chunks aligned to sector boundaries of the file
+ *
+ * The first chunk is shortened so that later chunks start on a sector
+ * boundary of the file, which lets FATFS pass them to the card as whole
+ * multi-block writes. Chunks the DMA cannot read are copied to the buffer
+ * of file_write_init() first.
+ *
+ * @param fd Open file descriptor, positioned where the data goes
+ * @param data Data buffer to write
+ * @param size Size of data to write
+ * @param chunk_size Bytes per write() call, multiple of FILE_SECTOR_SIZE
+ * @param sync_every_chunk Call fsync() after every chunk
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t file_write_chunked(int fd, const uint8_t *data, size_t size, size_t chunk_size,
+                             bool sync_every_chunk);
+
+/**
+ * @brief Remove the temporary file an interrupted atomic write of @p path left
+ *
+ * Writes are sequential, so after a power cut only the file that was being
+ * written can have one; callers pass that name instead of scanning the
+ * directory.
+ *
+ * @param path Final name of the file
+ * @return ESP_OK if a temporary file was removed, ESP_ERR_NOT_FOUND if there was none
+ */
+esp_err_t file_remove_temp_file(const char *path);
+
+/**
+ * @brief Compare the stdio and high-throughput write paths on the mounted card
+ *
+ * Writes @p iterations files of @p size bytes from a PSRAM buffer with
+ * file_write_binary() and file_write_binary_fast() and logs MB/s and
+ * per-write latency of both.
+ *
+ * @param dir Directory for the test files (removed afterwards)
+ * @param size File size in bytes
+ * @param iterations Files written per path
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t file_write_benchmark(const char *dir, size_t size, int iterations);
+
 /**
  * @brief Read and display content from a text file
  * @param path File path to read from
@@ -37,6 +238,27 @@ esp_err_t file_read_text(const char *path);
  */
 esp_err_t file_write_text(const char *path, const char *text);
 
+/**
+ * @brief Find the next free index for numbered files such as IMG00042.JPG
+ * @param dir Directory to scan
+ * @param prefix File name prefix (e.g. "IMG")
+ * @param ext File extension including the dot (e.g. ".JPG")
+ * @return One past the highest index found, 0 if there are no matching files
+ */
+uint32_t file_next_index(const char *dir, const char *prefix, const char *ext);
+
+/**
+ * @brief Find the range of indices used by numbered files such as IMG00042.JPG
+ * @param dir Directory to scan
+ * @param prefix File name prefix (e.g. "IMG")
+ * @param ext File extension including the dot (e.g. ".JPG")
+ * @param[out] first Lowest index found (may be NULL)
+ * @param[out] next One past the highest index found (may be NULL)
+ * @return Number of matching files, 0 if there are none
+ */
+uint32_t file_index_range(const char *dir, const char *prefix, const char *ext,
+                          uint32_t *first, uint32_t *next);
+
 #ifdef __cplusplus
 }
 #endif
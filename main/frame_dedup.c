@@ -0,0 +1,244 @@
+/**
+ * @file frame_dedup.c
+ * @brief Near-duplicate frame suppression implementation
+ */
+
+#include "frame_dedup.h"
+#include "jpeg_dc.h"
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Hash grid: 9 columns give 8 horizontal differences per row */
+#define DEDUP_GRID_W    9
+#define DEDUP_GRID_H    8
+
+static const char *TAG = "frame_dedup";
+
+struct frame_dedup_t {
+    frame_dedup_config_t config;
+    jpeg_dc_handle_t jpeg;      /* Luminance map parser */
+    uint8_t *map;               /* Luminance map of the current frame */
+    size_t map_size;
+    uint64_t hashes[FRAME_DEDUP_MAX_HISTORY];  /* Recently kept frames, oldest overwritten */
+    size_t count;
+    size_t next;
+    int64_t last_kept_us;
+    portMUX_TYPE lock;          /* Protects the statistics */
+    frame_dedup_stats_t stats;
+    uint64_t hash_time_us;
+};
+
+esp_err_t frame_dedup_create(const frame_dedup_config_t *config, frame_dedup_handle_t *ret_dedup)
+{
+    if (config == NULL || ret_dedup == NULL || config->history == 0 ||
+        config->history > FRAME_DEDUP_MAX_HISTORY || config->max_distance >= 64) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct frame_dedup_t *dedup = calloc(1, sizeof(*dedup));
+    if (dedup == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    dedup->config = *config;
+    portMUX_INITIALIZE(&dedup->lock);
+    if (jpeg_dc_create(&dedup->jpeg) != ESP_OK) {
+        free(dedup);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Skipping frames within %u bits of the last %u stored, keeping one every %lu ms",
+             config->max_distance, config->history, (unsigned long)config->keep_interval_ms);
+    *ret_dedup = dedup;
+    return ESP_OK;
+}
+
+void frame_dedup_delete(frame_dedup_handle_t dedup)
+{
+    if (dedup == NULL) {
+        return;
+    }
+    jpeg_dc_delete(dedup->jpeg);
+    heap_caps_free(dedup->map);
+    free(dedup);
+}
+
+void frame_dedup_reset(frame_dedup_handle_t dedup)
+{
+    dedup->count = 0;
+    dedup->next = 0;
+}
+
+uint64_t frame_dedup_hash_gray(const uint8_t *gray, uint16_t width, uint16_t height, size_t stride)
+{
+    /* Cell means in 8.8 fixed point, so small gradients still order correctly */
+    uint32_t cells[DEDUP_GRID_H][DEDUP_GRID_W];
+
+    for (size_t cy = 0; cy < DEDUP_GRID_H; cy++) {
+        size_t y0 = cy * height / DEDUP_GRID_H;
+        size_t y1 = (cy + 1) * height / DEDUP_GRID_H;
+        for (size_t cx = 0; cx < DEDUP_GRID_W; cx++) {
+            size_t x0 = cx * width / DEDUP_GRID_W;
+            size_t x1 = (cx + 1) * width / DEDUP_GRID_W;
+            uint32_t sum = 0;
+            for (size_t y = y0; y < y1; y++) {
+                const uint8_t *row = gray + y * stride;
+                for (size_t x = x0; x < x1; x++) {
+                    sum += row[x];
+                }
+            }
+            size_t area = (x1 - x0) * (y1 - y0);
+            cells[cy][cx] = area ? (sum << 8) / area : 0;
+        }
+    }
+
+    uint64_t hash = 0;
+    for (size_t cy = 0; cy < DEDUP_GRID_H; cy++) {
+        for (size_t cx = 0; cx < DEDUP_GRID_W - 1; cx++) {
+            if (cells[cy][cx] > cells[cy][cx + 1]) {
+                hash |= 1ull << (cy * 8 + cx);
+            }
+        }
+    }
+    return hash;
+}
+
+esp_err_t frame_dedup_hash_jpeg(frame_dedup_handle_t dedup, const capture_frame_t *frame, uint64_t *hash)
+{
+    if (frame == NULL || frame->buf == NULL || hash == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    jpeg_dc_info_t info;
+    esp_err_t ret = jpeg_dc_get_info(dedup->jpeg, frame->buf, frame->len, &info);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (info.map_width < DEDUP_GRID_W || info.map_height < DEDUP_GRID_H) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    /* Touched once per frame, so PSRAM is fine */
+    size_t size = (size_t)info.map_width * info.map_height;
+    if (size > dedup->map_size) {
+        heap_caps_free(dedup->map);
+        dedup->map = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (dedup->map == NULL) {
+            dedup->map = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+        }
+        dedup->map_size = dedup->map != NULL ? size : 0;
+        if (dedup->map == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    ret = jpeg_dc_luma(dedup->jpeg, frame->buf, frame->len, dedup->map, info.map_width, NULL);
+    if (ret == ESP_OK) {
+        *hash = frame_dedup_hash_gray(dedup->map, info.map_width, info.map_height, info.map_width);
+    }
+    return ret;
+}
+
+void frame_dedup_check(frame_dedup_handle_t dedup, uint64_t hash, int64_t timestamp_us,
+                       frame_dedup_result_t *result)
+{
+    result->hash = hash;
+    result->distance = 64;
+    for (size_t i = 0; i < dedup->count; i++) {
+        uint8_t distance = frame_dedup_distance(hash, dedup->hashes[i]);
+        if (distance < result->distance) {
+            result->distance = distance;
+        }
+    }
+
+    result->duplicate = result->distance <= dedup->config.max_distance;
+    bool thinned = result->duplicate && dedup->config.keep_interval_ms != 0 &&
+                   timestamp_us - dedup->last_kept_us >= (int64_t)dedup->config.keep_interval_ms * 1000;
+    result->keep = !result->duplicate || thinned;
+
+    if (result->keep) {
+        dedup->hashes[dedup->next] = hash;
+        dedup->next = (dedup->next + 1) % dedup->config.history;
+        if (dedup->count < dedup->config.history) {
+            dedup->count++;
+        }
+        dedup->last_kept_us = timestamp_us;
+    }
+
+    portENTER_CRITICAL(&dedup->lock);
+    dedup->stats.frames++;
+    if (result->keep) {
+        dedup->stats.kept++;
+    } else {
+        dedup->stats.skipped++;
+    }
+    if (thinned) {
+        dedup->stats.thinned++;
+    }
+    portEXIT_CRITICAL(&dedup->lock);
+}
+
+bool frame_dedup_filter(void *ctx, capture_frame_t *frame)
+{
+    frame_dedup_handle_t dedup = (frame_dedup_handle_t)ctx;
+
+    int64_t start = esp_timer_get_time();
+    uint64_t hash;
+    esp_err_t ret = frame_dedup_hash_jpeg(dedup, frame, &hash);
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+
+    /* A frame that cannot be compared is not known to be a duplicate */
+    if (ret != ESP_OK) {
+        portENTER_CRITICAL(&dedup->lock);
+        dedup->stats.errors++;
+        portEXIT_CRITICAL(&dedup->lock);
+        ESP_LOGW(TAG, "Frame %lu: no hash: %s", (unsigned long)frame->seq, esp_err_to_name(ret));
+        return true;
+    }
+
+    frame_dedup_result_t result;
+    frame_dedup_check(dedup, hash, frame->timestamp_us, &result);
+
+    portENTER_CRITICAL(&dedup->lock);
+    dedup->hash_time_us += elapsed;
+    if (!result.keep) {
+        dedup->stats.bytes_saved += frame->len;
+    }
+    portEXIT_CRITICAL(&dedup->lock);
+
+    if (!result.keep) {
+        ESP_LOGD(TAG, "Frame %lu skipped: hash %016llx, %u bits from a stored frame",
+                 (unsigned long)frame->seq, (unsigned long long)hash, result.distance);
+    }
+    return result.keep;
+}
+
+void frame_dedup_get_stats(frame_dedup_handle_t dedup, frame_dedup_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&dedup->lock);
+    *stats = dedup->stats;
+    uint64_t hash_time_us = dedup->hash_time_us;
+    portEXIT_CRITICAL(&dedup->lock);
+
+    uint32_t hashed = stats->frames;
+    stats->avg_hash_us = hashed ? (uint32_t)(hash_time_us / hashed) : 0;
+}
+
+void frame_dedup_log_stats(frame_dedup_handle_t dedup)
+{
+    frame_dedup_stats_t stats;
+    frame_dedup_get_stats(dedup, &stats);
+
+    ESP_LOGI(TAG, "frames %lu, kept %lu (%lu thinned), skipped %lu, saved %llu KB, errors %lu, hash %lu us",
+             (unsigned long)stats.frames, (unsigned long)stats.kept, (unsigned long)stats.thinned,
+             (unsigned long)stats.skipped, (unsigned long long)(stats.bytes_saved / 1024),
+             (unsigned long)stats.errors, (unsigned long)stats.avg_hash_us);
+}
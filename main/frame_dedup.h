@@ -0,0 +1,170 @@
+/**
+ * @file frame_dedup.h
+ * @brief Near-duplicate frame suppression with a perceptual hash
+ *
+ * Each frame gets a 64-bit difference hash: its 1/8 scale luminance map
+ * (the JPEG DC coefficients, jpeg_dc) is averaged down to 9x8 cells and
+ * every bit tells whether a cell is brighter than its right neighbour.
+ * The hash follows the structure of the scene rather than its exposure,
+ * and JPEG noise moves few bits. Frames whose hash is within a Hamming
+ * distance of one of the recently stored frames are skipped; at most one
+ * per keep interval is stored anyway, so a static scene is thinned instead
+ * of going silent.
+ *
+ * frame_dedup_hash_gray() is a pure function of the image, so hashes can be
+ * checked on a host against fixture JPEGs.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "capture_frame.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Largest number of stored frame hashes compared against */
+#define FRAME_DEDUP_MAX_HISTORY     16
+
+typedef struct frame_dedup_t *frame_dedup_handle_t;
+
+/**
+ * @brief Duplicate suppression configuration
+ */
+typedef struct {
+    uint8_t max_distance;           /**< Hamming distance up to which a frame is a duplicate */
+    uint8_t history;                /**< Recently stored hashes compared against, 1..FRAME_DEDUP_MAX_HISTORY */
+    uint32_t keep_interval_ms;      /**< Store a duplicate anyway after this long without storing, 0 = never */
+} frame_dedup_config_t;
+
+#ifndef CONFIG_APP_DEDUP_MAX_DISTANCE
+#define CONFIG_APP_DEDUP_MAX_DISTANCE       4
+#endif
+#ifndef CONFIG_APP_DEDUP_HISTORY
+#define CONFIG_APP_DEDUP_HISTORY            4
+#endif
+#ifndef CONFIG_APP_DEDUP_KEEP_INTERVAL_MS
+#define CONFIG_APP_DEDUP_KEEP_INTERVAL_MS   10000
+#endif
+
+/**
+ * @brief Default duplicate suppression configuration from Kconfig
+ */
+#define FRAME_DEDUP_DEFAULT_CONFIG() {                              \
+    .max_distance       = CONFIG_APP_DEDUP_MAX_DISTANCE,            \
+    .history            = CONFIG_APP_DEDUP_HISTORY,                 \
+    .keep_interval_ms   = CONFIG_APP_DEDUP_KEEP_INTERVAL_MS,        \
+}
+
+/**
+ * @brief Result of checking one frame
+ */
+typedef struct {
+    uint64_t hash;                  /**< Perceptual hash of the frame */
+    uint8_t distance;               /**< Smallest distance to a stored hash, 64 if there is none */
+    bool duplicate;                 /**< distance is within max_distance */
+    bool keep;                      /**< Frame is to be stored */
+} frame_dedup_result_t;
+
+/**
+ * @brief Duplicate suppression statistics
+ */
+typedef struct {
+    uint32_t frames;                /**< Frames hashed and checked */
+    uint32_t kept;                  /**< Frames passed on to be stored */
+    uint32_t skipped;               /**< Duplicates dropped */
+    uint32_t thinned;               /**< Duplicates kept because of the keep interval */
+    uint32_t errors;                /**< Frames without a luminance map, kept */
+    uint64_t bytes_saved;           /**< JPEG bytes of the skipped frames */
+    uint32_t avg_hash_us;           /**< Average luminance map and hash time */
+} frame_dedup_stats_t;
+
+/**
+ * @brief Create a duplicate suppressor and its JPEG parser
+ * @param config Configuration
+ * @param[out] ret_dedup Created suppressor
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad configuration, ESP_ERR_NO_MEM
+ */
+esp_err_t frame_dedup_create(const frame_dedup_config_t *config, frame_dedup_handle_t *ret_dedup);
+
+/**
+ * @brief Free a duplicate suppressor
+ */
+void frame_dedup_delete(frame_dedup_handle_t dedup);
+
+/**
+ * @brief Forget the stored hashes; the next frame is kept
+ */
+void frame_dedup_reset(frame_dedup_handle_t dedup);
+
+/**
+ * @brief Difference hash of a grayscale image
+ *
+ * Bit 8 * y + x is set when cell (x, y) of a 9x8 grid of cell means is
+ * brighter than cell (x + 1, y).
+ *
+ * @param gray 8-bit luminance image, at least 9x8
+ * @param width Image width
+ * @param height Image height
+ * @param stride Row stride of @p gray
+ * @return Hash
+ */
+uint64_t frame_dedup_hash_gray(const uint8_t *gray, uint16_t width, uint16_t height, size_t stride);
+
+/**
+ * @brief Hash the 1/8 scale luminance map of a JPEG frame
+ * @param dedup Suppressor, for its parser and map buffer
+ * @param frame JPEG frame
+ * @param[out] hash Hash
+ * @return ESP_OK on success, a jpeg_dc_luma() error if the frame cannot be parsed,
+ *         ESP_ERR_NO_MEM if the map buffer cannot be allocated
+ */
+esp_err_t frame_dedup_hash_jpeg(frame_dedup_handle_t dedup, const capture_frame_t *frame, uint64_t *hash);
+
+/**
+ * @brief Number of differing bits of two hashes
+ */
+static inline uint8_t frame_dedup_distance(uint64_t a, uint64_t b)
+{
+    return (uint8_t)__builtin_popcountll(a ^ b);
+}
+
+/**
+ * @brief Decide on a hashed frame and remember its hash if it is kept
+ * @param dedup Suppressor
+ * @param hash Frame hash
+ * @param timestamp_us Frame time, for the keep interval
+ * @param[out] result Decision
+ */
+void frame_dedup_check(frame_dedup_handle_t dedup, uint64_t hash, int64_t timestamp_us,
+                       frame_dedup_result_t *result);
+
+/**
+ * @brief Capture pipeline filter: drop near-duplicates of recently stored frames
+ *
+ * Frames without a luminance map (e.g. progressive JPEGs) are kept.
+ *
+ * @param ctx Suppressor handle
+ * @param frame Frame to check
+ * @return true to store the frame
+ */
+bool frame_dedup_filter(void *ctx, capture_frame_t *frame);
+
+/**
+ * @brief Get a snapshot of the statistics
+ */
+void frame_dedup_get_stats(frame_dedup_handle_t dedup, frame_dedup_stats_t *stats);
+
+/**
+ * @brief Log the statistics
+ */
+void frame_dedup_log_stats(frame_dedup_handle_t dedup);
+
+#ifdef __cplusplus
+}
+#endif
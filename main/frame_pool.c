@@ -0,0 +1,297 @@
+/**
+ * @file frame_pool.c
+ * @brief Frame pool implementation
+ */
+
+#include "frame_pool.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Blocks start on PSRAM cache line boundaries: the arena is aligned and block sizes are multiples */
+#define FRAME_POOL_LINE     64
+#define FRAME_POOL_ALIGN(x) (((x) + FRAME_POOL_LINE - 1) & ~(size_t)(FRAME_POOL_LINE - 1))
+
+/* Class sizes below the largest frame, in quarters of the typical size, and their share of blocks */
+static const uint8_t s_class_quarters[FRAME_POOL_MAX_CLASSES - 1] = { 3, 4, 5, 6, 8 };
+static const uint8_t s_class_weights[FRAME_POOL_MAX_CLASSES - 1] = { 2, 4, 2, 1, 1 };
+
+static const char *TAG = "frame_pool";
+
+typedef struct {
+    uint8_t *base;              /* First block of the class in the arena */
+    size_t block_size;
+    uint32_t blocks;
+    uint32_t first_slot;        /* Index of the first block over all classes */
+    uint32_t *free_stack;       /* Indexes of free blocks, top at free_count - 1 */
+    uint32_t free_count;
+} frame_pool_class_t;
+
+struct frame_pool_t {
+    uint8_t *arena;
+    size_t arena_size;
+    size_t classes;
+    frame_pool_class_t cls[FRAME_POOL_MAX_CLASSES];
+    size_t *requested;          /* Requested size per block, by arena position */
+    portMUX_TYPE lock;
+    frame_pool_stats_t stats;
+};
+
+/**
+ * @brief Choose the class sizes and block counts for an arena
+ *
+ * One block of the largest class is always kept. The rest of the arena is
+ * shared out by class weight, most blocks going to the classes around the
+ * typical size; what is left over goes to the class of the typical size and
+ * then to the classes above it.
+ */
+static void frame_pool_layout(frame_pool_handle_t pool, size_t typical, size_t max)
+{
+    size_t classes = 0;
+    for (size_t i = 0; i < FRAME_POOL_MAX_CLASSES - 1; i++) {
+        size_t size = FRAME_POOL_ALIGN(typical * s_class_quarters[i] / 4);
+        if (size >= max) {
+            break;
+        }
+        pool->cls[classes].block_size = size;
+        pool->cls[classes].blocks = s_class_weights[i];
+        classes++;
+    }
+    pool->cls[classes].block_size = max;
+    pool->cls[classes].blocks = 1;
+    classes++;
+    pool->classes = classes;
+
+    size_t sum = 0;
+    for (size_t i = 0; i < classes; i++) {
+        sum += pool->cls[i].blocks * pool->cls[i].block_size;
+    }
+
+    size_t left = pool->arena_size - max;
+    uint32_t shares = (uint32_t)(left / sum);
+    left -= shares * sum;
+    for (size_t i = 0; i < classes; i++) {
+        pool->cls[i].blocks *= shares;
+    }
+    pool->cls[classes - 1].blocks++;
+
+    size_t typical_class = 0;
+    while (pool->cls[typical_class].block_size < typical) {
+        typical_class++;
+    }
+    for (size_t i = typical_class; i < classes; i++) {
+        uint32_t extra = (uint32_t)(left / pool->cls[i].block_size);
+        pool->cls[i].blocks += extra;
+        left -= extra * pool->cls[i].block_size;
+    }
+}
+
+esp_err_t frame_pool_create(const frame_pool_config_t *config, frame_pool_handle_t *ret_pool)
+{
+    if (config == NULL || ret_pool == NULL || config->max_size == 0 ||
+        config->typical_size > config->max_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t max = FRAME_POOL_ALIGN(config->max_size);
+    size_t typical = config->typical_size != 0 ? config->typical_size : max / 2;
+    if ((config->arena_size & ~(size_t)(FRAME_POOL_LINE - 1)) < max) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct frame_pool_t *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    pool->arena_size = config->arena_size & ~(size_t)(FRAME_POOL_LINE - 1);
+    portMUX_INITIALIZE(&pool->lock);
+    frame_pool_layout(pool, typical, max);
+
+    uint32_t total_blocks = 0;
+    for (size_t i = 0; i < pool->classes; i++) {
+        total_blocks += pool->cls[i].blocks;
+    }
+
+    pool->arena = heap_caps_aligned_alloc(FRAME_POOL_LINE, pool->arena_size, config->caps);
+    pool->requested = calloc(total_blocks, sizeof(size_t));
+    if (pool->arena == NULL || pool->requested == NULL) {
+        frame_pool_delete(pool);
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t *base = pool->arena;
+    uint32_t slot = 0;
+    for (size_t i = 0; i < pool->classes; i++) {
+        frame_pool_class_t *cls = &pool->cls[i];
+        cls->base = base;
+        cls->first_slot = slot;
+        slot += cls->blocks;
+        cls->free_stack = malloc(cls->blocks * sizeof(uint32_t));
+        if (cls->free_stack == NULL && cls->blocks != 0) {
+            frame_pool_delete(pool);
+            return ESP_ERR_NO_MEM;
+        }
+        /* Lowest blocks on top, so a lightly used pool stays at the start of its class */
+        for (uint32_t b = 0; b < cls->blocks; b++) {
+            cls->free_stack[b] = cls->blocks - 1 - b;
+        }
+        cls->free_count = cls->blocks;
+        base += cls->blocks * cls->block_size;
+
+        pool->stats.class_stats[i].block_size = cls->block_size;
+        pool->stats.class_stats[i].blocks = cls->blocks;
+    }
+    pool->stats.arena_size = pool->arena_size;
+    pool->stats.classes = pool->classes;
+
+    ESP_LOGI(TAG, "%u KB arena, %u classes from %u to %u bytes, %lu blocks",
+             (unsigned)(pool->arena_size / 1024), (unsigned)pool->classes,
+             (unsigned)pool->cls[0].block_size, (unsigned)pool->cls[pool->classes - 1].block_size,
+             (unsigned long)total_blocks);
+    *ret_pool = pool;
+    return ESP_OK;
+}
+
+void frame_pool_delete(frame_pool_handle_t pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < pool->classes; i++) {
+        free(pool->cls[i].free_stack);
+    }
+    heap_caps_free(pool->arena);
+    free(pool->requested);
+    free(pool);
+}
+
+/**
+ * @brief Smallest class with a free block of at least @p size bytes; call with the lock held
+ * @return Class index, or pool->classes if there is none
+ */
+static size_t frame_pool_find(frame_pool_handle_t pool, size_t size)
+{
+    size_t i = 0;
+    while (i < pool->classes && (pool->cls[i].block_size < size || pool->cls[i].free_count == 0)) {
+        i++;
+    }
+    return i;
+}
+
+void *frame_pool_alloc(frame_pool_handle_t pool, size_t size)
+{
+    if (size == 0) {
+        return NULL;
+    }
+
+    portENTER_CRITICAL(&pool->lock);
+    frame_pool_stats_t *stats = &pool->stats;
+    size_t i = frame_pool_find(pool, size);
+    if (i == pool->classes) {
+        if (size > pool->cls[pool->classes - 1].block_size) {
+            stats->oversize++;
+        } else {
+            stats->failed++;
+        }
+        portEXIT_CRITICAL(&pool->lock);
+        return NULL;
+    }
+
+    frame_pool_class_t *cls = &pool->cls[i];
+    uint32_t index = cls->free_stack[--cls->free_count];
+    pool->requested[cls->first_slot + index] = size;
+
+    frame_pool_class_stats_t *class_stats = &stats->class_stats[i];
+    class_stats->in_use++;
+    if (class_stats->in_use > class_stats->high_water) {
+        class_stats->high_water = class_stats->in_use;
+    }
+    if (i > 0 && pool->cls[i - 1].block_size >= size) {
+        class_stats->fallbacks++;
+    }
+
+    stats->allocs++;
+    stats->bytes_in_use += cls->block_size;
+    stats->requested += size;
+    stats->waste = stats->bytes_in_use - stats->requested;
+    if (stats->bytes_in_use > stats->bytes_high_water) {
+        stats->bytes_high_water = stats->bytes_in_use;
+    }
+    if (stats->waste > stats->waste_high_water) {
+        stats->waste_high_water = stats->waste;
+    }
+    portEXIT_CRITICAL(&pool->lock);
+
+    return cls->base + (size_t)index * cls->block_size;
+}
+
+void frame_pool_free(frame_pool_handle_t pool, void *block)
+{
+    if (block == NULL) {
+        return;
+    }
+
+    uint8_t *p = block;
+    size_t i = 0;
+    while (i < pool->classes &&
+           !(p >= pool->cls[i].base && p < pool->cls[i].base + pool->cls[i].blocks * pool->cls[i].block_size)) {
+        i++;
+    }
+    frame_pool_class_t *cls = &pool->cls[i];
+    if (i == pool->classes || (size_t)(p - cls->base) % cls->block_size != 0) {
+        ESP_LOGE(TAG, "Freeing %p, not a block of this pool", block);
+        return;
+    }
+    uint32_t index = (uint32_t)((size_t)(p - cls->base) / cls->block_size);
+
+    portENTER_CRITICAL(&pool->lock);
+    size_t *requested = &pool->requested[cls->first_slot + index];
+    cls->free_stack[cls->free_count++] = index;
+    pool->stats.class_stats[i].in_use--;
+    pool->stats.frees++;
+    pool->stats.bytes_in_use -= cls->block_size;
+    pool->stats.requested -= *requested;
+    pool->stats.waste = pool->stats.bytes_in_use - pool->stats.requested;
+    *requested = 0;
+    portEXIT_CRITICAL(&pool->lock);
+}
+
+bool frame_pool_can_alloc(frame_pool_handle_t pool, size_t size)
+{
+    portENTER_CRITICAL(&pool->lock);
+    bool found = size != 0 && frame_pool_find(pool, size) < pool->classes;
+    portEXIT_CRITICAL(&pool->lock);
+    return found;
+}
+
+size_t frame_pool_max_size(frame_pool_handle_t pool)
+{
+    return pool->cls[pool->classes - 1].block_size;
+}
+
+void frame_pool_get_stats(frame_pool_handle_t pool, frame_pool_stats_t *stats)
+{
+    portENTER_CRITICAL(&pool->lock);
+    *stats = pool->stats;
+    portEXIT_CRITICAL(&pool->lock);
+}
+
+void frame_pool_log_stats(frame_pool_handle_t pool)
+{
+    frame_pool_stats_t stats;
+    frame_pool_get_stats(pool, &stats);
+
+    ESP_LOGI(TAG, "in use %u KB (high water %u KB of %u KB), waste %u KB (high water %u KB), "
+             "allocs %lu, failed %lu, oversize %lu",
+             (unsigned)(stats.bytes_in_use / 1024), (unsigned)(stats.bytes_high_water / 1024),
+             (unsigned)(stats.arena_size / 1024), (unsigned)(stats.waste / 1024),
+             (unsigned)(stats.waste_high_water / 1024), (unsigned long)stats.allocs,
+             (unsigned long)stats.failed, (unsigned long)stats.oversize);
+    for (size_t i = 0; i < stats.classes; i++) {
+        const frame_pool_class_stats_t *cls = &stats.class_stats[i];
+        ESP_LOGI(TAG, "  %7u bytes: %lu/%lu in use, high water %lu, fallbacks %lu",
+                 (unsigned)cls->block_size, (unsigned long)cls->in_use, (unsigned long)cls->blocks,
+                 (unsigned long)cls->high_water, (unsigned long)cls->fallbacks);
+    }
+}
@@ -0,0 +1,149 @@
+/**
+ * @file frame_pool.h
+ * @brief Pool of frame-sized blocks in a single pre-allocated arena
+ *
+ * Frames held beyond the camera driver's own buffers (pre-trigger ring,
+ * burst and batch buffers, thumbnail stage) take their memory from one
+ * pool reserved at startup instead of separate arenas or per-frame
+ * heap_caps_malloc() calls, so variable JPEG sizes never fragment PSRAM.
+ *
+ * The arena is divided into size classes around the typical JPEG size at
+ * the configured frame size, up to the largest frame the camera can
+ * produce. Every class is a stack of equal blocks: allocation takes a block
+ * from the smallest class that fits and has one free, falling back to
+ * larger classes; both allocation and free are O(1). The pool is safe to
+ * use from several tasks.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Most size classes of a pool */
+#define FRAME_POOL_MAX_CLASSES      6
+
+typedef struct frame_pool_t *frame_pool_handle_t;
+
+/**
+ * @brief Frame pool configuration
+ */
+typedef struct {
+    size_t arena_size;          /**< Bytes reserved for all blocks */
+    size_t typical_size;        /**< Typical JPEG size at the configured frame size */
+    size_t max_size;            /**< Largest frame to hold, at least typical_size */
+    uint32_t caps;              /**< heap_caps flags for the arena (e.g. MALLOC_CAP_SPIRAM) */
+} frame_pool_config_t;
+
+#ifndef CONFIG_APP_FRAME_POOL_KB
+#define CONFIG_APP_FRAME_POOL_KB    4096
+#endif
+
+/**
+ * @brief Default frame pool configuration from Kconfig, in PSRAM
+ */
+#define FRAME_POOL_DEFAULT_CONFIG(typical, max) {                      \
+    .arena_size   = CONFIG_APP_FRAME_POOL_KB * 1024,                    \
+    .typical_size = (typical),                                          \
+    .max_size     = (max),                                              \
+    .caps         = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,                \
+}
+
+/**
+ * @brief Statistics of one size class
+ */
+typedef struct {
+    size_t block_size;          /**< Bytes per block */
+    uint32_t blocks;            /**< Blocks in the class */
+    uint32_t in_use;            /**< Blocks allocated now */
+    uint32_t high_water;        /**< Most blocks allocated at once */
+    uint32_t fallbacks;         /**< Allocations served here because smaller classes were full */
+} frame_pool_class_stats_t;
+
+/**
+ * @brief Frame pool statistics
+ */
+typedef struct {
+    size_t arena_size;          /**< Bytes reserved */
+    size_t classes;             /**< Size classes in use */
+    size_t bytes_in_use;        /**< Block bytes allocated now */
+    size_t bytes_high_water;    /**< Most block bytes allocated at once */
+    size_t requested;           /**< Bytes requested by the allocations alive now */
+    size_t waste;               /**< Internal waste now: block bytes beyond the requested sizes */
+    size_t waste_high_water;    /**< Largest internal waste */
+    uint32_t allocs;            /**< Successful allocations */
+    uint32_t frees;             /**< Blocks returned */
+    uint32_t failed;            /**< Allocations refused, no free block large enough */
+    uint32_t oversize;          /**< Allocations refused, larger than the largest class */
+    frame_pool_class_stats_t class_stats[FRAME_POOL_MAX_CLASSES];
+} frame_pool_stats_t;
+
+/**
+ * @brief Create a pool and reserve its arena
+ * @param config Pool configuration
+ * @param[out] ret_pool Created pool
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an invalid configuration or an arena
+ *         smaller than the largest block, ESP_ERR_NO_MEM if the arena cannot be allocated
+ */
+esp_err_t frame_pool_create(const frame_pool_config_t *config, frame_pool_handle_t *ret_pool);
+
+/**
+ * @brief Free a pool and its arena; all blocks must have been returned
+ * @param pool Pool to delete
+ */
+void frame_pool_delete(frame_pool_handle_t pool);
+
+/**
+ * @brief Take a block of at least @p size bytes
+ * @param pool Pool
+ * @param size Bytes needed
+ * @return Block, or NULL if no free block is large enough
+ */
+void *frame_pool_alloc(frame_pool_handle_t pool, size_t size);
+
+/**
+ * @brief Return a block to the pool
+ * @param pool Pool the block was taken from
+ * @param block Block from frame_pool_alloc(), or NULL
+ */
+void frame_pool_free(frame_pool_handle_t pool, void *block);
+
+/**
+ * @brief Check whether frame_pool_alloc() of @p size bytes would succeed now
+ * @param pool Pool
+ * @param size Bytes needed
+ * @return true if a free block is large enough
+ */
+bool frame_pool_can_alloc(frame_pool_handle_t pool, size_t size);
+
+/**
+ * @brief Largest block of the pool
+ * @param pool Pool
+ * @return Bytes
+ */
+size_t frame_pool_max_size(frame_pool_handle_t pool);
+
+/**
+ * @brief Get a snapshot of the pool statistics
+ * @param pool Pool
+ * @param[out] stats Output statistics
+ */
+void frame_pool_get_stats(frame_pool_handle_t pool, frame_pool_stats_t *stats);
+
+/**
+ * @brief Log the pool statistics
+ * @param pool Pool
+ */
+void frame_pool_log_stats(frame_pool_handle_t pool);
+
+#ifdef __cplusplus
+}
+#endif
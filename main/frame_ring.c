@@ -0,0 +1,282 @@
+/**
+ * @file frame_ring.c
+ * @brief Ring of recent JPEG frames implementation
+ */
+
+#include "frame_ring.h"
+#include <esp_heap_caps.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Frames start on 4-byte boundaries within the arena */
+#define FRAME_RING_ALIGN(x) (((x) + 3) & ~(size_t)3)
+
+typedef struct {
+    size_t offset;              /* Position of the frame data in the arena */
+    uint8_t *block;             /* Pool block holding the frame data, with a pool */
+    capture_frame_t frame;      /* Descriptor, buf points into the arena or block */
+} frame_ring_entry_t;
+
+struct frame_ring_t {
+    uint8_t *arena;
+    size_t arena_size;          /* Arena capacity, or byte budget with a pool */
+    frame_pool_handle_t pool;
+    frame_ring_entry_t *entries;
+    size_t max_frames;
+    size_t head;                /* Index of the oldest entry */
+    size_t count;
+    size_t tail_offset;         /* End of the newest frame in the arena */
+    size_t bytes_used;
+    frame_ring_stats_t stats;
+};
+
+esp_err_t frame_ring_create(const frame_ring_config_t *config, frame_ring_handle_t *ret_ring)
+{
+    if (config == NULL || ret_ring == NULL || config->arena_size == 0 || config->max_frames == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct frame_ring_t *ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ring->arena_size = FRAME_RING_ALIGN(config->arena_size);
+    ring->max_frames = config->max_frames;
+    ring->pool = config->pool;
+    if (ring->pool == NULL) {
+        ring->arena = heap_caps_malloc(ring->arena_size, config->caps);
+    }
+    ring->entries = calloc(config->max_frames, sizeof(frame_ring_entry_t));
+    if ((ring->arena == NULL && ring->pool == NULL) || ring->entries == NULL) {
+        frame_ring_delete(ring);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ring->stats.arena_size = ring->arena_size;
+    ring->stats.max_frames = ring->max_frames;
+    *ret_ring = ring;
+    return ESP_OK;
+}
+
+void frame_ring_delete(frame_ring_handle_t ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+    if (ring->entries != NULL) {
+        frame_ring_clear(ring);
+    }
+    heap_caps_free(ring->arena);
+    free(ring->entries);
+    free(ring);
+}
+
+void frame_ring_pop_oldest(frame_ring_handle_t ring)
+{
+    if (ring->count == 0) {
+        return;
+    }
+
+    frame_ring_entry_t *entry = &ring->entries[ring->head];
+    if (ring->pool != NULL) {
+        frame_pool_free(ring->pool, entry->block);
+        entry->block = NULL;
+    }
+    ring->bytes_used -= entry->frame.len;
+    ring->head = (ring->head + 1) % ring->max_frames;
+    ring->count--;
+    if (ring->count == 0) {
+        ring->tail_offset = 0;
+    }
+}
+
+/**
+ * @brief Find a contiguous free region of @p size bytes without evicting
+ * @return Offset of the region in the arena, or SIZE_MAX if there is none
+ */
+static size_t frame_ring_find(frame_ring_handle_t ring, size_t size)
+{
+    if (ring->count == 0) {
+        return 0;
+    }
+
+    size_t head_offset = ring->entries[ring->head].offset;
+    size_t tail_offset = ring->tail_offset;
+
+    if (tail_offset > head_offset) {
+        /* Data in [head, tail): free space at the end and at the start */
+        if (ring->arena_size - tail_offset >= size) {
+            return tail_offset;
+        }
+        if (head_offset >= size) {
+            return 0;
+        }
+    } else if (head_offset - tail_offset >= size) {
+        /* Data wraps around: free space in [tail, head) */
+        return tail_offset;
+    }
+    return SIZE_MAX;
+}
+
+/**
+ * @brief Find a contiguous region of @p size bytes, evicting oldest frames as needed
+ * @return Offset of the region in the arena
+ */
+static size_t frame_ring_reserve(frame_ring_handle_t ring, size_t size)
+{
+    for (;;) {
+        size_t offset = frame_ring_find(ring, size);
+        if (offset != SIZE_MAX) {
+            return offset;
+        }
+
+        ring->stats.evicted++;
+        frame_ring_pop_oldest(ring);
+    }
+}
+
+bool frame_ring_fits(frame_ring_handle_t ring, size_t len)
+{
+    if (ring->pool != NULL) {
+        return len != 0 && ring->count < ring->max_frames && ring->bytes_used + len <= ring->arena_size &&
+               frame_pool_can_alloc(ring->pool, len);
+    }
+    size_t size = FRAME_RING_ALIGN(len);
+    return size != 0 && ring->count < ring->max_frames && frame_ring_find(ring, size) != SIZE_MAX;
+}
+
+/**
+ * @brief Count a frame just stored at the tail
+ */
+static void frame_ring_account(frame_ring_handle_t ring, size_t len)
+{
+    ring->count++;
+    ring->bytes_used += len;
+
+    ring->stats.pushed++;
+    if (ring->count > ring->stats.frames_high_water) {
+        ring->stats.frames_high_water = ring->count;
+    }
+    if (ring->bytes_used > ring->stats.bytes_high_water) {
+        ring->stats.bytes_high_water = ring->bytes_used;
+    }
+}
+
+/**
+ * @brief Take a pool block for a frame of @p len bytes, evicting oldest frames as needed
+ * @return Block, or NULL if the pool has none even with the ring empty
+ */
+static uint8_t *frame_ring_reserve_block(frame_ring_handle_t ring, size_t len)
+{
+    while (ring->count > 0 && ring->bytes_used + len > ring->arena_size) {
+        ring->stats.evicted++;
+        frame_ring_pop_oldest(ring);
+    }
+
+    uint8_t *block = frame_pool_alloc(ring->pool, len);
+    while (block == NULL && ring->count > 0) {
+        ring->stats.evicted++;
+        frame_ring_pop_oldest(ring);
+        block = frame_pool_alloc(ring->pool, len);
+    }
+    return block;
+}
+
+esp_err_t frame_ring_push(frame_ring_handle_t ring, const capture_frame_t *frame)
+{
+    size_t size = FRAME_RING_ALIGN(frame->len);
+    if (size == 0 || size > ring->arena_size ||
+        (ring->pool != NULL && frame->len > frame_pool_max_size(ring->pool))) {
+        ring->stats.rejected++;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (ring->count == ring->max_frames) {
+        ring->stats.evicted++;
+        frame_ring_pop_oldest(ring);
+    }
+
+    size_t index = (ring->head + ring->count) % ring->max_frames;
+    frame_ring_entry_t *entry = &ring->entries[index];
+    uint8_t *data;
+    if (ring->pool != NULL) {
+        data = frame_ring_reserve_block(ring, frame->len);
+        if (data == NULL) {
+            ring->stats.rejected++;
+            return ESP_ERR_NO_MEM;
+        }
+        entry->block = data;
+    } else {
+        size_t offset = frame_ring_reserve(ring, size);
+        data = ring->arena + offset;
+        entry->offset = offset;
+        ring->tail_offset = offset + size;
+    }
+
+    memcpy(data, frame->buf, frame->len);
+    entry->frame = *frame;
+    entry->frame.buf = data;
+    entry->frame.priv = NULL;
+
+    frame_ring_account(ring, frame->len);
+    return ESP_OK;
+}
+
+esp_err_t frame_ring_try_push(frame_ring_handle_t ring, const capture_frame_t *frame)
+{
+    if (ring->pool == NULL) {
+        return frame_ring_fits(ring, frame->len) ? frame_ring_push(ring, frame) : ESP_ERR_NO_MEM;
+    }
+
+    /* The pool is shared, so allocate instead of checking first */
+    if (frame->len == 0 || ring->count == ring->max_frames || ring->bytes_used + frame->len > ring->arena_size) {
+        return ESP_ERR_NO_MEM;
+    }
+    uint8_t *block = frame_pool_alloc(ring->pool, frame->len);
+    if (block == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    frame_ring_entry_t *entry = &ring->entries[(ring->head + ring->count) % ring->max_frames];
+    memcpy(block, frame->buf, frame->len);
+    entry->block = block;
+    entry->frame = *frame;
+    entry->frame.buf = block;
+    entry->frame.priv = NULL;
+    frame_ring_account(ring, frame->len);
+    return ESP_OK;
+}
+
+bool frame_ring_peek_oldest(frame_ring_handle_t ring, capture_frame_t *frame)
+{
+    if (ring->count == 0) {
+        return false;
+    }
+    *frame = ring->entries[ring->head].frame;
+    return true;
+}
+
+void frame_ring_clear(frame_ring_handle_t ring)
+{
+    while (ring->pool != NULL && ring->count > 0) {
+        frame_ring_pop_oldest(ring);
+    }
+    ring->head = 0;
+    ring->count = 0;
+    ring->tail_offset = 0;
+    ring->bytes_used = 0;
+}
+
+size_t frame_ring_count(frame_ring_handle_t ring)
+{
+    return ring->count;
+}
+
+void frame_ring_get_stats(frame_ring_handle_t ring, frame_ring_stats_t *stats)
+{
+    *stats = ring->stats;
+    stats->frames = ring->count;
+    stats->bytes_used = ring->bytes_used;
+}
@@ -0,0 +1,143 @@
+/**
+ * @file frame_ring.h
+ * @brief Ring of recent JPEG frames copied into a fixed pre-allocated arena
+ *
+ * Frames are copied back to back into a single arena allocated once at
+ * creation; when a new frame does not fit, the oldest frames are evicted
+ * one at a time (O(1) each) until it does. No memory is allocated per frame.
+ *
+ * A ring created with a frame pool has no arena of its own: every frame
+ * takes a block of the shared pool, and the arena size only caps the bytes
+ * the ring holds. When the pool has no block for a new frame, the oldest
+ * frames of this ring are evicted until it has.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "capture_frame.h"
+#include "frame_pool.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct frame_ring_t *frame_ring_handle_t;
+
+/**
+ * @brief Frame ring configuration
+ */
+typedef struct {
+    size_t arena_size;          /**< Byte budget for frame data */
+    size_t max_frames;          /**< Maximum number of frames kept */
+    uint32_t caps;              /**< heap_caps flags for the arena (e.g. MALLOC_CAP_SPIRAM) */
+    frame_pool_handle_t pool;   /**< Pool holding the frames instead of an own arena, or NULL */
+} frame_ring_config_t;
+
+/**
+ * @brief Frame ring occupancy statistics
+ */
+typedef struct {
+    size_t frames;              /**< Frames currently stored */
+    size_t bytes_used;          /**< Bytes of frame data currently stored */
+    size_t arena_size;          /**< Arena capacity in bytes */
+    size_t max_frames;          /**< Frame capacity */
+    size_t frames_high_water;   /**< Highest number of frames stored */
+    size_t bytes_high_water;    /**< Highest number of bytes stored */
+    uint32_t pushed;            /**< Frames copied into the ring */
+    uint32_t evicted;           /**< Frames evicted to make room */
+    uint32_t rejected;          /**< Frames larger than the whole arena, or with no pool block */
+} frame_ring_stats_t;
+
+/**
+ * @brief Create a frame ring and allocate its arena, unless it uses a pool
+ * @param config Ring configuration
+ * @param[out] ret_ring Created ring
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the arena cannot be allocated
+ */
+esp_err_t frame_ring_create(const frame_ring_config_t *config, frame_ring_handle_t *ret_ring);
+
+/**
+ * @brief Free a frame ring and its arena
+ * @param ring Ring to delete
+ */
+void frame_ring_delete(frame_ring_handle_t ring);
+
+/**
+ * @brief Copy a frame into the ring, evicting the oldest frames as needed
+ *
+ * The descriptor fields (size, timestamp, sequence, trigger) are kept with
+ * the copy; @c priv is not.
+ *
+ * @param ring Ring
+ * @param frame Frame to copy
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the frame is larger than the arena
+ *         or the largest pool block, ESP_ERR_NO_MEM if the pool has no block even with
+ *         this ring empty
+ */
+esp_err_t frame_ring_push(frame_ring_handle_t ring, const capture_frame_t *frame);
+
+/**
+ * @brief Copy a frame into the ring only if it fits without evicting any stored frame
+ *
+ * Unlike frame_ring_fits() followed by frame_ring_push(), this cannot evict
+ * when another user of the same pool took blocks in between.
+ *
+ * @param ring Ring
+ * @param frame Frame to copy
+ * @return ESP_OK if stored, ESP_ERR_NO_MEM if it does not fit
+ */
+esp_err_t frame_ring_try_push(frame_ring_handle_t ring, const capture_frame_t *frame);
+
+/**
+ * @brief Check whether a frame fits without evicting any stored frame
+ * @param ring Ring
+ * @param len Frame length in bytes
+ * @return true if frame_ring_push() of such a frame would evict nothing
+ */
+bool frame_ring_fits(frame_ring_handle_t ring, size_t len);
+
+/**
+ * @brief Get the oldest frame without removing it
+ *
+ * The returned descriptor points into the arena and stays valid until the
+ * frame is popped or evicted by a later push.
+ *
+ * @param ring Ring
+ * @param[out] frame Oldest frame
+ * @return true if a frame was returned, false if the ring is empty
+ */
+bool frame_ring_peek_oldest(frame_ring_handle_t ring, capture_frame_t *frame);
+
+/**
+ * @brief Remove the oldest frame
+ * @param ring Ring
+ */
+void frame_ring_pop_oldest(frame_ring_handle_t ring);
+
+/**
+ * @brief Remove all frames
+ * @param ring Ring
+ */
+void frame_ring_clear(frame_ring_handle_t ring);
+
+/**
+ * @brief Number of frames currently stored
+ * @param ring Ring
+ * @return Frame count
+ */
+size_t frame_ring_count(frame_ring_handle_t ring);
+
+/**
+ * @brief Get occupancy statistics
+ * @param ring Ring
+ * @param[out] stats Output statistics
+ */
+void frame_ring_get_stats(frame_ring_handle_t ring, frame_ring_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,686 @@
+/**
+ * @file jpeg_dc.c
+ * @brief JPEG DC level map implementation
+ */
+
+#include "jpeg_dc.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Huffman codes up to this length are decoded with a single table lookup */
+#define JPEG_FAST_BITS      9
+#define JPEG_FAST_SIZE      (1 << JPEG_FAST_BITS)
+
+#define JPEG_MAX_COMPONENTS 4
+#define JPEG_MAX_TABLES     4
+
+/* Y, Cb and Cr */
+#define JPEG_DC_MAX_MAPS    3
+
+#define JPEG_MARKER_SOF0    0xC0
+#define JPEG_MARKER_SOF1    0xC1
+#define JPEG_MARKER_DHT     0xC4
+#define JPEG_MARKER_JPG     0xC8
+#define JPEG_MARKER_DAC     0xCC
+#define JPEG_MARKER_SOF15   0xCF
+#define JPEG_MARKER_RST0    0xD0
+#define JPEG_MARKER_RST7    0xD7
+#define JPEG_MARKER_SOI     0xD8
+#define JPEG_MARKER_EOI     0xD9
+#define JPEG_MARKER_SOS     0xDA
+#define JPEG_MARKER_DQT     0xDB
+#define JPEG_MARKER_DRI     0xDD
+
+typedef struct {
+    uint16_t fast[JPEG_FAST_SIZE];  /* (code length << 8) | symbol, 0 for longer codes */
+    uint32_t maxcode[17];           /* Codes of each length are below this, left-aligned to 16 bits */
+    int32_t delta[17];              /* Symbol index minus code, per length */
+    uint16_t count;
+    uint8_t symbols[256];
+    bool defined;
+} jpeg_huff_t;
+
+typedef struct {
+    jpeg_huff_t huff;
+    /* (run << 8) | bits of code and magnitude, 0 if they do not fit in JPEG_FAST_BITS */
+    uint16_t fast_skip[JPEG_FAST_SIZE];
+} jpeg_huff_ac_t;
+
+typedef struct {
+    uint8_t id;
+    uint8_t h;                      /* Sampling factors */
+    uint8_t v;
+    uint8_t tq;                     /* Quantization table */
+    uint8_t td;                     /* DC and AC Huffman tables of the scan */
+    uint8_t ta;
+} jpeg_component_t;
+
+struct jpeg_dc_t {
+    jpeg_huff_t dc[JPEG_MAX_TABLES];
+    jpeg_huff_ac_t ac[JPEG_MAX_TABLES];
+    uint16_t dc_quant[JPEG_MAX_TABLES];
+    uint8_t quant_defined;          /* Bit per quantization table */
+    jpeg_component_t comp[JPEG_MAX_COMPONENTS];
+    uint8_t ncomp;
+    uint8_t h_max;
+    uint8_t v_max;
+    uint16_t width;
+    uint16_t height;
+    uint16_t restart_interval;
+    uint8_t scan[JPEG_MAX_COMPONENTS];  /* Components of the first scan, in scan order */
+    uint8_t scan_count;
+    const uint8_t *data;            /* Entropy-coded data of the first scan */
+
+    /* Bit reader, next bit in the MSB of acc */
+    const uint8_t *pos;
+    const uint8_t *end;
+    uint32_t acc;
+    int bits;
+    uint32_t fill_zeros;            /* Zero bytes fed in place of a marker or past the end */
+};
+
+static inline uint16_t jpeg_be16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint16_t jpeg_ceil_div(uint32_t a, uint32_t b)
+{
+    return (uint16_t)((a + b - 1) / b);
+}
+
+/**
+ * @brief Build the lookup tables of a Huffman table from its DHT definition
+ */
+static bool jpeg_build_huff(jpeg_huff_t *h, const uint8_t *counts, const uint8_t *symbols, uint16_t total)
+{
+    uint32_t code = 0;
+    int32_t index = 0;
+
+    memset(h->fast, 0, sizeof(h->fast));
+    memcpy(h->symbols, symbols, total);
+    h->count = total;
+
+    for (int len = 1; len <= 16; len++) {
+        h->delta[len] = index - (int32_t)code;
+        for (int i = 0; i < counts[len - 1]; i++, index++, code++) {
+            if (code >= (1u << len)) {
+                return false;
+            }
+            if (len <= JPEG_FAST_BITS) {
+                int shift = JPEG_FAST_BITS - len;
+                for (uint32_t j = 0; j < (1u << shift); j++) {
+                    h->fast[(code << shift) + j] = (uint16_t)((len << 8) | symbols[index]);
+                }
+            }
+        }
+        h->maxcode[len] = code << (16 - len);
+        code <<= 1;
+    }
+
+    h->defined = true;
+    return true;
+}
+
+/**
+ * @brief Precompute code plus magnitude lengths of AC symbols that fit the fast lookup
+ */
+static void jpeg_build_ac_skip(jpeg_huff_ac_t *ac)
+{
+    for (int i = 0; i < JPEG_FAST_SIZE; i++) {
+        uint16_t fast = ac->huff.fast[i];
+        int len = fast >> 8;
+        int run = (fast >> 4) & 0x0F;
+        int size = fast & 0x0F;
+
+        ac->fast_skip[i] = 0;
+        if (fast != 0 && size != 0 && len + size <= JPEG_FAST_BITS) {
+            ac->fast_skip[i] = (uint16_t)((run << 8) | (len + size));
+        }
+    }
+}
+
+/**
+ * @brief Parse the markers up to the first SOS
+ * @param tables Build the Huffman lookup tables (not needed for the geometry)
+ */
+static esp_err_t jpeg_parse_headers(struct jpeg_dc_t *jd, const uint8_t *jpeg, size_t len, bool tables)
+{
+    const uint8_t *p = jpeg;
+    const uint8_t *end = jpeg + len;
+
+    jd->ncomp = 0;
+    jd->quant_defined = 0;
+    jd->restart_interval = 0;
+    for (int i = 0; i < JPEG_MAX_TABLES; i++) {
+        jd->dc[i].defined = false;
+        jd->ac[i].huff.defined = false;
+    }
+
+    if (len < 4 || p[0] != 0xFF || p[1] != JPEG_MARKER_SOI) {
+        return ESP_FAIL;
+    }
+    p += 2;
+
+    for (;;) {
+        /* Markers may be preceded by fill bytes */
+        while (end - p >= 2 && p[0] == 0xFF && p[1] == 0xFF) {
+            p++;
+        }
+        if (end - p < 4 || p[0] != 0xFF) {
+            return ESP_FAIL;
+        }
+
+        uint8_t marker = p[1];
+        if (marker == JPEG_MARKER_EOI) {
+            return ESP_FAIL;
+        }
+        size_t seg_len = jpeg_be16(p + 2);
+        if (seg_len < 2 || seg_len > (size_t)(end - p - 2)) {
+            return ESP_FAIL;
+        }
+        const uint8_t *seg = p + 4;
+        seg_len -= 2;
+        p = seg + seg_len;
+
+        if (marker == JPEG_MARKER_SOF0 || marker == JPEG_MARKER_SOF1) {
+            if (seg_len < 6) {
+                return ESP_FAIL;
+            }
+            if (seg[0] != 8) {
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            jd->height = jpeg_be16(seg + 1);
+            jd->width = jpeg_be16(seg + 3);
+            jd->ncomp = seg[5];
+            if (jd->width == 0 || jd->height == 0) {
+                /* Height defined by a DNL marker after the scan */
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            if (jd->ncomp == 0 || jd->ncomp > JPEG_MAX_COMPONENTS || seg_len < 6 + 3u * jd->ncomp) {
+                return ESP_FAIL;
+            }
+
+            jd->h_max = 1;
+            jd->v_max = 1;
+            for (int i = 0; i < jd->ncomp; i++) {
+                jpeg_component_t *c = &jd->comp[i];
+                c->id = seg[6 + 3 * i];
+                c->h = seg[7 + 3 * i] >> 4;
+                c->v = seg[7 + 3 * i] & 0x0F;
+                c->tq = seg[8 + 3 * i];
+                if (c->h == 0 || c->h > 4 || c->v == 0 || c->v > 4 || c->tq >= JPEG_MAX_TABLES) {
+                    return ESP_FAIL;
+                }
+                if (c->h > jd->h_max) {
+                    jd->h_max = c->h;
+                }
+                if (c->v > jd->v_max) {
+                    jd->v_max = c->v;
+                }
+            }
+        } else if ((marker > JPEG_MARKER_SOF1 && marker <= JPEG_MARKER_SOF15 && marker != JPEG_MARKER_DHT &&
+                    marker != JPEG_MARKER_JPG) || marker == JPEG_MARKER_DAC) {
+            /* Progressive, lossless, hierarchical or arithmetic coding */
+            return ESP_ERR_NOT_SUPPORTED;
+        } else if (marker == JPEG_MARKER_DQT) {
+            while (seg < p) {
+                int precision = seg[0] >> 4;
+                int id = seg[0] & 0x0F;
+                size_t size = 1 + 64 * (precision ? 2 : 1);
+                if (id >= JPEG_MAX_TABLES || size > (size_t)(p - seg)) {
+                    return ESP_FAIL;
+                }
+                /* Only the DC entry, first in zigzag order, is used */
+                jd->dc_quant[id] = precision ? jpeg_be16(seg + 1) : seg[1];
+                jd->quant_defined |= 1 << id;
+                seg += size;
+            }
+        } else if (marker == JPEG_MARKER_DHT) {
+            while (seg < p) {
+                if (p - seg < 17) {
+                    return ESP_FAIL;
+                }
+                int table_class = seg[0] >> 4;
+                int id = seg[0] & 0x0F;
+                uint16_t total = 0;
+                for (int i = 1; i <= 16; i++) {
+                    total += seg[i];
+                }
+                if (table_class > 1 || id >= JPEG_MAX_TABLES || total > 256 || 17u + total > (size_t)(p - seg)) {
+                    return ESP_FAIL;
+                }
+                if (tables) {
+                    jpeg_huff_t *h = table_class ? &jd->ac[id].huff : &jd->dc[id];
+                    if (!jpeg_build_huff(h, seg + 1, seg + 17, total)) {
+                        return ESP_FAIL;
+                    }
+                    if (table_class) {
+                        jpeg_build_ac_skip(&jd->ac[id]);
+                    }
+                }
+                seg += 17 + total;
+            }
+        } else if (marker == JPEG_MARKER_DRI) {
+            if (seg_len < 2) {
+                return ESP_FAIL;
+            }
+            jd->restart_interval = jpeg_be16(seg);
+        } else if (marker == JPEG_MARKER_SOS) {
+            if (jd->ncomp == 0 || seg_len < 1 || seg[0] == 0 || seg[0] > jd->ncomp ||
+                seg_len < 1 + 2u * seg[0] + 3) {
+                return ESP_FAIL;
+            }
+            jd->scan_count = seg[0];
+            for (int i = 0; i < jd->scan_count; i++) {
+                uint8_t id = seg[1 + 2 * i];
+                uint8_t td = seg[2 + 2 * i] >> 4;
+                uint8_t ta = seg[2 + 2 * i] & 0x0F;
+                int c = 0;
+                while (c < jd->ncomp && jd->comp[c].id != id) {
+                    c++;
+                }
+                if (c == jd->ncomp || td >= JPEG_MAX_TABLES || ta >= JPEG_MAX_TABLES) {
+                    return ESP_FAIL;
+                }
+                jd->comp[c].td = td;
+                jd->comp[c].ta = ta;
+                jd->scan[i] = (uint8_t)c;
+            }
+            jd->data = p;
+            return ESP_OK;
+        }
+    }
+}
+
+static void jpeg_fill_info(const struct jpeg_dc_t *jd, jpeg_dc_info_t *info)
+{
+    /* The luminance (first) component may itself be subsampled */
+    const jpeg_component_t *y = &jd->comp[0];
+
+    info->width = jd->width;
+    info->height = jd->height;
+    info->map_width = jpeg_ceil_div(jpeg_ceil_div((uint32_t)jd->width * y->h, jd->h_max), 8);
+    info->map_height = jpeg_ceil_div(jpeg_ceil_div((uint32_t)jd->height * y->v, jd->v_max), 8);
+    info->components = jd->ncomp;
+    info->restart_interval = jd->restart_interval;
+}
+
+/**
+ * @brief Top up the bit reader to more than 24 bits, unstuffing 0xFF00
+ *
+ * At a marker or the end of the data zeros are fed and counted, so reading
+ * past the real data can be detected.
+ */
+static inline void jpeg_fill(struct jpeg_dc_t *jd)
+{
+    while (jd->bits <= 24) {
+        uint32_t byte = 0;
+        if (jd->pos < jd->end && jd->pos[0] != 0xFF) {
+            byte = *jd->pos++;
+        } else if (jd->end - jd->pos >= 2 && jd->pos[1] == 0x00) {
+            byte = 0xFF;
+            jd->pos += 2;
+        } else {
+            jd->fill_zeros++;
+        }
+        jd->acc |= byte << (24 - jd->bits);
+        jd->bits += 8;
+    }
+}
+
+static inline void jpeg_consume(struct jpeg_dc_t *jd, int n)
+{
+    jd->acc <<= n;
+    jd->bits -= n;
+}
+
+/**
+ * @brief Bits read past the end of the entropy-coded data
+ */
+static inline bool jpeg_overrun(const struct jpeg_dc_t *jd)
+{
+    return jd->fill_zeros * 8 > (uint32_t)jd->bits;
+}
+
+/**
+ * @brief Decode one Huffman symbol
+ * @return Symbol, -1 on an invalid code
+ */
+static inline int jpeg_decode(struct jpeg_dc_t *jd, const jpeg_huff_t *h)
+{
+    if (jd->bits < 16) {
+        jpeg_fill(jd);
+    }
+
+    uint16_t fast = h->fast[jd->acc >> (32 - JPEG_FAST_BITS)];
+    if (fast) {
+        jpeg_consume(jd, fast >> 8);
+        return fast & 0xFF;
+    }
+
+    uint32_t code = jd->acc >> 16;
+    for (int len = JPEG_FAST_BITS + 1; len <= 16; len++) {
+        if (code < h->maxcode[len]) {
+            int32_t index = (int32_t)(code >> (16 - len)) + h->delta[len];
+            jpeg_consume(jd, len);
+            return (index >= 0 && index < h->count) ? h->symbols[index] : -1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Decode the DC difference of a block
+ */
+static inline bool jpeg_decode_dc(struct jpeg_dc_t *jd, const jpeg_huff_t *h, int32_t *diff)
+{
+    int size = jpeg_decode(jd, h);
+    if (size < 0 || size > 11) {
+        return false;
+    }
+    if (size == 0) {
+        *diff = 0;
+        return true;
+    }
+
+    if (jd->bits < size) {
+        jpeg_fill(jd);
+    }
+    uint32_t value = jd->acc >> (32 - size);
+    jpeg_consume(jd, size);
+
+    /* Values with a leading zero bit are negative */
+    *diff = value < (1u << (size - 1)) ? (int32_t)value - (1 << size) + 1 : (int32_t)value;
+    return true;
+}
+
+/**
+ * @brief Step over the AC coefficients of a block without decoding their values
+ */
+static inline bool jpeg_skip_ac(struct jpeg_dc_t *jd, const jpeg_huff_ac_t *ac)
+{
+    int k = 1;
+
+    while (k < 64) {
+        if (jd->bits < 16) {
+            jpeg_fill(jd);
+        }
+
+        /* Common case: code and magnitude in one lookup */
+        uint16_t skip = ac->fast_skip[jd->acc >> (32 - JPEG_FAST_BITS)];
+        if (skip) {
+            jpeg_consume(jd, skip & 0xFF);
+            k += (skip >> 8) + 1;
+            continue;
+        }
+
+        int rs = jpeg_decode(jd, &ac->huff);
+        if (rs < 0) {
+            return false;
+        }
+        int run = rs >> 4;
+        int size = rs & 0x0F;
+        if (size == 0) {
+            if (run != 15) {
+                break;          /* End of block */
+            }
+            k += 16;
+            continue;
+        }
+
+        if (jd->bits < size) {
+            jpeg_fill(jd);
+        }
+        jpeg_consume(jd, size);
+        k += run + 1;
+    }
+    return k <= 64;
+}
+
+/**
+ * @brief Reset the bit reader after the RSTn marker that ends a restart interval
+ */
+static bool jpeg_restart(struct jpeg_dc_t *jd)
+{
+    const uint8_t *p = jd->pos;
+    while (jd->end - p >= 2 && !(p[0] == 0xFF && p[1] >= JPEG_MARKER_RST0 && p[1] <= JPEG_MARKER_RST7)) {
+        p++;
+    }
+    if (jd->end - p < 2) {
+        return false;
+    }
+
+    jd->pos = p + 2;
+    jd->acc = 0;
+    jd->bits = 0;
+    jd->fill_zeros = 0;
+    return true;
+}
+
+static inline uint8_t jpeg_dc_level(int32_t dc, uint16_t quant)
+{
+    /* The DC coefficient is 8x the block mean, level shifted by 128 */
+    int32_t level = (dc * quant + 1024 + 4) >> 3;
+    return level < 0 ? 0 : level > 255 ? 255 : (uint8_t)level;
+}
+
+esp_err_t jpeg_dc_get_size(const uint8_t *jpeg, size_t len, uint16_t *width, uint16_t *height)
+{
+    if (jpeg == NULL || width == NULL || height == NULL || len < 4 ||
+        jpeg[0] != 0xFF || jpeg[1] != JPEG_MARKER_SOI) {
+        return ESP_FAIL;
+    }
+
+    const uint8_t *p = jpeg + 2;
+    const uint8_t *end = jpeg + len;
+    while (end - p >= 4 && p[0] == 0xFF) {
+        uint8_t marker = p[1];
+        if (marker == 0xFF) {
+            p++;
+            continue;
+        }
+        if (marker == JPEG_MARKER_SOS || marker == JPEG_MARKER_EOI) {
+            break;
+        }
+
+        size_t seg_len = jpeg_be16(p + 2);
+        if (marker >= JPEG_MARKER_SOF0 && marker <= JPEG_MARKER_SOF15 && marker != JPEG_MARKER_DHT &&
+            marker != JPEG_MARKER_JPG && marker != JPEG_MARKER_DAC) {
+            if (seg_len < 7 || end - p < 9) {
+                break;
+            }
+            *height = jpeg_be16(p + 5);
+            *width = jpeg_be16(p + 7);
+            return ESP_OK;
+        }
+        if (seg_len < 2) {
+            break;
+        }
+        p += 2 + seg_len;
+    }
+    return ESP_FAIL;
+}
+
+esp_err_t jpeg_dc_create(jpeg_dc_handle_t *ret_parser)
+{
+    if (ret_parser == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct jpeg_dc_t *jd = calloc(1, sizeof(*jd));
+    if (jd == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    *ret_parser = jd;
+    return ESP_OK;
+}
+
+void jpeg_dc_delete(jpeg_dc_handle_t parser)
+{
+    free(parser);
+}
+
+esp_err_t jpeg_dc_get_info(jpeg_dc_handle_t parser, const uint8_t *jpeg, size_t len,
+                           jpeg_dc_info_t *info)
+{
+    if (parser == NULL || jpeg == NULL || info == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = jpeg_parse_headers(parser, jpeg, len, false);
+    if (ret == ESP_OK) {
+        jpeg_fill_info(parser, info);
+    }
+    return ret;
+}
+
+/**
+ * @brief Decode the DC levels of the first scan into per-component maps at luminance map resolution
+ *
+ * A chroma block covering several luminance blocks is written to all of
+ * them. Components with a NULL map are decoded but not stored.
+ */
+static esp_err_t jpeg_dc_decode(struct jpeg_dc_t *jd, const uint8_t *jpeg, size_t len,
+                                uint8_t *const maps[JPEG_DC_MAX_MAPS], size_t stride, jpeg_dc_info_t *info)
+{
+    esp_err_t ret = jpeg_parse_headers(jd, jpeg, len, true);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    jpeg_dc_info_t geometry;
+    jpeg_fill_info(jd, &geometry);
+    if (info) {
+        *info = geometry;
+    }
+    if (stride < geometry.map_width) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    /* Only the first scan is decoded, so it has to carry every wanted component */
+    const jpeg_component_t *y = &jd->comp[0];
+    uint8_t in_scan = 0;
+    for (int i = 0; i < jd->scan_count; i++) {
+        const jpeg_component_t *c = &jd->comp[jd->scan[i]];
+        if (!jd->dc[c->td].defined || !jd->ac[c->ta].huff.defined) {
+            return ESP_FAIL;
+        }
+        in_scan |= 1 << jd->scan[i];
+    }
+    for (int k = 0; k < JPEG_DC_MAX_MAPS; k++) {
+        if (maps[k] == NULL) {
+            continue;
+        }
+        const jpeg_component_t *c = &jd->comp[k];
+        if (k >= jd->ncomp || !(in_scan & (1 << k)) || y->h % c->h != 0 || y->v % c->v != 0) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        if (!(jd->quant_defined & (1 << c->tq))) {
+            return ESP_FAIL;
+        }
+    }
+
+    /* A single-component scan is not interleaved: one block per MCU */
+    bool interleaved = jd->scan_count > 1;
+    uint16_t mcus_x = interleaved ? jpeg_ceil_div(jd->width, 8u * jd->h_max) : geometry.map_width;
+    uint16_t mcus_y = interleaved ? jpeg_ceil_div(jd->height, 8u * jd->v_max) : geometry.map_height;
+
+    jd->pos = jd->data;
+    jd->end = jpeg + len;
+    jd->acc = 0;
+    jd->bits = 0;
+    jd->fill_zeros = 0;
+
+    int32_t pred[JPEG_MAX_COMPONENTS] = { 0 };
+    uint32_t restart_left = jd->restart_interval;
+
+    for (uint16_t my = 0; my < mcus_y; my++) {
+        for (uint16_t mx = 0; mx < mcus_x; mx++) {
+            if (jd->restart_interval) {
+                if (restart_left == 0) {
+                    if (jpeg_overrun(jd) || !jpeg_restart(jd)) {
+                        return ESP_ERR_INVALID_SIZE;
+                    }
+                    memset(pred, 0, sizeof(pred));
+                    restart_left = jd->restart_interval;
+                }
+                restart_left--;
+            }
+
+            for (int i = 0; i < jd->scan_count; i++) {
+                uint8_t k = jd->scan[i];
+                const jpeg_component_t *c = &jd->comp[k];
+                int blocks_h = interleaved ? c->h : 1;
+                int blocks_v = interleaved ? c->v : 1;
+                uint8_t *map = k < JPEG_DC_MAX_MAPS ? maps[k] : NULL;
+
+                for (int v = 0; v < blocks_v; v++) {
+                    for (int h = 0; h < blocks_h; h++) {
+                        int32_t diff;
+                        if (!jpeg_decode_dc(jd, &jd->dc[c->td], &diff) || !jpeg_skip_ac(jd, &jd->ac[c->ta])) {
+                            return jpeg_overrun(jd) ? ESP_ERR_INVALID_SIZE : ESP_FAIL;
+                        }
+                        if (map == NULL) {
+                            continue;
+                        }
+
+                        /* Only predictions of stored components are tracked */
+                        pred[k] += diff;
+                        uint8_t level = jpeg_dc_level(pred[k], jd->dc_quant[c->tq]);
+                        uint32_t scale_h = y->h / c->h;
+                        uint32_t scale_v = y->v / c->v;
+                        uint32_t bx = ((uint32_t)mx * blocks_h + h) * scale_h;
+                        uint32_t by = ((uint32_t)my * blocks_v + v) * scale_v;
+                        for (uint32_t dy = 0; dy < scale_v && by + dy < geometry.map_height; dy++) {
+                            for (uint32_t dx = 0; dx < scale_h && bx + dx < geometry.map_width; dx++) {
+                                map[(by + dy) * stride + bx + dx] = level;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return jpeg_overrun(jd) ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+esp_err_t jpeg_dc_luma(jpeg_dc_handle_t parser, const uint8_t *jpeg, size_t len,
+                       uint8_t *map, size_t stride, jpeg_dc_info_t *info)
+{
+    if (parser == NULL || jpeg == NULL || map == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t *const maps[JPEG_DC_MAX_MAPS] = { map, NULL, NULL };
+    return jpeg_dc_decode(parser, jpeg, len, maps, stride, info);
+}
+
+esp_err_t jpeg_dc_ycbcr(jpeg_dc_handle_t parser, const uint8_t *jpeg, size_t len,
+                        uint8_t *y, uint8_t *cb, uint8_t *cr, size_t stride, jpeg_dc_info_t *info)
+{
+    if (parser == NULL || jpeg == NULL || y == NULL || cb == NULL || cr == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = jpeg_parse_headers(parser, jpeg, len, false);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    /* Grayscale JPEGs get neutral chroma */
+    bool gray = parser->ncomp == 1;
+    uint8_t *const maps[JPEG_DC_MAX_MAPS] = { y, gray ? NULL : cb, gray ? NULL : cr };
+    ret = jpeg_dc_decode(parser, jpeg, len, maps, stride, info);
+    if (ret == ESP_OK && gray) {
+        jpeg_dc_info_t geometry;
+        jpeg_fill_info(parser, &geometry);
+        for (uint16_t row = 0; row < geometry.map_height; row++) {
+            memset(cb + row * stride, 128, geometry.map_width);
+            memset(cr + row * stride, 128, geometry.map_width);
+        }
+    }
+    return ret;
+}
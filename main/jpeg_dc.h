@@ -0,0 +1,126 @@
+/**
+ * @file jpeg_dc.h
+ * @brief 1/8 scale luminance (and chroma) maps from the DC coefficients of a JPEG
+ *
+ * The DC coefficient of an 8x8 block is eight times the block's mean level,
+ * so the DC values of the luminance blocks form a 1/8 scale image. This
+ * parser Huffman-decodes the entropy-coded data but stops there: AC
+ * coefficients are skipped without being stored, and there is no
+ * dequantization beyond DC, no IDCT and no color conversion. The chroma
+ * DC levels can be extracted the same way for a 1/8 scale color image.
+ *
+ * Supports baseline and extended sequential Huffman JPEGs with 8-bit
+ * samples, any chroma subsampling and restart intervals, i.e. what the
+ * camera sensors produce. Progressive and arithmetic-coded JPEGs are not
+ * supported. Portable C, so it can be checked on a host.
+ *
+ * A parser holds the Huffman lookup tables (about 12 KB), allocated once by
+ * jpeg_dc_create(); it is not safe to use from two tasks at once.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jpeg_dc_t *jpeg_dc_handle_t;
+
+/**
+ * @brief Image and luminance map geometry
+ */
+typedef struct {
+    uint16_t width;             /**< Image width in pixels */
+    uint16_t height;            /**< Image height in pixels */
+    uint16_t map_width;         /**< Luminance map width, one value per 8x8 block */
+    uint16_t map_height;        /**< Luminance map height */
+    uint8_t components;         /**< 1 for grayscale, 3 for YCbCr */
+    uint16_t restart_interval;  /**< MCUs between restart markers, 0 if none */
+} jpeg_dc_info_t;
+
+/**
+ * @brief Read the image size from the frame header
+ *
+ * Needs no parser and accepts any JPEG coding process, e.g. to check which
+ * resolution a sensor actually delivered.
+ *
+ * @param jpeg JPEG data
+ * @param len JPEG data length
+ * @param[out] width Image width
+ * @param[out] height Image height
+ * @return ESP_OK on success, ESP_FAIL if no frame header precedes the scan
+ */
+esp_err_t jpeg_dc_get_size(const uint8_t *jpeg, size_t len, uint16_t *width, uint16_t *height);
+
+/**
+ * @brief Allocate a parser
+ * @param[out] ret_parser Created parser
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if it cannot be allocated
+ */
+esp_err_t jpeg_dc_create(jpeg_dc_handle_t *ret_parser);
+
+/**
+ * @brief Free a parser
+ */
+void jpeg_dc_delete(jpeg_dc_handle_t parser);
+
+/**
+ * @brief Parse the JPEG headers
+ * @param parser Parser
+ * @param jpeg JPEG data
+ * @param len JPEG data length
+ * @param[out] info Image and luminance map geometry
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED for progressive or arithmetic-coded
+ *         JPEGs, ESP_FAIL if the headers are malformed or truncated
+ */
+esp_err_t jpeg_dc_get_info(jpeg_dc_handle_t parser, const uint8_t *jpeg, size_t len,
+                           jpeg_dc_info_t *info);
+
+/**
+ * @brief Extract the luminance map of a JPEG
+ *
+ * Writes info.map_width x info.map_height values, each the mean luminance of
+ * one 8x8 block (a 16x8 or 16x16 block of pixels for subsampled luminance).
+ *
+ * @param parser Parser
+ * @param jpeg JPEG data
+ * @param len JPEG data length
+ * @param[out] map Luminance map
+ * @param stride Row stride of @p map, at least info.map_width
+ * @param[out] info Geometry (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED for unsupported JPEGs,
+ *         ESP_ERR_INVALID_SIZE if the entropy-coded data is truncated,
+ *         ESP_FAIL if the JPEG is malformed
+ */
+esp_err_t jpeg_dc_luma(jpeg_dc_handle_t parser, const uint8_t *jpeg, size_t len,
+                       uint8_t *map, size_t stride, jpeg_dc_info_t *info);
+
+/**
+ * @brief Extract 1/8 scale Y, Cb and Cr maps of a JPEG
+ *
+ * All three maps have the luminance map geometry; subsampled chroma levels
+ * are repeated over the luminance blocks they cover. Grayscale JPEGs give
+ * neutral (128) chroma.
+ *
+ * @param parser Parser
+ * @param jpeg JPEG data
+ * @param len JPEG data length
+ * @param[out] y Luminance map
+ * @param[out] cb Blue difference map
+ * @param[out] cr Red difference map
+ * @param stride Row stride of the maps, at least info.map_width
+ * @param[out] info Geometry (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED for unsupported JPEGs (including chroma
+ *         sampling factors that do not divide the luminance ones), ESP_ERR_INVALID_SIZE if
+ *         the entropy-coded data is truncated, ESP_FAIL if the JPEG is malformed
+ */
+esp_err_t jpeg_dc_ycbcr(jpeg_dc_handle_t parser, const uint8_t *jpeg, size_t len,
+                        uint8_t *y, uint8_t *cb, uint8_t *cr, size_t stride, jpeg_dc_info_t *info);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,484 @@
+/**
+ * @file jpeg_enc.c
+ * @brief Baseline JPEG encoder implementation
+ */
+
+#include "jpeg_enc.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JPEG_MARKER_SOF0    0xC0
+#define JPEG_MARKER_DHT     0xC4
+#define JPEG_MARKER_SOI     0xD8
+#define JPEG_MARKER_EOI     0xD9
+#define JPEG_MARKER_SOS     0xDA
+#define JPEG_MARKER_DQT     0xDB
+#define JPEG_MARKER_APP0    0xE0
+
+/* Natural order index of each zigzag position */
+static const uint8_t s_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+/* Example quantization tables of ITU-T T.81 Annex K, natural order */
+static const uint8_t s_luma_quant[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99,
+};
+
+static const uint8_t s_chroma_quant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+/* Standard Huffman tables of Annex K: code counts per length, then symbols */
+static const uint8_t s_dc_luma_bits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t s_dc_chroma_bits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8_t s_dc_symbols[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t s_ac_luma_bits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8_t s_ac_luma_symbols[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+static const uint8_t s_ac_chroma_bits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8_t s_ac_chroma_symbols[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+/* AAN DCT output scale factors, cos(k * pi / 16) * sqrt(2) with 1 for k = 0 */
+static const float s_aan_scale[8] = {
+    1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+};
+
+typedef struct {
+    uint16_t code[256];
+    uint8_t size[256];
+} jpeg_enc_huff_t;
+
+typedef struct {
+    uint8_t quant[64];              /* Scaled table, zigzag order, as written to DQT */
+    float divisor[64];              /* Reciprocal of quantizer x AAN scale, natural order */
+    const jpeg_enc_huff_t *dc;
+    const jpeg_enc_huff_t *ac;
+} jpeg_enc_table_t;
+
+struct jpeg_enc_t {
+    jpeg_enc_table_t luma;
+    jpeg_enc_table_t chroma;
+    jpeg_enc_huff_t dc_luma;
+    jpeg_enc_huff_t dc_chroma;
+    jpeg_enc_huff_t ac_luma;
+    jpeg_enc_huff_t ac_chroma;
+
+    /* Output */
+    uint8_t *out;
+    size_t out_size;
+    size_t out_len;
+    bool overflow;
+    uint32_t acc;                   /* Pending bits, MSB first */
+    int bits;
+};
+
+static void jpeg_enc_build_huff(jpeg_enc_huff_t *h, const uint8_t *bits, const uint8_t *symbols)
+{
+    uint16_t code = 0;
+    int k = 0;
+
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < bits[len - 1]; i++, k++) {
+            h->code[symbols[k]] = code++;
+            h->size[symbols[k]] = (uint8_t)len;
+        }
+        code <<= 1;
+    }
+}
+
+static void jpeg_enc_build_table(jpeg_enc_table_t *t, const uint8_t *base, uint8_t quality)
+{
+    /* IJG quality scaling */
+    int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+
+    for (int i = 0; i < 64; i++) {
+        int q = (base[i] * scale + 50) / 100;
+        q = q < 1 ? 1 : q > 255 ? 255 : q;
+        t->divisor[i] = 1.0f / (q * s_aan_scale[i / 8] * s_aan_scale[i % 8] * 8.0f);
+    }
+    for (int k = 0; k < 64; k++) {
+        int q = (base[s_zigzag[k]] * scale + 50) / 100;
+        t->quant[k] = (uint8_t)(q < 1 ? 1 : q > 255 ? 255 : q);
+    }
+}
+
+static inline void jpeg_enc_byte(struct jpeg_enc_t *je, uint8_t byte)
+{
+    if (je->out_len < je->out_size) {
+        je->out[je->out_len++] = byte;
+    } else {
+        je->overflow = true;
+    }
+}
+
+static void jpeg_enc_marker(struct jpeg_enc_t *je, uint8_t marker, uint16_t length)
+{
+    jpeg_enc_byte(je, 0xFF);
+    jpeg_enc_byte(je, marker);
+    if (length) {
+        jpeg_enc_byte(je, length >> 8);
+        jpeg_enc_byte(je, length & 0xFF);
+    }
+}
+
+/**
+ * @brief Append bits to the entropy-coded data, stuffing a zero after every 0xFF
+ */
+static inline void jpeg_enc_bits(struct jpeg_enc_t *je, uint32_t value, int count)
+{
+    je->acc |= (value & ((1u << count) - 1)) << (32 - je->bits - count);
+    je->bits += count;
+    while (je->bits >= 8) {
+        uint8_t byte = je->acc >> 24;
+        jpeg_enc_byte(je, byte);
+        if (byte == 0xFF) {
+            jpeg_enc_byte(je, 0x00);
+        }
+        je->acc <<= 8;
+        je->bits -= 8;
+    }
+}
+
+static void jpeg_enc_write_dht(struct jpeg_enc_t *je, uint8_t class_id, const uint8_t *bits,
+                               const uint8_t *symbols)
+{
+    uint16_t count = 0;
+    for (int i = 0; i < 16; i++) {
+        count += bits[i];
+    }
+
+    jpeg_enc_marker(je, JPEG_MARKER_DHT, 2 + 1 + 16 + count);
+    jpeg_enc_byte(je, class_id);
+    for (int i = 0; i < 16; i++) {
+        jpeg_enc_byte(je, bits[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        jpeg_enc_byte(je, symbols[i]);
+    }
+}
+
+static void jpeg_enc_write_headers(struct jpeg_enc_t *je, const jpeg_enc_image_t *image, bool color)
+{
+    static const uint8_t jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    uint8_t ncomp = color ? 3 : 1;
+
+    jpeg_enc_marker(je, JPEG_MARKER_SOI, 0);
+    jpeg_enc_marker(je, JPEG_MARKER_APP0, 2 + sizeof(jfif));
+    for (size_t i = 0; i < sizeof(jfif); i++) {
+        jpeg_enc_byte(je, jfif[i]);
+    }
+
+    jpeg_enc_marker(je, JPEG_MARKER_DQT, 2 + 65 * (color ? 2 : 1));
+    jpeg_enc_byte(je, 0);
+    for (int k = 0; k < 64; k++) {
+        jpeg_enc_byte(je, je->luma.quant[k]);
+    }
+    if (color) {
+        jpeg_enc_byte(je, 1);
+        for (int k = 0; k < 64; k++) {
+            jpeg_enc_byte(je, je->chroma.quant[k]);
+        }
+    }
+
+    /* Y is sampled 2x2 against the chroma planes */
+    jpeg_enc_marker(je, JPEG_MARKER_SOF0, 8 + 3 * ncomp);
+    jpeg_enc_byte(je, 8);
+    jpeg_enc_byte(je, image->height >> 8);
+    jpeg_enc_byte(je, image->height & 0xFF);
+    jpeg_enc_byte(je, image->width >> 8);
+    jpeg_enc_byte(je, image->width & 0xFF);
+    jpeg_enc_byte(je, ncomp);
+    for (uint8_t c = 0; c < ncomp; c++) {
+        jpeg_enc_byte(je, c + 1);
+        jpeg_enc_byte(je, c == 0 && color ? 0x22 : 0x11);
+        jpeg_enc_byte(je, c == 0 ? 0 : 1);
+    }
+
+    jpeg_enc_write_dht(je, 0x00, s_dc_luma_bits, s_dc_symbols);
+    jpeg_enc_write_dht(je, 0x10, s_ac_luma_bits, s_ac_luma_symbols);
+    if (color) {
+        jpeg_enc_write_dht(je, 0x01, s_dc_chroma_bits, s_dc_symbols);
+        jpeg_enc_write_dht(je, 0x11, s_ac_chroma_bits, s_ac_chroma_symbols);
+    }
+
+    jpeg_enc_marker(je, JPEG_MARKER_SOS, 6 + 2 * ncomp);
+    jpeg_enc_byte(je, ncomp);
+    for (uint8_t c = 0; c < ncomp; c++) {
+        jpeg_enc_byte(je, c + 1);
+        jpeg_enc_byte(je, c == 0 ? 0x00 : 0x11);
+    }
+    jpeg_enc_byte(je, 0);
+    jpeg_enc_byte(je, 63);
+    jpeg_enc_byte(je, 0);
+}
+
+/**
+ * @brief In-place 1-D AAN forward DCT of 8 values spaced @p step apart
+ */
+static inline void jpeg_enc_fdct_1d(float *d, int step)
+{
+    float tmp0 = d[0 * step] + d[7 * step];
+    float tmp7 = d[0 * step] - d[7 * step];
+    float tmp1 = d[1 * step] + d[6 * step];
+    float tmp6 = d[1 * step] - d[6 * step];
+    float tmp2 = d[2 * step] + d[5 * step];
+    float tmp5 = d[2 * step] - d[5 * step];
+    float tmp3 = d[3 * step] + d[4 * step];
+    float tmp4 = d[3 * step] - d[4 * step];
+
+    /* Even part */
+    float tmp10 = tmp0 + tmp3;
+    float tmp13 = tmp0 - tmp3;
+    float tmp11 = tmp1 + tmp2;
+    float tmp12 = tmp1 - tmp2;
+
+    d[0 * step] = tmp10 + tmp11;
+    d[4 * step] = tmp10 - tmp11;
+    float z1 = (tmp12 + tmp13) * 0.707106781f;
+    d[2 * step] = tmp13 + z1;
+    d[6 * step] = tmp13 - z1;
+
+    /* Odd part */
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+
+    float z5 = (tmp10 - tmp12) * 0.382683433f;
+    float z2 = 0.541196100f * tmp10 + z5;
+    float z4 = 1.306562965f * tmp12 + z5;
+    float z3 = tmp11 * 0.707106781f;
+    float z11 = tmp7 + z3;
+    float z13 = tmp7 - z3;
+
+    d[5 * step] = z13 + z2;
+    d[3 * step] = z13 - z2;
+    d[1 * step] = z11 + z4;
+    d[7 * step] = z11 - z4;
+}
+
+/**
+ * @brief Number of bits of the magnitude of @p value, the JPEG size category
+ */
+static inline int jpeg_enc_category(int value)
+{
+    unsigned magnitude = value < 0 ? -value : value;
+    int bits = 0;
+    while (magnitude) {
+        bits++;
+        magnitude >>= 1;
+    }
+    return bits;
+}
+
+/**
+ * @brief Transform, quantize and entropy-code one level-shifted 8x8 block
+ */
+static void jpeg_enc_block(struct jpeg_enc_t *je, float *block, const jpeg_enc_table_t *t, int *pred)
+{
+    for (int row = 0; row < 8; row++) {
+        jpeg_enc_fdct_1d(block + row * 8, 1);
+    }
+    for (int col = 0; col < 8; col++) {
+        jpeg_enc_fdct_1d(block + col, 8);
+    }
+
+    int coef[64];
+    for (int k = 0; k < 64; k++) {
+        float v = block[s_zigzag[k]] * t->divisor[s_zigzag[k]];
+        coef[k] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
+    }
+
+    int diff = coef[0] - *pred;
+    *pred = coef[0];
+    int size = jpeg_enc_category(diff);
+    jpeg_enc_bits(je, t->dc->code[size], t->dc->size[size]);
+    if (size) {
+        jpeg_enc_bits(je, diff < 0 ? diff - 1 : diff, size);
+    }
+
+    int run = 0;
+    for (int k = 1; k < 64; k++) {
+        if (coef[k] == 0) {
+            run++;
+            continue;
+        }
+        while (run >= 16) {
+            jpeg_enc_bits(je, t->ac->code[0xF0], t->ac->size[0xF0]);
+            run -= 16;
+        }
+        size = jpeg_enc_category(coef[k]);
+        uint8_t symbol = (uint8_t)((run << 4) | size);
+        jpeg_enc_bits(je, t->ac->code[symbol], t->ac->size[symbol]);
+        jpeg_enc_bits(je, coef[k] < 0 ? coef[k] - 1 : coef[k], size);
+        run = 0;
+    }
+    if (run) {
+        jpeg_enc_bits(je, t->ac->code[0x00], t->ac->size[0x00]);
+    }
+}
+
+/**
+ * @brief Load an 8x8 block, repeating the last row and column past the image edge
+ */
+static void jpeg_enc_load(const jpeg_enc_image_t *image, const uint8_t *plane, int x0, int y0, float *block)
+{
+    for (int y = 0; y < 8; y++) {
+        int sy = y0 + y < image->height ? y0 + y : image->height - 1;
+        const uint8_t *row = plane + (size_t)sy * image->stride;
+        for (int x = 0; x < 8; x++) {
+            int sx = x0 + x < image->width ? x0 + x : image->width - 1;
+            block[y * 8 + x] = (float)row[sx] - 128.0f;
+        }
+    }
+}
+
+/**
+ * @brief Load an 8x8 chroma block averaged from 16x16 pixels
+ */
+static void jpeg_enc_load_subsampled(const jpeg_enc_image_t *image, const uint8_t *plane, int x0, int y0,
+                                     float *block)
+{
+    for (int y = 0; y < 8; y++) {
+        int sy0 = y0 + 2 * y < image->height ? y0 + 2 * y : image->height - 1;
+        int sy1 = sy0 + 1 < image->height ? sy0 + 1 : sy0;
+        const uint8_t *row0 = plane + (size_t)sy0 * image->stride;
+        const uint8_t *row1 = plane + (size_t)sy1 * image->stride;
+        for (int x = 0; x < 8; x++) {
+            int sx0 = x0 + 2 * x < image->width ? x0 + 2 * x : image->width - 1;
+            int sx1 = sx0 + 1 < image->width ? sx0 + 1 : sx0;
+            int sum = row0[sx0] + row0[sx1] + row1[sx0] + row1[sx1];
+            block[y * 8 + x] = sum * 0.25f - 128.0f;
+        }
+    }
+}
+
+esp_err_t jpeg_enc_create(uint8_t quality, jpeg_enc_handle_t *ret_encoder)
+{
+    if (ret_encoder == NULL || quality == 0 || quality > 100) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct jpeg_enc_t *je = calloc(1, sizeof(*je));
+    if (je == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    jpeg_enc_build_huff(&je->dc_luma, s_dc_luma_bits, s_dc_symbols);
+    jpeg_enc_build_huff(&je->dc_chroma, s_dc_chroma_bits, s_dc_symbols);
+    jpeg_enc_build_huff(&je->ac_luma, s_ac_luma_bits, s_ac_luma_symbols);
+    jpeg_enc_build_huff(&je->ac_chroma, s_ac_chroma_bits, s_ac_chroma_symbols);
+    jpeg_enc_build_table(&je->luma, s_luma_quant, quality);
+    jpeg_enc_build_table(&je->chroma, s_chroma_quant, quality);
+    je->luma.dc = &je->dc_luma;
+    je->luma.ac = &je->ac_luma;
+    je->chroma.dc = &je->dc_chroma;
+    je->chroma.ac = &je->ac_chroma;
+
+    *ret_encoder = je;
+    return ESP_OK;
+}
+
+void jpeg_enc_delete(jpeg_enc_handle_t encoder)
+{
+    free(encoder);
+}
+
+esp_err_t jpeg_enc_encode(jpeg_enc_handle_t encoder, const jpeg_enc_image_t *image,
+                          uint8_t *out, size_t out_size, size_t *out_len)
+{
+    struct jpeg_enc_t *je = encoder;
+
+    if (je == NULL || image == NULL || image->y == NULL || out == NULL || out_len == NULL ||
+        image->width == 0 || image->height == 0 || image->stride < image->width) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bool color = image->cb != NULL && image->cr != NULL;
+    je->out = out;
+    je->out_size = out_size;
+    je->out_len = 0;
+    je->overflow = false;
+    je->acc = 0;
+    je->bits = 0;
+
+    jpeg_enc_write_headers(je, image, color);
+
+    float block[64];
+    int pred[3] = { 0 };
+    int mcu = color ? 16 : 8;
+
+    for (int y = 0; y < image->height && !je->overflow; y += mcu) {
+        for (int x = 0; x < image->width; x += mcu) {
+            if (!color) {
+                jpeg_enc_load(image, image->y, x, y, block);
+                jpeg_enc_block(je, block, &je->luma, &pred[0]);
+                continue;
+            }
+
+            for (int i = 0; i < 4; i++) {
+                jpeg_enc_load(image, image->y, x + (i & 1) * 8, y + (i >> 1) * 8, block);
+                jpeg_enc_block(je, block, &je->luma, &pred[0]);
+            }
+            jpeg_enc_load_subsampled(image, image->cb, x, y, block);
+            jpeg_enc_block(je, block, &je->chroma, &pred[1]);
+            jpeg_enc_load_subsampled(image, image->cr, x, y, block);
+            jpeg_enc_block(je, block, &je->chroma, &pred[2]);
+        }
+    }
+
+    /* Pad the last byte with ones */
+    if (je->bits > 0) {
+        jpeg_enc_bits(je, 0x7F, 8 - je->bits);
+    }
+    jpeg_enc_marker(je, JPEG_MARKER_EOI, 0);
+
+    if (je->overflow) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *out_len = je->out_len;
+    return ESP_OK;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file jpeg_enc.h
+ * @brief Small baseline JPEG encoder for thumbnails
+ *
+ * Encodes 8-bit Y, Cb and Cr planes of equal size as a baseline JFIF JPEG
+ * with 4:2:0 chroma (or a single Y plane as grayscale), using the example
+ * quantization tables of the JPEG standard scaled by a 1-100 quality and
+ * the standard Huffman tables. Meant for images of a few hundred pixels a
+ * side, such as the 1/8 scale maps of jpeg_dc.h; there is no optimisation
+ * for large images. Portable C, so it can be checked on a host.
+ *
+ * An encoder holds its scaled quantization and Huffman code tables (about
+ * 3 KB); it is not safe to use from two tasks at once.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jpeg_enc_t *jpeg_enc_handle_t;
+
+/**
+ * @brief Image to encode
+ */
+typedef struct {
+    const uint8_t *y;           /**< Luminance plane */
+    const uint8_t *cb;          /**< Blue difference plane, NULL for grayscale */
+    const uint8_t *cr;          /**< Red difference plane, NULL for grayscale */
+    uint16_t width;             /**< Width in pixels */
+    uint16_t height;            /**< Height in pixels */
+    size_t stride;              /**< Row stride of the planes */
+} jpeg_enc_image_t;
+
+/**
+ * @brief Allocate an encoder
+ * @param quality Quality 1-100, higher is better (IJG scale)
+ * @param[out] ret_encoder Created encoder
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a quality outside 1-100,
+ *         ESP_ERR_NO_MEM if it cannot be allocated
+ */
+esp_err_t jpeg_enc_create(uint8_t quality, jpeg_enc_handle_t *ret_encoder);
+
+/**
+ * @brief Free an encoder
+ */
+void jpeg_enc_delete(jpeg_enc_handle_t encoder);
+
+/**
+ * @brief Encode an image
+ * @param encoder Encoder
+ * @param image Image planes and geometry
+ * @param[out] out Output buffer
+ * @param out_size Output buffer size
+ * @param[out] out_len JPEG length
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an empty image,
+ *         ESP_ERR_INVALID_SIZE if the JPEG does not fit the output buffer
+ */
+esp_err_t jpeg_enc_encode(jpeg_enc_handle_t encoder, const jpeg_enc_image_t *image,
+                          uint8_t *out, size_t out_size, size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif
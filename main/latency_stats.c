@@ -0,0 +1,194 @@
+/**
+ * @file latency_stats.c
+ * @brief Per-stage latency histograms for the capture and storage path
+ */
+
+#include "latency_stats.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "latency_stats";
+
+static const char *const s_stage_names[LATENCY_STAGE_MAX] = {
+    [LATENCY_STAGE_CAPTURE] = "capture",
+    [LATENCY_STAGE_QUEUE] = "queue",
+    [LATENCY_STAGE_OPEN] = "open",
+    [LATENCY_STAGE_WRITE] = "write",
+    [LATENCY_STAGE_FSYNC] = "fsync",
+    [LATENCY_STAGE_CLOSE] = "close",
+    [LATENCY_STAGE_STORE] = "store",
+    [LATENCY_STAGE_THUMBNAIL] = "thumb",
+};
+
+/**
+ * @brief Counters of one stage on one core
+ *
+ * The 64-bit total is kept as two words so it can be updated with 32-bit
+ * atomics; a reader may briefly see the low word wrapped before the carry.
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t total_lo;
+    uint32_t total_hi;
+    uint32_t max_us;
+    uint32_t buckets[LATENCY_BUCKETS];
+} latency_counters_t;
+
+static latency_counters_t s_counters[portNUM_PROCESSORS][LATENCY_STAGE_MAX];
+
+static inline size_t latency_bucket(uint32_t us)
+{
+    size_t bucket = us ? 32 - (size_t)__builtin_clz(us) : 0;
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+#ifdef CONFIG_APP_LATENCY_STATS
+void latency_stats_record(latency_stage_t stage, uint32_t us)
+{
+    if ((unsigned)stage >= LATENCY_STAGE_MAX) {
+        return;
+    }
+
+    /* Relaxed atomics: the task may be preempted or migrate between the updates */
+    latency_counters_t *c = &s_counters[xPortGetCoreID()][stage];
+    __atomic_fetch_add(&c->buckets[latency_bucket(us)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->count, 1, __ATOMIC_RELAXED);
+    uint32_t lo = __atomic_fetch_add(&c->total_lo, us, __ATOMIC_RELAXED);
+    if (lo + us < lo) {
+        __atomic_fetch_add(&c->total_hi, 1, __ATOMIC_RELAXED);
+    }
+    uint32_t max = __atomic_load_n(&c->max_us, __ATOMIC_RELAXED);
+    while (us > max &&
+           !__atomic_compare_exchange_n(&c->max_us, &max, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+#endif
+
+void latency_stats_get(latency_stage_t stage, latency_histogram_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+    if ((unsigned)stage >= LATENCY_STAGE_MAX) {
+        return;
+    }
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        const latency_counters_t *c = &s_counters[core][stage];
+        hist->count += __atomic_load_n(&c->count, __ATOMIC_RELAXED);
+        hist->total_us += ((uint64_t)__atomic_load_n(&c->total_hi, __ATOMIC_RELAXED) << 32) |
+                          __atomic_load_n(&c->total_lo, __ATOMIC_RELAXED);
+        uint32_t max = __atomic_load_n(&c->max_us, __ATOMIC_RELAXED);
+        if (max > hist->max_us) {
+            hist->max_us = max;
+        }
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+            hist->buckets[i] += __atomic_load_n(&c->buckets[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+uint32_t latency_histogram_percentile(const latency_histogram_t *hist, uint8_t pct)
+{
+    uint32_t total = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        total += hist->buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint32_t rank = (uint32_t)(((uint64_t)(pct > 100 ? 100 : pct) * total + 99) / 100);
+    uint32_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank && seen > 0) {
+            uint32_t upper = i ? (1UL << i) - 1 : 0;
+            return upper < hist->max_us ? upper : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
+
+const char *latency_stage_name(latency_stage_t stage)
+{
+    return (unsigned)stage < LATENCY_STAGE_MAX ? s_stage_names[stage] : "unknown";
+}
+
+void latency_stats_reset(void)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        for (int stage = 0; stage < LATENCY_STAGE_MAX; stage++) {
+            latency_counters_t *c = &s_counters[core][stage];
+            __atomic_store_n(&c->count, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->total_lo, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->total_hi, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->max_us, 0, __ATOMIC_RELAXED);
+            for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+                __atomic_store_n(&c->buckets[i], 0, __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+void latency_stats_log(void)
+{
+    for (int stage = 0; stage < LATENCY_STAGE_MAX; stage++) {
+        latency_histogram_t hist;
+        latency_stats_get((latency_stage_t)stage, &hist);
+        if (hist.count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%-7s n %lu, avg %lu us, p50 %lu us, p99 %lu us, max %lu us",
+                 s_stage_names[stage], (unsigned long)hist.count,
+                 (unsigned long)(hist.total_us / hist.count),
+                 (unsigned long)latency_histogram_percentile(&hist, 50),
+                 (unsigned long)latency_histogram_percentile(&hist, 99),
+                 (unsigned long)hist.max_us);
+    }
+}
+
+esp_err_t latency_stats_dump(const char *path)
+{
+    struct stat st;
+    bool create = (stat(path, &st) != 0);
+
+    FILE *f = fopen(path, "a");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+
+    if (create) {
+        fputs("uptime_ms,stage,count,total_us,max_us", f);
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+            fprintf(f, ",lt%lu", i ? (unsigned long)(1UL << i) : 1UL);
+        }
+        fputc('\n', f);
+    }
+
+    unsigned long uptime_ms = (unsigned long)(esp_timer_get_time() / 1000);
+    for (int stage = 0; stage < LATENCY_STAGE_MAX; stage++) {
+        latency_histogram_t hist;
+        latency_stats_get((latency_stage_t)stage, &hist);
+        fprintf(f, "%lu,%s,%lu,%llu,%lu", uptime_ms, s_stage_names[stage], (unsigned long)hist.count,
+                (unsigned long long)hist.total_us, (unsigned long)hist.max_us);
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+            fprintf(f, ",%lu", (unsigned long)hist.buckets[i]);
+        }
+        fputc('\n', f);
+    }
+
+    bool ok = !ferror(f);
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
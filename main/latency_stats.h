@@ -0,0 +1,109 @@
+/**
+ * @file latency_stats.h
+ * @brief Per-stage latency histograms for the capture and storage path
+ *
+ * Each stage has a histogram with power-of-two microsecond buckets, a count,
+ * a total and a maximum. Recording takes a few relaxed atomic increments on
+ * counters owned by the calling core, with no lock and no logging, so it
+ * can stay enabled in production. Readers merge the per-core counters.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Bucket i > 0 counts durations in [2^(i-1), 2^i) us; the last bucket is open-ended */
+#define LATENCY_BUCKETS     24
+
+/** Statistics file written by latency_stats_dump() under the mount point (8.3 name) */
+#define LATENCY_STATS_FILE  "STATS.CSV"
+
+/**
+ * @brief Instrumented stages
+ */
+typedef enum {
+    LATENCY_STAGE_CAPTURE = 0,  /**< Frame acquisition from the source */
+    LATENCY_STAGE_QUEUE,        /**< Wait in the pipeline queue for the writer */
+    LATENCY_STAGE_OPEN,         /**< File creation, pre-allocation and open */
+    LATENCY_STAGE_WRITE,        /**< Data writes */
+    LATENCY_STAGE_FSYNC,        /**< Explicit fsync() */
+    LATENCY_STAGE_CLOSE,        /**< close() including the implicit flush, and the rename of atomic writes */
+    LATENCY_STAGE_STORE,        /**< Whole sink call (write plus index update) */
+    LATENCY_STAGE_THUMBNAIL,    /**< Thumbnail decode, encode and write, off the capture path */
+    LATENCY_STAGE_MAX,
+} latency_stage_t;
+
+/**
+ * @brief Snapshot of one stage
+ */
+typedef struct {
+    uint32_t count;                     /**< Recorded durations */
+    uint64_t total_us;                  /**< Sum of the durations */
+    uint32_t max_us;                    /**< Longest duration */
+    uint32_t buckets[LATENCY_BUCKETS];  /**< Histogram */
+} latency_histogram_t;
+
+#ifdef CONFIG_APP_LATENCY_STATS
+/**
+ * @brief Record a duration; safe from any task on either core
+ */
+void latency_stats_record(latency_stage_t stage, uint32_t us);
+#else
+static inline void latency_stats_record(latency_stage_t stage, uint32_t us)
+{
+}
+#endif
+
+/**
+ * @brief Merge the per-core counters of a stage
+ *
+ * Counters keep changing while they are read, so the fields of a snapshot
+ * taken during recording may be off by the records in flight.
+ */
+void latency_stats_get(latency_stage_t stage, latency_histogram_t *hist);
+
+/**
+ * @brief Upper bound of the bucket holding the given percentile
+ * @param hist Histogram
+ * @param pct Percentile, 0-100
+ * @return Duration in us (the maximum for the last bucket), 0 if empty
+ */
+uint32_t latency_histogram_percentile(const latency_histogram_t *hist, uint8_t pct);
+
+/**
+ * @brief Short stage name, e.g. "write"
+ */
+const char *latency_stage_name(latency_stage_t stage);
+
+/**
+ * @brief Clear every stage
+ */
+void latency_stats_reset(void);
+
+/**
+ * @brief Log count, mean, p50, p99 and maximum of every stage that has records
+ */
+void latency_stats_log(void);
+
+/**
+ * @brief Append one CSV line per stage to a file
+ *
+ * Columns: uptime_ms, stage, count, total_us, max_us, then the bucket
+ * counts. Counters are cumulative since boot (or the last reset); a header
+ * line is written when the file is created.
+ *
+ * @param path File to append to
+ * @return ESP_OK on success, ESP_FAIL if the file cannot be written
+ */
+esp_err_t latency_stats_dump(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
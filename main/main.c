@@ -4,7 +4,8 @@
  * This example demonstrates how to:
  * - Initialize and configure an ESP32-CAM module
  * - Mount an SD card using SDMMC interface
- * - Capture a single photo and save it to the SD card
+ * - Capture photos on motion events through a double-buffered capture/write
+ *   pipeline and save them to the SD card
  *
  * Hardware Requirements:
  * - ESP32-CAM module (AI-Thinker or compatible)
@@ -12,6 +13,7 @@
  */
 
 /* Standard library includes */
+#include <stdio.h>
 #include <string.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
@@ -19,37 +21,274 @@
 /* ESP-IDF includes */
 #include <esp_log.h>
 #include <esp_system.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
 #include <nvs_flash.h>
+#include "driver/gpio.h"
+#ifdef CONFIG_APP_EXIF_ENABLE
+#include <esp_mac.h>
+#endif
 
 /* FreeRTOS includes */
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
-#include "freertos/queue.h"
 
 /* Application modules */
 #include "app_config.h"
 #include "camera_driver.h"
 #include "sd_card_driver.h"
 #include "file_operations.h"
-#include "driver/gpio.h"
+#include "capture_pipeline.h"
+#include "frame_ring.h"
+#include "frame_pool.h"
+#include "segment_store.h"
+#include "sector_log.h"
+#include "trigger.h"
+#include "capture_index.h"
+#include "retention.h"
+#include "motion_detector.h"
+#include "frame_dedup.h"
+#include "latency_stats.h"
+#include "quality_controller.h"
+#include "timelapse.h"
+#include "thumbnail.h"
+#include "exif.h"
+#include "startup.h"
+#include "scrub.h"
+
+/* Interval between statistics reports */
+#define STATS_INTERVAL_MS 10000
 
-#define PIR_SENSOR_PIN 12 // GPIO 12
+/* Boot timeline milestones */
+#define BOOT_MARK_PIPELINE      "pipeline started"
+#define BOOT_MARK_FIRST_FRAME   "first frame saved"
 
 static const char *TAG = "camera_sd_example";
-uint8_t intr_flag = 0;
 
-// ISR handler for GPIO interrupt
-static void IRAM_ATTR gpio_isr_handler(void* arg) {
-    // ESP_LOGI(TAG, "Rising edge detected on GPIO 12!");
-    intr_flag = 1;
+#if CONFIG_APP_STORAGE_JPEG_FILES
+/* Index used for the next photo file name */
+static uint32_t s_photo_index = 0;
+#endif
+
+#ifdef CONFIG_APP_EXIF_ENABLE
+/* BodySerialNumber of every stored JPEG file */
+static char s_device_id[EXIF_DEVICE_ID_MAX + 1];
+
+/* Head of the file being written; too large for the writer task stack */
+static exif_frame_t s_exif_frame;
+#endif
+
+/* Blocks for every frame held outside the camera driver */
+static frame_pool_handle_t s_frame_pool = NULL;
+
+/* Frames captured before the last trigger */
+static frame_ring_handle_t s_pretrigger_ring = NULL;
+
+/* Frames of a burst, written out after the burst */
+static frame_ring_handle_t s_burst_buffer = NULL;
+
+/* Time-lapse frames held between SD card writes */
+static frame_ring_handle_t s_batch_buffer = NULL;
+
+/* Drops frames without motion before they are stored */
+static motion_detector_handle_t s_motion_detector = NULL;
+
+/* Drops near-duplicates of recently stored frames */
+static frame_dedup_handle_t s_frame_dedup = NULL;
+
+/* Adjusts the capture JPEG quality to the frame size and write budget */
+static quality_controller_handle_t s_quality_controller = NULL;
+
+/* Set by the writer task once the first frame is on the card */
+static bool s_first_frame_saved = false;
+
+/**
+ * @brief Feed a stored frame to the quality controller and pass its decisions to the camera
+ */
+static void control_quality(const capture_frame_t *frame, uint32_t write_us)
+{
+#ifdef CONFIG_APP_CAMERA_MONITOR_PROFILE
+    /* Pre-trigger frames were captured in the monitor profile */
+    if (frame->trigger.id != 0 && frame->timestamp_us < frame->trigger.edge_us)
+    {
+        return;
+    }
+#endif
+
+    quality_sample_t sample = {
+        .bytes = frame->len,
+        .write_us = write_us,
+        .timestamp_us = frame->timestamp_us,
+    };
+    quality_decision_t decision;
+    if (quality_controller_update(s_quality_controller, &sample, &decision))
+    {
+        camera_set_capture_settings(decision.quality, decision.size_step);
+    }
+}
+
+/**
+ * @brief Pipeline filter: motion confirmation, then duplicate suppression
+ * @return true to store the frame
+ */
+static bool filter_frame(void *ctx, capture_frame_t *frame)
+{
+    if (s_motion_detector && !motion_detector_filter(s_motion_detector, frame))
+    {
+        return false;
+    }
+    /* Last, so only frames that will be stored become dedup references */
+    if (s_frame_dedup && !frame_dedup_filter(s_frame_dedup, frame))
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Pipeline sink: save a frame to the SD card in the configured format
+ * @return ESP_OK on success, error code otherwise
+ */
+static esp_err_t store_photo(void *ctx, const capture_frame_t *frame)
+{
+    int64_t start = esp_timer_get_time();
+
+    /* The frame as indexed; EXIF metadata and the CRC trailer make a JPEG file longer than the frame */
+    capture_frame_t stored = *frame;
+
+#ifdef CONFIG_APP_RETENTION_ENABLE
+    /* No deletion starts while the frame is written */
+    retention_write_begin();
+#endif
+#ifdef CONFIG_APP_SCRUB_ENABLE
+    /* Read-back verification holds off until the write is done */
+    scrub_write_begin();
+#endif
+
+#if CONFIG_APP_STORAGE_SEGMENTS
+    segment_location_t location = { 0 };
+    esp_err_t ret = segment_store_append(frame, &location);
+    uint32_t file_id = location.segment_id;
+    uint32_t offset = location.offset;
+
+    /* A segment takes its whole pre-allocated size when it is created */
+    if (ret == ESP_OK && offset == SEGMENT_DATA_OFFSET)
+    {
+        retention_note_written((uint64_t)CONFIG_APP_SEGMENT_SIZE_MB * 1024 * 1024);
+    }
+#elif CONFIG_APP_STORAGE_SECTOR_LOG
+    /* Written to raw sectors outside FATFS; the record number stands in for the file */
+    sector_log_location_t location = { 0 };
+    esp_err_t ret = sector_log_append(frame, &location);
+    uint32_t file_id = (uint32_t)location.lsn;
+    uint32_t offset = location.sector;
+#else
+    /* 8.3 file names, FATFS long file name support is disabled */
+    char photo_path[EXAMPLE_MAX_CHAR_SIZE];
+    uint32_t file_id = s_photo_index++;
+    uint32_t offset = 0;
+    snprintf(photo_path, sizeof(photo_path), PHOTO_NAME_FORMAT, MOUNT_POINT, (unsigned long)file_id);
+
+    file_write_options_t options = FILE_WRITE_OPTIONS_DEFAULT();
+    options.chunk_size = sd_card_get_write_chunk_size();
+
+    /* The EXIF head, the frame buffer and the CRC trailer go out as one gather write, the frame is not copied */
+    file_write_part_t parts[3] = { { .data = frame->buf, .size = frame->len } };
+    size_t part_count = 1;
+#ifdef CONFIG_APP_EXIF_ENABLE
+    if (exif_frame_build(frame, s_device_id, &s_exif_frame) == ESP_OK)
+    {
+        memcpy(parts, s_exif_frame.parts, s_exif_frame.part_count * sizeof(parts[0]));
+        part_count = s_exif_frame.part_count;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Frame %lu is not a JPEG, stored without EXIF", (unsigned long)frame->seq);
+    }
+#endif
+#ifdef CONFIG_APP_JPEG_CRC_TRAILER
+    /* Checked by the scrub; JPEG readers stop at EOI */
+    scrub_trailer_t trailer;
+    scrub_trailer_init(&trailer, parts, part_count);
+    parts[part_count].data = (const uint8_t *)&trailer;
+    parts[part_count].size = sizeof(trailer);
+    part_count++;
+#endif
+    esp_err_t ret = file_write_binary_fast_v(photo_path, parts, part_count, &options, NULL);
+    stored.len = 0;
+    for (size_t i = 0; i < part_count; i++)
+    {
+        stored.len += parts[i].size;
+    }
+    if (ret == ESP_OK)
+    {
+        retention_note_written(stored.len);
+    }
+#endif
+
+    if (ret == ESP_OK && s_quality_controller)
+    {
+        control_quality(frame, (uint32_t)(esp_timer_get_time() - start));
+    }
+
+#ifdef CONFIG_APP_THUMBNAIL_ENABLE
+    /* Only a copy is made here; frames are skipped while the thumbnail stage is full */
+    if (ret == ESP_OK)
+    {
+        thumbnail_submit(frame, file_id, offset);
+    }
+#endif
+
+#ifdef CONFIG_APP_TIMELAPSE_ENABLE
+    if (ret == ESP_OK && frame->trigger.source == CAPTURE_TRIGGER_SOURCE_SCHEDULE)
+    {
+        timelapse_note_frame(frame);
+    }
+#endif
+
+    if (ret == ESP_OK && !s_first_frame_saved)
+    {
+        s_first_frame_saved = true;
+        startup_mark(BOOT_MARK_FIRST_FRAME);
+    }
+
+    /* The index is repaired from the captures at boot, so a failed append only loses lookups */
+    if (ret == ESP_OK && capture_index_is_open() &&
+        capture_index_append(&stored, file_id, offset, frame->motion_score) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to index frame %lu", (unsigned long)frame->seq);
+    }
+
+#ifdef CONFIG_APP_SCRUB_ENABLE
+    scrub_write_end();
+#endif
+#ifdef CONFIG_APP_RETENTION_ENABLE
+    retention_write_end();
+#endif
+    return ret;
+}
+
+/**
+ * @brief Reserve the frame pool, with size classes around the settled JPEG size
+ */
+static void create_frame_pool(size_t typical_len)
+{
+    size_t max_len = camera_get_max_frame_size();
+    frame_pool_config_t pool_config = FRAME_POOL_DEFAULT_CONFIG(typical_len < max_len ? typical_len : max_len, max_len);
+    esp_err_t ret = frame_pool_create(&pool_config, &s_frame_pool);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to create frame pool (%s), held frames use their own arenas", esp_err_to_name(ret));
+        s_frame_pool = NULL;
+    }
 }
 
 /**
- * @brief Capture and save a photo to SD card
+ * @brief Start the capture pipeline with the camera as source
  * @return ESP_OK on success, error code otherwise
  */
-static esp_err_t capture_and_save_photo(void)
+static esp_err_t start_capture_pipeline(void)
 {
     if (!camera_is_supported())
     {
@@ -57,137 +296,464 @@ static esp_err_t capture_and_save_photo(void)
         return ESP_ERR_NOT_SUPPORTED;
     }
 
-    camera_fb_t *frame_buffer = camera_capture_photo();
-    if (frame_buffer == NULL)
+#if CONFIG_APP_STORAGE_SEGMENTS
+    segment_store_config_t segment_config = SEGMENT_STORE_DEFAULT_CONFIG(MOUNT_POINT);
+    segment_config.chunk_size = sd_card_get_write_chunk_size();
+    esp_err_t ret = segment_store_open(&segment_config);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open segment store: %s", esp_err_to_name(ret));
+        return ret;
+    }
+#elif CONFIG_APP_STORAGE_SECTOR_LOG
+    /* The log region lies after the FAT partition, which stays mounted for everything else */
+    sector_log_config_t log_config = SECTOR_LOG_DEFAULT_CONFIG(sd_card_get_handle());
+    log_config.chunk_size = sd_card_get_write_chunk_size();
+    esp_err_t ret = sector_log_open(&log_config);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open sector log: %s", esp_err_to_name(ret));
+        return ret;
+    }
+#else
+    /* Continue numbering after the photos already on the card */
+    s_photo_index = file_next_index(MOUNT_POINT, PHOTO_NAME_PREFIX, PHOTO_NAME_EXT);
+
+    /* A power cut during the last write left at most the temporary file of the next photo */
+    char photo_path[EXAMPLE_MAX_CHAR_SIZE];
+    snprintf(photo_path, sizeof(photo_path), PHOTO_NAME_FORMAT, MOUNT_POINT, (unsigned long)s_photo_index);
+    file_remove_temp_file(photo_path);
+#endif
+
+    capture_pipeline_config_t pipeline_config = CAPTURE_PIPELINE_DEFAULT_CONFIG();
+    pipeline_config.source = camera_get_frame_source();
+    pipeline_config.sink = store_photo;
+
+#ifdef CONFIG_APP_MOTION_CONFIRM
+    /* PIR triggers are confirmed against a background model before storing */
+    motion_detector_config_t motion_config = MOTION_DETECTOR_DEFAULT_CONFIG();
+    if (motion_detector_create(&motion_config, &s_motion_detector) != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to capture photo");
-        return ESP_FAIL;
+        ESP_LOGW(TAG, "Failed to create motion detector, storing every frame");
+        s_motion_detector = NULL;
     }
+#endif
 
-    /* Save photo to SD card */
-    const char *photo_path = MOUNT_POINT "/picture.jpg";
-    esp_err_t ret = file_write_binary(photo_path, frame_buffer->buf, frame_buffer->len);
+#ifdef CONFIG_APP_DEDUP_ENABLE
+    /* Static scenes would otherwise fill the card with the same picture */
+    frame_dedup_config_t dedup_config = FRAME_DEDUP_DEFAULT_CONFIG();
+    if (frame_dedup_create(&dedup_config, &s_frame_dedup) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to create duplicate suppression, storing every frame");
+        s_frame_dedup = NULL;
+    }
+#endif
 
-    /* Return the frame buffer */
-    camera_return_frame_buffer(frame_buffer);
+    if (s_motion_detector || s_frame_dedup)
+    {
+        pipeline_config.filter = filter_frame;
+    }
+
+#ifdef CONFIG_APP_QUALITY_CONTROL
+    /* Frame sizes and write times close the loop on the camera's JPEG quality */
+    quality_controller_config_t quality_config = QUALITY_CONTROLLER_DEFAULT_CONFIG();
+    if (quality_controller_create(&quality_config, camera_get_capture_quality(), &s_quality_controller) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to create quality controller, keeping a fixed JPEG quality");
+    }
+#endif
 
+#ifdef CONFIG_APP_PRETRIGGER_ENABLE
+    /* The ring arena is reserved once, before the pipeline starts */
+    frame_ring_config_t ring_config = {
+        .arena_size = CONFIG_APP_PRETRIGGER_ARENA_KB * 1024,
+        .max_frames = CONFIG_APP_PRETRIGGER_MAX_FRAMES,
+        .caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+        .pool = s_frame_pool,
+    };
+    if (frame_ring_create(&ring_config, &s_pretrigger_ring) == ESP_OK)
+    {
+        pipeline_config.pretrigger = s_pretrigger_ring;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Failed to allocate pre-trigger ring, continuing without it");
+    }
+#endif
+
+#ifdef CONFIG_APP_BURST_ENABLE
+    /* Reserved up front so a burst never waits for an allocation */
+    frame_ring_config_t burst_config = {
+        .arena_size = CONFIG_APP_BURST_ARENA_KB * 1024,
+        .max_frames = CONFIG_APP_BURST_MAX_FRAMES,
+        .caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+        .pool = s_frame_pool,
+    };
+    if (frame_ring_create(&burst_config, &s_burst_buffer) == ESP_OK)
+    {
+        pipeline_config.burst = s_burst_buffer;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Failed to allocate burst buffer, triggers capture without bursts");
+    }
+#endif
+
+#if defined(CONFIG_APP_TIMELAPSE_ENABLE) && CONFIG_APP_TIMELAPSE_BATCH_FRAMES > 1
+    /* Slot frames wait in PSRAM so the card is written in batches */
+    frame_ring_config_t batch_config = {
+        .arena_size = CONFIG_APP_TIMELAPSE_BATCH_ARENA_KB * 1024,
+        .max_frames = CONFIG_APP_TIMELAPSE_BATCH_FRAMES,
+        .caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+        .pool = s_frame_pool,
+    };
+    if (frame_ring_create(&batch_config, &s_batch_buffer) == ESP_OK)
+    {
+        pipeline_config.batch = s_batch_buffer;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Failed to allocate time-lapse batch buffer, writing every frame");
+    }
+#endif
+
+    return capture_pipeline_start(&pipeline_config);
+}
+
+/**
+ * @brief Startup step: initialize NVS, erasing it if the partition is full or from a newer format
+ * @return ESP_OK on success, error code otherwise
+ */
+static esp_err_t init_nvs(void *ctx)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        ESP_LOGW(TAG, "NVS partition needs to be erased: %s", esp_err_to_name(ret));
+        ret = nvs_flash_erase();
+        if (ret == ESP_OK)
+        {
+            ret = nvs_flash_init();
+        }
+    }
     return ret;
 }
 
+#ifdef CONFIG_APP_EXIF_ENABLE
 /**
- * @brief Main application entry point
+ * @brief Set the device id stored in EXIF metadata, from the configuration or the MAC address
  */
-void app_main(void)
+static void init_device_id(void)
 {
-    // Install GPIO ISR service and add handler
-    gpio_install_isr_service(0); // already installed
-    gpio_isr_handler_add(PIR_SENSOR_PIN, gpio_isr_handler, NULL);
-
-    // Configure GPIO 12 as input with pull-down and interrupt on rising edge
-    gpio_config_t io_conf = {
-        .intr_type = GPIO_INTR_POSEDGE,
-        .mode = GPIO_MODE_INPUT,
-        .pin_bit_mask = (1ULL << PIR_SENSOR_PIN),
-        .pull_down_en = 1,
-        .pull_up_en = 0,
-    };
-    gpio_config(&io_conf);
+    uint8_t mac[6];
+    if (CONFIG_APP_EXIF_DEVICE_ID[0] != '\0')
+    {
+        snprintf(s_device_id, sizeof(s_device_id), "%s", CONFIG_APP_EXIF_DEVICE_ID);
+    }
+    else if (esp_read_mac(mac, ESP_MAC_WIFI_STA) == ESP_OK)
+    {
+        snprintf(s_device_id, sizeof(s_device_id), "%02X%02X%02X%02X%02X%02X",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+    ESP_LOGI(TAG, "EXIF device id: %s", s_device_id);
+}
+#endif
 
-    ESP_LOGI(TAG, "Starting Camera SD Card Example");
+/**
+ * @brief Startup step: install the GPIO ISR service once, for the camera driver and the trigger inputs
+ * @return ESP_OK on success, error code otherwise
+ */
+static esp_err_t init_gpio_isr(void *ctx)
+{
+    /* The camera driver's flags; both it and trigger_init() accept an installed service */
+    esp_err_t ret = gpio_install_isr_service(ESP_INTR_FLAG_LOWMED | ESP_INTR_FLAG_IRAM);
+    return ret == ESP_ERR_INVALID_STATE ? ESP_OK : ret;
+}
+
+/**
+ * @brief Startup step: initialize the camera
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED without a camera, error code otherwise
+ */
+static esp_err_t init_camera(void *ctx)
+{
+    if (!camera_is_supported())
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return camera_init();
+}
 
-    /* Initialize camera */
-    if (camera_is_supported())
+/**
+ * @brief Startup step: settle the camera, then reserve the frame pool for the settled JPEG size
+ * @return ESP_OK on success, error code otherwise
+ */
+static esp_err_t warm_up_camera(void *ctx)
+{
+    /* Discard frames only until exposure, gain and JPEG size have settled */
+    camera_warmup_result_t warmup = { 0 };
+    camera_warmup_config_t warmup_config = CAMERA_WARMUP_DEFAULT_CONFIG();
+    esp_err_t ret = camera_warmup(&warmup_config, &warmup);
+#ifdef CONFIG_APP_FRAME_POOL_ENABLE
+    create_frame_pool(warmup.last_len);
+#endif
+    return ret;
+}
+
+/**
+ * @brief Startup step: mount the SD card, formatting it if configured
+ * @return ESP_OK on success, error code otherwise
+ */
+static esp_err_t init_storage(void *ctx)
+{
+    esp_err_t ret = sd_card_init();
+#ifdef CONFIG_EXAMPLE_FORMAT_SD_CARD
+    if (ret == ESP_OK)
     {
-        if (camera_init() != ESP_OK)
+        ret = sd_card_format();
+        if (ret != ESP_OK)
         {
-            ESP_LOGE(TAG, "Camera initialization failed, exiting");
-            return;
+            ESP_LOGE(TAG, "SD card formatting failed");
         }
     }
-    else
+#endif
+    return ret;
+}
+
+/**
+ * @brief Startup step: configure the trigger GPIOs and attach their interrupt handlers
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if the time-lapse replaces them, error code otherwise
+ */
+static esp_err_t init_triggers(void *ctx)
+{
+#if !defined(CONFIG_APP_TIMELAPSE_ENABLE) || defined(CONFIG_APP_TIMELAPSE_TRIGGERS)
+    /* Trigger inputs wake the capture task directly from their interrupt */
+    trigger_config_t trigger_config = TRIGGER_DEFAULT_CONFIG();
+    return trigger_init(&trigger_config);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/* Indices of the startup steps */
+enum
+{
+    BOOT_NVS,
+    BOOT_GPIO_ISR,
+    BOOT_CAMERA,
+    BOOT_WARMUP,
+    BOOT_SD_CARD,
+    BOOT_TRIGGERS,
+    BOOT_STEP_COUNT
+};
+
+/*
+ * The camera chain runs on the capture core, where its interrupts then land,
+ * and storage on the writer core. The SD card waits for NVS, which holds its
+ * calibration.
+ */
+static const startup_step_t s_boot_steps[BOOT_STEP_COUNT] = {
+    [BOOT_NVS] = {
+        .name = "nvs", .fn = init_nvs,
+        .core = CONFIG_APP_PIPELINE_WRITER_CORE, .optional = true,
+    },
+    [BOOT_GPIO_ISR] = {
+        .name = "gpio_isr", .fn = init_gpio_isr,
+        .core = CONFIG_APP_PIPELINE_CAPTURE_CORE,
+    },
+    [BOOT_CAMERA] = {
+        .name = "camera", .fn = init_camera, .deps = STARTUP_STEP(BOOT_GPIO_ISR),
+        .core = CONFIG_APP_PIPELINE_CAPTURE_CORE,
+    },
+    [BOOT_WARMUP] = {
+        .name = "camera_warmup", .fn = warm_up_camera, .deps = STARTUP_STEP(BOOT_CAMERA),
+        .core = CONFIG_APP_PIPELINE_CAPTURE_CORE, .optional = true,
+    },
+    [BOOT_SD_CARD] = {
+        .name = "sd_card", .fn = init_storage, .deps = STARTUP_STEP(BOOT_NVS),
+        .core = CONFIG_APP_PIPELINE_WRITER_CORE,
+    },
+    [BOOT_TRIGGERS] = {
+        .name = "triggers", .fn = init_triggers, .deps = STARTUP_STEP(BOOT_GPIO_ISR),
+        .core = CONFIG_APP_PIPELINE_CAPTURE_CORE, .optional = true,
+    },
+};
+
+/**
+ * @brief Main application entry point
+ */
+void app_main(void)
+{
+    ESP_LOGI(TAG, "Starting Camera SD Card Example");
+
+    /* Camera, SD card, NVS and trigger inputs come up concurrently, in dependency order */
+    startup_config_t startup_config = STARTUP_DEFAULT_CONFIG();
+    startup_result_t boot[BOOT_STEP_COUNT];
+    startup_run(&startup_config, s_boot_steps, BOOT_STEP_COUNT, boot);
+
+    if (boot[BOOT_NVS].result != ESP_OK)
+    {
+        ESP_LOGW(TAG, "NVS not available, SD card settings will not be cached");
+    }
+    if (boot[BOOT_CAMERA].result == ESP_ERR_NOT_SUPPORTED)
     {
         ESP_LOGW(TAG, "Camera not supported, continuing with SD card only");
     }
-
-    /* Initialize SD card */
-    if (sd_card_init() != ESP_OK)
+    else if (boot[BOOT_CAMERA].result != ESP_OK)
     {
-        ESP_LOGE(TAG, "SD card initialization failed, exiting");
+        ESP_LOGE(TAG, "Camera initialization failed, exiting");
+        sd_card_cleanup();
         return;
     }
-
-#ifdef CONFIG_EXAMPLE_FORMAT_SD_CARD
-    /* Format SD card if requested */
-    if (sd_card_format() != ESP_OK)
+    if (boot[BOOT_SD_CARD].result != ESP_OK)
     {
-        ESP_LOGE(TAG, "SD card formatting failed, exiting");
+        ESP_LOGE(TAG, "SD card initialization failed, exiting");
         sd_card_cleanup();
         return;
     }
+    if (boot[BOOT_TRIGGERS].result != ESP_OK && boot[BOOT_TRIGGERS].result != ESP_ERR_NOT_SUPPORTED)
+    {
+        ESP_LOGE(TAG, "Failed to initialize trigger inputs: %s", esp_err_to_name(boot[BOOT_TRIGGERS].result));
+    }
+
+#ifdef CONFIG_APP_FILE_WRITE_BENCHMARK
+    /* Compare the stdio and pre-allocated unbuffered write paths on this card */
+    file_write_benchmark(MOUNT_POINT, CONFIG_APP_FILE_WRITE_BENCHMARK_SIZE_KB * 1024,
+                         CONFIG_APP_FILE_WRITE_BENCHMARK_ITERATIONS);
 #endif
 
-    // Configure GPIO 12 as input with pull-down and interrupt on rising edge
-    gpio_config_t io_conf = {
-        .intr_type = GPIO_INTR_POSEDGE,
-        .mode = GPIO_MODE_INPUT,
-        .pin_bit_mask = (1ULL << PIR_SENSOR_PIN),
-        .pull_down_en = 1,
-        .pull_up_en = 0,
-    };
-    gpio_config(&io_conf);
+#ifdef CONFIG_APP_MOTION_BENCHMARK
+    /* Scalar and SIMD block difference on the 1/8 scale luminance map of a UXGA frame */
+    motion_kernel_init();
+    motion_detector_benchmark(1600 / 8, 1200 / 8, CONFIG_APP_MOTION_BENCHMARK_ITERATIONS);
+#endif
 
-    // Install GPIO ISR service and add handler
-    // gpio_install_isr_service(0); // already installed
-    gpio_isr_handler_add(PIR_SENSOR_PIN, gpio_isr_handler, NULL);
+#ifdef CONFIG_APP_EXIF_ENABLE
+    init_device_id();
+#endif
 
-    ESP_LOGI(TAG, "Initiating camera warm-up delay (3 seconds)...");
-    vTaskDelay(3000 / portTICK_PERIOD_MS);
+    /* Calibration and benchmark writes are not captures */
+    latency_stats_reset();
 
-    /* Warm-up loop to discard first few frames */
-    for (int i = 0; i < 100; i++)
+    esp_err_t ret;
+#ifdef CONFIG_APP_THUMBNAIL_ENABLE
+    /* Started first so the initial captures get thumbnails too */
+    thumbnail_config_t thumbnail_config = THUMBNAIL_DEFAULT_CONFIG(MOUNT_POINT);
+    thumbnail_config.pool = s_frame_pool;
+    ret = thumbnail_start(&thumbnail_config);
+    if (ret != ESP_OK)
     {
-        camera_fb_t *fb = esp_camera_fb_get();
-        if (!fb)
-        {
-            ESP_LOGE(TAG, "Failed to get frame buffer during warm-up");
-            continue;
-        }
-        esp_camera_fb_return(fb);
+        ESP_LOGE(TAG, "Failed to start thumbnails: %s", esp_err_to_name(ret));
     }
+#endif
 
-    /* Capture a single photo */
-    ESP_LOGI(TAG, "Capturing a single photo...");
-    esp_err_t ret = capture_and_save_photo();
-    if (ret == ESP_OK)
+    /* Start the capture/write pipeline */
+    ret = start_capture_pipeline();
+    if (ret != ESP_OK)
     {
-        ESP_LOGI(TAG, "Photo captured and saved successfully!");
+        ESP_LOGE(TAG, "Failed to start capture pipeline: %s", esp_err_to_name(ret));
+        sd_card_cleanup();
+        return;
     }
-    else
+    startup_mark(BOOT_MARK_PIPELINE);
+
+#ifdef CONFIG_APP_RETENTION_ENABLE
+    /* Oldest captures are deleted in the background when the card fills up */
+    retention_config_t retention_config = RETENTION_DEFAULT_CONFIG(MOUNT_POINT);
+    ret = retention_start(&retention_config);
+    if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to capture/save photo: %s", esp_err_to_name(ret));
+        ESP_LOGE(TAG, "Failed to start retention: %s", esp_err_to_name(ret));
     }
+#endif
+
+#ifdef CONFIG_APP_SCRUB_ENABLE
+    /* Stored captures are read back and checked while the card is not being written */
+    scrub_config_t scrub_config = SCRUB_DEFAULT_CONFIG(MOUNT_POINT);
+    scrub_config.card = sd_card_get_handle();
+    ret = scrub_start(&scrub_config);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start scrub: %s", esp_err_to_name(ret));
+    }
+#endif
+
+#ifdef CONFIG_APP_TIMELAPSE_ENABLE
+    /* Slots are requested on absolute times by a task of its own */
+    timelapse_config_t timelapse_config = TIMELAPSE_DEFAULT_CONFIG();
+    ret = timelapse_start(&timelapse_config);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start time-lapse: %s", esp_err_to_name(ret));
+    }
+#endif
+
+    /* Capture an initial set of photos */
+    ESP_LOGI(TAG, "Capturing initial photos...");
+    capture_pipeline_trigger();
 
-    /* Cleanup and exit */
-    sd_card_cleanup();
-    ESP_LOGI(TAG, "Application completed, entering idle state");
+    ESP_LOGI(TAG, "Waiting for motion events");
+
+#if CONFIG_APP_LATENCY_STATS_DUMP_INTERVAL_S > 0
+    int64_t last_dump_us = esp_timer_get_time();
+#endif
+    bool timeline_logged = false;
 
-    /* Keep the task alive but idle */
+    /* Captures are event driven; this task only reports statistics */
     while (1)
     {
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
-        
-        if (intr_flag == 1) {
-            ESP_LOGI(TAG, "Motion detected! Capturing photo...");
-            // esp_err_t ret = capture_and_save_photo();
-            // if (ret == ESP_OK)
-            // {
-            //     ESP_LOGI(TAG, "Photo captured and saved successfully!");
-            // }
-            // else
-            // {
-            //     ESP_LOGE(TAG, "Failed to capture/save photo: %s", esp_err_to_name(ret));
-            // }
-            intr_flag = 0;
+        vTaskDelay(STATS_INTERVAL_MS / portTICK_PERIOD_MS);
+        if (!timeline_logged && startup_get_mark(BOOT_MARK_FIRST_FRAME) != 0)
+        {
+            timeline_logged = true;
+            startup_log_timeline();
+        }
+        trigger_log_stats();
+        capture_pipeline_log_stats();
+#ifdef CONFIG_APP_TIMELAPSE_ENABLE
+        timelapse_log_stats();
+#endif
+#ifdef CONFIG_APP_THUMBNAIL_ENABLE
+        thumbnail_log_stats();
+#endif
+        if (s_frame_pool)
+        {
+            frame_pool_log_stats(s_frame_pool);
+        }
+        if (s_motion_detector)
+        {
+            motion_detector_log_stats(s_motion_detector);
+        }
+        if (s_frame_dedup)
+        {
+            frame_dedup_log_stats(s_frame_dedup);
+        }
+        if (s_quality_controller)
+        {
+            quality_controller_log_stats(s_quality_controller);
+        }
+        if (file_write_get_fallbacks() > 0)
+        {
+            ESP_LOGW(TAG, "%lu write chunks went to the card unstaged, one sector per command",
+                     (unsigned long)file_write_get_fallbacks());
+        }
+#ifdef CONFIG_APP_CAMERA_MONITOR_PROFILE
+        camera_log_profile_stats();
+#endif
+#ifdef CONFIG_APP_RETENTION_ENABLE
+        retention_log_stats();
+#endif
+#ifdef CONFIG_APP_SCRUB_ENABLE
+        scrub_log_stats();
+#endif
+#ifdef CONFIG_APP_LATENCY_STATS
+        latency_stats_log();
+#if CONFIG_APP_LATENCY_STATS_DUMP_INTERVAL_S > 0
+        if (esp_timer_get_time() - last_dump_us >= CONFIG_APP_LATENCY_STATS_DUMP_INTERVAL_S * 1000000LL)
+        {
+            last_dump_us = esp_timer_get_time();
+            latency_stats_dump(MOUNT_POINT "/" LATENCY_STATS_FILE);
         }
+#endif
+#endif
     }
 }
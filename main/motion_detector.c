@@ -0,0 +1,371 @@
+/**
+ * @file motion_detector.c
+ * @brief Software motion confirmation implementation
+ */
+
+#include "motion_detector.h"
+#include "jpeg_dc.h"
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "motion_detector";
+
+struct motion_detector_t {
+    motion_detector_config_t config;
+    uint16_t width;             /* Grayscale image size, 0 before the first frame */
+    uint16_t height;
+    size_t stride;              /* Padded to whole blocks */
+    size_t rows;
+    size_t blocks_x;
+    size_t blocks_y;
+    uint8_t *cur;               /* Current image, padding kept at zero */
+    uint8_t *bg;                /* Background image */
+    uint16_t *bg_acc;           /* Background in 8.8 fixed point */
+    uint32_t *block_sad;
+    jpeg_dc_handle_t jpeg;      /* Luminance map parser */
+    bool has_background;
+    portMUX_TYPE lock;          /* Protects the statistics */
+    motion_detector_stats_t stats;
+    uint64_t decode_time_us;
+    uint64_t detect_time_us;
+};
+
+/**
+ * @brief Allocate an aligned image buffer, in internal RAM if possible
+ */
+static void *motion_alloc_image(size_t size)
+{
+    void *buf = heap_caps_aligned_alloc(MOTION_ALIGN, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (buf == NULL) {
+        buf = heap_caps_aligned_alloc(MOTION_ALIGN, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+    return buf;
+}
+
+/**
+ * @brief Allocate a buffer that is touched once per frame, in PSRAM if available
+ */
+static void *motion_alloc_bulk(size_t size)
+{
+    void *buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buf == NULL) {
+        buf = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    return buf;
+}
+
+static void motion_free_images(motion_detector_handle_t det)
+{
+    heap_caps_free(det->cur);
+    heap_caps_free(det->bg);
+    heap_caps_free(det->bg_acc);
+    free(det->block_sad);
+    det->cur = NULL;
+    det->bg = NULL;
+    det->bg_acc = NULL;
+    det->block_sad = NULL;
+    det->width = 0;
+    det->height = 0;
+    det->has_background = false;
+}
+
+/**
+ * @brief Size the image buffers for a grayscale image, dropping the background if it changes
+ */
+static esp_err_t motion_prepare(motion_detector_handle_t det, uint16_t width, uint16_t height)
+{
+    if (width == det->width && height == det->height) {
+        return ESP_OK;
+    }
+
+    motion_free_images(det);
+
+    det->stride = MOTION_PAD(width);
+    det->rows = MOTION_PAD(height);
+    det->blocks_x = det->stride / MOTION_BLOCK_SIZE;
+    det->blocks_y = det->rows / MOTION_BLOCK_SIZE;
+
+    size_t pixels = det->stride * det->rows;
+    det->cur = motion_alloc_image(pixels);
+    det->bg = motion_alloc_image(pixels);
+    det->bg_acc = motion_alloc_bulk(pixels * sizeof(uint16_t));
+    det->block_sad = malloc(det->blocks_x * det->blocks_y * sizeof(uint32_t));
+    if (det->cur == NULL || det->bg == NULL || det->bg_acc == NULL || det->block_sad == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate buffers for %ux%u images", width, height);
+        motion_free_images(det);
+        return ESP_ERR_NO_MEM;
+    }
+
+    memset(det->cur, 0, pixels);
+    det->width = width;
+    det->height = height;
+    ESP_LOGI(TAG, "Comparing %ux%u grayscale images in %zux%zu blocks",
+             width, height, det->blocks_x, det->blocks_y);
+    return ESP_OK;
+}
+
+/**
+ * @brief Compare det->cur with the background and update it
+ */
+static void motion_detect(motion_detector_handle_t det, motion_result_t *result)
+{
+    size_t pixels = det->stride * det->rows;
+    size_t blocks = det->blocks_x * det->blocks_y;
+
+    memset(result, 0, sizeof(*result));
+    result->total_blocks = (uint16_t)blocks;
+
+    if (!det->has_background) {
+        for (size_t i = 0; i < pixels; i++) {
+            det->bg_acc[i] = (uint16_t)(det->cur[i] << 8);
+        }
+        memcpy(det->bg, det->cur, pixels);
+        det->has_background = true;
+        result->reference = true;
+        result->motion = true;
+        return;
+    }
+
+    motion_block_diff(det->cur, det->bg, det->stride, det->blocks_x, det->blocks_y, det->block_sad);
+
+    uint32_t threshold = (uint32_t)det->config.pixel_threshold * MOTION_BLOCK_SIZE * MOTION_BLOCK_SIZE;
+    for (size_t i = 0; i < blocks; i++) {
+        if (det->block_sad[i] >= threshold) {
+            result->changed_blocks++;
+        }
+        if (det->block_sad[i] > result->max_block_sad) {
+            result->max_block_sad = det->block_sad[i];
+        }
+    }
+    result->motion = result->changed_blocks >= det->config.min_changed_blocks;
+
+    motion_background_update(det->bg_acc, det->bg, det->cur, pixels, det->config.learn_shift);
+}
+
+static void motion_account(motion_detector_handle_t det, const motion_result_t *result,
+                           uint32_t decode_us, uint32_t detect_us)
+{
+    portENTER_CRITICAL(&det->lock);
+    det->stats.frames++;
+    if (result->motion) {
+        det->stats.confirmed++;
+    } else {
+        det->stats.rejected++;
+    }
+    det->decode_time_us += decode_us;
+    det->detect_time_us += detect_us;
+    portEXIT_CRITICAL(&det->lock);
+}
+
+esp_err_t motion_detector_create(const motion_detector_config_t *config,
+                                 motion_detector_handle_t *ret_detector)
+{
+    if (config == NULL || ret_detector == NULL || config->learn_shift == 0 ||
+        config->learn_shift > 8) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct motion_detector_t *det = calloc(1, sizeof(*det));
+    if (det == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    det->config = *config;
+    portMUX_INITIALIZE(&det->lock);
+    if (jpeg_dc_create(&det->jpeg) != ESP_OK) {
+        free(det);
+        return ESP_ERR_NO_MEM;
+    }
+    det->stats.kernel = motion_kernel_init();
+
+    ESP_LOGI(TAG, "Motion detector using %s kernel (threshold %u, min blocks %u, learn 1/%u)",
+             motion_kernel_name(det->stats.kernel), config->pixel_threshold,
+             config->min_changed_blocks, 1u << config->learn_shift);
+    *ret_detector = det;
+    return ESP_OK;
+}
+
+void motion_detector_delete(motion_detector_handle_t detector)
+{
+    if (detector == NULL) {
+        return;
+    }
+    motion_free_images(detector);
+    jpeg_dc_delete(detector->jpeg);
+    free(detector);
+}
+
+void motion_detector_reset(motion_detector_handle_t detector)
+{
+    detector->has_background = false;
+}
+
+esp_err_t motion_detector_process_gray(motion_detector_handle_t detector, const uint8_t *gray,
+                                       uint16_t width, uint16_t height, size_t stride,
+                                       motion_result_t *result)
+{
+    if (gray == NULL || result == NULL || width == 0 || height == 0 || stride < width) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = motion_prepare(detector, width, height);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    int64_t start = esp_timer_get_time();
+    for (uint16_t y = 0; y < height; y++) {
+        memcpy(detector->cur + y * detector->stride, gray + y * stride, width);
+    }
+    motion_detect(detector, result);
+    motion_account(detector, result, 0, (uint32_t)(esp_timer_get_time() - start));
+    return ESP_OK;
+}
+
+esp_err_t motion_detector_process_jpeg(motion_detector_handle_t detector, const capture_frame_t *frame,
+                                       motion_result_t *result)
+{
+    if (frame == NULL || frame->buf == NULL || result == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    jpeg_dc_info_t info;
+    esp_err_t ret = jpeg_dc_get_info(detector->jpeg, frame->buf, frame->len, &info);
+    if (ret == ESP_OK) {
+        ret = motion_prepare(detector, info.map_width, info.map_height);
+        if (ret == ESP_ERR_NO_MEM) {
+            return ret;
+        }
+    }
+
+    /* Block means straight from the DC coefficients, no IDCT */
+    int64_t start = esp_timer_get_time();
+    if (ret == ESP_OK) {
+        ret = jpeg_dc_luma(detector->jpeg, frame->buf, frame->len, detector->cur, detector->stride, NULL);
+    }
+    if (ret != ESP_OK) {
+        portENTER_CRITICAL(&detector->lock);
+        detector->stats.errors++;
+        portEXIT_CRITICAL(&detector->lock);
+        ESP_LOGW(TAG, "Frame %lu: no luminance map: %s",
+                 (unsigned long)frame->seq, esp_err_to_name(ret));
+        return ret;
+    }
+    int64_t decoded = esp_timer_get_time();
+
+    motion_detect(detector, result);
+    motion_account(detector, result, (uint32_t)(decoded - start),
+                   (uint32_t)(esp_timer_get_time() - decoded));
+    return ESP_OK;
+}
+
+bool motion_detector_filter(void *ctx, capture_frame_t *frame)
+{
+    motion_result_t result;
+
+    /* Losing a real event is worse than storing an empty frame */
+    if (motion_detector_process_jpeg((motion_detector_handle_t)ctx, frame, &result) != ESP_OK) {
+        return true;
+    }
+
+    frame->motion_score = result.changed_blocks;
+    if (!result.motion) {
+        ESP_LOGD(TAG, "Frame %lu rejected: %u/%u blocks changed (max SAD %lu)",
+                 (unsigned long)frame->seq, result.changed_blocks, result.total_blocks,
+                 (unsigned long)result.max_block_sad);
+    }
+    return result.motion;
+}
+
+void motion_detector_get_stats(motion_detector_handle_t detector, motion_detector_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&detector->lock);
+    *stats = detector->stats;
+    uint64_t decode_time_us = detector->decode_time_us;
+    uint64_t detect_time_us = detector->detect_time_us;
+    portEXIT_CRITICAL(&detector->lock);
+
+    stats->avg_decode_us = stats->frames ? (uint32_t)(decode_time_us / stats->frames) : 0;
+    stats->avg_detect_us = stats->frames ? (uint32_t)(detect_time_us / stats->frames) : 0;
+}
+
+void motion_detector_log_stats(motion_detector_handle_t detector)
+{
+    motion_detector_stats_t stats;
+    motion_detector_get_stats(detector, &stats);
+
+    ESP_LOGI(TAG, "frames %lu, motion %lu, rejected %lu, errors %lu, decode %lu us, "
+             "detect %lu us (%s)",
+             (unsigned long)stats.frames, (unsigned long)stats.confirmed,
+             (unsigned long)stats.rejected, (unsigned long)stats.errors,
+             (unsigned long)stats.avg_decode_us, (unsigned long)stats.avg_detect_us,
+             motion_kernel_name(stats.kernel));
+}
+
+void motion_detector_benchmark(uint16_t width, uint16_t height, uint32_t iterations)
+{
+    static const motion_kernel_t kernels[] = { MOTION_KERNEL_SCALAR, MOTION_KERNEL_PIE };
+
+    size_t stride = MOTION_PAD(width);
+    size_t rows = MOTION_PAD(height);
+    size_t blocks_x = stride / MOTION_BLOCK_SIZE;
+    size_t blocks_y = rows / MOTION_BLOCK_SIZE;
+
+    uint8_t *a = motion_alloc_image(stride * rows);
+    uint8_t *b = motion_alloc_image(stride * rows);
+    uint32_t *sad = malloc(blocks_x * blocks_y * sizeof(uint32_t));
+    uint32_t *reference = malloc(blocks_x * blocks_y * sizeof(uint32_t));
+    if (a == NULL || b == NULL || sad == NULL || reference == NULL || iterations == 0) {
+        ESP_LOGE(TAG, "Benchmark: failed to allocate %zux%zu images", stride, rows);
+        goto cleanup;
+    }
+
+    esp_fill_random(a, stride * rows);
+    esp_fill_random(b, stride * rows);
+
+    motion_kernel_t active = motion_kernel_active();
+    uint32_t scalar_us = 0;
+
+    ESP_LOGI(TAG, "Benchmark: %ux%u image, %zu blocks, %lu iterations",
+             width, height, blocks_x * blocks_y, (unsigned long)iterations);
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!motion_kernel_select(kernels[k])) {
+            continue;
+        }
+
+        int64_t start = esp_timer_get_time();
+        for (uint32_t i = 0; i < iterations; i++) {
+            motion_block_diff(a, b, stride, blocks_x, blocks_y, sad);
+        }
+        uint32_t per_frame_us = (uint32_t)((esp_timer_get_time() - start) / iterations);
+
+        if (kernels[k] == MOTION_KERNEL_SCALAR) {
+            scalar_us = per_frame_us;
+            memcpy(reference, sad, blocks_x * blocks_y * sizeof(uint32_t));
+        }
+        bool match = memcmp(reference, sad, blocks_x * blocks_y * sizeof(uint32_t)) == 0;
+
+        ESP_LOGI(TAG, "Benchmark: %-6s %6lu us/frame, %.2fx scalar%s",
+                 motion_kernel_name(kernels[k]), (unsigned long)per_frame_us,
+                 per_frame_us ? (float)scalar_us / per_frame_us : 0.0f,
+                 match ? "" : ", RESULTS DIFFER");
+    }
+
+    motion_kernel_select(active);
+
+cleanup:
+    heap_caps_free(a);
+    heap_caps_free(b);
+    free(sad);
+    free(reference);
+}
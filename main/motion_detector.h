@@ -0,0 +1,163 @@
+/**
+ * @file motion_detector.h
+ * @brief Software motion confirmation for PIR-triggered captures
+ *
+ * Each frame is reduced to a small grayscale image, compared block by block
+ * against a running-average background and classed as motion when enough
+ * blocks changed. Used as a capture pipeline filter, it drops frames caused
+ * by heat or light changes that a PIR sensor cannot tell from motion.
+ *
+ * The grayscale image is the 1/8 scale luminance map formed by the DC
+ * coefficients of the JPEG (jpeg_dc), so neither a second sensor capture nor
+ * a full decode is needed. The block differences run on motion_kernel (PIE
+ * SIMD on the ESP32-S3).
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "capture_frame.h"
+#include "motion_kernel.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct motion_detector_t *motion_detector_handle_t;
+
+/**
+ * @brief Motion detector configuration
+ */
+typedef struct {
+    uint8_t pixel_threshold;        /**< Mean absolute difference per pixel that marks a block as changed */
+    uint16_t min_changed_blocks;    /**< Changed blocks needed to confirm motion */
+    uint8_t learn_shift;            /**< Background moves by 1/2^learn_shift of the difference per frame */
+} motion_detector_config_t;
+
+#ifndef CONFIG_APP_MOTION_PIXEL_THRESHOLD
+#define CONFIG_APP_MOTION_PIXEL_THRESHOLD   12
+#endif
+#ifndef CONFIG_APP_MOTION_MIN_BLOCKS
+#define CONFIG_APP_MOTION_MIN_BLOCKS        2
+#endif
+#ifndef CONFIG_APP_MOTION_LEARN_SHIFT
+#define CONFIG_APP_MOTION_LEARN_SHIFT       3
+#endif
+
+/**
+ * @brief Default motion detector configuration from Kconfig
+ */
+#define MOTION_DETECTOR_DEFAULT_CONFIG() {                          \
+    .pixel_threshold    = CONFIG_APP_MOTION_PIXEL_THRESHOLD,        \
+    .min_changed_blocks = CONFIG_APP_MOTION_MIN_BLOCKS,             \
+    .learn_shift        = CONFIG_APP_MOTION_LEARN_SHIFT,            \
+}
+
+/**
+ * @brief Result of comparing one frame with the background
+ */
+typedef struct {
+    uint16_t changed_blocks;        /**< Blocks above the threshold */
+    uint16_t total_blocks;          /**< Blocks compared */
+    uint32_t max_block_sad;         /**< Largest block difference */
+    bool motion;                    /**< changed_blocks reached min_changed_blocks, or no background yet */
+    bool reference;                 /**< First frame of this size; it became the background */
+} motion_result_t;
+
+/**
+ * @brief Motion detector statistics
+ */
+typedef struct {
+    uint32_t frames;                /**< Frames processed */
+    uint32_t confirmed;             /**< Frames with motion (including reference frames) */
+    uint32_t rejected;              /**< Frames without motion */
+    uint32_t errors;                /**< Frames without a luminance map (unsupported or corrupt JPEG) */
+    uint32_t avg_decode_us;         /**< Average luminance map extraction time */
+    uint32_t avg_detect_us;         /**< Average block difference and background update time */
+    motion_kernel_t kernel;         /**< Block difference kernel in use */
+} motion_detector_stats_t;
+
+/**
+ * @brief Create a motion detector
+ *
+ * Selects the block difference kernel. Image buffers are allocated for the
+ * first frame and again whenever the frame size changes.
+ *
+ * @param config Detector configuration
+ * @param[out] ret_detector Created detector
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t motion_detector_create(const motion_detector_config_t *config,
+                                 motion_detector_handle_t *ret_detector);
+
+/**
+ * @brief Free a motion detector and its buffers
+ */
+void motion_detector_delete(motion_detector_handle_t detector);
+
+/**
+ * @brief Forget the background; the next frame becomes the reference
+ */
+void motion_detector_reset(motion_detector_handle_t detector);
+
+/**
+ * @brief Compare a grayscale image with the background and update it
+ * @param detector Detector
+ * @param gray 8-bit luminance image
+ * @param width Image width
+ * @param height Image height
+ * @param stride Row stride of @p gray
+ * @param[out] result Comparison result
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the buffers cannot be allocated
+ */
+esp_err_t motion_detector_process_gray(motion_detector_handle_t detector, const uint8_t *gray,
+                                       uint16_t width, uint16_t height, size_t stride,
+                                       motion_result_t *result);
+
+/**
+ * @brief Process the 1/8 scale luminance map of a JPEG frame
+ * @param detector Detector
+ * @param frame JPEG frame
+ * @param[out] result Comparison result
+ * @return ESP_OK on success, a jpeg_dc_luma() error if the frame cannot be parsed
+ */
+esp_err_t motion_detector_process_jpeg(motion_detector_handle_t detector, const capture_frame_t *frame,
+                                       motion_result_t *result);
+
+/**
+ * @brief Capture pipeline filter: keep frames with motion
+ *
+ * Sets the frame's motion score to its changed block count. Frames without
+ * a luminance map (e.g. progressive JPEGs) are kept.
+ *
+ * @param ctx Detector handle
+ * @param frame Frame to check
+ * @return true to store the frame
+ */
+bool motion_detector_filter(void *ctx, capture_frame_t *frame);
+
+/**
+ * @brief Get a snapshot of the detector statistics
+ */
+void motion_detector_get_stats(motion_detector_handle_t detector, motion_detector_stats_t *stats);
+
+/**
+ * @brief Log the detector statistics
+ */
+void motion_detector_log_stats(motion_detector_handle_t detector);
+
+/**
+ * @brief Time the block difference of every available kernel and log the results
+ * @param width Grayscale image width
+ * @param height Grayscale image height
+ * @param iterations Frames per kernel
+ */
+void motion_detector_benchmark(uint16_t width, uint16_t height, uint32_t iterations);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,130 @@
+/**
+ * @file motion_kernel.c
+ * @brief Block-wise frame difference kernels implementation
+ */
+
+#include "motion_kernel.h"
+#include "sdkconfig.h"
+#include <string.h>
+
+#if CONFIG_IDF_TARGET_ESP32S3
+#define MOTION_HAVE_PIE 1
+
+/**
+ * @brief Block SAD on the PIE unit, see motion_kernel_pie.S
+ *
+ * Needs 16-byte aligned rows and a stride that is a multiple of 16.
+ */
+extern uint32_t motion_block_sad_pie(const uint8_t *a, const uint8_t *b, size_t stride, size_t rows,
+                                     const uint8_t *consts);
+
+/* Sign flip (a ^ 0x80 turns unsigned into signed order), +1 and -1 vectors */
+static const uint8_t s_pie_consts[48] __attribute__((aligned(16))) = {
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+static uint32_t motion_block_sad_pie_wrap(const uint8_t *a, const uint8_t *b, size_t stride, size_t rows)
+{
+    return motion_block_sad_pie(a, b, stride, rows, s_pie_consts);
+}
+#else
+#define MOTION_HAVE_PIE 0
+#endif
+
+typedef uint32_t (*motion_block_sad_fn)(const uint8_t *a, const uint8_t *b, size_t stride, size_t rows);
+
+static motion_block_sad_fn s_block_sad = motion_block_sad_scalar;
+static motion_kernel_t s_kernel = MOTION_KERNEL_SCALAR;
+
+uint32_t motion_block_sad_scalar(const uint8_t *a, const uint8_t *b, size_t stride, size_t rows)
+{
+    uint32_t sad = 0;
+    for (size_t y = 0; y < rows; y++, a += stride, b += stride) {
+        for (size_t x = 0; x < MOTION_BLOCK_SIZE; x++) {
+            int diff = a[x] - b[x];
+            sad += diff < 0 ? -diff : diff;
+        }
+    }
+    return sad;
+}
+
+bool motion_kernel_select(motion_kernel_t kernel)
+{
+    switch (kernel) {
+    case MOTION_KERNEL_SCALAR:
+        s_block_sad = motion_block_sad_scalar;
+        break;
+#if MOTION_HAVE_PIE
+    case MOTION_KERNEL_PIE:
+        s_block_sad = motion_block_sad_pie_wrap;
+        break;
+#endif
+    default:
+        return false;
+    }
+    s_kernel = kernel;
+    return true;
+}
+
+motion_kernel_t motion_kernel_active(void)
+{
+    return s_kernel;
+}
+
+const char *motion_kernel_name(motion_kernel_t kernel)
+{
+    return kernel == MOTION_KERNEL_PIE ? "pie" : "scalar";
+}
+
+motion_kernel_t motion_kernel_init(void)
+{
+    motion_kernel_select(MOTION_KERNEL_SCALAR);
+
+#if MOTION_HAVE_PIE
+    /* Two blocks side by side, covering the extremes and pseudo-random values */
+    enum { STRIDE = 2 * MOTION_BLOCK_SIZE, SIZE = STRIDE * MOTION_BLOCK_SIZE };
+    static uint8_t a[SIZE] __attribute__((aligned(MOTION_ALIGN)));
+    static uint8_t b[SIZE] __attribute__((aligned(MOTION_ALIGN)));
+    uint32_t seed = 0x2545F491;
+
+    for (size_t i = 0; i < SIZE; i++) {
+        seed = seed * 1664525 + 1013904223;
+        a[i] = (i % 7 == 0) ? 0 : (uint8_t)(seed >> 24);
+        b[i] = (i % 5 == 0) ? 255 : (uint8_t)(seed >> 16);
+    }
+
+    for (size_t x = 0; x < STRIDE; x += MOTION_BLOCK_SIZE) {
+        if (motion_block_sad_pie_wrap(a + x, b + x, STRIDE, MOTION_BLOCK_SIZE) !=
+            motion_block_sad_scalar(a + x, b + x, STRIDE, MOTION_BLOCK_SIZE)) {
+            return s_kernel;
+        }
+    }
+    motion_kernel_select(MOTION_KERNEL_PIE);
+#endif
+    return s_kernel;
+}
+
+void motion_block_diff(const uint8_t *cur, const uint8_t *bg, size_t stride,
+                       size_t blocks_x, size_t blocks_y, uint32_t *block_sad)
+{
+    for (size_t by = 0; by < blocks_y; by++) {
+        size_t row = by * MOTION_BLOCK_SIZE * stride;
+        for (size_t bx = 0; bx < blocks_x; bx++) {
+            size_t offset = row + bx * MOTION_BLOCK_SIZE;
+            *block_sad++ = s_block_sad(cur + offset, bg + offset, stride, MOTION_BLOCK_SIZE);
+        }
+    }
+}
+
+void motion_background_update(uint16_t *bg_acc, uint8_t *bg, const uint8_t *cur,
+                              size_t count, unsigned shift)
+{
+    for (size_t i = 0; i < count; i++) {
+        int32_t acc = bg_acc[i];
+        acc += (((int32_t)cur[i] << 8) - acc) >> shift;
+        bg_acc[i] = (uint16_t)acc;
+        bg[i] = (uint8_t)(acc >> 8);
+    }
+}
@@ -0,0 +1,101 @@
+/**
+ * @file motion_kernel.h
+ * @brief Block-wise frame difference kernels for motion detection
+ *
+ * Portable C with no ESP-IDF dependencies, so it also builds on a host. On
+ * the ESP32-S3 the block SAD runs on the PIE SIMD unit (16 pixels per
+ * instruction); motion_kernel_init() checks it against the scalar version
+ * and falls back to scalar on any mismatch.
+ *
+ * Images are 8-bit luminance with a row stride that is a multiple of
+ * MOTION_ALIGN and a start address aligned to MOTION_ALIGN. Blocks are
+ * MOTION_BLOCK_SIZE x MOTION_BLOCK_SIZE pixels.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MOTION_BLOCK_SIZE   16
+#define MOTION_ALIGN        16
+
+/** Round a width or height up to whole blocks */
+#define MOTION_PAD(x)       (((x) + MOTION_BLOCK_SIZE - 1) & ~(size_t)(MOTION_BLOCK_SIZE - 1))
+
+/**
+ * @brief Kernel implementations
+ */
+typedef enum {
+    MOTION_KERNEL_SCALAR,       /**< Portable C */
+    MOTION_KERNEL_PIE,          /**< ESP32-S3 PIE SIMD */
+} motion_kernel_t;
+
+/**
+ * @brief Sum of absolute differences of one block, portable C
+ * @param a First image, at the block's top-left pixel
+ * @param b Second image, at the block's top-left pixel
+ * @param stride Row stride of both images
+ * @param rows Rows in the block
+ * @return Sum of |a - b| over MOTION_BLOCK_SIZE x rows pixels
+ */
+uint32_t motion_block_sad_scalar(const uint8_t *a, const uint8_t *b, size_t stride, size_t rows);
+
+/**
+ * @brief Select the fastest kernel that matches the scalar results
+ * @return Kernel selected
+ */
+motion_kernel_t motion_kernel_init(void);
+
+/**
+ * @brief Kernel currently used by motion_block_diff()
+ */
+motion_kernel_t motion_kernel_active(void);
+
+/**
+ * @brief Force a kernel, e.g. to benchmark one against the other
+ * @param kernel Kernel to use
+ * @return true if the kernel is available on this target
+ */
+bool motion_kernel_select(motion_kernel_t kernel);
+
+/**
+ * @brief Name of a kernel for logs
+ */
+const char *motion_kernel_name(motion_kernel_t kernel);
+
+/**
+ * @brief SAD of every block of two images
+ * @param cur Current image
+ * @param bg Background image
+ * @param stride Row stride of both images, multiple of MOTION_ALIGN
+ * @param blocks_x Blocks per row
+ * @param blocks_y Block rows
+ * @param[out] block_sad blocks_x * blocks_y sums, row by row
+ */
+void motion_block_diff(const uint8_t *cur, const uint8_t *bg, size_t stride,
+                       size_t blocks_x, size_t blocks_y, uint32_t *block_sad);
+
+/**
+ * @brief Move a running-average background towards the current image
+ *
+ * bg_acc holds the background in 8.8 fixed point; bg receives its integer
+ * part for motion_block_diff().
+ *
+ * @param bg_acc Background accumulator
+ * @param bg Background image
+ * @param cur Current image
+ * @param count Pixels (including padding)
+ * @param shift The background moves by 1/2^shift of the difference
+ */
+void motion_background_update(uint16_t *bg_acc, uint8_t *bg, const uint8_t *cur,
+                              size_t count, unsigned shift);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,226 @@
+/**
+ * @file quality_controller.c
+ * @brief Closed-loop JPEG quality control towards a frame size and throughput budget
+ */
+
+#include "quality_controller.h"
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "quality_ctrl";
+
+/* Running averages move by 1/2^n of the difference per frame */
+#define QUALITY_SMOOTHING_SHIFT     2
+
+/* Frames further apart than this belong to different bursts and do not set the frame rate */
+#define QUALITY_BURST_GAP_US        1000000
+
+/* A smaller frame size is left only when the estimate at the best quality is below target / this */
+#define QUALITY_SIZE_UP_MARGIN      2
+
+struct quality_controller_t {
+    quality_controller_config_t config;
+    uint8_t quality;
+    uint8_t size_step;
+    uint8_t settle_left;
+    uint64_t size_quality;          /* Smoothed bytes x quality, 0 until the first sample */
+    uint64_t write_bytes_per_s;     /* Smoothed write throughput, 0 until measured */
+    uint32_t interval_us;           /* Smoothed frame interval within bursts, 0 until measured */
+    int64_t last_timestamp_us;
+    portMUX_TYPE lock;
+    quality_controller_stats_t stats;
+};
+
+static inline uint64_t quality_smooth(uint64_t average, uint64_t sample)
+{
+    if (average == 0) {
+        return sample;
+    }
+    return average + (int64_t)(sample - average) / (1 << QUALITY_SMOOTHING_SHIFT);
+}
+
+/**
+ * @brief Tightest byte target of the configured limits, 0 if there is none yet
+ */
+static uint32_t quality_target_bytes(const struct quality_controller_t *ctl)
+{
+    const quality_controller_config_t *config = &ctl->config;
+    uint64_t target = config->target_frame_bytes ? config->target_frame_bytes : UINT64_MAX;
+
+    if (ctl->interval_us != 0) {
+        if (config->budget_kb_per_s != 0) {
+            uint64_t budget = (uint64_t)config->budget_kb_per_s * 1024 * ctl->interval_us / 1000000;
+            target = budget < target ? budget : target;
+        }
+        if (config->write_headroom_pct != 0 && ctl->write_bytes_per_s != 0) {
+            uint64_t writable = ctl->write_bytes_per_s * config->write_headroom_pct / 100 *
+                                ctl->interval_us / 1000000;
+            target = writable < target ? writable : target;
+        }
+    }
+
+    if (target == UINT64_MAX) {
+        return 0;
+    }
+    return target > UINT32_MAX ? UINT32_MAX : (target ? (uint32_t)target : 1);
+}
+
+esp_err_t quality_controller_create(const quality_controller_config_t *config, uint8_t initial_quality,
+                                    quality_controller_handle_t *ret_controller)
+{
+    if (config == NULL || ret_controller == NULL || config->min_quality == 0 ||
+        config->min_quality > config->max_quality || config->max_quality > 63 ||
+        config->max_step == 0 || config->deadband_pct >= 100 || config->size_steps == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct quality_controller_t *ctl = calloc(1, sizeof(*ctl));
+    if (ctl == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ctl->config = *config;
+    ctl->quality = initial_quality < config->min_quality ? config->min_quality :
+                   initial_quality > config->max_quality ? config->max_quality : initial_quality;
+    /* The source may still be at the initial setting if it was clamped */
+    ctl->settle_left = (ctl->quality != initial_quality) ? config->settle_frames : 0;
+    portMUX_INITIALIZE(&ctl->lock);
+
+    *ret_controller = ctl;
+    return ESP_OK;
+}
+
+void quality_controller_delete(quality_controller_handle_t controller)
+{
+    free(controller);
+}
+
+bool quality_controller_update(quality_controller_handle_t ctl, const quality_sample_t *sample,
+                               quality_decision_t *decision)
+{
+    const quality_controller_config_t *config = &ctl->config;
+    bool ignored = false;
+    bool changed = false;
+    bool size_changed = false;
+
+    /* Same fields as the traces host/quality_replay.c reads */
+    ESP_LOGD(TAG, "trace,%lld,%u,%lu,%lu", (long long)sample->timestamp_us, ctl->quality,
+             (unsigned long)sample->bytes, (unsigned long)sample->write_us);
+
+    /* Throughput and frame rate do not depend on the settings */
+    if (sample->write_us != 0) {
+        ctl->write_bytes_per_s = quality_smooth(ctl->write_bytes_per_s,
+                                                (uint64_t)sample->bytes * 1000000 / sample->write_us);
+    }
+    int64_t interval = sample->timestamp_us - ctl->last_timestamp_us;
+    if (ctl->last_timestamp_us != 0 && interval > 0 && interval <= QUALITY_BURST_GAP_US) {
+        ctl->interval_us = (uint32_t)quality_smooth(ctl->interval_us, (uint64_t)interval);
+    }
+    ctl->last_timestamp_us = sample->timestamp_us;
+
+    uint32_t target = quality_target_bytes(ctl);
+    uint32_t estimate = 0;
+
+    if (ctl->settle_left > 0) {
+        /* Captured before the last change reached the sensor */
+        ctl->settle_left--;
+        ignored = true;
+    } else {
+        ctl->size_quality = quality_smooth(ctl->size_quality, (uint64_t)sample->bytes * ctl->quality);
+        estimate = (uint32_t)(ctl->size_quality / ctl->quality);
+    }
+
+    uint64_t high = (uint64_t)target * (100 + config->deadband_pct) / 100;
+    uint64_t low = (uint64_t)target * (100 - config->deadband_pct) / 100;
+
+    if (!ignored && target != 0 && (estimate > high || estimate < low)) {
+        uint8_t from_quality = ctl->quality;
+        uint8_t from_step = ctl->size_step;
+
+        /* Quality for which size x quality / quality meets the target */
+        uint64_t wanted = (ctl->size_quality + target - 1) / target;
+        int quality = wanted > 63 ? 63 : (int)wanted;
+        int lowest = (int)ctl->quality - config->max_step;
+        int highest = (int)ctl->quality + config->max_step;
+        quality = quality < lowest ? lowest : quality > highest ? highest : quality;
+        quality = quality < config->min_quality ? config->min_quality :
+                  quality > config->max_quality ? config->max_quality : quality;
+
+        /* Frame size changes only once quality has reached its limit */
+        if (estimate > high && ctl->quality == config->max_quality &&
+            ctl->size_step + 1 < config->size_steps) {
+            ctl->size_step++;
+            size_changed = true;
+        } else if (estimate < low && ctl->size_step > 0 && ctl->quality == config->min_quality &&
+                   ctl->size_quality / config->min_quality < target / QUALITY_SIZE_UP_MARGIN) {
+            ctl->size_step--;
+            size_changed = true;
+        } else {
+            ctl->quality = (uint8_t)quality;
+        }
+
+        changed = size_changed || ctl->quality != from_quality;
+        if (changed) {
+            ctl->settle_left = config->settle_frames;
+            if (size_changed) {
+                /* Size x quality of the new frame size is not known yet */
+                ctl->size_quality = 0;
+            }
+            ESP_LOGI(TAG, "quality %u -> %u, size step %u -> %u (frames %lu bytes, target %lu bytes)",
+                     from_quality, ctl->quality, from_step, ctl->size_step,
+                     (unsigned long)estimate, (unsigned long)target);
+        }
+    }
+
+    if (decision) {
+        decision->quality = ctl->quality;
+        decision->size_step = ctl->size_step;
+        decision->target_bytes = target;
+        decision->estimate_bytes = estimate;
+    }
+
+    portENTER_CRITICAL(&ctl->lock);
+    quality_controller_stats_t *stats = &ctl->stats;
+    stats->samples++;
+    stats->ignored += ignored ? 1 : 0;
+    stats->changes += changed ? 1 : 0;
+    stats->size_changes += size_changed ? 1 : 0;
+    stats->quality = ctl->quality;
+    stats->size_step = ctl->size_step;
+    stats->target_bytes = target;
+    if (!ignored) {
+        stats->avg_bytes = (uint32_t)quality_smooth(stats->avg_bytes, sample->bytes);
+    }
+    stats->write_kb_per_s = (uint32_t)(ctl->write_bytes_per_s / 1024);
+    stats->fps_x10 = ctl->interval_us ? 10000000 / ctl->interval_us : 0;
+    portEXIT_CRITICAL(&ctl->lock);
+
+    return changed;
+}
+
+void quality_controller_get_stats(quality_controller_handle_t controller, quality_controller_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&controller->lock);
+    *stats = controller->stats;
+    portEXIT_CRITICAL(&controller->lock);
+}
+
+void quality_controller_log_stats(quality_controller_handle_t controller)
+{
+    quality_controller_stats_t stats;
+    quality_controller_get_stats(controller, &stats);
+
+    ESP_LOGI(TAG, "quality %u, size step %u, frames %lu bytes (target %lu), write %lu KB/s, "
+             "%lu.%lu fps, %lu changes (%lu frame size) in %lu frames",
+             stats.quality, stats.size_step, (unsigned long)stats.avg_bytes,
+             (unsigned long)stats.target_bytes, (unsigned long)stats.write_kb_per_s,
+             (unsigned long)(stats.fps_x10 / 10), (unsigned long)(stats.fps_x10 % 10),
+             (unsigned long)stats.changes, (unsigned long)stats.size_changes,
+             (unsigned long)stats.samples);
+}
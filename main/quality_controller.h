@@ -0,0 +1,172 @@
+/**
+ * @file quality_controller.h
+ * @brief Closed-loop JPEG quality control towards a frame size and throughput budget
+ *
+ * Fed with the size and write time of each stored frame, the controller
+ * picks the JPEG quality (and optionally a smaller frame size) for later
+ * frames so that frames stay near a byte target. The target is the
+ * tightest of a fixed bytes-per-frame limit, a sustained KB/s budget and a
+ * share of the write throughput measured on the card, the last two divided
+ * by the recent frame rate.
+ *
+ * The model is that JPEG size is inversely proportional to the quality
+ * setting (0-63, lower is better, as in esp32-camera); a running estimate
+ * of size x quality is refreshed every frame, so the model only has to
+ * hold locally. Every change is logged. The controller has no hardware
+ * dependencies, so a recorded size trace can be replayed through it on a
+ * host (host/quality_replay.c).
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct quality_controller_t *quality_controller_handle_t;
+
+#ifndef CONFIG_APP_QUALITY_TARGET_KB
+#define CONFIG_APP_QUALITY_TARGET_KB        200
+#endif
+#ifndef CONFIG_APP_QUALITY_BUDGET_KBPS
+#define CONFIG_APP_QUALITY_BUDGET_KBPS      0
+#endif
+#ifndef CONFIG_APP_QUALITY_WRITE_HEADROOM
+#define CONFIG_APP_QUALITY_WRITE_HEADROOM   80
+#endif
+#ifndef CONFIG_APP_QUALITY_MIN
+#define CONFIG_APP_QUALITY_MIN              4
+#endif
+#ifndef CONFIG_APP_QUALITY_MAX
+#define CONFIG_APP_QUALITY_MAX              30
+#endif
+#ifndef CONFIG_APP_QUALITY_MAX_STEP
+#define CONFIG_APP_QUALITY_MAX_STEP         4
+#endif
+#ifndef CONFIG_APP_QUALITY_DEADBAND
+#define CONFIG_APP_QUALITY_DEADBAND         10
+#endif
+#ifndef CONFIG_APP_QUALITY_SETTLE_FRAMES
+#define CONFIG_APP_QUALITY_SETTLE_FRAMES    2
+#endif
+
+/** Frame sizes the controller may step down through when frame size adaptation is on */
+#ifdef CONFIG_APP_QUALITY_ADAPT_FRAMESIZE
+#define QUALITY_CONTROLLER_SIZE_STEPS       4
+#else
+#define QUALITY_CONTROLLER_SIZE_STEPS       1
+#endif
+
+/**
+ * @brief Quality controller configuration
+ */
+typedef struct {
+    uint32_t target_frame_bytes;    /**< Bytes per frame to hold, 0 for no per-frame target */
+    uint32_t budget_kb_per_s;       /**< Sustained KB/s frames may produce, 0 for no budget */
+    uint8_t write_headroom_pct;     /**< Share of the measured write throughput frames may use, 0 to ignore it */
+    uint8_t min_quality;            /**< Best (lowest) quality setting allowed */
+    uint8_t max_quality;            /**< Worst (highest) quality setting allowed */
+    uint8_t max_step;               /**< Largest quality change per decision */
+    uint8_t deadband_pct;           /**< No change while the estimate is within this of the target */
+    uint8_t settle_frames;          /**< Frames ignored after a change (still in flight with the old setting) */
+    uint8_t size_steps;             /**< Frame sizes available, 1 for quality only; step 0 is the full size */
+} quality_controller_config_t;
+
+/**
+ * @brief Default quality controller configuration from Kconfig
+ */
+#define QUALITY_CONTROLLER_DEFAULT_CONFIG() {                               \
+    .target_frame_bytes = CONFIG_APP_QUALITY_TARGET_KB * 1024,              \
+    .budget_kb_per_s    = CONFIG_APP_QUALITY_BUDGET_KBPS,                   \
+    .write_headroom_pct = CONFIG_APP_QUALITY_WRITE_HEADROOM,                \
+    .min_quality        = CONFIG_APP_QUALITY_MIN,                           \
+    .max_quality        = CONFIG_APP_QUALITY_MAX,                           \
+    .max_step           = CONFIG_APP_QUALITY_MAX_STEP,                      \
+    .deadband_pct       = CONFIG_APP_QUALITY_DEADBAND,                      \
+    .settle_frames      = CONFIG_APP_QUALITY_SETTLE_FRAMES,                 \
+    .size_steps         = QUALITY_CONTROLLER_SIZE_STEPS,                    \
+}
+
+/**
+ * @brief One stored frame
+ */
+typedef struct {
+    uint32_t bytes;                 /**< JPEG size */
+    uint32_t write_us;              /**< Time to store it, 0 if unknown */
+    int64_t timestamp_us;           /**< Capture time */
+} quality_sample_t;
+
+/**
+ * @brief Settings for the next frames
+ */
+typedef struct {
+    uint8_t quality;                /**< JPEG quality setting */
+    uint8_t size_step;              /**< Frame size step, 0 = full size */
+    uint32_t target_bytes;          /**< Byte target the decision was made for */
+    uint32_t estimate_bytes;        /**< Expected frame size at the previous settings */
+} quality_decision_t;
+
+/**
+ * @brief Quality controller statistics
+ */
+typedef struct {
+    uint32_t samples;               /**< Frames fed to the controller */
+    uint32_t ignored;               /**< Frames skipped while a change settled */
+    uint32_t changes;               /**< Decisions that changed a setting */
+    uint32_t size_changes;          /**< Decisions that changed the frame size */
+    uint8_t quality;                /**< Current quality setting */
+    uint8_t size_step;              /**< Current frame size step */
+    uint32_t target_bytes;          /**< Current byte target */
+    uint32_t avg_bytes;             /**< Smoothed frame size */
+    uint32_t write_kb_per_s;        /**< Smoothed write throughput, 0 if unknown */
+    uint32_t fps_x10;               /**< Smoothed frame rate within bursts, x10 */
+} quality_controller_stats_t;
+
+/**
+ * @brief Create a controller
+ * @param config Controller configuration
+ * @param initial_quality Quality setting the source starts with
+ * @param[out] ret_controller Created controller
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an inconsistent configuration,
+ *         ESP_ERR_NO_MEM if it cannot be allocated
+ */
+esp_err_t quality_controller_create(const quality_controller_config_t *config, uint8_t initial_quality,
+                                    quality_controller_handle_t *ret_controller);
+
+/**
+ * @brief Free a controller
+ */
+void quality_controller_delete(quality_controller_handle_t controller);
+
+/**
+ * @brief Feed one stored frame and decide the settings for later frames
+ *
+ * Call from one task, e.g. the pipeline sink; statistics can be read from
+ * any task.
+ *
+ * @param controller Controller
+ * @param sample Stored frame
+ * @param[out] decision Current settings, whether changed or not
+ * @return true if the quality or frame size changed and must be applied to the source
+ */
+bool quality_controller_update(quality_controller_handle_t controller, const quality_sample_t *sample,
+                               quality_decision_t *decision);
+
+/**
+ * @brief Get a snapshot of the controller statistics
+ */
+void quality_controller_get_stats(quality_controller_handle_t controller, quality_controller_stats_t *stats);
+
+/**
+ * @brief Log the controller statistics
+ */
+void quality_controller_log_stats(quality_controller_handle_t controller);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,413 @@
+/**
+ * @file retention.c
+ * @brief Retention manager implementation
+ */
+
+#include "retention.h"
+#include "capture_index.h"
+#include "segment_store.h"
+#include "file_operations.h"
+#include "thumbnail.h"
+#include "app_config.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_vfs_fat.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RETENTION_TASK_STACK_SIZE 4096
+
+/* A write that ended this recently leaves the rest of the gap before the next one */
+#define RETENTION_WRITE_GAP_US 5000
+
+static const char *TAG = "retention";
+
+static retention_config_t s_config;
+static TaskHandle_t s_task = NULL;
+static SemaphoreHandle_t s_exit_sem = NULL;
+static volatile bool s_running = false;
+
+/* Capture numbers that may be deleted in the current pass, [s_oldest, s_next) */
+static uint32_t s_oldest = 0;
+static uint32_t s_next = 0;
+
+/* Cached space, updated by writers between measurements */
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint64_t s_total_bytes = 0;
+static uint64_t s_free_bytes = 0;
+static uint64_t s_high_free = 0;        /* Free space at the high watermark */
+static uint64_t s_low_free = 0;         /* Free space at the low watermark */
+static retention_stats_t s_stats;
+
+/* Capture writes, updated by the pipeline sink */
+static uint32_t s_writes = 0;
+static int64_t s_last_write_us = 0;
+static bool s_waiting = false;          /* Retention waits for a write to end */
+
+static BaseType_t retention_core(int core)
+{
+    return (core >= 0 && core < portNUM_PROCESSORS) ? core : tskNO_AFFINITY;
+}
+
+static uint64_t retention_free(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    uint64_t free_bytes = s_free_bytes;
+    portEXIT_CRITICAL(&s_lock);
+    return free_bytes;
+}
+
+/**
+ * @brief Measure free space with f_getfree()
+ */
+static esp_err_t retention_refresh(void)
+{
+    uint64_t total_bytes = 0, free_bytes = 0;
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = esp_vfs_fat_info(s_config.base_path, &total_bytes, &free_bytes);
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to read free space: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    s_total_bytes = total_bytes;
+    s_free_bytes = free_bytes;
+    s_high_free = total_bytes / 100 * (100 - s_config.high_watermark_pct);
+    s_low_free = total_bytes / 100 * (100 - s_config.low_watermark_pct);
+    s_stats.refreshes++;
+    if (elapsed > s_stats.max_refresh_us) {
+        s_stats.max_refresh_us = elapsed;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return ESP_OK;
+}
+
+/**
+ * @brief Wait until a deletion may start
+ *
+ * Waits for idle_ms without capture writes. If the writes do not leave such
+ * a gap within idle_ms, the deletion starts when the next write ends.
+ *
+ * @return false if retention is stopping
+ */
+static bool retention_wait_writes(void)
+{
+    const int64_t idle_us = (int64_t)s_config.idle_ms * 1000;
+    int64_t start = esp_timer_get_time();
+    bool deferred = false;
+
+    while (s_running) {
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&s_lock);
+        uint32_t writes = s_writes;
+        int64_t quiet_us = now - s_last_write_us;
+        bool written = s_last_write_us != 0;
+        s_waiting = writes > 0 || (written && quiet_us < idle_us);
+        portEXIT_CRITICAL(&s_lock);
+
+        if (writes == 0 && (!written || quiet_us >= idle_us ||
+                            (now - start >= idle_us && quiet_us < RETENTION_WRITE_GAP_US))) {
+            break;
+        }
+        deferred = true;
+
+        /* Woken by retention_write_end() */
+        int64_t wait_us = writes > 0 ? idle_us : idle_us - quiet_us;
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_us / 1000) + 1);
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    s_waiting = false;
+    if (deferred) {
+        s_stats.deferrals++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return s_running;
+}
+
+/**
+ * @brief Delete the oldest capture
+ * @param[out] reclaimed Size of the deleted file
+ * @return ESP_OK if a file was deleted, ESP_ERR_NOT_FOUND if nothing can be deleted
+ */
+static esp_err_t retention_delete_oldest(uint64_t *reclaimed)
+{
+    const char *format = s_config.segments ? SEGMENT_NAME_FORMAT : PHOTO_NAME_FORMAT;
+
+    /* The segment being appended to is never deleted */
+    uint32_t limit = s_next;
+    if (s_config.segments) {
+        segment_store_stats_t segments;
+        segment_store_get_stats(&segments);
+        if (segments.active_segment < limit) {
+            limit = segments.active_segment;
+        }
+    }
+
+    char path[EXAMPLE_MAX_CHAR_SIZE];
+    struct stat st;
+    for (; s_oldest < limit; s_oldest++) {
+        snprintf(path, sizeof(path), format, s_config.base_path, (unsigned long)s_oldest);
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+
+        /* Hide the capture from the index before it disappears */
+        if (capture_index_is_open()) {
+            capture_index_discard_before(s_oldest + 1);
+        }
+        int64_t start = esp_timer_get_time();
+        if (unlink(path) != 0) {
+            ESP_LOGW(TAG, "Failed to delete %s", path);
+            portENTER_CRITICAL(&s_lock);
+            s_stats.delete_errors++;
+            portEXIT_CRITICAL(&s_lock);
+            return ESP_FAIL;
+        }
+        uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+        portENTER_CRITICAL(&s_lock);
+        if (elapsed > s_stats.max_delete_us) {
+            s_stats.max_delete_us = elapsed;
+        }
+        portEXIT_CRITICAL(&s_lock);
+
+        /* Thumbnails go with their capture */
+        *reclaimed = st.st_size + thumbnail_remove(s_oldest);
+        s_oldest++;
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * @brief Delete the oldest captures in batches until below the low watermark
+ */
+static void retention_cleanup(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_stats.passes++;
+    portEXIT_CRITICAL(&s_lock);
+    ESP_LOGI(TAG, "Card usage above %u%%, deleting oldest captures", s_config.high_watermark_pct);
+
+    /* One directory scan per pass; captures written meanwhile are newer anyway */
+    file_index_range(s_config.base_path,
+                     s_config.segments ? SEGMENT_NAME_PREFIX : PHOTO_NAME_PREFIX,
+                     s_config.segments ? SEGMENT_NAME_EXT : PHOTO_NAME_EXT,
+                     &s_oldest, &s_next);
+
+    esp_err_t ret = ESP_OK;
+    while (s_running && ret == ESP_OK && retention_free() < s_low_free) {
+        int64_t start = esp_timer_get_time();
+        uint64_t batch_bytes = 0;
+        uint32_t batch_files = 0;
+
+        while (batch_files < s_config.batch_files && retention_free() < s_low_free) {
+            if (!retention_wait_writes()) {
+                break;
+            }
+            uint64_t reclaimed = 0;
+            ret = retention_delete_oldest(&reclaimed);
+            if (ret != ESP_OK) {
+                break;
+            }
+            batch_files++;
+            batch_bytes += reclaimed;
+
+            portENTER_CRITICAL(&s_lock);
+            s_free_bytes += reclaimed;
+            portEXIT_CRITICAL(&s_lock);
+        }
+
+        uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+        portENTER_CRITICAL(&s_lock);
+        s_stats.batches++;
+        s_stats.files_deleted += batch_files;
+        s_stats.bytes_reclaimed += batch_bytes;
+        s_stats.delete_time_us += elapsed;
+        if (elapsed > s_stats.max_batch_us) {
+            s_stats.max_batch_us = elapsed;
+        }
+        portEXIT_CRITICAL(&s_lock);
+
+        /* Let the capture path have the filesystem between batches */
+        vTaskDelay(1);
+    }
+
+    if (ret == ESP_ERR_NOT_FOUND) {
+        ESP_LOGW(TAG, "No captures left to delete, card usage stays above %u%%",
+                 s_config.low_watermark_pct);
+    }
+
+    /* Replace the estimate with the real value after deleting */
+    retention_refresh();
+}
+
+static void retention_task(void *arg)
+{
+    int64_t last_refresh = esp_timer_get_time();
+
+    while (s_running) {
+        /* Woken early when a write crosses the high watermark */
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(s_config.check_interval_ms));
+        if (!s_running) {
+            break;
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (now - last_refresh >= (int64_t)s_config.refresh_interval_ms * 1000) {
+            retention_refresh();
+            last_refresh = now;
+        }
+
+        if (retention_free() <= s_high_free) {
+            retention_refresh();
+            last_refresh = esp_timer_get_time();
+            if (retention_free() <= s_high_free) {
+                retention_cleanup();
+            }
+        }
+    }
+
+    xSemaphoreGive(s_exit_sem);
+    vTaskDelete(NULL);
+}
+
+esp_err_t retention_start(const retention_config_t *config)
+{
+    if (config == NULL || config->base_path == NULL || config->batch_files == 0 ||
+        config->high_watermark_pct > 100 || config->low_watermark_pct >= config->high_watermark_pct) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    s_config = *config;
+    memset(&s_stats, 0, sizeof(s_stats));
+
+    esp_err_t ret = retention_refresh();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    s_exit_sem = xSemaphoreCreateBinary();
+    if (s_exit_sem == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_running = true;
+    if (xTaskCreatePinnedToCore(retention_task, "retention", RETENTION_TASK_STACK_SIZE, NULL,
+                                s_config.priority, &s_task, retention_core(s_config.core)) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create retention task");
+        s_running = false;
+        s_task = NULL;
+        vSemaphoreDelete(s_exit_sem);
+        s_exit_sem = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Check right away in case the card is already above the watermark */
+    xTaskNotifyGive(s_task);
+
+    ESP_LOGI(TAG, "Retention started: %llu of %llu MB free, watermarks %u%%/%u%%",
+             (unsigned long long)(s_free_bytes >> 20), (unsigned long long)(s_total_bytes >> 20),
+             s_config.high_watermark_pct, s_config.low_watermark_pct);
+    return ESP_OK;
+}
+
+void retention_stop(void)
+{
+    if (!s_running) {
+        return;
+    }
+
+    s_running = false;
+    xTaskNotifyGive(s_task);
+    xSemaphoreTake(s_exit_sem, portMAX_DELAY);
+    s_task = NULL;
+    vSemaphoreDelete(s_exit_sem);
+    s_exit_sem = NULL;
+}
+
+void retention_note_written(uint64_t bytes)
+{
+    portENTER_CRITICAL(&s_lock);
+    bool was_above = s_free_bytes > s_high_free;
+    s_free_bytes = (bytes < s_free_bytes) ? s_free_bytes - bytes : 0;
+    bool crossed = was_above && s_free_bytes <= s_high_free;
+    portEXIT_CRITICAL(&s_lock);
+
+    if (crossed && s_task) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+void retention_write_begin(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_writes++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void retention_write_end(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_writes > 0) {
+        s_writes--;
+    }
+    s_last_write_us = now;
+    bool waiting = s_waiting;
+    portEXIT_CRITICAL(&s_lock);
+
+    if (waiting && s_task) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+void retention_get_space(uint64_t *total_bytes, uint64_t *free_bytes)
+{
+    portENTER_CRITICAL(&s_lock);
+    if (total_bytes) {
+        *total_bytes = s_total_bytes;
+    }
+    if (free_bytes) {
+        *free_bytes = s_free_bytes;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void retention_get_stats(retention_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&s_lock);
+    *stats = s_stats;
+    stats->total_bytes = s_total_bytes;
+    stats->free_bytes = s_free_bytes;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void retention_log_stats(void)
+{
+    retention_stats_t stats;
+    retention_get_stats(&stats);
+
+    ESP_LOGI(TAG, "free %llu/%llu MB, passes %lu, deleted %lu files (%llu MB) in %lu batches, "
+             "delete time %llu ms (max batch %lu us, max file %lu us), %lu deferred for writes, errors %lu",
+             (unsigned long long)(stats.free_bytes >> 20), (unsigned long long)(stats.total_bytes >> 20),
+             (unsigned long)stats.passes, (unsigned long)stats.files_deleted,
+             (unsigned long long)(stats.bytes_reclaimed >> 20), (unsigned long)stats.batches,
+             (unsigned long long)(stats.delete_time_us / 1000), (unsigned long)stats.max_batch_us,
+             (unsigned long)stats.max_delete_us, (unsigned long)stats.deferrals, (unsigned long)stats.delete_errors);
+}
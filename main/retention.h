@@ -0,0 +1,164 @@
+/**
+ * @file retention.h
+ * @brief Retention manager that keeps free space on the SD card
+ *
+ * Free space is measured with f_getfree() only by the retention task and
+ * kept up to date in between from the bytes the capture path reports, so
+ * writers never query the filesystem. When usage reaches the high
+ * watermark, a low-priority task deletes the oldest captures in small
+ * batches until usage drops below the low watermark. The active segment is
+ * never deleted; thumbnails (thumbnail.h) are deleted with their capture.
+ *
+ * Deleting a file frees its FAT chain under the volume lock, which a 64 MB
+ * segment holds for a while, so deletions never start during a capture
+ * write. They wait for the idle time without writes; when captures follow
+ * each other more closely than that, a deletion starts right after a write
+ * ends, one file per gap between writes.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Retention configuration
+ */
+typedef struct {
+    const char *base_path;          /**< Directory holding the captures */
+    bool segments;                  /**< Captures are segment files (true) or JPEG files (false) */
+    uint8_t high_watermark_pct;     /**< Start deleting at this card usage */
+    uint8_t low_watermark_pct;      /**< Stop deleting below this card usage */
+    uint32_t batch_files;           /**< Files deleted before yielding to the capture path */
+    uint32_t idle_ms;               /**< Time without capture writes wanted before a deletion */
+    uint32_t check_interval_ms;     /**< Period of the usage check */
+    uint32_t refresh_interval_ms;   /**< Period of the free space measurement */
+    int core;                       /**< Core of the retention task, -1 for no affinity */
+    int priority;                   /**< Priority of the retention task */
+} retention_config_t;
+
+#ifndef CONFIG_APP_RETENTION_HIGH_WATERMARK
+#define CONFIG_APP_RETENTION_HIGH_WATERMARK     90
+#endif
+#ifndef CONFIG_APP_RETENTION_LOW_WATERMARK
+#define CONFIG_APP_RETENTION_LOW_WATERMARK      80
+#endif
+#ifndef CONFIG_APP_RETENTION_BATCH_FILES
+#define CONFIG_APP_RETENTION_BATCH_FILES        8
+#endif
+#ifndef CONFIG_APP_RETENTION_IDLE_MS
+#define CONFIG_APP_RETENTION_IDLE_MS            500
+#endif
+#ifndef CONFIG_APP_RETENTION_CHECK_INTERVAL_MS
+#define CONFIG_APP_RETENTION_CHECK_INTERVAL_MS  5000
+#endif
+#ifndef CONFIG_APP_RETENTION_REFRESH_INTERVAL_S
+#define CONFIG_APP_RETENTION_REFRESH_INTERVAL_S 60
+#endif
+#ifndef CONFIG_APP_RETENTION_PRIORITY
+#define CONFIG_APP_RETENTION_PRIORITY           1
+#endif
+
+#if CONFIG_APP_STORAGE_SEGMENTS
+#define RETENTION_SEGMENTS_DEFAULT true
+#else
+#define RETENTION_SEGMENTS_DEFAULT false
+#endif
+
+/**
+ * @brief Default retention configuration from Kconfig
+ */
+#define RETENTION_DEFAULT_CONFIG(path) {                                        \
+    .base_path           = (path),                                              \
+    .segments            = RETENTION_SEGMENTS_DEFAULT,                          \
+    .high_watermark_pct  = CONFIG_APP_RETENTION_HIGH_WATERMARK,                 \
+    .low_watermark_pct   = CONFIG_APP_RETENTION_LOW_WATERMARK,                  \
+    .batch_files         = CONFIG_APP_RETENTION_BATCH_FILES,                    \
+    .idle_ms             = CONFIG_APP_RETENTION_IDLE_MS,                        \
+    .check_interval_ms   = CONFIG_APP_RETENTION_CHECK_INTERVAL_MS,              \
+    .refresh_interval_ms = CONFIG_APP_RETENTION_REFRESH_INTERVAL_S * 1000,      \
+    .core                = -1,                                                  \
+    .priority            = CONFIG_APP_RETENTION_PRIORITY,                       \
+}
+
+/**
+ * @brief Retention statistics
+ */
+typedef struct {
+    uint64_t total_bytes;           /**< Card capacity */
+    uint64_t free_bytes;            /**< Estimated free space */
+    uint32_t refreshes;             /**< Free space measurements */
+    uint32_t max_refresh_us;        /**< Slowest free space measurement */
+    uint32_t passes;                /**< Cleanup passes started at the high watermark */
+    uint32_t batches;               /**< Deletion batches */
+    uint32_t files_deleted;         /**< Captures deleted */
+    uint64_t bytes_reclaimed;       /**< Size of the deleted captures */
+    uint64_t delete_time_us;        /**< Total time spent deleting */
+    uint32_t max_batch_us;          /**< Slowest deletion batch */
+    uint32_t max_delete_us;         /**< Slowest single deletion, the longest a write can wait for one */
+    uint32_t deferrals;             /**< Deletions held back for capture writes */
+    uint32_t delete_errors;         /**< Failed deletions */
+} retention_stats_t;
+
+/**
+ * @brief Measure free space and start the retention task
+ * @param config Retention configuration
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t retention_start(const retention_config_t *config);
+
+/**
+ * @brief Stop the retention task, waiting for the current batch to finish
+ */
+void retention_stop(void);
+
+/**
+ * @brief Account for bytes written to the card
+ *
+ * Cheap enough for the capture path: updates the cached free space and wakes
+ * the retention task when the high watermark is crossed.
+ *
+ * @param bytes Bytes written
+ */
+void retention_note_written(uint64_t bytes);
+
+/**
+ * @brief Tell retention a capture write is starting; no deletion starts until retention_write_end()
+ *
+ * Called from the pipeline sink. Cheap, never blocks.
+ */
+void retention_write_begin(void);
+
+/**
+ * @brief Tell retention a capture write has finished
+ */
+void retention_write_end(void);
+
+/**
+ * @brief Cached card capacity and free space
+ * @param[out] total_bytes Card capacity (may be NULL)
+ * @param[out] free_bytes Estimated free space (may be NULL)
+ */
+void retention_get_space(uint64_t *total_bytes, uint64_t *free_bytes);
+
+/**
+ * @brief Get a snapshot of the retention statistics
+ * @param[out] stats Output statistics
+ */
+void retention_get_stats(retention_stats_t *stats);
+
+/**
+ * @brief Log the retention statistics
+ */
+void retention_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,833 @@
+/**
+ * @file scrub.c
+ * @brief Background read-back verification implementation
+ */
+
+#include "scrub.h"
+#include "segment_store.h"
+#include "sector_log.h"
+#include "app_config.h"
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define SCRUB_TASK_STACK_SIZE 4096
+
+/* Leading bytes of a capture kept for the marker segment check */
+#define SCRUB_HEAD_SIZE 2048
+
+/* Poll interval while a capture write is in progress */
+#define SCRUB_WRITE_POLL_US 10000
+
+/* Sector log records closer than this ahead of the writer are left for a later pass (8 MB) */
+#define SCRUB_LOG_GUARD_SECTORS 16384
+
+#define SCRUB_SECTOR_SIZE 512
+
+static const char *TAG = "scrub";
+
+/**
+ * @brief Outcome of checking one capture
+ */
+typedef enum {
+    SCRUB_RESULT_OK,
+    SCRUB_RESULT_CRC,           /* Data does not match the stored CRC */
+    SCRUB_RESULT_JPEG,          /* Not a complete JPEG */
+    SCRUB_RESULT_READ,          /* The card failed the read */
+    SCRUB_RESULT_GONE,          /* Deleted or overwritten while being read */
+    SCRUB_RESULT_STOPPED,
+} scrub_result_t;
+
+/**
+ * @brief Running check of the capture being read
+ */
+typedef struct {
+    uint32_t crc;
+    size_t length;
+    uint8_t head[SCRUB_HEAD_SIZE];
+    size_t head_len;
+    uint8_t tail[2];
+} scrub_check_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t offset;
+} scrub_bad_t;
+
+static scrub_config_t s_config;
+static TaskHandle_t s_task = NULL;
+static SemaphoreHandle_t s_exit_sem = NULL;
+static volatile bool s_running = false;
+static uint8_t *s_chunk = NULL;
+static scrub_check_t s_check;
+static int64_t s_next_read_us = 0;      /* Earliest next read under the rate cap */
+
+/* Known bad captures, logged once */
+static scrub_bad_t s_bad[SCRUB_MAX_BAD];
+static size_t s_bad_count = 0;
+
+/* Capture writes, updated by the pipeline sink */
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_writes = 0;
+static int64_t s_last_write_us = 0;
+
+static scrub_stats_t s_stats;
+static uint64_t s_read_time_us = 0;
+static int64_t s_start_us = 0;
+
+static BaseType_t scrub_core(int core)
+{
+    return (core >= 0 && core < portNUM_PROCESSORS) ? core : tskNO_AFFINITY;
+}
+
+/**
+ * @brief Sleep, woken early by scrub_stop()
+ */
+static void scrub_sleep_us(int64_t us)
+{
+    const int64_t tick_us = (int64_t)portTICK_PERIOD_MS * 1000;
+    TickType_t ticks = (TickType_t)((us + tick_us - 1) / tick_us);
+    ulTaskNotifyTake(pdTRUE, ticks > 0 ? ticks : 1);
+}
+
+/**
+ * @brief Wait until a read may start: no capture write for the idle time, within the rate cap
+ * @return false if the scrub is stopping
+ */
+static bool scrub_wait(void)
+{
+    const int64_t idle_us = (int64_t)s_config.idle_ms * 1000;
+    bool deferred = false;
+
+    while (s_running) {
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&s_lock);
+        uint32_t writes = s_writes;
+        int64_t quiet_us = now - s_last_write_us;
+        portEXIT_CRITICAL(&s_lock);
+
+        int64_t wait_us;
+        if (writes > 0) {
+            wait_us = SCRUB_WRITE_POLL_US;
+            deferred = true;
+        } else if (s_last_write_us != 0 && quiet_us < idle_us) {
+            wait_us = idle_us - quiet_us;
+            deferred = true;
+        } else if (now < s_next_read_us) {
+            wait_us = s_next_read_us - now;
+        } else {
+            break;
+        }
+        scrub_sleep_us(wait_us);
+    }
+
+    if (deferred) {
+        portENTER_CRITICAL(&s_lock);
+        s_stats.deferrals++;
+        portEXIT_CRITICAL(&s_lock);
+    }
+    return s_running;
+}
+
+/**
+ * @brief Account for a read: statistics and the next slot under the rate cap
+ */
+static void scrub_account(size_t bytes, int64_t start)
+{
+    int64_t now = esp_timer_get_time();
+    if (s_config.rate_kbps > 0) {
+        int64_t base = s_next_read_us > now ? s_next_read_us : now;
+        s_next_read_us = base + (int64_t)bytes * 1000000 / ((int64_t)s_config.rate_kbps * 1024);
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    s_stats.bytes += bytes;
+    s_read_time_us += (uint64_t)(now - start);
+    portEXIT_CRITICAL(&s_lock);
+}
+
+/**
+ * @brief Read from a file once reads are allowed
+ * @return ESP_OK, ESP_ERR_INVALID_STATE when stopping, ESP_FAIL on a short or failed read
+ */
+static esp_err_t scrub_read_file(int fd, void *buf, size_t len)
+{
+    if (!scrub_wait()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    int64_t start = esp_timer_get_time();
+    ssize_t done = read(fd, buf, len);
+    scrub_account(done > 0 ? (size_t)done : 0, start);
+    return done == (ssize_t)len ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Read sector log region sectors into the chunk buffer once reads are allowed
+ */
+static esp_err_t scrub_read_sectors(uint32_t start_sector, uint32_t region_start, uint32_t count)
+{
+    if (!scrub_wait()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = sdmmc_read_sectors(s_config.card, s_chunk, region_start + start_sector, count);
+    scrub_account(ret == ESP_OK ? (size_t)count * SCRUB_SECTOR_SIZE : 0, start);
+    return ret;
+}
+
+static void scrub_check_begin(void)
+{
+    s_check.crc = 0;
+    s_check.length = 0;
+    s_check.head_len = 0;
+    s_check.tail[0] = 0;
+    s_check.tail[1] = 0;
+}
+
+static void scrub_check_feed(const uint8_t *data, size_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    s_check.crc = esp_rom_crc32_le(s_check.crc, data, (uint32_t)len);
+    if (s_check.head_len < SCRUB_HEAD_SIZE) {
+        size_t n = SCRUB_HEAD_SIZE - s_check.head_len;
+        n = n < len ? n : len;
+        memcpy(s_check.head + s_check.head_len, data, n);
+        s_check.head_len += n;
+    }
+    if (len >= 2) {
+        s_check.tail[0] = data[len - 2];
+        s_check.tail[1] = data[len - 1];
+    } else {
+        s_check.tail[0] = s_check.tail[1];
+        s_check.tail[1] = data[0];
+    }
+    s_check.length += len;
+}
+
+/**
+ * @brief Check the JPEG structure: SOI, marker segments up to SOS with a frame header, EOI last
+ *
+ * Headers longer than the kept leading bytes are checked as far as they go.
+ */
+static bool scrub_check_jpeg(void)
+{
+    const uint8_t *p = s_check.head;
+    size_t len = s_check.head_len;
+    if (s_check.length < 4 || p[0] != 0xFF || p[1] != 0xD8 ||
+        s_check.tail[0] != 0xFF || s_check.tail[1] != 0xD9) {
+        return false;
+    }
+
+    bool frame_header = false;
+    size_t pos = 2;
+    while (pos + 4 <= len) {
+        if (p[pos] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = p[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        if (marker == 0xDA) {
+            return frame_header;
+        }
+        /* Standalone markers and a second SOI or EOI do not belong in the header */
+        if (marker == 0x00 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD9)) {
+            return false;
+        }
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            frame_header = true;
+        }
+        size_t segment = (size_t)p[pos + 2] << 8 | p[pos + 3];
+        if (segment < 2 || pos + 2 + segment > s_check.length) {
+            return false;
+        }
+        pos += 2 + segment;
+    }
+    return true;
+}
+
+/**
+ * @brief Classify a fully read capture
+ */
+static scrub_result_t scrub_check_end(bool has_crc, uint32_t crc)
+{
+    if (has_crc && s_check.crc != crc) {
+        return SCRUB_RESULT_CRC;
+    }
+    return scrub_check_jpeg() ? SCRUB_RESULT_OK : SCRUB_RESULT_JPEG;
+}
+
+/**
+ * @brief Append a bad capture to SCRUB.LOG, once
+ */
+static void scrub_report(const char *name, uint32_t id, uint32_t offset, const char *reason)
+{
+    for (size_t i = 0; i < s_bad_count; i++) {
+        if (s_bad[i].id == id && s_bad[i].offset == offset) {
+            return;
+        }
+    }
+    if (s_bad_count < SCRUB_MAX_BAD) {
+        s_bad[s_bad_count].id = id;
+        s_bad[s_bad_count].offset = offset;
+        s_bad_count++;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    s_stats.bad++;
+    portEXIT_CRITICAL(&s_lock);
+    ESP_LOGW(TAG, "%s at %lu: %s", name, (unsigned long)offset, reason);
+
+    char path[EXAMPLE_MAX_CHAR_SIZE];
+    snprintf(path, sizeof(path), "%s/" SCRUB_LOG_FILE, s_config.base_path);
+    FILE *f = fopen(path, "a");
+    if (f == NULL) {
+        ESP_LOGW(TAG, "Failed to open %s", path);
+        return;
+    }
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    fprintf(f, "%lld,%s,%lu,%s\n", (long long)now.tv_sec, name, (unsigned long)offset, reason);
+    fclose(f);
+}
+
+/**
+ * @brief Count a checked capture and record it if it is bad
+ */
+static void scrub_record(scrub_result_t result, const char *name, uint32_t id, uint32_t offset)
+{
+    if (result == SCRUB_RESULT_GONE || result == SCRUB_RESULT_STOPPED) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    s_stats.captures++;
+    if (result == SCRUB_RESULT_CRC) {
+        s_stats.crc_errors++;
+    } else if (result == SCRUB_RESULT_JPEG) {
+        s_stats.jpeg_errors++;
+    } else if (result == SCRUB_RESULT_READ) {
+        s_stats.read_errors++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (result != SCRUB_RESULT_OK) {
+        scrub_report(name, id, offset, result == SCRUB_RESULT_CRC ? "crc" :
+                     result == SCRUB_RESULT_JPEG ? "jpeg" : "read");
+    }
+}
+
+static void scrub_header_error(const char *name, uint32_t id, uint32_t offset)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_stats.header_errors++;
+    portEXIT_CRITICAL(&s_lock);
+    scrub_report(name, id, offset, "header");
+}
+
+/**
+ * @brief Feed @p len bytes of a file to the check, in chunks
+ */
+static scrub_result_t scrub_feed_file(int fd, size_t len)
+{
+    while (len > 0) {
+        size_t n = len < s_config.chunk_size ? len : s_config.chunk_size;
+        esp_err_t ret = scrub_read_file(fd, s_chunk, n);
+        if (ret == ESP_ERR_INVALID_STATE) {
+            return SCRUB_RESULT_STOPPED;
+        }
+        if (ret != ESP_OK) {
+            return SCRUB_RESULT_READ;
+        }
+        scrub_check_feed(s_chunk, n);
+        len -= n;
+    }
+    return SCRUB_RESULT_OK;
+}
+
+/**
+ * @brief A failure on a file deleted meanwhile (retention) is not an error
+ */
+static scrub_result_t scrub_unless_gone(scrub_result_t result, const char *path)
+{
+    struct stat st;
+    if (result != SCRUB_RESULT_OK && result != SCRUB_RESULT_STOPPED && stat(path, &st) != 0) {
+        return SCRUB_RESULT_GONE;
+    }
+    return result;
+}
+
+static void scrub_jpeg_file(uint32_t id)
+{
+    char path[EXAMPLE_MAX_CHAR_SIZE];
+    snprintf(path, sizeof(path), PHOTO_NAME_FORMAT, s_config.base_path, (unsigned long)id);
+    const char *name = strrchr(path, '/') + 1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return;
+    }
+
+    /* The trailer is read first; without one the whole file is JPEG data */
+    size_t size = (size_t)st.st_size;
+    size_t data_len = size;
+    scrub_trailer_t trailer = { 0 };
+    scrub_result_t result = SCRUB_RESULT_OK;
+    if (size >= sizeof(trailer) && lseek(fd, (off_t)(size - sizeof(trailer)), SEEK_SET) >= 0) {
+        esp_err_t ret = scrub_read_file(fd, &trailer, sizeof(trailer));
+        if (ret == ESP_ERR_INVALID_STATE) {
+            result = SCRUB_RESULT_STOPPED;
+        } else if (ret != ESP_OK) {
+            result = SCRUB_RESULT_READ;
+        }
+    }
+    bool has_crc = trailer.magic == SCRUB_TRAILER_MAGIC && trailer.length == size - sizeof(trailer);
+    if (has_crc) {
+        data_len = trailer.length;
+    }
+
+    scrub_check_begin();
+    if (result == SCRUB_RESULT_OK) {
+        result = lseek(fd, 0, SEEK_SET) == 0 ? scrub_feed_file(fd, data_len) : SCRUB_RESULT_READ;
+    }
+    close(fd);
+    if (result == SCRUB_RESULT_OK) {
+        result = scrub_check_end(has_crc, trailer.data_crc);
+    }
+    result = scrub_unless_gone(result, path);
+
+    if (result == SCRUB_RESULT_OK && !has_crc) {
+        portENTER_CRITICAL(&s_lock);
+        s_stats.unverified++;
+        portEXIT_CRITICAL(&s_lock);
+    }
+    scrub_record(result, name, id, 0);
+}
+
+static void scrub_jpeg_files(void)
+{
+    uint32_t first = 0, next = 0;
+    if (!scrub_wait() || file_index_range(s_config.base_path, PHOTO_NAME_PREFIX, PHOTO_NAME_EXT,
+                                          &first, &next) == 0) {
+        return;
+    }
+    /* Newest first; retention deletes from the oldest end */
+    for (uint32_t id = next; id-- > first && s_running;) {
+        scrub_jpeg_file(id);
+    }
+}
+
+/**
+ * @brief A segment being scrubbed; records come from segment_store_scan()
+ */
+typedef struct {
+    int fd;
+    const char *path;
+    uint32_t segment_id;
+    uint32_t limit;             /* Append position of the active segment, records past it are skipped */
+} scrub_segment_t;
+
+static bool scrub_segment_record(void *ctx, const segment_record_header_t *header, uint32_t offset)
+{
+    scrub_segment_t *segment = (scrub_segment_t *)ctx;
+    const char *name = strrchr(segment->path, '/') + 1;
+    if ((uint64_t)offset + sizeof(*header) + header->length > segment->limit) {
+        return false;
+    }
+
+    scrub_check_begin();
+    scrub_result_t result = SCRUB_RESULT_READ;
+    if (lseek(segment->fd, (off_t)offset + sizeof(*header), SEEK_SET) >= 0) {
+        result = scrub_feed_file(segment->fd, header->length);
+    }
+    if (result == SCRUB_RESULT_OK) {
+        result = scrub_check_end(true, header->data_crc);
+    }
+    result = scrub_unless_gone(result, segment->path);
+    scrub_record(result, name, segment->segment_id, offset);
+    return s_running && result != SCRUB_RESULT_GONE;
+}
+
+static void scrub_segment(uint32_t segment_id, uint32_t limit)
+{
+    char path[EXAMPLE_MAX_CHAR_SIZE];
+    snprintf(path, sizeof(path), SEGMENT_NAME_FORMAT, s_config.base_path, (unsigned long)segment_id);
+    const char *name = strrchr(path, '/') + 1;
+
+    scrub_segment_t segment = {
+        .fd = open(path, O_RDONLY), .path = path, .segment_id = segment_id, .limit = limit,
+    };
+    if (segment.fd < 0) {
+        return;
+    }
+    segment_file_header_t file_header;
+    esp_err_t ret = scrub_read_file(segment.fd, &file_header, sizeof(file_header));
+    if (ret != ESP_OK) {
+        close(segment.fd);
+        if (ret != ESP_ERR_INVALID_STATE) {
+            scrub_record(scrub_unless_gone(SCRUB_RESULT_READ, path), name, segment_id, 0);
+        }
+        return;
+    }
+
+    /* Reads the record headers, their data is read here in chunks */
+    uint32_t end = 0;
+    ret = segment_store_scan(s_config.base_path, segment_id, scrub_segment_record, &segment, &end);
+    if (ret == ESP_ERR_INVALID_RESPONSE) {
+        scrub_header_error(name, segment_id, 0);
+    } else if (ret == ESP_OK && s_running && end < limit &&
+               end + sizeof(segment_record_header_t) <= file_header.segment_size) {
+        /* Scanning stops at the first invalid header: past the last record, or a damaged one */
+        segment_record_header_t header;
+        if (lseek(segment.fd, end, SEEK_SET) >= 0 &&
+            scrub_read_file(segment.fd, &header, sizeof(header)) == ESP_OK &&
+            header.magic == SEGMENT_RECORD_MAGIC && header.nonce == file_header.nonce &&
+            header.header_crc != esp_rom_crc32_le(0, (const uint8_t *)&header,
+                                                  offsetof(segment_record_header_t, header_crc))) {
+            scrub_header_error(name, segment_id, end);
+        }
+    }
+    close(segment.fd);
+}
+
+static void scrub_segments(void)
+{
+    uint32_t first = 0, next = 0;
+    if (!scrub_wait() || file_index_range(s_config.base_path, SEGMENT_NAME_PREFIX, SEGMENT_NAME_EXT,
+                                          &first, &next) == 0) {
+        return;
+    }
+
+    /* The active segment is checked up to the append position; it is pre-allocated, so its size does not change */
+    segment_store_stats_t store;
+    segment_store_get_stats(&store);
+    for (uint32_t id = next; id-- > first && s_running;) {
+        scrub_segment(id, id == store.active_segment ? store.active_offset : UINT32_MAX);
+    }
+}
+
+/**
+ * @brief Whether the writer is far enough behind a sector log record to read it
+ */
+static bool scrub_log_safe(uint32_t sector, uint32_t sectors, uint32_t wraps, bool previous)
+{
+    sector_log_stats_t log;
+    sector_log_get_stats(&log);
+    if (log.wraps != wraps) {
+        return false;
+    }
+    /* Far enough ahead of the writer in the previous lap, or behind it in this one */
+    return previous ? (uint64_t)sector >= (uint64_t)log.head + SCRUB_LOG_GUARD_SECTORS
+                    : sector + sectors <= log.head;
+}
+
+/**
+ * @brief Position of a walk through the sector log records
+ */
+typedef struct {
+    int64_t next_lsn;           /* Number of the next record, -1 if not known */
+    uint32_t gap;               /* First sector of the invalid headers being skipped */
+    bool searching;             /* Skipping sectors without a valid header */
+    bool reported;              /* The gap has been reported */
+} scrub_log_walk_t;
+
+/**
+ * @brief Check the sector log records in [from, to) of the region
+ *
+ * Sectors without a valid header are skipped until the next record. In
+ * the current lap every header before the writer's head must be valid.
+ * In the previous lap the writer has cut into an old record and left
+ * unused sectors at the end of the region, so a gap there is only
+ * reported when the record numbers after it are not consecutive.
+ *
+ * @return false if the writer came too close and the range was left
+ */
+static bool scrub_log_range(const sector_log_stats_t *log, uint32_t from, uint32_t to, bool previous,
+                            scrub_log_walk_t *walk)
+{
+    const uint32_t chunk_sectors = s_config.chunk_size / SCRUB_SECTOR_SIZE;
+    uint32_t sector = from;
+
+    while (sector < to && s_running) {
+        if (!scrub_log_safe(sector, 1, log->wraps, previous)) {
+            return false;
+        }
+        esp_err_t ret = scrub_read_sectors(sector, log->start_sector, 1);
+        if (ret == ESP_ERR_INVALID_STATE) {
+            return false;
+        }
+        sector_log_record_header_t header;
+        memcpy(&header, s_chunk, sizeof(header));
+        bool valid = ret == ESP_OK &&
+                     header.magic == SECTOR_LOG_RECORD_MAGIC &&
+                     header.header_size == sizeof(sector_log_record_header_t) &&
+                     header.nonce == log->nonce &&
+                     header.header_crc == esp_rom_crc32_le(0, (const uint8_t *)&header,
+                                                           offsetof(sector_log_record_header_t, header_crc)) &&
+                     header.sectors == 1 + (header.length + SCRUB_SECTOR_SIZE - 1) / SCRUB_SECTOR_SIZE &&
+                     (uint64_t)sector + header.sectors <= log->sector_count;
+        if (!valid) {
+            if (!walk->searching) {
+                walk->searching = true;
+                walk->reported = false;
+                walk->gap = sector;
+            }
+            if (!previous && !walk->reported) {
+                scrub_header_error("LOG", walk->gap, walk->gap);
+                walk->reported = true;
+            }
+            sector++;
+            continue;
+        }
+        if (walk->searching && !walk->reported && walk->next_lsn >= 0 && (int64_t)header.lsn != walk->next_lsn) {
+            scrub_header_error("LOG", walk->gap, walk->gap);
+        }
+        walk->searching = false;
+        walk->next_lsn = (int64_t)header.lsn + 1;
+
+        if (!scrub_log_safe(sector, header.sectors, log->wraps, previous)) {
+            return false;
+        }
+        scrub_check_begin();
+        scrub_result_t result = SCRUB_RESULT_OK;
+        size_t remaining = header.length;
+        for (uint32_t s = 1; s < header.sectors && result == SCRUB_RESULT_OK; s += chunk_sectors) {
+            uint32_t count = header.sectors - s < chunk_sectors ? header.sectors - s : chunk_sectors;
+            ret = scrub_read_sectors(sector + s, log->start_sector, count);
+            if (ret == ESP_ERR_INVALID_STATE) {
+                result = SCRUB_RESULT_STOPPED;
+            } else if (ret != ESP_OK) {
+                result = SCRUB_RESULT_READ;
+            } else {
+                size_t n = (size_t)count * SCRUB_SECTOR_SIZE;
+                n = n < remaining ? n : remaining;
+                scrub_check_feed(s_chunk, n);
+                remaining -= n;
+            }
+        }
+        if (result == SCRUB_RESULT_OK) {
+            result = scrub_check_end(true, header.data_crc);
+        }
+        /* A record the writer reached while it was read is gone, not bad */
+        if (result != SCRUB_RESULT_OK && !scrub_log_safe(sector, header.sectors, log->wraps, previous)) {
+            result = SCRUB_RESULT_GONE;
+        }
+        scrub_record(result, "LOG", (uint32_t)header.lsn, sector);
+        sector += header.sectors;
+    }
+    return s_running;
+}
+
+static void scrub_sector_log(void)
+{
+    sector_log_stats_t log;
+    sector_log_get_stats(&log);
+    if (log.sector_count <= SECTOR_LOG_DATA_SECTOR) {
+        return;
+    }
+
+    /* Oldest first: the rest of the previous lap, then the current one up to the writer */
+    scrub_log_walk_t walk = { .next_lsn = -1 };
+    if (log.wraps > 0 && (uint64_t)log.head + SCRUB_LOG_GUARD_SECTORS < log.sector_count) {
+        /* Starting inside the record the writer has cut into is not a gap */
+        walk.searching = true;
+        walk.reported = true;
+        if (!scrub_log_range(&log, log.head + SCRUB_LOG_GUARD_SECTORS, log.sector_count, true, &walk)) {
+            walk = (scrub_log_walk_t){ .next_lsn = -1 };
+        }
+    }
+    if (s_running) {
+        scrub_log_range(&log, SECTOR_LOG_DATA_SECTOR, log.head, false, &walk);
+    }
+}
+
+static void scrub_task(void *arg)
+{
+    while (s_running) {
+        int64_t start = esp_timer_get_time();
+        scrub_stats_t before;
+        scrub_get_stats(&before);
+
+        switch (s_config.format) {
+        case SCRUB_JPEG_FILES:
+            scrub_jpeg_files();
+            break;
+        case SCRUB_SEGMENTS:
+            scrub_segments();
+            break;
+        case SCRUB_SECTOR_LOG:
+            scrub_sector_log();
+            break;
+        }
+        if (!s_running) {
+            break;
+        }
+
+        scrub_stats_t after;
+        portENTER_CRITICAL(&s_lock);
+        s_stats.passes++;
+        portEXIT_CRITICAL(&s_lock);
+        scrub_get_stats(&after);
+        ESP_LOGI(TAG, "Pass %lu: %lu captures, %llu KB in %lu s, %lu bad",
+                 (unsigned long)after.passes, (unsigned long)(after.captures - before.captures),
+                 (unsigned long long)((after.bytes - before.bytes) / 1024),
+                 (unsigned long)((esp_timer_get_time() - start) / 1000000),
+                 (unsigned long)(after.bad - before.bad));
+
+        scrub_sleep_us((int64_t)s_config.interval_s * 1000000);
+    }
+
+    xSemaphoreGive(s_exit_sem);
+    vTaskDelete(NULL);
+}
+
+esp_err_t scrub_start(const scrub_config_t *config)
+{
+    if (config == NULL || config->base_path == NULL || config->chunk_size < SCRUB_SECTOR_SIZE ||
+        config->chunk_size % SCRUB_SECTOR_SIZE != 0 ||
+        (config->format == SCRUB_SECTOR_LOG && config->card == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    s_config = *config;
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_read_time_us = 0;
+    s_next_read_us = 0;
+    s_bad_count = 0;
+
+    /* DMA-capable, so FATFS and the SDMMC driver read straight into it */
+    s_chunk = heap_caps_malloc(s_config.chunk_size, MALLOC_CAP_DMA);
+    if (s_chunk == NULL) {
+        s_chunk = heap_caps_malloc(s_config.chunk_size, MALLOC_CAP_8BIT);
+        ESP_LOGW(TAG, "Read buffer is not DMA-capable");
+    }
+    s_exit_sem = xSemaphoreCreateBinary();
+    if (s_chunk == NULL || s_exit_sem == NULL) {
+        heap_caps_free(s_chunk);
+        s_chunk = NULL;
+        if (s_exit_sem) {
+            vSemaphoreDelete(s_exit_sem);
+            s_exit_sem = NULL;
+        }
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_running = true;
+    s_start_us = esp_timer_get_time();
+    if (xTaskCreatePinnedToCore(scrub_task, "scrub", SCRUB_TASK_STACK_SIZE, NULL,
+                                s_config.priority, &s_task, scrub_core(s_config.core)) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create scrub task");
+        s_running = false;
+        s_task = NULL;
+        vSemaphoreDelete(s_exit_sem);
+        s_exit_sem = NULL;
+        heap_caps_free(s_chunk);
+        s_chunk = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Scrub started: %lu KB reads, up to %lu KB/s, %lu ms after writes, every %lu s",
+             (unsigned long)(s_config.chunk_size / 1024), (unsigned long)s_config.rate_kbps,
+             (unsigned long)s_config.idle_ms, (unsigned long)s_config.interval_s);
+    return ESP_OK;
+}
+
+void scrub_stop(void)
+{
+    if (!s_running) {
+        return;
+    }
+
+    s_running = false;
+    xTaskNotifyGive(s_task);
+    xSemaphoreTake(s_exit_sem, portMAX_DELAY);
+    s_task = NULL;
+    vSemaphoreDelete(s_exit_sem);
+    s_exit_sem = NULL;
+    heap_caps_free(s_chunk);
+    s_chunk = NULL;
+}
+
+void scrub_write_begin(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_writes++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void scrub_write_end(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_writes > 0) {
+        s_writes--;
+    }
+    s_last_write_us = now;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void scrub_trailer_init(scrub_trailer_t *trailer, const file_write_part_t *parts, size_t count)
+{
+    uint32_t crc = 0;
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) {
+        crc = esp_rom_crc32_le(crc, parts[i].data, (uint32_t)parts[i].size);
+        length += parts[i].size;
+    }
+    trailer->length = (uint32_t)length;
+    trailer->data_crc = crc;
+    trailer->magic = SCRUB_TRAILER_MAGIC;
+}
+
+void scrub_get_stats(scrub_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    *stats = s_stats;
+    uint64_t read_time_us = s_read_time_us;
+    portEXIT_CRITICAL(&s_lock);
+
+    int64_t elapsed_us = esp_timer_get_time() - s_start_us;
+    stats->read_kbps = read_time_us ? (uint32_t)(stats->bytes * 1000000 / 1024 / read_time_us) : 0;
+    stats->avg_kbps = elapsed_us > 0 ? (uint32_t)(stats->bytes * 1000000 / 1024 / (uint64_t)elapsed_us) : 0;
+}
+
+void scrub_log_stats(void)
+{
+    scrub_stats_t stats;
+    scrub_get_stats(&stats);
+
+    ESP_LOGI(TAG, "passes %lu, captures %lu (%lu without CRC), %llu MB at %.2f MB/s (%.2f MB/s overall), "
+             "errors: crc %lu, jpeg %lu, header %lu, read %lu, bad %lu, deferred %lu",
+             (unsigned long)stats.passes, (unsigned long)stats.captures, (unsigned long)stats.unverified,
+             (unsigned long long)(stats.bytes / (1024 * 1024)), stats.read_kbps / 1024.0,
+             stats.avg_kbps / 1024.0, (unsigned long)stats.crc_errors, (unsigned long)stats.jpeg_errors,
+             (unsigned long)stats.header_errors, (unsigned long)stats.read_errors, (unsigned long)stats.bad,
+             (unsigned long)stats.deferrals);
+}
@@ -0,0 +1,181 @@
+/**
+ * @file scrub.h
+ * @brief Background read-back verification (scrub) of stored captures
+ *
+ * A low-priority task reads the stored captures back in large sequential
+ * chunks and checks each one against the CRC32 stored when it was written,
+ * and that it is a complete JPEG (SOI, well-formed marker segments up to
+ * SOS, EOI at the end). Segment and sector log records carry the CRC in
+ * their header; JPEG files carry it in a scrub_trailer_t after EOI, which
+ * JPEG readers ignore. JPEG files without a trailer only get the structure
+ * check.
+ *
+ * A pass walks the JPEG files and segments from the newest to the oldest,
+ * away from the files retention deletes, and the sector log from its oldest
+ * record. The active segment is checked up to its append position and the
+ * sector log up to the writer; records the writer is about to overwrite are
+ * left alone. Reads yield to capture writes: no chunk is read while a
+ * write is in progress or within the idle time after one, so a write waits
+ * for at most one chunk read. The read rate is capped on top of that.
+ *
+ * Each bad capture is appended to SCRUB.LOG on the card once per scrub_start().
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "file_operations.h"
+#include "sdmmc_cmd.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCRUB_TRAILER_MAGIC     0x31435243  /**< "CRC1" */
+
+/** Bad captures, one line each: Unix time, file, offset or sector, reason */
+#define SCRUB_LOG_FILE          "SCRUB.LOG"
+
+/** Bad captures remembered so they are logged once */
+#define SCRUB_MAX_BAD           32
+
+/**
+ * @brief CRC trailer at the end of a JPEG file, after EOI
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t length;            /**< File bytes before the trailer */
+    uint32_t data_crc;          /**< CRC32 of those bytes */
+    uint32_t magic;             /**< SCRUB_TRAILER_MAGIC, the last bytes of the file */
+} scrub_trailer_t;
+
+/**
+ * @brief Capture storage format being scrubbed
+ */
+typedef enum {
+    SCRUB_JPEG_FILES,           /**< IMGnnnnn.JPG files */
+    SCRUB_SEGMENTS,             /**< SEGnnnnn.BIN segment files */
+    SCRUB_SECTOR_LOG,           /**< Raw sector log, read with sdmmc_read_sectors() */
+} scrub_format_t;
+
+/**
+ * @brief Scrub configuration
+ */
+typedef struct {
+    const char *base_path;          /**< Directory holding the captures and SCRUB.LOG */
+    scrub_format_t format;          /**< Storage format */
+    sdmmc_card_t *card;             /**< Card holding the sector log, for SCRUB_SECTOR_LOG */
+    size_t chunk_size;              /**< Bytes per read, multiple of 512 */
+    uint32_t rate_kbps;             /**< Read rate cap in KB/s, 0 for none */
+    uint32_t idle_ms;               /**< Time after a capture write before reading again */
+    uint32_t interval_s;            /**< Pause between passes */
+    int core;                       /**< Core of the scrub task, -1 for no affinity */
+    int priority;                   /**< Priority of the scrub task */
+} scrub_config_t;
+
+#ifndef CONFIG_APP_SCRUB_CHUNK_KB
+#define CONFIG_APP_SCRUB_CHUNK_KB       16
+#endif
+#ifndef CONFIG_APP_SCRUB_RATE_KBPS
+#define CONFIG_APP_SCRUB_RATE_KBPS      1024
+#endif
+#ifndef CONFIG_APP_SCRUB_IDLE_MS
+#define CONFIG_APP_SCRUB_IDLE_MS        2000
+#endif
+#ifndef CONFIG_APP_SCRUB_INTERVAL_S
+#define CONFIG_APP_SCRUB_INTERVAL_S     3600
+#endif
+#ifndef CONFIG_APP_SCRUB_PRIORITY
+#define CONFIG_APP_SCRUB_PRIORITY       1
+#endif
+
+#if CONFIG_APP_STORAGE_SEGMENTS
+#define SCRUB_FORMAT_DEFAULT SCRUB_SEGMENTS
+#elif CONFIG_APP_STORAGE_SECTOR_LOG
+#define SCRUB_FORMAT_DEFAULT SCRUB_SECTOR_LOG
+#else
+#define SCRUB_FORMAT_DEFAULT SCRUB_JPEG_FILES
+#endif
+
+/**
+ * @brief Default scrub configuration from Kconfig; the sector log card is set by the caller
+ */
+#define SCRUB_DEFAULT_CONFIG(path) {                                \
+    .base_path  = (path),                                           \
+    .format     = SCRUB_FORMAT_DEFAULT,                             \
+    .card       = NULL,                                             \
+    .chunk_size = CONFIG_APP_SCRUB_CHUNK_KB * 1024,                 \
+    .rate_kbps  = CONFIG_APP_SCRUB_RATE_KBPS,                       \
+    .idle_ms    = CONFIG_APP_SCRUB_IDLE_MS,                         \
+    .interval_s = CONFIG_APP_SCRUB_INTERVAL_S,                      \
+    .core       = -1,                                               \
+    .priority   = CONFIG_APP_SCRUB_PRIORITY,                        \
+}
+
+/**
+ * @brief Scrub statistics
+ */
+typedef struct {
+    uint32_t passes;                /**< Completed passes */
+    uint32_t captures;              /**< Captures checked */
+    uint64_t bytes;                 /**< Bytes read back */
+    uint32_t unverified;            /**< JPEG files without a CRC trailer, structure checked only */
+    uint32_t crc_errors;            /**< Captures not matching their stored CRC */
+    uint32_t jpeg_errors;           /**< Captures that are not a complete JPEG */
+    uint32_t header_errors;         /**< Damaged segment or sector log record headers */
+    uint32_t read_errors;           /**< Failed reads */
+    uint32_t bad;                   /**< Bad captures recorded in SCRUB.LOG */
+    uint32_t deferrals;             /**< Reads held back for capture writes */
+    uint32_t read_kbps;             /**< Read and check rate while reading */
+    uint32_t avg_kbps;              /**< Bytes read back per time since start, throttling included */
+} scrub_stats_t;
+
+/**
+ * @brief Allocate the read buffer and start the scrub task; the first pass starts right away
+ * @param config Scrub configuration
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an invalid configuration,
+ *         ESP_ERR_INVALID_STATE if already running, ESP_ERR_NO_MEM if out of memory
+ */
+esp_err_t scrub_start(const scrub_config_t *config);
+
+/**
+ * @brief Stop the scrub task after the current chunk
+ */
+void scrub_stop(void);
+
+/**
+ * @brief Tell the scrub a capture write is starting; reads wait until scrub_write_end()
+ *
+ * Called from the pipeline sink. Cheap, never blocks.
+ */
+void scrub_write_begin(void);
+
+/**
+ * @brief Tell the scrub a capture write has finished; reads resume after the idle time
+ */
+void scrub_write_end(void);
+
+/**
+ * @brief Fill the CRC trailer of a JPEG file written as @p parts
+ * @param[out] trailer Trailer, written after the parts
+ * @param parts File contents before the trailer
+ * @param count Number of parts
+ */
+void scrub_trailer_init(scrub_trailer_t *trailer, const file_write_part_t *parts, size_t count);
+
+/**
+ * @brief Get a snapshot of the statistics
+ */
+void scrub_get_stats(scrub_stats_t *stats);
+
+/**
+ * @brief Log the statistics
+ */
+void scrub_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
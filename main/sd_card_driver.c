@@ -4,8 +4,17 @@
  */
 
 #include "sd_card_driver.h"
+#include "capture_index.h"
+#include "file_operations.h"
 #include "app_config.h"
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <esp_rom_crc.h>
+#include <nvs.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include "esp_vfs_fat.h"
 #include "driver/sdmmc_host.h"
 #include "sd_test_io.h"
@@ -17,6 +26,35 @@
 static const char *TAG = "sd_card_driver";
 static sdmmc_card_t *sd_card = NULL;
 
+#if CONFIG_EXAMPLE_SD_PWR_CTRL_LDO_INTERNAL_IO
+static sd_pwr_ctrl_handle_t s_pwr_ctrl_handle = NULL;
+#endif
+
+/* Bus frequency limit selected in Kconfig */
+#if CONFIG_EXAMPLE_SDMMC_SPEED_HS
+#define SD_CARD_MAX_FREQ_KHZ    SDMMC_FREQ_HIGHSPEED
+#elif CONFIG_EXAMPLE_SDMMC_SPEED_UHS_I_SDR50
+#define SD_CARD_MAX_FREQ_KHZ    SDMMC_FREQ_SDR50
+#elif CONFIG_EXAMPLE_SDMMC_SPEED_UHS_I_DDR50
+#define SD_CARD_MAX_FREQ_KHZ    SDMMC_FREQ_DDR50
+#else
+#define SD_CARD_MAX_FREQ_KHZ    SDMMC_FREQ_DEFAULT
+#endif
+
+/* Calibration records in NVS, one per card, keyed by the CRC32 of its CID */
+#define SD_CAL_NVS_NAMESPACE    "sd_cal"
+#define SD_CAL_VERSION          1
+#define SD_CAL_TEST_FILE        "SDCAL.BIN"
+
+typedef struct {
+    uint32_t version;           /* SD_CAL_VERSION */
+    uint32_t config_freq_khz;   /* SD_CARD_MAX_FREQ_KHZ when measured; other limits recalibrate */
+    sd_card_calibration_t cal;
+} sd_cal_record_t;
+
+static sd_card_calibration_t s_calibration;
+static bool s_calibrated = false;
+
 #ifdef CONFIG_EXAMPLE_DEBUG_PIN_CONNECTIONS
 /* Pin configuration for debugging */
 static const char *pin_names[] = {"CLK", "CMD", "D0", "D1", "D2", "D3"};
@@ -53,10 +91,50 @@ static pin_configuration_t pin_config = {
 };
 #endif // CONFIG_EXAMPLE_DEBUG_PIN_CONNECTIONS
 
-esp_err_t sd_card_init(void)
+/**
+ * @brief Open the capture index, rebuilding it if it is missing or inconsistent
+ *
+ * A card without a usable index still works, so failures are only logged.
+ *
+ * @param budget_ms Time left for adding missing entries, 0 for no limit
+ */
+static void sd_card_open_index(uint32_t budget_ms)
+{
+#ifdef CONFIG_APP_CAPTURE_INDEX_ENABLE
+    capture_index_config_t index_config = CAPTURE_INDEX_DEFAULT_CONFIG(MOUNT_POINT);
+    index_config.budget_ms = budget_ms;
+    esp_err_t ret = capture_index_open(&index_config);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Capture index not available: %s", esp_err_to_name(ret));
+    }
+#endif
+}
+
+/**
+ * @brief Undo the effects of an interrupted write after a power cut
+ *
+ * Opens the capture index, which drops its torn tail and re-indexes
+ * captures committed after it; adding entries stops at
+ * CONFIG_APP_RECOVERY_BUDGET_MS and continues at the next boot, so recovery
+ * does not delay the first capture. Torn records at the end of a segment
+ * need no work: the record header is written after the data, so an
+ * interrupted append leaves no valid header and is overwritten by the next
+ * append. The temporary file of an interrupted atomic JPEG write is removed
+ * by the caller that numbers the photos (see file_remove_temp_file()).
+ */
+static void sd_card_recover(void)
+{
+    int64_t start = esp_timer_get_time();
+    sd_card_open_index(CONFIG_APP_RECOVERY_BUDGET_MS);
+    ESP_LOGI(TAG, "Recovery took %lu ms", (unsigned long)((esp_timer_get_time() - start) / 1000));
+}
+
+/**
+ * @brief Mount the card with the given bus frequency limit
+ * @return ESP_OK on success, error code otherwise
+ */
+static esp_err_t sd_card_mount(uint32_t max_freq_khz)
 {
-    ESP_LOGI(TAG, "Initializing SD card...");
-    
     /* Configure filesystem mount options */
     esp_vfs_fat_sdmmc_mount_config_t mount_config = {
 #ifdef CONFIG_EXAMPLE_FORMAT_IF_MOUNT_FAILED
@@ -71,30 +149,16 @@ esp_err_t sd_card_init(void)
     /* Configure SDMMC host */
     sdmmc_host_t host = SDMMC_HOST_DEFAULT();
     
-#if CONFIG_EXAMPLE_SDMMC_SPEED_HS
-    host.max_freq_khz = SDMMC_FREQ_HIGHSPEED;
-#elif CONFIG_EXAMPLE_SDMMC_SPEED_UHS_I_SDR50
+#if CONFIG_EXAMPLE_SDMMC_SPEED_UHS_I_SDR50
     host.slot = SDMMC_HOST_SLOT_0;
-    host.max_freq_khz = SDMMC_FREQ_SDR50;
     host.flags &= ~SDMMC_HOST_FLAG_DDR;
 #elif CONFIG_EXAMPLE_SDMMC_SPEED_UHS_I_DDR50
     host.slot = SDMMC_HOST_SLOT_0;
-    host.max_freq_khz = SDMMC_FREQ_DDR50;
 #endif
+    host.max_freq_khz = max_freq_khz;
 
-    /* Initialize power control if needed */
 #if CONFIG_EXAMPLE_SD_PWR_CTRL_LDO_INTERNAL_IO
-    sd_pwr_ctrl_ldo_config_t ldo_config = {
-        .ldo_chan_id = CONFIG_EXAMPLE_SD_PWR_CTRL_LDO_IO_ID,
-    };
-    sd_pwr_ctrl_handle_t pwr_ctrl_handle = NULL;
-
-    esp_err_t ret = sd_pwr_ctrl_new_on_chip_ldo(&ldo_config, &pwr_ctrl_handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to create LDO power control driver: %s", esp_err_to_name(ret));
-        return ret;
-    }
-    host.pwr_ctrl_handle = pwr_ctrl_handle;
+    host.pwr_ctrl_handle = s_pwr_ctrl_handle;
 #endif
 
     /* Configure SD card slot */
@@ -126,8 +190,248 @@ esp_err_t sd_card_init(void)
     slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
 
     /* Mount the filesystem */
-    ESP_LOGI(TAG, "Mounting filesystem...");
-    esp_err_t ret = esp_vfs_fat_sdmmc_mount(MOUNT_POINT, &host, &slot_config, &mount_config, &sd_card);
+    ESP_LOGI(TAG, "Mounting filesystem (up to %lu kHz)...", (unsigned long)max_freq_khz);
+    return esp_vfs_fat_sdmmc_mount(MOUNT_POINT, &host, &slot_config, &mount_config, &sd_card);
+}
+
+/**
+ * @brief Unmount and mount again with another bus frequency limit
+ *
+ * If the card does not mount at @p max_freq_khz it is mounted with the
+ * Kconfig limit again and an error is returned; sd_card is NULL only if
+ * that fails too.
+ */
+static esp_err_t sd_card_remount(uint32_t max_freq_khz)
+{
+    esp_vfs_fat_sdcard_unmount(MOUNT_POINT, sd_card);
+    sd_card = NULL;
+
+    esp_err_t ret = sd_card_mount(max_freq_khz);
+    if (ret != ESP_OK && max_freq_khz != SD_CARD_MAX_FREQ_KHZ) {
+        ESP_LOGW(TAG, "Mount at %lu kHz failed: %s", (unsigned long)max_freq_khz, esp_err_to_name(ret));
+        if (sd_card_mount(SD_CARD_MAX_FREQ_KHZ) != ESP_OK) {
+            sd_card = NULL;
+        }
+    }
+    return ret;
+}
+
+#ifdef CONFIG_APP_SD_CALIBRATION
+/**
+ * @brief NVS key of the mounted card: CRC32 of its CID in hex
+ */
+static void sd_card_cal_key(char *key, size_t size)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&sd_card->cid, sizeof(sd_card->cid));
+    snprintf(key, size, "%08lx", (unsigned long)crc);
+}
+
+static bool sd_card_cal_load(const char *key, sd_card_calibration_t *cal)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(SD_CAL_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    sd_cal_record_t record;
+    size_t len = sizeof(record);
+    esp_err_t ret = nvs_get_blob(nvs, key, &record, &len);
+    nvs_close(nvs);
+
+    if (ret != ESP_OK || len != sizeof(record) || record.version != SD_CAL_VERSION ||
+        record.config_freq_khz != SD_CARD_MAX_FREQ_KHZ) {
+        return false;
+    }
+    *cal = record.cal;
+    return true;
+}
+
+static void sd_card_cal_save(const char *key, const sd_card_calibration_t *cal)
+{
+    sd_cal_record_t record = {
+        .version = SD_CAL_VERSION,
+        .config_freq_khz = SD_CARD_MAX_FREQ_KHZ,
+        .cal = *cal,
+    };
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(SD_CAL_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(nvs, key, &record, sizeof(record));
+        if (ret == ESP_OK) {
+            ret = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save calibration: %s", esp_err_to_name(ret));
+    }
+}
+
+/**
+ * @brief Time sequential writes of one chunk size on the mounted card
+ * @return Throughput in KB/s, 0 if a write failed
+ */
+static uint32_t sd_card_cal_measure(const uint8_t *data, size_t size, size_t chunk_size)
+{
+    file_write_options_t options = {
+        .chunk_size = chunk_size,
+        .preallocate = true,
+        .sync = FILE_SYNC_BEFORE_CLOSE,
+        .atomic = false,
+    };
+    uint64_t total_us = 0;
+
+    for (int i = 0; i < CONFIG_APP_SD_CALIBRATION_ITERATIONS; i++) {
+        file_write_result_t result;
+        if (file_write_binary_fast(MOUNT_POINT "/" SD_CAL_TEST_FILE, data, size, &options, &result) != ESP_OK) {
+            return 0;
+        }
+        total_us += result.total_us;
+    }
+    unlink(MOUNT_POINT "/" SD_CAL_TEST_FILE);
+
+    uint64_t bytes = (uint64_t)size * CONFIG_APP_SD_CALIBRATION_ITERATIONS;
+    return total_us ? (uint32_t)(bytes * 1000000 / 1024 / total_us) : 0;
+}
+
+/**
+ * @brief Find the fastest bus frequency limit and chunk size for the mounted card
+ *
+ * Leaves the card mounted with the winning frequency limit.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM without a test buffer,
+ *         ESP_FAIL if no combination could be measured
+ */
+static esp_err_t sd_card_calibrate(sd_card_calibration_t *cal)
+{
+    static const uint32_t freqs_khz[] = { SDMMC_FREQ_DEFAULT, SDMMC_FREQ_HIGHSPEED, SD_CARD_MAX_FREQ_KHZ };
+    static const uint32_t chunks_kb[] = { 4, 8, 16, 32, 64 };
+
+    size_t size = CONFIG_APP_SD_CALIBRATION_SIZE_KB * 1024;
+    uint8_t *data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (data == NULL) {
+        data = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    if (data == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Incompressible content, like JPEG data */
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+
+    /* PSRAM test data is staged like frames are; sd_card_init() shrinks the buffer afterwards */
+    file_write_init(chunks_kb[sizeof(chunks_kb) / sizeof(chunks_kb[0]) - 1] * 1024);
+
+    int64_t start = esp_timer_get_time();
+    uint32_t mounted_khz = SD_CARD_MAX_FREQ_KHZ;
+    memset(cal, 0, sizeof(*cal));
+
+    for (size_t f = 0; f < sizeof(freqs_khz) / sizeof(freqs_khz[0]); f++) {
+        uint32_t freq_khz = freqs_khz[f];
+        if (freq_khz > SD_CARD_MAX_FREQ_KHZ || (f > 0 && freq_khz <= freqs_khz[f - 1])) {
+            continue;
+        }
+        if (freq_khz != mounted_khz) {
+            if (sd_card_remount(freq_khz) != ESP_OK) {
+                /* Back at the Kconfig limit, if mounted at all */
+                mounted_khz = SD_CARD_MAX_FREQ_KHZ;
+                if (sd_card == NULL) {
+                    heap_caps_free(data);
+                    return ESP_FAIL;
+                }
+                continue;
+            }
+            mounted_khz = freq_khz;
+        }
+
+        for (size_t c = 0; c < sizeof(chunks_kb) / sizeof(chunks_kb[0]); c++) {
+            uint32_t kb_per_s = sd_card_cal_measure(data, size, chunks_kb[c] * 1024);
+            ESP_LOGI(TAG, "Calibration: %lu kHz (actual %d), %lu KB chunks: %lu KB/s",
+                     (unsigned long)freq_khz, sd_card->real_freq_khz,
+                     (unsigned long)chunks_kb[c], (unsigned long)kb_per_s);
+            if (kb_per_s > cal->kb_per_s) {
+                cal->max_freq_khz = freq_khz;
+                cal->chunk_size = chunks_kb[c] * 1024;
+                cal->kb_per_s = kb_per_s;
+            }
+        }
+    }
+    heap_caps_free(data);
+
+    if (cal->kb_per_s == 0) {
+        return ESP_FAIL;
+    }
+    if (cal->max_freq_khz != mounted_khz) {
+        esp_err_t ret = sd_card_remount(cal->max_freq_khz);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    ESP_LOGI(TAG, "Calibration took %lu ms", (unsigned long)((esp_timer_get_time() - start) / 1000));
+    return ESP_OK;
+}
+
+/**
+ * @brief Apply the cached calibration of the mounted card, measuring it first if there is none
+ *
+ * Failures leave the card mounted with the Kconfig settings.
+ */
+static esp_err_t sd_card_apply_calibration(void)
+{
+    char key[16];
+    sd_card_cal_key(key, sizeof(key));
+
+    sd_card_calibration_t cal;
+    if (sd_card_cal_load(key, &cal)) {
+        ESP_LOGI(TAG, "Card %s: cached calibration %lu kHz, %lu KB chunks (%lu KB/s)", key,
+                 (unsigned long)cal.max_freq_khz, (unsigned long)(cal.chunk_size / 1024),
+                 (unsigned long)cal.kb_per_s);
+        if (cal.max_freq_khz != SD_CARD_MAX_FREQ_KHZ && sd_card_remount(cal.max_freq_khz) != ESP_OK) {
+            return sd_card != NULL ? ESP_OK : ESP_FAIL;
+        }
+    } else {
+        ESP_LOGI(TAG, "Card %s not calibrated yet, measuring write throughput", key);
+        esp_err_t ret = sd_card_calibrate(&cal);
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Calibration failed: %s", esp_err_to_name(ret));
+            return sd_card != NULL ? ESP_OK : ret;
+        }
+        ESP_LOGI(TAG, "Card %s: calibrated %lu kHz, %lu KB chunks (%lu KB/s)", key,
+                 (unsigned long)cal.max_freq_khz, (unsigned long)(cal.chunk_size / 1024),
+                 (unsigned long)cal.kb_per_s);
+        sd_card_cal_save(key, &cal);
+    }
+
+    s_calibration = cal;
+    s_calibrated = true;
+    return ESP_OK;
+}
+#endif // CONFIG_APP_SD_CALIBRATION
+
+esp_err_t sd_card_init(void)
+{
+    ESP_LOGI(TAG, "Initializing SD card...");
+
+    /* Initialize power control if needed */
+#if CONFIG_EXAMPLE_SD_PWR_CTRL_LDO_INTERNAL_IO
+    if (s_pwr_ctrl_handle == NULL) {
+        sd_pwr_ctrl_ldo_config_t ldo_config = {
+            .ldo_chan_id = CONFIG_EXAMPLE_SD_PWR_CTRL_LDO_IO_ID,
+        };
+        esp_err_t ret = sd_pwr_ctrl_new_on_chip_ldo(&ldo_config, &s_pwr_ctrl_handle);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create LDO power control driver: %s", esp_err_to_name(ret));
+            return ret;
+        }
+    }
+#endif
+
+    s_calibrated = false;
+    esp_err_t ret = sd_card_mount(SD_CARD_MAX_FREQ_KHZ);
 
     if (ret != ESP_OK) {
         if (ret == ESP_FAIL) {
@@ -142,16 +446,28 @@ esp_err_t sd_card_init(void)
         }
         return ret;
     }
+
+#ifdef CONFIG_APP_SD_CALIBRATION
+    ret = sd_card_apply_calibration();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to remount SD card: %s", esp_err_to_name(ret));
+        return ret;
+    }
+#endif
     
     ESP_LOGI(TAG, "Filesystem mounted successfully");
     sdmmc_card_print_info(stdout, sd_card);
-    
+
+    /* Without it, frames in memory the DMA cannot read are written one sector per command */
+    file_write_init(sd_card_get_write_chunk_size());
+    sd_card_recover();
     return ESP_OK;
 }
 
 void sd_card_cleanup(void)
 {
     if (sd_card) {
+        capture_index_close();
         esp_vfs_fat_sdcard_unmount(MOUNT_POINT, sd_card);
         ESP_LOGI(TAG, "SD card unmounted");
         sd_card = NULL;
@@ -168,6 +484,20 @@ sdmmc_card_t* sd_card_get_handle(void)
     return sd_card;
 }
 
+esp_err_t sd_card_get_calibration(sd_card_calibration_t *cal)
+{
+    if (!s_calibrated) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *cal = s_calibration;
+    return ESP_OK;
+}
+
+size_t sd_card_get_write_chunk_size(void)
+{
+    return s_calibrated ? s_calibration.chunk_size : FILE_WRITE_CHUNK_SIZE;
+}
+
 esp_err_t sd_card_format(void)
 {
     if (sd_card == NULL) {
@@ -176,6 +506,7 @@ esp_err_t sd_card_format(void)
     }
     
     ESP_LOGI(TAG, "Formatting SD card...");
+    capture_index_close();
     esp_err_t ret = esp_vfs_fat_sdcard_format(MOUNT_POINT, sd_card);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to format SD card: %s", esp_err_to_name(ret));
@@ -183,5 +514,6 @@ esp_err_t sd_card_format(void)
     }
     
     ESP_LOGI(TAG, "SD card formatted successfully");
+    sd_card_open_index(0);
     return ESP_OK;
 }
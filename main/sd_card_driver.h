@@ -7,13 +7,35 @@
 
 #include "esp_err.h"
 #include "sdmmc_cmd.h"
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief Write settings measured for the mounted card
+ */
+typedef struct {
+    uint32_t max_freq_khz;      /**< Bus frequency limit the card is mounted with */
+    uint32_t chunk_size;        /**< Bytes per write() call */
+    uint32_t kb_per_s;          /**< Sequential write throughput measured with these settings */
+} sd_card_calibration_t;
+
 /**
  * @brief Initialize and mount the SD card
+ *
+ * With CONFIG_APP_SD_CALIBRATION the card is identified by its CID. The
+ * first time a card is seen, sequential writes are timed at each bus
+ * frequency up to the configured one and at several chunk sizes, and the
+ * fastest combination is stored in NVS; later mounts reuse it directly.
+ * NVS must be initialized first.
+ *
+ * Then runs a time-bounded recovery pass: the capture index (see
+ * capture_index.h) is repaired, or rebuilt from the captures if it is
+ * missing or inconsistent.
+ *
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t sd_card_init(void);
@@ -29,6 +51,19 @@ void sd_card_cleanup(void);
  */
 sdmmc_card_t* sd_card_get_handle(void);
 
+/**
+ * @brief Get the calibration the card is mounted with
+ * @param[out] cal Calibration
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the card was mounted with the Kconfig settings
+ */
+esp_err_t sd_card_get_calibration(sd_card_calibration_t *cal);
+
+/**
+ * @brief Bytes per write() call for frame data on the mounted card
+ * @return The calibrated chunk size, or FILE_WRITE_CHUNK_SIZE without calibration
+ */
+size_t sd_card_get_write_chunk_size(void);
+
 /**
  * @brief Format the SD card
  * @return ESP_OK on success, error code otherwise
@@ -0,0 +1,473 @@
+/**
+ * @file sector_log.c
+ * @brief Raw sector capture log implementation
+ */
+
+#include "sector_log.h"
+#include "latency_stats.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_random.h>
+#include <esp_rom_crc.h>
+#include <esp_heap_caps.h>
+#include <stddef.h>
+#include <string.h>
+
+#define SECTOR_LOG_SECTORS(bytes) (((bytes) + SECTOR_LOG_SECTOR_SIZE - 1) / SECTOR_LOG_SECTOR_SIZE)
+
+/* Partition table in the master boot record */
+#define MBR_SIGNATURE_OFFSET    510
+#define MBR_PARTITION_OFFSET    446
+#define MBR_PARTITION_COUNT     4
+#define MBR_TYPE_GPT_PROTECTIVE 0xEE
+
+static const char *TAG = "sector_log";
+
+static sector_log_config_t s_config;
+static bool s_open = false;
+static uint32_t s_start = 0;            /* Region, in card sectors */
+static uint32_t s_count = 0;
+static uint32_t s_nonce = 0;
+static uint32_t s_head = 0;
+static uint32_t s_wraps = 0;
+static uint64_t s_next_lsn = 0;
+static uint64_t s_checkpoint = 0;
+static uint32_t s_unsynced = 0;
+
+/* DMA-capable buffers: one sector for headers and record tails, one chunk for frames in PSRAM */
+static uint8_t *s_sector = NULL;
+static uint8_t *s_bounce = NULL;
+
+static sector_log_stats_t s_stats;
+static uint64_t s_append_time_us = 0;
+
+static uint32_t sector_log_crc(const void *data, size_t len)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)data, len);
+}
+
+static uint32_t sector_log_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static esp_err_t sector_log_read(uint32_t sector, void *buf)
+{
+    return sdmmc_read_sectors(s_config.card, buf, s_start + sector, 1);
+}
+
+static esp_err_t sector_log_write(uint32_t sector, const void *buf, uint32_t count)
+{
+    return sdmmc_write_sectors(s_config.card, buf, s_start + sector, count);
+}
+
+/**
+ * @brief End of the last partition in the card's partition table
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the card has a filesystem but no
+ *         partition table, or one this log cannot place itself after
+ */
+static esp_err_t sector_log_partition_end(uint32_t *end)
+{
+    *end = 0;
+    if (sdmmc_read_sectors(s_config.card, s_sector, 0, 1) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (s_sector[MBR_SIGNATURE_OFFSET] != 0x55 || s_sector[MBR_SIGNATURE_OFFSET + 1] != 0xAA) {
+        /* Nothing FATFS could have mounted */
+        return ESP_OK;
+    }
+
+    /* A boot sector (x86 jump, 512 bytes per sector) here means FAT spans the whole card */
+    if ((s_sector[0] == 0xEB || s_sector[0] == 0xE9) && s_sector[11] == 0x00 && s_sector[12] == 0x02) {
+        ESP_LOGE(TAG, "Card has no partition table, the filesystem covers the whole card");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    for (int i = 0; i < MBR_PARTITION_COUNT; i++) {
+        const uint8_t *entry = s_sector + MBR_PARTITION_OFFSET + 16 * i;
+        if (entry[4] == 0) {
+            continue;
+        }
+        if (entry[4] == MBR_TYPE_GPT_PROTECTIVE) {
+            ESP_LOGE(TAG, "GPT partitioned cards are not supported");
+            return ESP_ERR_INVALID_STATE;
+        }
+        uint32_t last = sector_log_le32(entry + 8) + sector_log_le32(entry + 12);
+        if (last > *end) {
+            *end = last;
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Check the configuration, allocate the buffers and place the region on the card
+ */
+static esp_err_t sector_log_setup(const sector_log_config_t *config)
+{
+    if (config == NULL || config->card == NULL || config->chunk_size < SECTOR_LOG_SECTOR_SIZE ||
+        (config->chunk_size % SECTOR_LOG_SECTOR_SIZE) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->card->csd.sector_size != SECTOR_LOG_SECTOR_SIZE) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    sector_log_close();
+    s_config = *config;
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_append_time_us = 0;
+
+    s_sector = heap_caps_malloc(SECTOR_LOG_SECTOR_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    if (s_sector == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint32_t end = 0;
+    esp_err_t ret = sector_log_partition_end(&end);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    uint32_t capacity = (uint32_t)s_config.card->csd.capacity;
+    s_start = s_config.start_sector;
+    if (s_start == 0) {
+        s_start = (end + SECTOR_LOG_AUTO_ALIGN - 1) / SECTOR_LOG_AUTO_ALIGN * SECTOR_LOG_AUTO_ALIGN;
+    } else if (s_start < end) {
+        ESP_LOGE(TAG, "Region at sector %lu overlaps the partitions, which end at sector %lu",
+                 (unsigned long)s_start, (unsigned long)end);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_start >= capacity) {
+        ESP_LOGE(TAG, "No room on the card after sector %lu", (unsigned long)s_start);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    s_count = s_config.sector_count ? s_config.sector_count : capacity - s_start;
+    if ((uint64_t)s_start + s_count > capacity || s_count <= SECTOR_LOG_DATA_SECTOR + 1) {
+        ESP_LOGE(TAG, "Region of %lu sectors at sector %lu does not fit the card of %lu sectors",
+                 (unsigned long)s_count, (unsigned long)s_start, (unsigned long)capacity);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+static void sector_log_free(void)
+{
+    heap_caps_free(s_sector);
+    s_sector = NULL;
+    heap_caps_free(s_bounce);
+    s_bounce = NULL;
+}
+
+static bool sector_log_superblock_valid(const sector_log_superblock_t *sb)
+{
+    return sb->magic == SECTOR_LOG_MAGIC &&
+           sb->version == SECTOR_LOG_VERSION &&
+           sb->header_size == sizeof(sector_log_superblock_t) &&
+           sb->header_crc == sector_log_crc(sb, offsetof(sector_log_superblock_t, header_crc)) &&
+           sb->start_sector == s_start;
+}
+
+/**
+ * @brief Read a record header and check it belongs to this log
+ */
+static bool sector_log_read_header(uint32_t sector, sector_log_record_header_t *header)
+{
+    if (sector < SECTOR_LOG_DATA_SECTOR || sector >= s_count || sector_log_read(sector, s_sector) != ESP_OK) {
+        return false;
+    }
+    memcpy(header, s_sector, sizeof(*header));
+    return header->magic == SECTOR_LOG_RECORD_MAGIC &&
+           header->header_size == sizeof(sector_log_record_header_t) &&
+           header->nonce == s_nonce &&
+           header->header_crc == sector_log_crc(header, offsetof(sector_log_record_header_t, header_crc)) &&
+           header->sectors == 1 + SECTOR_LOG_SECTORS(header->length) &&
+           (uint64_t)sector + header->sectors <= s_count;
+}
+
+/**
+ * @brief Write the append position to the superblock copy not holding the current checkpoint
+ */
+static esp_err_t sector_log_write_superblock(void)
+{
+    int64_t start = esp_timer_get_time();
+
+    sector_log_superblock_t sb = {
+        .magic = SECTOR_LOG_MAGIC,
+        .version = SECTOR_LOG_VERSION,
+        .header_size = sizeof(sector_log_superblock_t),
+        .nonce = s_nonce,
+        .start_sector = s_start,
+        .sector_count = s_count,
+        .checkpoint = s_checkpoint + 1,
+        .next_lsn = s_next_lsn,
+        .head = s_head,
+        .wraps = s_wraps,
+    };
+    sb.header_crc = sector_log_crc(&sb, offsetof(sector_log_superblock_t, header_crc));
+
+    memset(s_sector, 0, SECTOR_LOG_SECTOR_SIZE);
+    memcpy(s_sector, &sb, sizeof(sb));
+    if (sector_log_write((uint32_t)(sb.checkpoint & 1), s_sector, 1) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write checkpoint %llu", (unsigned long long)sb.checkpoint);
+        return ESP_FAIL;
+    }
+
+    s_checkpoint = sb.checkpoint;
+    s_unsynced = 0;
+    s_stats.checkpoints++;
+    latency_stats_record(LATENCY_STAGE_FSYNC, (uint32_t)(esp_timer_get_time() - start));
+    return ESP_OK;
+}
+
+/**
+ * @brief Start an empty log: new nonce, both superblock copies written
+ */
+static esp_err_t sector_log_create(void)
+{
+    s_nonce = esp_random();
+    s_head = SECTOR_LOG_DATA_SECTOR;
+    s_wraps = 0;
+    s_next_lsn = 0;
+    s_checkpoint = 0;
+
+    if (sector_log_write_superblock() != ESP_OK || sector_log_write_superblock() != ESP_OK) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Created log of %lu sectors at sector %lu", (unsigned long)s_count, (unsigned long)s_start);
+    return ESP_OK;
+}
+
+/**
+ * @brief Advance past the complete records written after the checkpoint
+ */
+static uint32_t sector_log_roll_forward(void)
+{
+    uint32_t recovered = 0;
+    sector_log_record_header_t header;
+
+    while (true) {
+        if (sector_log_read_header(s_head, &header) && header.lsn == s_next_lsn) {
+            /* Next record in place */
+        } else if (s_head != SECTOR_LOG_DATA_SECTOR &&
+                   sector_log_read_header(SECTOR_LOG_DATA_SECTOR, &header) && header.lsn == s_next_lsn) {
+            /* The writer wrapped because the record did not fit before the end */
+            s_head = SECTOR_LOG_DATA_SECTOR;
+            s_wraps++;
+        } else {
+            break;
+        }
+        s_head += header.sectors;
+        s_next_lsn++;
+        recovered++;
+    }
+    return recovered;
+}
+
+esp_err_t sector_log_open(const sector_log_config_t *config)
+{
+    esp_err_t ret = sector_log_setup(config);
+    if (ret != ESP_OK) {
+        sector_log_free();
+        return ret;
+    }
+
+    /* The valid copy with the higher checkpoint number is current */
+    sector_log_superblock_t sb[2];
+    bool valid[2];
+    for (int i = 0; i < 2; i++) {
+        valid[i] = sector_log_read(i, s_sector) == ESP_OK;
+        memcpy(&sb[i], s_sector, sizeof(sb[i]));
+        valid[i] = valid[i] && sector_log_superblock_valid(&sb[i]);
+    }
+    int current = (valid[0] && (!valid[1] || sb[0].checkpoint > sb[1].checkpoint)) ? 0 : 1;
+
+    if (!valid[current]) {
+        ESP_LOGW(TAG, "No log at sector %lu, creating one", (unsigned long)s_start);
+        ret = sector_log_create();
+    } else if (sb[current].sector_count != s_count) {
+        ESP_LOGE(TAG, "Log at sector %lu has %lu sectors, not %lu; format it to resize",
+                 (unsigned long)s_start, (unsigned long)sb[current].sector_count, (unsigned long)s_count);
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        s_nonce = sb[current].nonce;
+        s_head = sb[current].head;
+        s_wraps = sb[current].wraps;
+        s_next_lsn = sb[current].next_lsn;
+        s_checkpoint = sb[current].checkpoint;
+
+        s_stats.recovered = sector_log_roll_forward();
+        if (s_stats.recovered > 0) {
+            ret = sector_log_write_superblock();
+        }
+        ESP_LOGI(TAG, "Resuming log at sector %lu, record %llu (%lu past the checkpoint)",
+                 (unsigned long)s_head, (unsigned long long)s_next_lsn, (unsigned long)s_stats.recovered);
+    }
+
+    if (ret != ESP_OK) {
+        sector_log_free();
+        return ret;
+    }
+    s_open = true;
+    return ESP_OK;
+}
+
+esp_err_t sector_log_format(const sector_log_config_t *config)
+{
+    esp_err_t ret = sector_log_setup(config);
+    if (ret == ESP_OK) {
+        ret = sector_log_create();
+    }
+    if (ret != ESP_OK) {
+        sector_log_free();
+        return ret;
+    }
+    s_open = true;
+    return ESP_OK;
+}
+
+void sector_log_close(void)
+{
+    if (s_open) {
+        sector_log_write_superblock();
+        s_open = false;
+    }
+    sector_log_free();
+}
+
+/**
+ * @brief Write whole sectors of frame data, through the bounce buffer if the DMA cannot read them
+ */
+static esp_err_t sector_log_write_data(uint32_t sector, const uint8_t *data, uint32_t count)
+{
+    if (file_buffer_dma_capable(data)) {
+        return sector_log_write(sector, data, count);
+    }
+
+    if (s_bounce == NULL) {
+        s_bounce = heap_caps_malloc(s_config.chunk_size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        if (s_bounce == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    s_stats.bounced++;
+
+    uint32_t chunk = s_config.chunk_size / SECTOR_LOG_SECTOR_SIZE;
+    for (uint32_t done = 0; done < count; done += chunk) {
+        uint32_t n = count - done < chunk ? count - done : chunk;
+        memcpy(s_bounce, data + (size_t)done * SECTOR_LOG_SECTOR_SIZE, (size_t)n * SECTOR_LOG_SECTOR_SIZE);
+        esp_err_t ret = sector_log_write(sector + done, s_bounce, n);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t sector_log_append(const capture_frame_t *frame, sector_log_location_t *location)
+{
+    if (!s_open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint32_t full = frame->len / SECTOR_LOG_SECTOR_SIZE;
+    uint32_t rem = frame->len % SECTOR_LOG_SECTOR_SIZE;
+    uint32_t sectors = 1 + SECTOR_LOG_SECTORS((uint64_t)frame->len);
+    if (sectors > s_count - SECTOR_LOG_DATA_SECTOR) {
+        ESP_LOGE(TAG, "Frame of %zu bytes does not fit in the log", frame->len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    /* The oldest records are overwritten from the first data sector on */
+    if ((uint64_t)s_head + sectors > s_count) {
+        s_head = SECTOR_LOG_DATA_SECTOR;
+        s_wraps++;
+        if (sector_log_write_superblock() != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+
+    /* Data first, header last: a valid header marks a complete record */
+    esp_err_t ret = ESP_OK;
+    if (full > 0) {
+        ret = sector_log_write_data(s_head + 1, frame->buf, full);
+    }
+    if (ret == ESP_OK && rem > 0) {
+        memset(s_sector, 0, SECTOR_LOG_SECTOR_SIZE);
+        memcpy(s_sector, frame->buf + (size_t)full * SECTOR_LOG_SECTOR_SIZE, rem);
+        ret = sector_log_write(s_head + 1 + full, s_sector, 1);
+    }
+
+    sector_log_record_header_t header = {
+        .magic = SECTOR_LOG_RECORD_MAGIC,
+        .header_size = sizeof(sector_log_record_header_t),
+        .trigger_source = (int16_t)frame->trigger.source,
+        .nonce = s_nonce,
+        .sectors = sectors,
+        .lsn = s_next_lsn,
+        .seq = frame->seq,
+        .trigger_id = frame->trigger.id,
+        .timestamp_us = frame->timestamp_us,
+        .length = frame->len,
+        .data_crc = sector_log_crc(frame->buf, frame->len),
+    };
+    header.header_crc = sector_log_crc(&header, offsetof(sector_log_record_header_t, header_crc));
+
+    if (ret == ESP_OK) {
+        memset(s_sector, 0, SECTOR_LOG_SECTOR_SIZE);
+        memcpy(s_sector, &header, sizeof(header));
+        ret = sector_log_write(s_head, s_sector, 1);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write frame %lu at sector %lu: %s",
+                 (unsigned long)frame->seq, (unsigned long)s_head, esp_err_to_name(ret));
+        return ESP_FAIL;
+    }
+    latency_stats_record(LATENCY_STAGE_WRITE, (uint32_t)(esp_timer_get_time() - start));
+
+    if (location) {
+        location->lsn = s_next_lsn;
+        location->sector = s_head;
+        location->sectors = sectors;
+    }
+    s_head += sectors;
+    s_next_lsn++;
+
+    if (s_config.checkpoint_every > 0 && ++s_unsynced >= s_config.checkpoint_every) {
+        ret = sector_log_write_superblock();
+    }
+
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+    s_stats.records++;
+    s_stats.bytes += frame->len;
+    s_append_time_us += elapsed;
+    if (elapsed > s_stats.max_append_us) {
+        s_stats.max_append_us = elapsed;
+    }
+    return ret;
+}
+
+esp_err_t sector_log_checkpoint(void)
+{
+    if (!s_open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return sector_log_write_superblock();
+}
+
+void sector_log_get_stats(sector_log_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    *stats = s_stats;
+    stats->start_sector = s_start;
+    stats->sector_count = s_count;
+    stats->nonce = s_nonce;
+    stats->head = s_head;
+    stats->next_lsn = s_next_lsn;
+    stats->wraps = s_wraps;
+    stats->avg_append_us = s_stats.records ? (uint32_t)(s_append_time_us / s_stats.records) : 0;
+}
@@ -0,0 +1,198 @@
+/**
+ * @file sector_log.h
+ * @brief Capture log written to raw card sectors, outside the FAT filesystem
+ *
+ * Frames are appended as sector-aligned records to a region of the card
+ * after the FAT partition with sdmmc_write_sectors(), so a capture costs no
+ * cluster allocation, FAT table or directory update. Frame data goes to the
+ * card straight from the frame buffer when the SDMMC DMA can read it. The
+ * region is a circular log: when the next record does not fit before the
+ * end, writing wraps to the first data sector and overwrites the oldest
+ * records.
+ *
+ * On-card layout (little endian, 512-byte sectors, relative to the region):
+ *
+ *   sector 0, 1              sector_log_superblock_t, alternating checkpoints
+ *   SECTOR_LOG_DATA_SECTOR   record, record, ...
+ *
+ *   record = sector_log_record_header_t in one sector + JPEG data padded to sectors
+ *
+ * A record's data is written before its header sector, so a record with a
+ * valid header is complete. Checkpoints save the append position every few
+ * records; after a reboot the log is opened from the newest valid
+ * checkpoint and rolled forward over the records written after it, which
+ * carry consecutive record numbers. Every record repeats the random nonce
+ * of the log, so records of an earlier format are never taken for valid
+ * ones. tools/sector_log_extract.py exports the JPEGs of a card image.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "sdmmc_cmd.h"
+#include "capture_frame.h"
+#include "file_operations.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SECTOR_LOG_MAGIC            0x31474C53  /**< "SLG1" */
+#define SECTOR_LOG_RECORD_MAGIC     0x31524C53  /**< "SLR1" */
+#define SECTOR_LOG_VERSION          1
+#define SECTOR_LOG_SECTOR_SIZE      512
+#define SECTOR_LOG_DATA_SECTOR      64          /**< First record, 32 KB into the region */
+
+/** Region start used when none is configured: after the last partition, on a 4 MB boundary */
+#define SECTOR_LOG_AUTO_ALIGN       8192
+
+/**
+ * @brief Superblock, one copy in each of the first two sectors of the region
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             /**< SECTOR_LOG_MAGIC */
+    uint16_t version;           /**< SECTOR_LOG_VERSION */
+    uint16_t header_size;       /**< sizeof(sector_log_superblock_t) */
+    uint32_t nonce;             /**< Random value repeated in every record */
+    uint32_t start_sector;      /**< First card sector of the region */
+    uint32_t sector_count;      /**< Sectors in the region */
+    uint64_t checkpoint;        /**< Checkpoint number; the valid copy with the higher one is current */
+    uint64_t next_lsn;          /**< Number of the next record */
+    uint32_t head;              /**< Region sector of the next record */
+    uint32_t wraps;             /**< Times writing has wrapped to the first data sector */
+    uint32_t header_crc;        /**< CRC32 of the preceding header bytes */
+} sector_log_superblock_t;
+
+/**
+ * @brief Header sector in front of every record
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             /**< SECTOR_LOG_RECORD_MAGIC */
+    uint16_t header_size;       /**< sizeof(sector_log_record_header_t) */
+    int16_t trigger_source;     /**< Trigger GPIO or CAPTURE_TRIGGER_SOURCE_* */
+    uint32_t nonce;             /**< Nonce of the log */
+    uint32_t sectors;           /**< Sectors of the record, header sector included */
+    uint64_t lsn;               /**< Record number, consecutive in write order */
+    uint32_t seq;               /**< Frame sequence number */
+    uint32_t trigger_id;        /**< Trigger event id, 0 if untriggered */
+    int64_t timestamp_us;       /**< esp_timer time of capture */
+    uint32_t length;            /**< JPEG data length */
+    uint32_t data_crc;          /**< CRC32 of the JPEG data */
+    uint32_t header_crc;        /**< CRC32 of the preceding header bytes */
+} sector_log_record_header_t;
+
+/**
+ * @brief Sector log configuration
+ */
+typedef struct {
+    sdmmc_card_t *card;         /**< Card holding the region, from sd_card_get_handle() */
+    uint32_t start_sector;      /**< First sector of the region, 0 to place it after the last partition */
+    uint32_t sector_count;      /**< Sectors in the region, 0 for the rest of the card */
+    uint32_t checkpoint_every;  /**< Records between checkpoints, 0 to checkpoint only on wrap and close */
+    size_t chunk_size;          /**< Bounce buffer size for frames the DMA cannot read, multiple of 512 */
+} sector_log_config_t;
+
+#ifndef CONFIG_APP_SECTOR_LOG_START_MB
+#define CONFIG_APP_SECTOR_LOG_START_MB          0
+#endif
+#ifndef CONFIG_APP_SECTOR_LOG_SIZE_MB
+#define CONFIG_APP_SECTOR_LOG_SIZE_MB           0
+#endif
+#ifndef CONFIG_APP_SECTOR_LOG_CHECKPOINT_EVERY
+#define CONFIG_APP_SECTOR_LOG_CHECKPOINT_EVERY  16
+#endif
+
+/**
+ * @brief Default sector log configuration from Kconfig
+ */
+#define SECTOR_LOG_DEFAULT_CONFIG(sd_card) {                                    \
+    .card             = (sd_card),                                              \
+    .start_sector     = (uint32_t)CONFIG_APP_SECTOR_LOG_START_MB * 2048,        \
+    .sector_count     = (uint32_t)CONFIG_APP_SECTOR_LOG_SIZE_MB * 2048,         \
+    .checkpoint_every = CONFIG_APP_SECTOR_LOG_CHECKPOINT_EVERY,                 \
+    .chunk_size       = FILE_WRITE_CHUNK_SIZE,                                  \
+}
+
+/**
+ * @brief Where a record was stored
+ */
+typedef struct {
+    uint64_t lsn;               /**< Record number */
+    uint32_t sector;            /**< Region sector of the record header */
+    uint32_t sectors;           /**< Sectors of the record */
+} sector_log_location_t;
+
+/**
+ * @brief Sector log statistics
+ */
+typedef struct {
+    uint32_t start_sector;      /**< First card sector of the region */
+    uint32_t sector_count;      /**< Sectors in the region */
+    uint32_t nonce;             /**< Nonce of the log, repeated in every record header */
+    uint32_t head;              /**< Region sector of the next record */
+    uint64_t next_lsn;          /**< Number of the next record */
+    uint32_t wraps;             /**< Times writing has wrapped */
+    uint32_t recovered;         /**< Records rolled forward past the checkpoint at open */
+    uint32_t records;           /**< Records appended since open */
+    uint64_t bytes;             /**< JPEG bytes appended since open */
+    uint32_t bounced;           /**< Records whose data went through the bounce buffer */
+    uint32_t checkpoints;       /**< Checkpoints written since open */
+    uint32_t avg_append_us;     /**< Average append duration */
+    uint32_t max_append_us;     /**< Worst append duration */
+} sector_log_stats_t;
+
+/**
+ * @brief Open the log and resume after its last complete record
+ *
+ * The region must lie after every partition of the card's partition table;
+ * a card formatted without one (FAT on the whole card) is refused. A region
+ * without a valid superblock is formatted.
+ *
+ * @param config Log configuration
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an invalid configuration,
+ *         ESP_ERR_INVALID_STATE if the region overlaps the filesystem or a log of another
+ *         size, ESP_ERR_INVALID_SIZE if the region does not fit the card, ESP_FAIL on a card error
+ */
+esp_err_t sector_log_open(const sector_log_config_t *config);
+
+/**
+ * @brief Start an empty log in the region and open it, invalidating all its records
+ *
+ * @param config Log configuration
+ * @return As sector_log_open()
+ */
+esp_err_t sector_log_format(const sector_log_config_t *config);
+
+/**
+ * @brief Write a checkpoint and close the log
+ */
+void sector_log_close(void);
+
+/**
+ * @brief Append a frame as a record, wrapping over the oldest records if needed
+ * @param frame Frame to append
+ * @param[out] location Where the record was stored (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not open,
+ *         ESP_ERR_INVALID_SIZE if the frame is larger than the region, ESP_FAIL on a card error
+ */
+esp_err_t sector_log_append(const capture_frame_t *frame, sector_log_location_t *location);
+
+/**
+ * @brief Save the append position in the older superblock copy
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not open, ESP_FAIL on a card error
+ */
+esp_err_t sector_log_checkpoint(void);
+
+/**
+ * @brief Get a snapshot of the log statistics
+ * @param[out] stats Output statistics
+ */
+void sector_log_get_stats(sector_log_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,341 @@
+/**
+ * @file segment_store.c
+ * @brief Append-only segment files implementation
+ */
+
+#include "segment_store.h"
+#include "file_operations.h"
+#include "latency_stats.h"
+#include "app_config.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_random.h>
+#include <esp_rom_crc.h>
+#include <esp_vfs_fat.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SEGMENT_ALIGN(x) (((x) + SEGMENT_RECORD_ALIGN - 1) & ~(size_t)(SEGMENT_RECORD_ALIGN - 1))
+
+static const char *TAG = "segment_store";
+
+static segment_store_config_t s_config;
+static int s_fd = -1;
+static uint32_t s_segment_id = 0;
+static uint32_t s_nonce = 0;
+static uint32_t s_offset = 0;
+static uint32_t s_unsynced = 0;
+
+static segment_store_stats_t s_stats;
+static uint64_t s_append_time_us = 0;
+
+static void segment_path(char *path, size_t size, const char *base_path, uint32_t segment_id)
+{
+    snprintf(path, size, SEGMENT_NAME_FORMAT, base_path, (unsigned long)segment_id);
+}
+
+static uint32_t segment_crc(const void *data, size_t len)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)data, len);
+}
+
+static bool segment_file_header_valid(const segment_file_header_t *header, uint32_t segment_id)
+{
+    return header->magic == SEGMENT_FILE_MAGIC &&
+           header->version == SEGMENT_FORMAT_VERSION &&
+           header->header_size == sizeof(segment_file_header_t) &&
+           header->segment_id == segment_id &&
+           header->segment_size > SEGMENT_DATA_OFFSET &&
+           header->header_crc == segment_crc(header, offsetof(segment_file_header_t, header_crc));
+}
+
+static bool segment_record_header_valid(const segment_record_header_t *header, uint32_t nonce,
+                                        uint32_t offset, uint64_t segment_size)
+{
+    return header->magic == SEGMENT_RECORD_MAGIC &&
+           header->header_size == sizeof(segment_record_header_t) &&
+           header->nonce == nonce &&
+           header->header_crc == segment_crc(header, offsetof(segment_record_header_t, header_crc)) &&
+           offset + SEGMENT_ALIGN(sizeof(segment_record_header_t) + (uint64_t)header->length) <= segment_size;
+}
+
+static esp_err_t segment_write_all(int fd, const void *data, size_t len)
+{
+    ssize_t written = write(fd, data, len);
+    if (written < 0 || (size_t)written != len) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Create a segment file of the configured size and write its header
+ */
+static esp_err_t segment_create(uint32_t segment_id)
+{
+    char path[EXAMPLE_MAX_CHAR_SIZE];
+    segment_path(path, sizeof(path), s_config.base_path, segment_id);
+
+    /* A leftover file with this number is never valid: it was not found by open */
+    unlink(path);
+
+    /* Reserve contiguous clusters up front; fall back to extending the file */
+    esp_err_t err = esp_vfs_fat_create_contiguous_file(MOUNT_POINT, path, s_config.segment_size, true);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to create segment: %s", path);
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "No contiguous space for %s, allocating incrementally", path);
+        uint8_t last = 0;
+        if (lseek(fd, (off_t)(s_config.segment_size - 1), SEEK_SET) < 0 ||
+            segment_write_all(fd, &last, 1) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to pre-size segment: %s", path);
+            close(fd);
+            unlink(path);
+            return ESP_FAIL;
+        }
+    }
+
+    segment_file_header_t header = {
+        .magic = SEGMENT_FILE_MAGIC,
+        .version = SEGMENT_FORMAT_VERSION,
+        .header_size = sizeof(segment_file_header_t),
+        .segment_id = segment_id,
+        .nonce = esp_random(),
+        .segment_size = s_config.segment_size,
+    };
+    header.header_crc = segment_crc(&header, offsetof(segment_file_header_t, header_crc));
+
+    if (lseek(fd, 0, SEEK_SET) < 0 || segment_write_all(fd, &header, sizeof(header)) != ESP_OK ||
+        fsync(fd) != 0) {
+        ESP_LOGE(TAG, "Failed to write segment header: %s", path);
+        close(fd);
+        unlink(path);
+        return ESP_FAIL;
+    }
+
+    s_fd = fd;
+    s_segment_id = segment_id;
+    s_nonce = header.nonce;
+    s_offset = SEGMENT_DATA_OFFSET;
+    s_unsynced = 0;
+    s_stats.segments_created++;
+
+    ESP_LOGI(TAG, "Created segment %s (%llu bytes)", path, (unsigned long long)s_config.segment_size);
+    return ESP_OK;
+}
+
+static void segment_close_active(void)
+{
+    if (s_fd >= 0) {
+        fsync(s_fd);
+        close(s_fd);
+        s_fd = -1;
+    }
+}
+
+esp_err_t segment_store_scan(const char *base_path, uint32_t segment_id,
+                             segment_scan_cb_t cb, void *ctx, uint32_t *end_offset)
+{
+    char path[EXAMPLE_MAX_CHAR_SIZE];
+    segment_path(path, sizeof(path), base_path, segment_id);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    segment_file_header_t file_header;
+    if (read(fd, &file_header, sizeof(file_header)) != sizeof(file_header) ||
+        !segment_file_header_valid(&file_header, segment_id)) {
+        close(fd);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    uint32_t offset = SEGMENT_DATA_OFFSET;
+    segment_record_header_t header;
+
+    while (offset + sizeof(header) <= file_header.segment_size) {
+        if (lseek(fd, offset, SEEK_SET) < 0 ||
+            read(fd, &header, sizeof(header)) != sizeof(header) ||
+            !segment_record_header_valid(&header, file_header.nonce, offset, file_header.segment_size)) {
+            break;
+        }
+        if (cb && !cb(ctx, &header, offset)) {
+            break;
+        }
+        offset += SEGMENT_ALIGN(sizeof(header) + header.length);
+    }
+
+    close(fd);
+    if (end_offset) {
+        *end_offset = offset;
+    }
+    return ESP_OK;
+}
+
+esp_err_t segment_store_open(const segment_store_config_t *config)
+{
+    if (config == NULL || config->base_path == NULL ||
+        config->segment_size <= SEGMENT_DATA_OFFSET || config->segment_size > UINT32_MAX ||
+        config->chunk_size < FILE_SECTOR_SIZE || (config->chunk_size % FILE_SECTOR_SIZE) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    segment_store_close();
+    s_config = *config;
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_append_time_us = 0;
+
+    uint32_t next_id = file_next_index(s_config.base_path, SEGMENT_NAME_PREFIX, SEGMENT_NAME_EXT);
+    if (next_id > 0) {
+        /* Resume the newest segment after its last valid record */
+        uint32_t segment_id = next_id - 1;
+        uint32_t end_offset = 0;
+        esp_err_t err = segment_store_scan(s_config.base_path, segment_id, NULL, NULL, &end_offset);
+
+        char path[EXAMPLE_MAX_CHAR_SIZE];
+        segment_path(path, sizeof(path), s_config.base_path, segment_id);
+        segment_file_header_t header;
+        int fd = (err == ESP_OK) ? open(path, O_RDWR) : -1;
+
+        if (fd >= 0 && read(fd, &header, sizeof(header)) == sizeof(header) &&
+            header.segment_size == s_config.segment_size) {
+            s_fd = fd;
+            s_segment_id = segment_id;
+            s_nonce = header.nonce;
+            s_offset = end_offset;
+            s_unsynced = 0;
+            ESP_LOGI(TAG, "Resuming segment %lu at offset %lu",
+                     (unsigned long)segment_id, (unsigned long)end_offset);
+            return ESP_OK;
+        }
+
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (err == ESP_ERR_INVALID_RESPONSE) {
+            /* Creation was cut before the header was committed: the file holds no records */
+            ESP_LOGW(TAG, "Segment %lu has no valid header, recreating it", (unsigned long)segment_id);
+            return segment_create(segment_id);
+        }
+        ESP_LOGW(TAG, "Segment %lu is not usable, starting a new one", (unsigned long)segment_id);
+    }
+
+    return segment_create(next_id);
+}
+
+void segment_store_close(void)
+{
+    segment_close_active();
+}
+
+esp_err_t segment_store_append(const capture_frame_t *frame, segment_location_t *location)
+{
+    if (s_fd < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint64_t record_size = SEGMENT_ALIGN(sizeof(segment_record_header_t) + (uint64_t)frame->len);
+    if (SEGMENT_DATA_OFFSET + record_size > s_config.segment_size) {
+        ESP_LOGE(TAG, "Frame of %zu bytes does not fit in a segment", frame->len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    if (s_offset + record_size > s_config.segment_size) {
+        segment_close_active();
+        int64_t closed = esp_timer_get_time();
+        latency_stats_record(LATENCY_STAGE_CLOSE, (uint32_t)(closed - start));
+        esp_err_t err = segment_create(s_segment_id + 1);
+        latency_stats_record(LATENCY_STAGE_OPEN, (uint32_t)(esp_timer_get_time() - closed));
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    segment_record_header_t header = {
+        .magic = SEGMENT_RECORD_MAGIC,
+        .header_size = sizeof(segment_record_header_t),
+        .trigger_source = (int16_t)frame->trigger.source,
+        .nonce = s_nonce,
+        .seq = frame->seq,
+        .trigger_id = frame->trigger.id,
+        .timestamp_us = frame->timestamp_us,
+        .length = frame->len,
+        .data_crc = segment_crc(frame->buf, frame->len),
+    };
+    header.header_crc = segment_crc(&header, offsetof(segment_record_header_t, header_crc));
+
+    /*
+     * POSIX writes bypass stdio buffering; whole sectors go straight to the card.
+     * Data first, header last: a valid header marks a complete record. FATFS
+     * writes back the buffered last data sector when seeking to the header, and
+     * the header sector stays buffered until the next seek, sync or close.
+     */
+    int64_t write_start = esp_timer_get_time();
+    if (lseek(s_fd, s_offset + sizeof(header), SEEK_SET) < 0 ||
+        file_write_chunked(s_fd, frame->buf, frame->len, s_config.chunk_size, false) != ESP_OK ||
+        lseek(s_fd, s_offset, SEEK_SET) < 0 ||
+        segment_write_all(s_fd, &header, sizeof(header)) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to append frame %lu to segment %lu",
+                 (unsigned long)frame->seq, (unsigned long)s_segment_id);
+        return ESP_FAIL;
+    }
+    latency_stats_record(LATENCY_STAGE_WRITE, (uint32_t)(esp_timer_get_time() - write_start));
+
+    if (location) {
+        location->segment_id = s_segment_id;
+        location->offset = s_offset;
+        location->length = header.length;
+        location->data_crc = header.data_crc;
+    }
+    s_offset += record_size;
+
+    esp_err_t ret = ESP_OK;
+    if (s_config.sync_every > 0 && ++s_unsynced >= s_config.sync_every) {
+        ret = segment_store_sync();
+    }
+
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+    s_stats.records++;
+    s_stats.bytes += frame->len;
+    s_append_time_us += elapsed;
+    if (elapsed > s_stats.max_append_us) {
+        s_stats.max_append_us = elapsed;
+    }
+    return ret;
+}
+
+esp_err_t segment_store_sync(void)
+{
+    if (s_fd < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_unsynced = 0;
+    int64_t start = esp_timer_get_time();
+    int ret = fsync(s_fd);
+    latency_stats_record(LATENCY_STAGE_FSYNC, (uint32_t)(esp_timer_get_time() - start));
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to sync segment %lu", (unsigned long)s_segment_id);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void segment_store_get_stats(segment_store_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    *stats = s_stats;
+    stats->active_segment = s_segment_id;
+    stats->active_offset = s_offset;
+    stats->avg_append_us = s_stats.records ? (uint32_t)(s_append_time_us / s_stats.records) : 0;
+}
@@ -0,0 +1,189 @@
+/**
+ * @file segment_store.h
+ * @brief Append-only segment files holding many JPEG frames
+ *
+ * Instead of one FAT file per photo, frames are appended as records to large
+ * pre-sized segment files (SEGnnnnn.BIN), so a capture costs no directory
+ * entry creation and no FAT chain extension. A segment is rolled over when
+ * the next record does not fit.
+ *
+ * On-card layout (little endian):
+ *
+ *   offset 0                 segment_file_header_t
+ *   SEGMENT_DATA_OFFSET      record, record, ...
+ *
+ *   record = segment_record_header_t + JPEG data + padding to 8 bytes
+ *
+ * The bytes after the last record are whatever the pre-allocated clusters
+ * contained; readers stop at the first header that fails validation. The
+ * data of a record is written before its header, so an append cut by a
+ * power loss leaves no valid header and readers stop in front of it. Every
+ * record repeats the random nonce of its segment, so stale records left in
+ * reused clusters are never mistaken for valid ones.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "capture_frame.h"
+#include "file_operations.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SEGMENT_FILE_MAGIC      0x31474553  /**< "SEG1" */
+#define SEGMENT_RECORD_MAGIC    0x314D5246  /**< "FRM1" */
+#define SEGMENT_FORMAT_VERSION  1
+#define SEGMENT_DATA_OFFSET     512         /**< First record, sector aligned */
+#define SEGMENT_RECORD_ALIGN    8
+
+/** Segment file name format, 8.3 compatible */
+#define SEGMENT_NAME_PREFIX     "SEG"
+#define SEGMENT_NAME_EXT        ".BIN"
+#define SEGMENT_NAME_FORMAT     "%s/" SEGMENT_NAME_PREFIX "%05lu" SEGMENT_NAME_EXT
+
+/**
+ * @brief Header at the start of every segment file
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             /**< SEGMENT_FILE_MAGIC */
+    uint16_t version;           /**< SEGMENT_FORMAT_VERSION */
+    uint16_t header_size;       /**< sizeof(segment_file_header_t) */
+    uint32_t segment_id;        /**< Number in the file name */
+    uint32_t nonce;             /**< Random value repeated in every record */
+    uint64_t segment_size;      /**< Pre-allocated file size */
+    uint32_t header_crc;        /**< CRC32 of the preceding header bytes */
+} segment_file_header_t;
+
+/**
+ * @brief Header in front of every frame record
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             /**< SEGMENT_RECORD_MAGIC */
+    uint16_t header_size;       /**< sizeof(segment_record_header_t) */
+    int16_t trigger_source;     /**< Trigger GPIO, -1 for software/untriggered */
+    uint32_t nonce;             /**< Nonce of the segment */
+    uint32_t seq;               /**< Frame sequence number */
+    uint32_t trigger_id;        /**< Trigger event id, 0 if untriggered */
+    int64_t timestamp_us;       /**< esp_timer time of capture */
+    uint32_t length;            /**< JPEG data length */
+    uint32_t data_crc;          /**< CRC32 of the JPEG data */
+    uint32_t header_crc;        /**< CRC32 of the preceding header bytes */
+} segment_record_header_t;
+
+/**
+ * @brief Segment store configuration
+ */
+typedef struct {
+    const char *base_path;      /**< Directory holding the segment files */
+    uint64_t segment_size;      /**< Pre-allocated size of each segment */
+    uint32_t sync_every;        /**< fsync after this many records, 0 to sync only on rollover/close */
+    size_t chunk_size;          /**< Largest single write of frame data, multiple of 512 */
+} segment_store_config_t;
+
+#ifndef CONFIG_APP_SEGMENT_SIZE_MB
+#define CONFIG_APP_SEGMENT_SIZE_MB      64
+#endif
+#ifndef CONFIG_APP_SEGMENT_SYNC_EVERY
+#define CONFIG_APP_SEGMENT_SYNC_EVERY   1
+#endif
+
+/**
+ * @brief Default segment store configuration from Kconfig
+ */
+#define SEGMENT_STORE_DEFAULT_CONFIG(path) {                            \
+    .base_path    = (path),                                             \
+    .segment_size = (uint64_t)CONFIG_APP_SEGMENT_SIZE_MB * 1024 * 1024, \
+    .sync_every   = CONFIG_APP_SEGMENT_SYNC_EVERY,                      \
+    .chunk_size   = FILE_WRITE_CHUNK_SIZE,                              \
+}
+
+/**
+ * @brief Where a record was stored
+ */
+typedef struct {
+    uint32_t segment_id;        /**< Segment number */
+    uint32_t offset;            /**< Offset of the record header in the segment */
+    uint32_t length;            /**< JPEG data length */
+    uint32_t data_crc;          /**< CRC32 of the JPEG data */
+} segment_location_t;
+
+/**
+ * @brief Segment store statistics
+ */
+typedef struct {
+    uint32_t active_segment;    /**< Segment currently appended to */
+    uint32_t active_offset;     /**< Append position in the active segment */
+    uint32_t records;           /**< Records appended since open */
+    uint64_t bytes;             /**< JPEG bytes appended since open */
+    uint32_t segments_created;  /**< Segments created since open */
+    uint32_t avg_append_us;     /**< Average append duration */
+    uint32_t max_append_us;     /**< Worst append duration */
+} segment_store_stats_t;
+
+/**
+ * @brief Callback for each valid record found by segment_store_scan()
+ * @param ctx User context
+ * @param header Record header
+ * @param offset Offset of the record header in the segment
+ * @return true to continue scanning, false to stop
+ */
+typedef bool (*segment_scan_cb_t)(void *ctx, const segment_record_header_t *header, uint32_t offset);
+
+/**
+ * @brief Open the store and resume appending to the newest segment
+ *
+ * The newest segment is scanned to find its append position; a new segment
+ * is created if there is none or it is not valid.
+ *
+ * @param config Store configuration
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t segment_store_open(const segment_store_config_t *config);
+
+/**
+ * @brief Sync and close the active segment
+ */
+void segment_store_close(void);
+
+/**
+ * @brief Append a frame as a record, rolling over to a new segment if needed
+ * @param frame Frame to append
+ * @param[out] location Where the record was stored (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the frame cannot fit any segment
+ */
+esp_err_t segment_store_append(const capture_frame_t *frame, segment_location_t *location);
+
+/**
+ * @brief Flush the active segment to the card
+ * @return ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t segment_store_sync(void);
+
+/**
+ * @brief Walk the valid records of a segment
+ * @param base_path Directory holding the segment files
+ * @param segment_id Segment to scan
+ * @param cb Callback for each record (may be NULL)
+ * @param ctx Callback context
+ * @param[out] end_offset Offset after the last valid record (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the segment does not exist,
+ *         ESP_ERR_INVALID_RESPONSE if its header is not valid
+ */
+esp_err_t segment_store_scan(const char *base_path, uint32_t segment_id,
+                             segment_scan_cb_t cb, void *ctx, uint32_t *end_offset);
+
+/**
+ * @brief Get a snapshot of the store statistics
+ * @param stats Output statistics
+ */
+void segment_store_get_stats(segment_store_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,261 @@
+/**
+ * @file startup.c
+ * @brief Boot orchestration and boot timeline implementation
+ */
+
+#include "startup.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <string.h>
+
+static const char *TAG = "startup";
+
+/**
+ * @brief A step being run, shared between its task and startup_run()
+ */
+typedef struct {
+    const startup_step_t *step;
+    startup_result_t result;
+    TaskHandle_t waiter;            /* Task of startup_run(), notified when the step is done */
+    bool done;
+} startup_job_t;
+
+typedef struct {
+    const char *name;
+    int64_t time_us;
+} startup_mark_t;
+
+typedef struct {
+    const char *name;
+    startup_result_t result;
+} startup_entry_t;
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static startup_job_t s_jobs[STARTUP_MAX_STEPS];
+
+/* Boot timeline */
+static startup_entry_t s_entries[STARTUP_MAX_STEPS];
+static size_t s_entry_count = 0;
+static startup_mark_t s_marks[STARTUP_MAX_MARKS];
+static size_t s_mark_count = 0;
+
+static BaseType_t startup_core(int core)
+{
+    return (core >= 0 && core < portNUM_PROCESSORS) ? core : tskNO_AFFINITY;
+}
+
+/**
+ * @brief Run a step in the current task and record its times
+ */
+static void startup_exec(const startup_step_t *step, startup_result_t *result)
+{
+    result->core = (int)xPortGetCoreID();
+    result->start_us = esp_timer_get_time();
+    esp_err_t ret = step->fn(step->ctx);
+    result->end_us = esp_timer_get_time();
+    result->result = ret;
+
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "%s done in %lu ms on core %d", step->name,
+                 (unsigned long)((result->end_us - result->start_us) / 1000), result->core);
+    } else {
+        ESP_LOGW(TAG, "%s failed after %lu ms: %s", step->name,
+                 (unsigned long)((result->end_us - result->start_us) / 1000), esp_err_to_name(ret));
+    }
+}
+
+static void startup_task(void *arg)
+{
+    startup_job_t *job = (startup_job_t *)arg;
+    startup_result_t result;
+    startup_exec(job->step, &result);
+
+    portENTER_CRITICAL(&s_lock);
+    job->result = result;
+    job->done = true;
+    TaskHandle_t waiter = job->waiter;
+    portEXIT_CRITICAL(&s_lock);
+
+    xTaskNotifyGive(waiter);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Check that every step only depends on steps before it
+ */
+static bool startup_table_valid(const startup_step_t *steps, size_t count)
+{
+    if (steps == NULL || count == 0 || count > STARTUP_MAX_STEPS) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (steps[i].fn == NULL || steps[i].name == NULL || (steps[i].deps >> i) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+esp_err_t startup_run(const startup_config_t *config, const startup_step_t *steps, size_t count,
+                      startup_result_t *results)
+{
+    if (config == NULL || !startup_table_valid(steps, count)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const uint32_t all = (uint32_t)((1ull << count) - 1);
+    uint32_t started = 0;
+    uint32_t done = 0;
+    uint32_t failed = 0;            /* Failed or held back, and not optional */
+
+    memset(s_jobs, 0, sizeof(s_jobs));
+    int64_t start = esp_timer_get_time();
+    ESP_LOGI(TAG, "Running %u startup steps %s", (unsigned)count,
+             config->parallel ? "concurrently" : "one after the other");
+
+    while (done != all) {
+        /* Dependencies point backwards, so one pass in table order also settles held back chains */
+        for (size_t i = 0; i < count; i++) {
+            const startup_step_t *step = &steps[i];
+            startup_job_t *job = &s_jobs[i];
+            uint32_t bit = STARTUP_STEP(i);
+            if ((started & bit) || (step->deps & done) != step->deps) {
+                continue;
+            }
+            started |= bit;
+            job->step = step;
+
+            if (step->deps & failed) {
+                ESP_LOGW(TAG, "%s skipped, a step it depends on failed", step->name);
+                job->result.result = ESP_ERR_INVALID_STATE;
+                job->result.core = -1;
+            } else if (!config->parallel) {
+                startup_exec(step, &job->result);
+            } else {
+                job->waiter = xTaskGetCurrentTaskHandle();
+                if (xTaskCreatePinnedToCore(startup_task, step->name, config->stack_size, job,
+                                            config->priority, NULL, startup_core(step->core)) == pdPASS) {
+                    continue;
+                }
+                ESP_LOGW(TAG, "No task for %s, running it here", step->name);
+                startup_exec(step, &job->result);
+            }
+
+            done |= bit;
+            if (job->result.result != ESP_OK && !step->optional) {
+                failed |= bit;
+            }
+        }
+        if (done == all) {
+            break;
+        }
+
+        /* Woken by every step task that finishes */
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t bit = STARTUP_STEP(i);
+            if (!(started & bit) || (done & bit)) {
+                continue;
+            }
+            portENTER_CRITICAL(&s_lock);
+            bool finished = s_jobs[i].done;
+            portEXIT_CRITICAL(&s_lock);
+            if (finished) {
+                done |= bit;
+                if (s_jobs[i].result.result != ESP_OK && !steps[i].optional) {
+                    failed |= bit;
+                }
+            }
+        }
+    }
+
+    esp_err_t ret = ESP_OK;
+    portENTER_CRITICAL(&s_lock);
+    for (size_t i = 0; i < count; i++) {
+        if (ret == ESP_OK && (failed & STARTUP_STEP(i))) {
+            ret = s_jobs[i].result.result;
+        }
+        if (results != NULL) {
+            results[i] = s_jobs[i].result;
+        }
+        if (s_entry_count < STARTUP_MAX_STEPS) {
+            s_entries[s_entry_count].name = steps[i].name;
+            s_entries[s_entry_count].result = s_jobs[i].result;
+            s_entry_count++;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    ESP_LOGI(TAG, "Startup steps took %lu ms", (unsigned long)((esp_timer_get_time() - start) / 1000));
+    return ret;
+}
+
+void startup_mark(const char *milestone)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_mark_count < STARTUP_MAX_MARKS) {
+        s_marks[s_mark_count].name = milestone;
+        s_marks[s_mark_count].time_us = now;
+        s_mark_count++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+int64_t startup_get_mark(const char *milestone)
+{
+    int64_t time_us = 0;
+
+    portENTER_CRITICAL(&s_lock);
+    for (size_t i = 0; i < s_mark_count; i++) {
+        if (strcmp(s_marks[i].name, milestone) == 0) {
+            time_us = s_marks[i].time_us;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return time_us;
+}
+
+void startup_log_timeline(void)
+{
+    startup_entry_t entries[STARTUP_MAX_STEPS];
+    startup_mark_t marks[STARTUP_MAX_MARKS];
+
+    portENTER_CRITICAL(&s_lock);
+    size_t entry_count = s_entry_count;
+    size_t mark_count = s_mark_count;
+    memcpy(entries, s_entries, entry_count * sizeof(entries[0]));
+    memcpy(marks, s_marks, mark_count * sizeof(marks[0]));
+    portEXIT_CRITICAL(&s_lock);
+
+    /* Step time added up against the time from the first step start to the last step end */
+    int64_t first_us = 0;
+    int64_t last_us = 0;
+    int64_t busy_us = 0;
+
+    ESP_LOGI(TAG, "Boot timeline (ms since boot):");
+    for (size_t i = 0; i < entry_count; i++) {
+        const startup_result_t *r = &entries[i].result;
+        if (r->start_us == 0) {
+            ESP_LOGI(TAG, "  %-18s skipped", entries[i].name);
+            continue;
+        }
+        ESP_LOGI(TAG, "  %-18s %6lu - %6lu on core %d%s%s", entries[i].name,
+                 (unsigned long)(r->start_us / 1000), (unsigned long)(r->end_us / 1000), r->core,
+                 r->result == ESP_OK ? "" : ", ", r->result == ESP_OK ? "" : esp_err_to_name(r->result));
+        first_us = (first_us == 0 || r->start_us < first_us) ? r->start_us : first_us;
+        last_us = r->end_us > last_us ? r->end_us : last_us;
+        busy_us += r->end_us - r->start_us;
+    }
+    for (size_t i = 0; i < mark_count; i++) {
+        ESP_LOGI(TAG, "  %-18s %6lu", marks[i].name, (unsigned long)(marks[i].time_us / 1000));
+    }
+    if (last_us > first_us) {
+        ESP_LOGI(TAG, "%lu ms of startup steps in %lu ms", (unsigned long)(busy_us / 1000),
+                 (unsigned long)((last_us - first_us) / 1000));
+    }
+}
@@ -0,0 +1,137 @@
+/**
+ * @file startup.h
+ * @brief Boot orchestration with dependency ordering, and the boot timeline
+ *
+ * The bring-up (NVS, SD card mount, camera, trigger GPIOs, ...) is a table
+ * of steps, each naming the earlier steps it waits for. startup_run() starts
+ * every step as soon as its dependencies are done, in a task of its own
+ * pinned to the step's core, so independent bring-ups overlap instead of
+ * adding up. A failed step holds back the steps that depend on it, unless
+ * it is marked optional. With parallel startup disabled the steps run one
+ * after the other in the calling task, in table order, which gives the
+ * sequential boot time to compare against.
+ *
+ * Step times and named milestones (pipeline started, first frame saved)
+ * are kept as a boot timeline, in microseconds since esp_timer started
+ * during boot, and logged with startup_log_timeline().
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Largest number of steps in a startup table */
+#define STARTUP_MAX_STEPS       16
+
+/** Largest number of milestones in the boot timeline */
+#define STARTUP_MAX_MARKS       16
+
+/** Dependency bit of the step at table index @p index */
+#define STARTUP_STEP(index)     (1u << (index))
+
+#ifdef CONFIG_APP_STARTUP_PARALLEL
+#define STARTUP_PARALLEL_DEFAULT true
+#else
+#define STARTUP_PARALLEL_DEFAULT false
+#endif
+#ifndef CONFIG_APP_STARTUP_STACK_SIZE
+#define CONFIG_APP_STARTUP_STACK_SIZE       6144
+#endif
+#ifndef CONFIG_APP_STARTUP_PRIORITY
+#define CONFIG_APP_STARTUP_PRIORITY         5
+#endif
+
+/**
+ * @brief Startup step function
+ * @param ctx Step context
+ * @return ESP_OK on success, error code otherwise
+ */
+typedef esp_err_t (*startup_fn)(void *ctx);
+
+/**
+ * @brief One step of the startup table
+ */
+typedef struct {
+    const char *name;               /**< Step name in the log and timeline, a static string */
+    startup_fn fn;                  /**< Step function */
+    void *ctx;                      /**< Passed to fn */
+    uint32_t deps;                  /**< STARTUP_STEP() bits of earlier steps to wait for */
+    int core;                       /**< Core to run on, -1 for no affinity */
+    bool optional;                  /**< Dependent steps run even if this one fails */
+} startup_step_t;
+
+/**
+ * @brief Outcome of one step
+ */
+typedef struct {
+    esp_err_t result;               /**< Step result, ESP_ERR_INVALID_STATE if a dependency failed */
+    int64_t start_us;               /**< Start time, 0 if the step did not run */
+    int64_t end_us;                 /**< End time */
+    int core;                       /**< Core the step ran on */
+} startup_result_t;
+
+/**
+ * @brief Startup configuration
+ */
+typedef struct {
+    bool parallel;                  /**< Run steps concurrently, in tasks of their own */
+    uint32_t stack_size;            /**< Stack size of the step tasks */
+    int priority;                   /**< Priority of the step tasks */
+} startup_config_t;
+
+/**
+ * @brief Default startup configuration from Kconfig
+ */
+#define STARTUP_DEFAULT_CONFIG() {                                  \
+    .parallel   = STARTUP_PARALLEL_DEFAULT,                         \
+    .stack_size = CONFIG_APP_STARTUP_STACK_SIZE,                    \
+    .priority   = CONFIG_APP_STARTUP_PRIORITY,                      \
+}
+
+/**
+ * @brief Run a startup table and wait until every step has finished or been held back
+ *
+ * Steps may only depend on steps before them in the table, so the table
+ * order is always a valid sequential order. A step whose task cannot be
+ * created runs in the calling task. The steps become part of the boot
+ * timeline.
+ *
+ * @param config Startup configuration
+ * @param steps Step table
+ * @param count Number of steps, up to STARTUP_MAX_STEPS
+ * @param[out] results One result per step, may be NULL
+ * @return ESP_OK if every step that is not optional succeeded, the error of the first
+ *         failed one otherwise, ESP_ERR_INVALID_ARG for a bad table
+ */
+esp_err_t startup_run(const startup_config_t *config, const startup_step_t *steps, size_t count,
+                      startup_result_t *results);
+
+/**
+ * @brief Add a milestone to the boot timeline at the current time
+ * @param milestone Milestone name, a static string
+ */
+void startup_mark(const char *milestone);
+
+/**
+ * @brief Time of a milestone
+ * @param milestone Milestone name
+ * @return Time of its first mark, 0 if it has not been marked
+ */
+int64_t startup_get_mark(const char *milestone);
+
+/**
+ * @brief Log the steps and milestones of the boot timeline
+ */
+void startup_log_timeline(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,449 @@
+/**
+ * @file thumbnail.c
+ * @brief Thumbnail stage implementation
+ */
+
+#include "thumbnail.h"
+#include "frame_ring.h"
+#include "jpeg_dc.h"
+#include "jpeg_enc.h"
+#include "latency_stats.h"
+#include "retention.h"
+#include "segment_store.h"
+#include "app_config.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <esp_rom_crc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define THUMBNAIL_TASK_STACK_SIZE 4096
+
+/* Headers, tables and worst-case entropy data of a thumbnail */
+#define THUMBNAIL_OUT_SIZE(pixels) ((pixels) * 2 + 1024)
+
+static const char *TAG = "thumbnail";
+
+/**
+ * @brief Where a queued frame was stored
+ */
+typedef struct {
+    uint32_t file_id;
+    uint32_t offset;
+} thumbnail_pending_t;
+
+static thumbnail_config_t s_config;
+static TaskHandle_t s_task = NULL;
+static SemaphoreHandle_t s_exit_sem = NULL;
+static volatile bool s_running = false;
+
+/* Frames and their locations, FIFO in the same order; guarded by s_mutex */
+static SemaphoreHandle_t s_mutex = NULL;
+static frame_ring_handle_t s_ring = NULL;
+static thumbnail_pending_t *s_pending = NULL;
+static uint32_t s_pending_head = 0;
+
+/* Used by the thumbnail task only */
+static jpeg_dc_handle_t s_parser = NULL;
+static jpeg_enc_handle_t s_encoder = NULL;
+static uint8_t *s_planes = NULL;        /* Y, Cb and Cr maps back to back */
+static size_t s_planes_size = 0;
+static uint8_t *s_out = NULL;
+static size_t s_out_size = 0;
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static thumbnail_stats_t s_stats;
+static uint64_t s_copy_us = 0;
+static uint64_t s_decode_us = 0;
+static uint64_t s_encode_us = 0;
+static uint64_t s_write_us = 0;
+static uint64_t s_total_us = 0;
+
+static BaseType_t thumbnail_core(int core)
+{
+    return (core >= 0 && core < portNUM_PROCESSORS) ? core : tskNO_AFFINITY;
+}
+
+static void thumbnail_path(char *path, size_t size, uint32_t file_id)
+{
+    if (s_config.segments) {
+        snprintf(path, size, "%s/" THUMBNAIL_DIR "/" SEGMENT_NAME_PREFIX "%05lu" THUMBNAIL_SEGMENT_EXT,
+                 s_config.base_path, (unsigned long)file_id);
+    } else {
+        snprintf(path, size, "%s/" THUMBNAIL_DIR "/" PHOTO_NAME_PREFIX "%05lu" PHOTO_NAME_EXT,
+                 s_config.base_path, (unsigned long)file_id);
+    }
+}
+
+/**
+ * @brief Grow a task buffer, preferring PSRAM; contents are not kept
+ */
+static bool thumbnail_reserve(uint8_t **buf, size_t *size, size_t needed)
+{
+    if (*size >= needed) {
+        return true;
+    }
+
+    heap_caps_free(*buf);
+    *buf = heap_caps_malloc(needed, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (*buf == NULL) {
+        *buf = heap_caps_malloc(needed, MALLOC_CAP_8BIT);
+    }
+    *size = *buf ? needed : 0;
+    return *buf != NULL;
+}
+
+static esp_err_t thumbnail_write(const capture_frame_t *frame, const thumbnail_pending_t *pending,
+                                 const uint8_t *jpeg, size_t len)
+{
+    char path[EXAMPLE_MAX_CHAR_SIZE];
+    thumbnail_path(path, sizeof(path), pending->file_id);
+
+    /* Plain stdio: the fast write path would show up in the capture latency statistics */
+    FILE *f = fopen(path, s_config.segments ? "ab" : "wb");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+
+    size_t written = 0;
+    size_t expected = len;
+    if (s_config.segments) {
+        thumbnail_record_header_t header = {
+            .magic = THUMBNAIL_RECORD_MAGIC,
+            .header_size = sizeof(thumbnail_record_header_t),
+            .offset = pending->offset,
+            .seq = frame->seq,
+            .timestamp_us = frame->timestamp_us,
+            .length = len,
+            .data_crc = esp_rom_crc32_le(0, jpeg, len),
+        };
+        header.header_crc = esp_rom_crc32_le(0, (const uint8_t *)&header,
+                                             offsetof(thumbnail_record_header_t, header_crc));
+        written += fwrite(&header, 1, sizeof(header), f);
+        expected += sizeof(header);
+    }
+    written += fwrite(jpeg, 1, len, f);
+
+    if (fclose(f) != 0 || written != expected) {
+        return ESP_FAIL;
+    }
+    retention_note_written(expected);
+    return ESP_OK;
+}
+
+/**
+ * @brief Decode, encode and store the thumbnail of one frame
+ */
+static esp_err_t thumbnail_process(const capture_frame_t *frame, const thumbnail_pending_t *pending)
+{
+    int64_t start = esp_timer_get_time();
+
+    jpeg_dc_info_t info;
+    esp_err_t ret = jpeg_dc_get_info(s_parser, frame->buf, frame->len, &info);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    size_t pixels = (size_t)info.map_width * info.map_height;
+    if (!thumbnail_reserve(&s_planes, &s_planes_size, pixels * 3) ||
+        !thumbnail_reserve(&s_out, &s_out_size, THUMBNAIL_OUT_SIZE(pixels))) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    jpeg_enc_image_t image = {
+        .y = s_planes,
+        .cb = s_planes + pixels,
+        .cr = s_planes + 2 * pixels,
+        .width = info.map_width,
+        .height = info.map_height,
+        .stride = info.map_width,
+    };
+    ret = jpeg_dc_ycbcr(s_parser, frame->buf, frame->len, s_planes, s_planes + pixels,
+                        s_planes + 2 * pixels, info.map_width, NULL);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (info.components == 1) {
+        image.cb = NULL;
+        image.cr = NULL;
+    }
+    int64_t decoded = esp_timer_get_time();
+
+    size_t len = 0;
+    ret = jpeg_enc_encode(s_encoder, &image, s_out, s_out_size, &len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    int64_t encoded = esp_timer_get_time();
+
+    ret = thumbnail_write(frame, pending, s_out, len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    int64_t written = esp_timer_get_time();
+
+    uint32_t decode_us = (uint32_t)(decoded - start);
+    uint32_t encode_us = (uint32_t)(encoded - decoded);
+    uint32_t write_us = (uint32_t)(written - encoded);
+    uint32_t total_us = (uint32_t)(written - start);
+    latency_stats_record(LATENCY_STAGE_THUMBNAIL, total_us);
+
+    portENTER_CRITICAL(&s_lock);
+    s_stats.written++;
+    s_stats.bytes += len;
+    s_decode_us += decode_us;
+    s_encode_us += encode_us;
+    s_write_us += write_us;
+    s_total_us += total_us;
+    if (decode_us > s_stats.max_decode_us) {
+        s_stats.max_decode_us = decode_us;
+    }
+    if (encode_us > s_stats.max_encode_us) {
+        s_stats.max_encode_us = encode_us;
+    }
+    if (write_us > s_stats.max_write_us) {
+        s_stats.max_write_us = write_us;
+    }
+    if (total_us > s_stats.max_total_us) {
+        s_stats.max_total_us = total_us;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return ESP_OK;
+}
+
+static void thumbnail_task(void *arg)
+{
+    while (s_running) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (s_running) {
+            /* Only this task pops and submit never evicts, so the frame stays valid unlocked */
+            capture_frame_t frame;
+            thumbnail_pending_t pending;
+            xSemaphoreTake(s_mutex, portMAX_DELAY);
+            bool found = frame_ring_peek_oldest(s_ring, &frame);
+            if (found) {
+                pending = s_pending[s_pending_head];
+            }
+            xSemaphoreGive(s_mutex);
+            if (!found) {
+                break;
+            }
+
+            esp_err_t ret = thumbnail_process(&frame, &pending);
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "No thumbnail for frame %lu: %s", (unsigned long)frame.seq,
+                         esp_err_to_name(ret));
+                portENTER_CRITICAL(&s_lock);
+                s_stats.failed++;
+                portEXIT_CRITICAL(&s_lock);
+            }
+
+            xSemaphoreTake(s_mutex, portMAX_DELAY);
+            frame_ring_pop_oldest(s_ring);
+            s_pending_head = (s_pending_head + 1) % s_config.max_pending;
+            xSemaphoreGive(s_mutex);
+        }
+    }
+
+    xSemaphoreGive(s_exit_sem);
+    vTaskDelete(NULL);
+}
+
+static void thumbnail_free(void)
+{
+    jpeg_enc_delete(s_encoder);
+    s_encoder = NULL;
+    jpeg_dc_delete(s_parser);
+    s_parser = NULL;
+    frame_ring_delete(s_ring);
+    s_ring = NULL;
+    free(s_pending);
+    s_pending = NULL;
+    heap_caps_free(s_planes);
+    s_planes = NULL;
+    s_planes_size = 0;
+    heap_caps_free(s_out);
+    s_out = NULL;
+    s_out_size = 0;
+    if (s_mutex) {
+        vSemaphoreDelete(s_mutex);
+        s_mutex = NULL;
+    }
+    if (s_exit_sem) {
+        vSemaphoreDelete(s_exit_sem);
+        s_exit_sem = NULL;
+    }
+}
+
+esp_err_t thumbnail_start(const thumbnail_config_t *config)
+{
+    if (config == NULL || config->base_path == NULL || config->arena_size == 0 ||
+        config->max_pending == 0 || config->quality == 0 || config->quality > 100) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    s_config = *config;
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_copy_us = s_decode_us = s_encode_us = s_write_us = s_total_us = 0;
+    s_pending_head = 0;
+
+    frame_ring_config_t ring_config = {
+        .arena_size = s_config.arena_size,
+        .max_frames = s_config.max_pending,
+        .caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+        .pool = s_config.pool,
+    };
+    s_pending = calloc(s_config.max_pending, sizeof(thumbnail_pending_t));
+    s_mutex = xSemaphoreCreateMutex();
+    s_exit_sem = xSemaphoreCreateBinary();
+    if (s_pending == NULL || s_mutex == NULL || s_exit_sem == NULL ||
+        frame_ring_create(&ring_config, &s_ring) != ESP_OK ||
+        jpeg_dc_create(&s_parser) != ESP_OK ||
+        jpeg_enc_create(s_config.quality, &s_encoder) != ESP_OK) {
+        thumbnail_free();
+        return ESP_ERR_NO_MEM;
+    }
+
+    char dir[EXAMPLE_MAX_CHAR_SIZE];
+    snprintf(dir, sizeof(dir), "%s/" THUMBNAIL_DIR, s_config.base_path);
+    struct stat st;
+    if (stat(dir, &st) != 0 && mkdir(dir, 0775) != 0) {
+        ESP_LOGW(TAG, "Failed to create %s, thumbnails will not be stored", dir);
+    }
+
+    s_running = true;
+    if (xTaskCreatePinnedToCore(thumbnail_task, "thumbnail", THUMBNAIL_TASK_STACK_SIZE, NULL,
+                                s_config.priority, &s_task, thumbnail_core(s_config.core)) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create thumbnail task");
+        s_running = false;
+        s_task = NULL;
+        thumbnail_free();
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Thumbnails started: quality %u, %lu frames in %lu KB",
+             s_config.quality, (unsigned long)s_config.max_pending,
+             (unsigned long)(s_config.arena_size / 1024));
+    return ESP_OK;
+}
+
+void thumbnail_stop(void)
+{
+    if (!s_running) {
+        return;
+    }
+
+    s_running = false;
+    xTaskNotifyGive(s_task);
+    xSemaphoreTake(s_exit_sem, portMAX_DELAY);
+    s_task = NULL;
+    thumbnail_free();
+}
+
+esp_err_t thumbnail_submit(const capture_frame_t *frame, uint32_t file_id, uint32_t offset)
+{
+    if (!s_running || frame == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    /* A full stage skips the frame; the storage path never waits for thumbnails */
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    bool queued = frame_ring_try_push(s_ring, frame) == ESP_OK;
+    if (queued) {
+        uint32_t tail = (s_pending_head + frame_ring_count(s_ring) - 1) % s_config.max_pending;
+        s_pending[tail] = (thumbnail_pending_t) {
+            .file_id = file_id,
+            .offset = offset,
+        };
+    }
+    xSemaphoreGive(s_mutex);
+
+    uint32_t copy_us = (uint32_t)(esp_timer_get_time() - start);
+    portENTER_CRITICAL(&s_lock);
+    if (queued) {
+        s_stats.submitted++;
+        s_copy_us += copy_us;
+        if (copy_us > s_stats.max_copy_us) {
+            s_stats.max_copy_us = copy_us;
+        }
+    } else {
+        s_stats.skipped++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (!queued) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotifyGive(s_task);
+    return ESP_OK;
+}
+
+size_t thumbnail_remove(uint32_t file_id)
+{
+    if (!s_running) {
+        return 0;
+    }
+
+    char path[EXAMPLE_MAX_CHAR_SIZE];
+    thumbnail_path(path, sizeof(path), file_id);
+
+    struct stat st;
+    if (stat(path, &st) != 0 || unlink(path) != 0) {
+        return 0;
+    }
+    return st.st_size;
+}
+
+void thumbnail_get_stats(thumbnail_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    *stats = s_stats;
+    uint64_t copy_us = s_copy_us;
+    uint64_t decode_us = s_decode_us;
+    uint64_t encode_us = s_encode_us;
+    uint64_t write_us = s_write_us;
+    uint64_t total_us = s_total_us;
+    portEXIT_CRITICAL(&s_lock);
+
+    uint32_t done = stats->written;
+    stats->pending = stats->submitted - stats->written - stats->failed;
+    stats->avg_copy_us = stats->submitted ? (uint32_t)(copy_us / stats->submitted) : 0;
+    stats->avg_decode_us = done ? (uint32_t)(decode_us / done) : 0;
+    stats->avg_encode_us = done ? (uint32_t)(encode_us / done) : 0;
+    stats->avg_write_us = done ? (uint32_t)(write_us / done) : 0;
+    stats->avg_total_us = done ? (uint32_t)(total_us / done) : 0;
+}
+
+void thumbnail_log_stats(void)
+{
+    thumbnail_stats_t stats;
+    thumbnail_get_stats(&stats);
+
+    ESP_LOGI(TAG, "written %lu (%llu bytes), skipped %lu, failed %lu, pending %lu",
+             (unsigned long)stats.written, (unsigned long long)stats.bytes,
+             (unsigned long)stats.skipped, (unsigned long)stats.failed, (unsigned long)stats.pending);
+    ESP_LOGI(TAG, "per frame avg/max us: copy %lu/%lu, decode %lu/%lu, encode %lu/%lu, "
+             "write %lu/%lu, total %lu/%lu",
+             (unsigned long)stats.avg_copy_us, (unsigned long)stats.max_copy_us,
+             (unsigned long)stats.avg_decode_us, (unsigned long)stats.max_decode_us,
+             (unsigned long)stats.avg_encode_us, (unsigned long)stats.max_encode_us,
+             (unsigned long)stats.avg_write_us, (unsigned long)stats.max_write_us,
+             (unsigned long)stats.avg_total_us, (unsigned long)stats.max_total_us);
+}
@@ -0,0 +1,172 @@
+/**
+ * @file thumbnail.h
+ * @brief Low-priority thumbnail stage for stored captures
+ *
+ * The storage sink hands every stored frame to thumbnail_submit(), which
+ * copies it into a PSRAM ring and returns; a frame is skipped rather than
+ * waited for when the ring is full. A low-priority task, normally on the
+ * writer core so it never competes with capture, turns each frame into a
+ * 1/8 scale JPEG from the DC coefficients (jpeg_dc.h) and a small encoder
+ * (jpeg_enc.h), without decoding the full image.
+ *
+ * Thumbnails live in THUMBNAIL_DIR under the capture directory and carry
+ * the capture's number, so retention can delete them with their capture:
+ * - JPEG files: THUMB/IMGnnnnn.JPG, one per photo
+ * - Segments: THUMB/SEGnnnnn.THM, one per segment, holding a
+ *   thumbnail_record_header_t and the JPEG per frame, in frame order
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "capture_frame.h"
+#include "frame_pool.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Thumbnail directory under the capture directory (8.3 name) */
+#define THUMBNAIL_DIR               "THUMB"
+#define THUMBNAIL_SEGMENT_EXT       ".THM"
+#define THUMBNAIL_RECORD_MAGIC      0x314D4854  /**< "THM1" */
+
+/**
+ * @brief Header in front of every thumbnail in a segment thumbnail file
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             /**< THUMBNAIL_RECORD_MAGIC */
+    uint16_t header_size;       /**< sizeof(thumbnail_record_header_t) */
+    uint16_t reserved;
+    uint32_t offset;            /**< Offset of the frame record in its segment */
+    uint32_t seq;               /**< Frame sequence number */
+    int64_t timestamp_us;       /**< esp_timer time of capture */
+    uint32_t length;            /**< JPEG data length */
+    uint32_t data_crc;          /**< CRC32 of the JPEG data */
+    uint32_t header_crc;        /**< CRC32 of the preceding header bytes */
+} thumbnail_record_header_t;
+
+/**
+ * @brief Thumbnail configuration
+ */
+typedef struct {
+    const char *base_path;          /**< Directory holding the captures */
+    bool segments;                  /**< Captures are segment files (true) or JPEG files (false) */
+    size_t arena_size;              /**< PSRAM held for frames waiting for a thumbnail */
+    frame_pool_handle_t pool;       /**< Pool holding those frames, arena_size capping their bytes, or NULL */
+    uint32_t max_pending;           /**< Frames waiting for a thumbnail */
+    uint8_t quality;                /**< Thumbnail JPEG quality, 1-100 */
+    int core;                       /**< Core of the thumbnail task, -1 for no affinity */
+    int priority;                   /**< Priority of the thumbnail task */
+} thumbnail_config_t;
+
+#ifndef CONFIG_APP_THUMBNAIL_QUALITY
+#define CONFIG_APP_THUMBNAIL_QUALITY        75
+#endif
+#ifndef CONFIG_APP_THUMBNAIL_ARENA_KB
+#define CONFIG_APP_THUMBNAIL_ARENA_KB       512
+#endif
+#ifndef CONFIG_APP_THUMBNAIL_MAX_PENDING
+#define CONFIG_APP_THUMBNAIL_MAX_PENDING    4
+#endif
+#ifndef CONFIG_APP_THUMBNAIL_PRIORITY
+#define CONFIG_APP_THUMBNAIL_PRIORITY       1
+#endif
+#ifndef CONFIG_APP_PIPELINE_WRITER_CORE
+#define CONFIG_APP_PIPELINE_WRITER_CORE     0
+#endif
+
+#if CONFIG_APP_STORAGE_SEGMENTS
+#define THUMBNAIL_SEGMENTS_DEFAULT true
+#else
+#define THUMBNAIL_SEGMENTS_DEFAULT false
+#endif
+
+/**
+ * @brief Default thumbnail configuration from Kconfig, on the pipeline writer core
+ */
+#define THUMBNAIL_DEFAULT_CONFIG(path) {                                \
+    .base_path   = (path),                                              \
+    .segments    = THUMBNAIL_SEGMENTS_DEFAULT,                          \
+    .arena_size  = CONFIG_APP_THUMBNAIL_ARENA_KB * 1024,                \
+    .pool        = NULL,                                                \
+    .max_pending = CONFIG_APP_THUMBNAIL_MAX_PENDING,                    \
+    .quality     = CONFIG_APP_THUMBNAIL_QUALITY,                        \
+    .core        = CONFIG_APP_PIPELINE_WRITER_CORE,                     \
+    .priority    = CONFIG_APP_THUMBNAIL_PRIORITY,                       \
+}
+
+/**
+ * @brief Thumbnail statistics; times are per frame
+ */
+typedef struct {
+    uint32_t submitted;             /**< Frames queued for a thumbnail */
+    uint32_t skipped;               /**< Frames not queued because the stage was full */
+    uint32_t written;               /**< Thumbnails stored */
+    uint32_t failed;                /**< Frames that could not be decoded, encoded or written */
+    uint32_t pending;               /**< Frames waiting now */
+    uint64_t bytes;                 /**< Thumbnail bytes stored */
+    uint32_t avg_copy_us;           /**< Copy into the ring, spent in the storage sink */
+    uint32_t max_copy_us;
+    uint32_t avg_decode_us;         /**< DC decode of the capture */
+    uint32_t max_decode_us;
+    uint32_t avg_encode_us;         /**< Thumbnail encode */
+    uint32_t max_encode_us;
+    uint32_t avg_write_us;          /**< Thumbnail write */
+    uint32_t max_write_us;
+    uint32_t avg_total_us;          /**< Decode, encode and write */
+    uint32_t max_total_us;
+} thumbnail_stats_t;
+
+/**
+ * @brief Allocate the ring and start the thumbnail task
+ * @param config Thumbnail configuration
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an invalid configuration,
+ *         ESP_ERR_INVALID_STATE if already running, ESP_ERR_NO_MEM if out of memory
+ */
+esp_err_t thumbnail_start(const thumbnail_config_t *config);
+
+/**
+ * @brief Stop the thumbnail task; frames still waiting get no thumbnail
+ */
+void thumbnail_stop(void);
+
+/**
+ * @brief Queue a stored frame for a thumbnail
+ *
+ * Called from the storage sink; copies the frame and returns without waiting
+ * for the thumbnail task.
+ *
+ * @param frame Stored frame
+ * @param file_id Number of the photo or segment the frame was stored in
+ * @param offset Offset of the frame record in its segment, 0 for photos
+ * @return ESP_OK if queued, ESP_ERR_NO_MEM if skipped because the stage is full,
+ *         ESP_ERR_INVALID_STATE if not started
+ */
+esp_err_t thumbnail_submit(const capture_frame_t *frame, uint32_t file_id, uint32_t offset);
+
+/**
+ * @brief Delete the thumbnails of a photo or segment; no-op if not started
+ * @param file_id Number of the deleted photo or segment
+ * @return Bytes freed
+ */
+size_t thumbnail_remove(uint32_t file_id);
+
+/**
+ * @brief Get a snapshot of the thumbnail statistics
+ * @param[out] stats Output statistics
+ */
+void thumbnail_get_stats(thumbnail_stats_t *stats);
+
+/**
+ * @brief Log the thumbnail statistics
+ */
+void thumbnail_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,177 @@
+/**
+ * @file timelapse.c
+ * @brief Time-lapse scheduler implementation
+ */
+
+#include "timelapse.h"
+#include "capture_pipeline.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <string.h>
+
+#define TIMELAPSE_TASK_STACK_SIZE 3072
+
+static const char *TAG = "timelapse";
+
+static timelapse_config_t s_config;
+static TaskHandle_t s_task = NULL;
+static SemaphoreHandle_t s_exit_sem = NULL;
+static volatile bool s_running = false;
+static int64_t s_start_us = 0;
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static timelapse_stats_t s_stats;
+static uint64_t s_jitter_us = 0;
+static uint32_t s_last_trigger_id = 0;
+
+static BaseType_t timelapse_core(int core)
+{
+    return (core >= 0 && core < portNUM_PROCESSORS) ? core : tskNO_AFFINITY;
+}
+
+static void timelapse_task(void *arg)
+{
+    const int64_t interval_us = (int64_t)s_config.interval_ms * 1000;
+    const int64_t tick_us = (int64_t)portTICK_PERIOD_MS * 1000;
+    uint64_t slot = 1;
+
+    while (s_running) {
+        int64_t slot_us = s_start_us + (int64_t)slot * interval_us;
+        int64_t wait_us = slot_us - esp_timer_get_time();
+        if (wait_us > 0) {
+            /* Rounded up to whole ticks so a slot is never requested early; woken early by stop */
+            ulTaskNotifyTake(pdTRUE, (TickType_t)((wait_us + tick_us - 1) / tick_us));
+            continue;
+        }
+
+        /* Slots that passed while the task could not run are skipped, not caught up */
+        int64_t now = esp_timer_get_time();
+        uint32_t skipped = (uint32_t)((now - slot_us) / interval_us);
+        slot += skipped;
+        slot_us += (int64_t)skipped * interval_us;
+
+        esp_err_t err = capture_pipeline_trigger_scheduled(slot_us, s_config.frames_per_slot);
+        uint32_t late_us = (uint32_t)(now - slot_us);
+
+        portENTER_CRITICAL(&s_lock);
+        s_stats.missed += skipped + (err != ESP_OK ? 1 : 0);
+        if (err == ESP_OK) {
+            s_stats.slots++;
+        }
+        if (late_us > s_stats.max_late_us) {
+            s_stats.max_late_us = late_us;
+        }
+        portEXIT_CRITICAL(&s_lock);
+
+        if (skipped > 0 || err != ESP_OK) {
+            ESP_LOGW(TAG, "Slot %llu: %lu slots skipped, request %s", (unsigned long long)slot,
+                     (unsigned long)skipped, esp_err_to_name(err));
+        }
+        slot++;
+    }
+
+    xSemaphoreGive(s_exit_sem);
+    vTaskDelete(NULL);
+}
+
+esp_err_t timelapse_start(const timelapse_config_t *config)
+{
+    if (config == NULL || config->interval_ms == 0 || config->frames_per_slot == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    s_config = *config;
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_jitter_us = 0;
+    s_last_trigger_id = 0;
+
+    s_exit_sem = xSemaphoreCreateBinary();
+    if (s_exit_sem == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_running = true;
+    s_start_us = esp_timer_get_time();
+    if (xTaskCreatePinnedToCore(timelapse_task, "timelapse", TIMELAPSE_TASK_STACK_SIZE, NULL,
+                                s_config.priority, &s_task, timelapse_core(s_config.core)) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create time-lapse task");
+        s_running = false;
+        s_task = NULL;
+        vSemaphoreDelete(s_exit_sem);
+        s_exit_sem = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Time-lapse started: %lu frame(s) every %lu ms",
+             (unsigned long)s_config.frames_per_slot, (unsigned long)s_config.interval_ms);
+    return ESP_OK;
+}
+
+void timelapse_stop(void)
+{
+    if (!s_running) {
+        return;
+    }
+
+    s_running = false;
+    xTaskNotifyGive(s_task);
+    xSemaphoreTake(s_exit_sem, portMAX_DELAY);
+    s_task = NULL;
+    vSemaphoreDelete(s_exit_sem);
+    s_exit_sem = NULL;
+}
+
+void timelapse_note_frame(const capture_frame_t *frame)
+{
+    const capture_trigger_t *trigger = &frame->trigger;
+    if (trigger->source != CAPTURE_TRIGGER_SOURCE_SCHEDULE) {
+        return;
+    }
+
+    int64_t offset = frame->timestamp_us - trigger->edge_us;
+    uint32_t jitter = (uint32_t)(offset < 0 ? -offset : offset);
+
+    portENTER_CRITICAL(&s_lock);
+    /* Frames of a slot are stored in order, so only the first sees a new id */
+    if (trigger->id != s_last_trigger_id) {
+        s_last_trigger_id = trigger->id;
+        s_stats.stored++;
+        s_jitter_us += jitter;
+        if (jitter > s_stats.max_jitter_us) {
+            s_stats.max_jitter_us = jitter;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void timelapse_get_stats(timelapse_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    *stats = s_stats;
+    uint64_t jitter_us = s_jitter_us;
+    portEXIT_CRITICAL(&s_lock);
+
+    stats->avg_jitter_us = stats->stored ? (uint32_t)(jitter_us / stats->stored) : 0;
+}
+
+void timelapse_log_stats(void)
+{
+    timelapse_stats_t stats;
+    timelapse_get_stats(&stats);
+
+    ESP_LOGI(TAG, "slots %lu (missed %lu, request late max %lu us), stored %lu, "
+             "jitter avg %lu us max %lu us",
+             (unsigned long)stats.slots, (unsigned long)stats.missed, (unsigned long)stats.max_late_us,
+             (unsigned long)stats.stored, (unsigned long)stats.avg_jitter_us,
+             (unsigned long)stats.max_jitter_us);
+}
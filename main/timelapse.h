@@ -0,0 +1,107 @@
+/**
+ * @file timelapse.h
+ * @brief Time-lapse scheduler on absolute slot times
+ *
+ * Slot n is due at start + n x interval, computed from esp_timer each time
+ * rather than by chaining delays, so waits that overrun do not accumulate
+ * into drift. Each slot is handed to the capture pipeline as a scheduled
+ * trigger; slots that pass while the scheduler cannot run, or that the
+ * pipeline cannot accept, are counted as missed and not caught up. Trigger
+ * inputs can stay active alongside the schedule.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "capture_frame.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CONFIG_APP_TIMELAPSE_INTERVAL_MS
+#define CONFIG_APP_TIMELAPSE_INTERVAL_MS        60000
+#endif
+#ifndef CONFIG_APP_TIMELAPSE_FRAMES_PER_SLOT
+#define CONFIG_APP_TIMELAPSE_FRAMES_PER_SLOT    1
+#endif
+#ifndef CONFIG_APP_TIMELAPSE_PRIORITY
+#define CONFIG_APP_TIMELAPSE_PRIORITY           8
+#endif
+
+/**
+ * @brief Time-lapse configuration
+ */
+typedef struct {
+    uint32_t interval_ms;           /**< Time between slots */
+    uint32_t frames_per_slot;       /**< Frames captured per slot */
+    int core;                       /**< Core of the scheduler task, -1 for no affinity */
+    int priority;                   /**< Priority of the scheduler task */
+} timelapse_config_t;
+
+/**
+ * @brief Default time-lapse configuration from Kconfig
+ */
+#define TIMELAPSE_DEFAULT_CONFIG() {                                \
+    .interval_ms     = CONFIG_APP_TIMELAPSE_INTERVAL_MS,            \
+    .frames_per_slot = CONFIG_APP_TIMELAPSE_FRAMES_PER_SLOT,        \
+    .core            = -1,                                          \
+    .priority        = CONFIG_APP_TIMELAPSE_PRIORITY,               \
+}
+
+/**
+ * @brief Time-lapse statistics
+ */
+typedef struct {
+    uint32_t slots;                 /**< Slots handed to the capture pipeline */
+    uint32_t missed;                /**< Slots skipped or not accepted by the pipeline */
+    uint32_t max_late_us;           /**< Worst delay from slot time to the request */
+    uint32_t stored;                /**< Slots whose first frame was stored */
+    uint32_t avg_jitter_us;         /**< Average distance of the first frame from the slot time */
+    uint32_t max_jitter_us;         /**< Worst distance of the first frame from the slot time */
+} timelapse_stats_t;
+
+/**
+ * @brief Start the scheduler task; the first slot is due one interval from now
+ *
+ * The capture pipeline should be started first.
+ *
+ * @param config Time-lapse configuration
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a zero interval or frame count,
+ *         ESP_ERR_INVALID_STATE if already running, ESP_ERR_NO_MEM if the task cannot be created
+ */
+esp_err_t timelapse_start(const timelapse_config_t *config);
+
+/**
+ * @brief Stop the scheduler task
+ */
+void timelapse_stop(void);
+
+/**
+ * @brief Account for a stored frame of a schedule slot
+ *
+ * Call from the pipeline sink for frames tagged with
+ * CAPTURE_TRIGGER_SOURCE_SCHEDULE; the first frame of each slot sets the
+ * jitter statistics.
+ *
+ * @param frame Stored frame
+ */
+void timelapse_note_frame(const capture_frame_t *frame);
+
+/**
+ * @brief Get a snapshot of the time-lapse statistics
+ * @param[out] stats Output statistics
+ */
+void timelapse_get_stats(timelapse_stats_t *stats);
+
+/**
+ * @brief Log the time-lapse statistics
+ */
+void timelapse_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
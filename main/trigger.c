@@ -0,0 +1,171 @@
+/**
+ * @file trigger.c
+ * @brief GPIO trigger inputs implementation
+ */
+
+#include "trigger.h"
+#include "capture_pipeline.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_attr.h>
+#include <stdlib.h>
+#include "driver/gpio.h"
+
+static const char *TAG = "trigger";
+
+typedef struct {
+    gpio_num_t gpio;
+    int64_t last_edge_us;       /* Time of the last accepted edge */
+} trigger_input_t;
+
+static trigger_input_t s_inputs[TRIGGER_MAX_GPIOS];
+static size_t s_input_count = 0;
+static int64_t s_debounce_us = 0;
+
+/* Only written from the GPIO interrupt handler */
+static volatile trigger_stats_t s_stats;
+
+static void IRAM_ATTR trigger_isr_handler(void *arg)
+{
+    trigger_input_t *input = (trigger_input_t *)arg;
+    int64_t now = esp_timer_get_time();
+
+    s_stats.edges++;
+
+    /* PIR sensors retrigger while the target is in view: merge those edges */
+    if (input->last_edge_us != 0 && now - input->last_edge_us < s_debounce_us) {
+        s_stats.coalesced++;
+        return;
+    }
+
+    BaseType_t task_woken = pdFALSE;
+    if (capture_pipeline_trigger_from_isr(input->gpio, now, &task_woken)) {
+        input->last_edge_us = now;
+        s_stats.accepted++;
+    } else {
+        s_stats.rejected++;
+    }
+
+    if (task_woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+/**
+ * @brief Parse a comma-separated GPIO list into s_inputs
+ */
+static esp_err_t trigger_parse_gpios(const char *list)
+{
+    const char *p = list;
+    s_input_count = 0;
+
+    while (*p != '\0') {
+        char *end;
+        long gpio = strtol(p, &end, 10);
+        if (end == p || !GPIO_IS_VALID_GPIO(gpio)) {
+            ESP_LOGE(TAG, "Invalid trigger GPIO list: \"%s\"", list);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (s_input_count == TRIGGER_MAX_GPIOS) {
+            ESP_LOGE(TAG, "Too many trigger GPIOs (max %d)", TRIGGER_MAX_GPIOS);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        s_inputs[s_input_count].gpio = (gpio_num_t)gpio;
+        s_inputs[s_input_count].last_edge_us = 0;
+        s_input_count++;
+
+        p = end;
+        while (*p == ',' || *p == ' ') {
+            p++;
+        }
+    }
+
+    return s_input_count > 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t trigger_init(const trigger_config_t *config)
+{
+    if (config == NULL || config->gpio_list == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = trigger_parse_gpios(config->gpio_list);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    s_debounce_us = (int64_t)config->debounce_ms * 1000;
+    s_stats.edges = 0;
+    s_stats.accepted = 0;
+    s_stats.coalesced = 0;
+    s_stats.rejected = 0;
+
+    uint64_t pin_mask = 0;
+    for (size_t i = 0; i < s_input_count; i++) {
+        pin_mask |= 1ULL << s_inputs[i].gpio;
+    }
+
+    gpio_config_t io_conf = {
+        .intr_type = config->active_low ? GPIO_INTR_NEGEDGE : GPIO_INTR_POSEDGE,
+        .mode = GPIO_MODE_INPUT,
+        .pin_bit_mask = pin_mask,
+        .pull_down_en = config->active_low ? 0 : 1,
+        .pull_up_en = config->active_low ? 1 : 0,
+    };
+    ret = gpio_config(&io_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure trigger GPIOs: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    /* Normally installed at startup, for the camera driver as well */
+    ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to install GPIO ISR service: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    for (size_t i = 0; i < s_input_count; i++) {
+        ret = gpio_isr_handler_add(s_inputs[i].gpio, trigger_isr_handler, &s_inputs[i]);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to add handler for GPIO %d: %s",
+                     s_inputs[i].gpio, esp_err_to_name(ret));
+            trigger_deinit();
+            return ret;
+        }
+        ESP_LOGI(TAG, "Trigger on GPIO %d (%s edge, debounce %lu ms)", s_inputs[i].gpio,
+                 config->active_low ? "falling" : "rising", (unsigned long)config->debounce_ms);
+    }
+
+    return ESP_OK;
+}
+
+void trigger_deinit(void)
+{
+    for (size_t i = 0; i < s_input_count; i++) {
+        gpio_isr_handler_remove(s_inputs[i].gpio);
+    }
+    s_input_count = 0;
+}
+
+void trigger_get_stats(trigger_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    stats->edges = s_stats.edges;
+    stats->accepted = s_stats.accepted;
+    stats->coalesced = s_stats.coalesced;
+    stats->rejected = s_stats.rejected;
+}
+
+void trigger_log_stats(void)
+{
+    trigger_stats_t stats;
+    trigger_get_stats(&stats);
+
+    ESP_LOGI(TAG, "edges %lu, accepted %lu, coalesced %lu, rejected %lu",
+             (unsigned long)stats.edges, (unsigned long)stats.accepted,
+             (unsigned long)stats.coalesced, (unsigned long)stats.rejected);
+}
@@ -0,0 +1,85 @@
+/**
+ * @file trigger.h
+ * @brief GPIO trigger inputs (PIR sensors) for the capture pipeline
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of trigger GPIOs */
+#define TRIGGER_MAX_GPIOS   4
+
+/**
+ * @brief Trigger configuration
+ */
+typedef struct {
+    const char *gpio_list;      /**< Comma-separated trigger GPIO numbers, e.g. "12,13" */
+    uint32_t debounce_ms;       /**< Edges within this time of the last accepted edge are coalesced */
+    bool active_low;            /**< Trigger on falling edges with pull-up instead of rising edges with pull-down */
+} trigger_config_t;
+
+#ifdef CONFIG_APP_TRIGGER_ACTIVE_LOW
+#define TRIGGER_ACTIVE_LOW_DEFAULT true
+#else
+#define TRIGGER_ACTIVE_LOW_DEFAULT false
+#endif
+
+/**
+ * @brief Default trigger configuration from Kconfig
+ */
+#define TRIGGER_DEFAULT_CONFIG() {                          \
+    .gpio_list   = CONFIG_APP_TRIGGER_GPIOS,                \
+    .debounce_ms = CONFIG_APP_TRIGGER_DEBOUNCE_MS,          \
+    .active_low  = TRIGGER_ACTIVE_LOW_DEFAULT,              \
+}
+
+/**
+ * @brief Trigger statistics
+ */
+typedef struct {
+    uint32_t edges;             /**< Edges seen by the interrupt handler */
+    uint32_t accepted;          /**< Edges forwarded to the capture pipeline */
+    uint32_t coalesced;         /**< Edges merged into a previous event by debouncing */
+    uint32_t rejected;          /**< Edges the capture pipeline could not accept */
+} trigger_stats_t;
+
+/**
+ * @brief Configure the trigger GPIOs and attach their interrupt handlers
+ *
+ * Each accepted edge is timestamped with esp_timer_get_time() in the
+ * interrupt handler and handed to capture_pipeline_trigger_from_isr().
+ * This can run during startup, before the capture pipeline; edges until
+ * the pipeline starts are counted as rejected.
+ *
+ * @param config Trigger configuration
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t trigger_init(const trigger_config_t *config);
+
+/**
+ * @brief Detach the interrupt handlers of all trigger GPIOs
+ */
+void trigger_deinit(void);
+
+/**
+ * @brief Get a snapshot of the trigger statistics
+ * @param stats Output statistics
+ */
+void trigger_get_stats(trigger_stats_t *stats);
+
+/**
+ * @brief Log the trigger statistics
+ */
+void trigger_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+# Extract JPEG frames from the raw sector capture log of a card image.
+#
+# Usage: sector_log_extract.py [-o OUTPUT_DIR] [--start SECTOR] [--keep-bad] IMAGE
+#
+# The layout is described in main/sector_log.h. IMAGE is a copy of the whole
+# card (e.g. dd if=/dev/sdX of=card.img) or of the log region alone with
+# --start 0. Without --start the region is found as the device finds it: after
+# the last partition of the partition table, on a 4 MB boundary.
+#
+# Every sector of the region is checked for a record header, so records are
+# found without the checkpoint and across wraps. Frames are written as
+# <record number>.jpg in record order; records whose data CRC does not match
+# (partly overwritten after a wrap) are reported and skipped unless
+# --keep-bad is given.
+import argparse
+import mmap
+import os
+import struct
+import sys
+import zlib
+
+SECTOR_SIZE = 512
+SECTOR_LOG_MAGIC = 0x31474C53
+SECTOR_LOG_RECORD_MAGIC = 0x31524C53
+SECTOR_LOG_VERSION = 1
+SECTOR_LOG_DATA_SECTOR = 64
+SECTOR_LOG_AUTO_ALIGN = 8192
+
+# sector_log_superblock_t: magic, version, header_size, nonce, start_sector, sector_count,
+# checkpoint, next_lsn, head, wraps, header_crc
+SUPERBLOCK = struct.Struct('<IHHIIIQQIII')
+# sector_log_record_header_t: magic, header_size, trigger_source, nonce, sectors, lsn, seq,
+# trigger_id, timestamp_us, length, data_crc, header_crc
+RECORD_HEADER = struct.Struct('<IHhIIQIIqIII')
+
+
+def partition_end(image) -> int:
+    """End sector of the last partition in the MBR, 0 without a partition table."""
+    mbr = image[:SECTOR_SIZE]
+    if len(mbr) < SECTOR_SIZE or mbr[510:512] != b'\x55\xaa':
+        return 0
+    if mbr[0] in (0xEB, 0xE9) and mbr[11:13] == b'\x00\x02':
+        raise ValueError('the filesystem covers the whole card, there is no log region')
+    end = 0
+    for i in range(4):
+        entry = mbr[446 + 16 * i:446 + 16 * (i + 1)]
+        if entry[4] == 0:
+            continue
+        if entry[4] == 0xEE:
+            raise ValueError('GPT partitioned cards are not supported')
+        lba, count = struct.unpack_from('<II', entry, 8)
+        end = max(end, lba + count)
+    return end
+
+
+def read_superblock(image, start: int):
+    """Current superblock of the log at start, or None."""
+    best = None
+    for copy in range(2):
+        offset = (start + copy) * SECTOR_SIZE
+        if offset + SUPERBLOCK.size > len(image):
+            continue
+        fields = SUPERBLOCK.unpack_from(image, offset)
+        (magic, version, header_size, nonce, start_sector, sector_count,
+         checkpoint, next_lsn, head, wraps, header_crc) = fields
+        if (magic != SECTOR_LOG_MAGIC or version != SECTOR_LOG_VERSION or header_size != SUPERBLOCK.size
+                or start_sector != start
+                or header_crc != zlib.crc32(image[offset:offset + SUPERBLOCK.size - 4])):
+            continue
+        if best is None or checkpoint > best['checkpoint']:
+            best = {'nonce': nonce, 'sector_count': sector_count, 'checkpoint': checkpoint,
+                    'next_lsn': next_lsn, 'head': head, 'wraps': wraps}
+    return best
+
+
+def read_records(image, start: int, superblock):
+    """Yield (sector, header dict, payload) for every record header of the log, in record order."""
+    magic = struct.pack('<I', SECTOR_LOG_RECORD_MAGIC)
+    base = start * SECTOR_SIZE
+    end = min(len(image), (start + superblock['sector_count']) * SECTOR_SIZE)
+    found = []
+
+    position = image.find(magic, base + SECTOR_LOG_DATA_SECTOR * SECTOR_SIZE, end)
+    while position >= 0:
+        if (position - base) % SECTOR_SIZE == 0 and position + RECORD_HEADER.size <= end:
+            fields = RECORD_HEADER.unpack_from(image, position)
+            (_, header_size, trigger_source, nonce, sectors, lsn, seq, trigger_id,
+             timestamp_us, length, data_crc, header_crc) = fields
+            data = position + SECTOR_SIZE
+            if (header_size == RECORD_HEADER.size and nonce == superblock['nonce']
+                    and header_crc == zlib.crc32(image[position:position + RECORD_HEADER.size - 4])
+                    and sectors == 1 + (length + SECTOR_SIZE - 1) // SECTOR_SIZE
+                    and position + sectors * SECTOR_SIZE <= end):
+                found.append((lsn, (position - base) // SECTOR_SIZE, {
+                    'lsn': lsn,
+                    'seq': seq,
+                    'trigger_id': trigger_id,
+                    'trigger_source': trigger_source,
+                    'timestamp_us': timestamp_us,
+                    'length': length,
+                    'data_crc': data_crc,
+                }, data))
+        position = image.find(magic, position + 4, end)
+
+    for lsn, sector, header, data in sorted(found, key=lambda record: record[0]):
+        payload = image[data:data + header['length']]
+        header['crc_ok'] = zlib.crc32(payload) == header['data_crc']
+        yield sector, header, payload
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description='Extract JPEG frames from a raw sector capture log')
+    parser.add_argument('image', help='card image or log region image')
+    parser.add_argument('-o', '--output', default='.', help='output directory')
+    parser.add_argument('--start', type=int, help='first sector of the log region in the image')
+    parser.add_argument('--keep-bad', action='store_true', help='also write frames that fail the CRC check')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        image = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    try:
+        start = args.start
+        if start is None:
+            end = partition_end(image)
+            start = (end + SECTOR_LOG_AUTO_ALIGN - 1) // SECTOR_LOG_AUTO_ALIGN * SECTOR_LOG_AUTO_ALIGN
+        superblock = read_superblock(image, start)
+        if superblock is None:
+            raise ValueError('no sector log at sector {}'.format(start))
+    except ValueError as e:
+        print('{}: {}'.format(args.image, e))
+        return 1
+
+    print('{}: log at sector {}, {} sectors, checkpoint {} (next record {}, {} wraps)'.format(
+        args.image, start, superblock['sector_count'], superblock['checkpoint'],
+        superblock['next_lsn'], superblock['wraps']))
+
+    os.makedirs(args.output, exist_ok=True)
+    written = bad = 0
+    first = last = None
+    for sector, header, payload in read_records(image, start, superblock):
+        if not header['crc_ok']:
+            bad += 1
+            print('{}: CRC mismatch in record {} (frame {}) at sector {}'.format(
+                args.image, header['lsn'], header['seq'], sector))
+            if not args.keep_bad:
+                continue
+        name = '{:08d}.jpg'.format(header['lsn'])
+        with open(os.path.join(args.output, name), 'wb') as out:
+            out.write(payload)
+        written += 1
+        first = header['lsn'] if first is None else first
+        last = header['lsn']
+    image.close()
+
+    if written:
+        print('{}: {} frames extracted (records {} to {}), {} bad'.format(args.image, written, first, last, bad))
+    else:
+        print('{}: no frames, {} bad'.format(args.image, bad))
+    return 1 if bad and not args.keep_bad and written == 0 else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+# Extract JPEG frames from capture segment files (SEGnnnnn.BIN).
+#
+# Usage: segment_extract.py [-o OUTPUT_DIR] [--keep-bad] SEGMENT [SEGMENT ...]
+#
+# The layout is described in main/segment_store.h. Frames are written as
+# <segment>_<record index>.jpg; records whose data CRC does not match are reported
+# and skipped unless --keep-bad is given.
+import argparse
+import os
+import struct
+import sys
+import zlib
+
+SEGMENT_FILE_MAGIC = 0x31474553
+SEGMENT_RECORD_MAGIC = 0x314D5246
+SEGMENT_FORMAT_VERSION = 1
+SEGMENT_DATA_OFFSET = 512
+SEGMENT_RECORD_ALIGN = 8
+
+# segment_file_header_t: magic, version, header_size, segment_id, nonce, segment_size, header_crc
+FILE_HEADER = struct.Struct('<IHHIIQI')
+# segment_record_header_t: magic, header_size, trigger_source, nonce, seq, trigger_id,
+# timestamp_us, length, data_crc, header_crc
+RECORD_HEADER = struct.Struct('<IHhIIIqIII')
+
+
+def align(value: int) -> int:
+    return (value + SEGMENT_RECORD_ALIGN - 1) & ~(SEGMENT_RECORD_ALIGN - 1)
+
+
+def read_records(data: bytes):
+    """Yield (offset, header dict, payload) for every valid record of a segment."""
+    if len(data) < FILE_HEADER.size:
+        raise ValueError('file too small for a segment header')
+    magic, version, header_size, segment_id, nonce, segment_size, header_crc = FILE_HEADER.unpack_from(data, 0)
+    if (magic != SEGMENT_FILE_MAGIC or version != SEGMENT_FORMAT_VERSION or header_size != FILE_HEADER.size
+            or header_crc != zlib.crc32(data[:FILE_HEADER.size - 4])):
+        raise ValueError('invalid segment header')
+
+    end = min(segment_size, len(data))
+    offset = SEGMENT_DATA_OFFSET
+    while offset + RECORD_HEADER.size <= end:
+        fields = RECORD_HEADER.unpack_from(data, offset)
+        (magic, header_size, trigger_source, rec_nonce, seq, trigger_id,
+         timestamp_us, length, data_crc, header_crc) = fields
+        if (magic != SEGMENT_RECORD_MAGIC or header_size != RECORD_HEADER.size or rec_nonce != nonce
+                or header_crc != zlib.crc32(data[offset:offset + RECORD_HEADER.size - 4])):
+            break
+        record_size = align(RECORD_HEADER.size + length)
+        if offset + record_size > end:
+            break
+        payload = data[offset + RECORD_HEADER.size:offset + RECORD_HEADER.size + length]
+        yield offset, {
+            'segment_id': segment_id,
+            'seq': seq,
+            'trigger_id': trigger_id,
+            'trigger_source': trigger_source,
+            'timestamp_us': timestamp_us,
+            'length': length,
+            'crc_ok': zlib.crc32(payload) == data_crc,
+        }, payload
+        offset += record_size
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description='Extract JPEG frames from capture segment files')
+    parser.add_argument('segments', nargs='+', help='segment files (SEGnnnnn.BIN)')
+    parser.add_argument('-o', '--output', default='.', help='output directory')
+    parser.add_argument('--keep-bad', action='store_true', help='also write frames that fail the CRC check')
+    args = parser.parse_args()
+
+    os.makedirs(args.output, exist_ok=True)
+    errors = 0
+    for path in args.segments:
+        with open(path, 'rb') as f:
+            data = f.read()
+        try:
+            written = bad = 0
+            for index, (offset, header, payload) in enumerate(read_records(data)):
+                if not header['crc_ok']:
+                    bad += 1
+                    print('{}: CRC mismatch in frame {} at offset {}'.format(path, header['seq'], offset))
+                    if not args.keep_bad:
+                        continue
+                name = '{:05d}_{:05d}.jpg'.format(header['segment_id'], index)
+                with open(os.path.join(args.output, name), 'wb') as out:
+                    out.write(payload)
+                written += 1
+            print('{}: {} frames extracted, {} bad'.format(path, written, bad))
+            errors += bad
+        except ValueError as e:
+            print('{}: {}'.format(path, e))
+            errors += 1
+    return 1 if errors else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())